@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "p30h_registers.hpp"
+#include "word_decode.hpp"
+
+/**
+* Бенчмарк на 'word_decode::be_to_float32': декодиране на голям блок от числа float32 направо от big-endian регистри
+* с всеки набор от инструкции, поддържан от процесора. Резултатите се сравняват с варианта без SIMD.
+* За сравнение се измерва и декодирането по плана 'reg::reg_plan' (както в P30HTcpReader::decode).
+* Употреба: decode_bench [числа в блока=4096] [повторения=20000]
+*/
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4096;
+    size_t repeats = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20000;
+
+    std::mt19937 random(1);
+    std::vector<uint8_t> bytes(4 * count);
+    for (uint8_t& b : bytes)
+        b = static_cast<uint8_t>(random());
+
+    std::cout << "процесор:           " << word_decode::isa_name(word_decode::detect()) << "\n"
+              << "блок:               " << count << " числа" << std::endl;
+
+    // Декодиране по плана: думите вече са подредени от Modbus библиотеката, а lo_first е отчетен в 'DecodeSlot'
+    const reg::ReadPlanView& plan = reg::reg_plan;
+    std::vector<uint16_t> words(plan.word_count);
+    for (uint16_t& w : words)
+        w = static_cast<uint16_t>(random());
+    std::vector<float> planned(plan.float_count);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < repeats; ++r)
+    {
+        for (size_t k = 0; k < plan.float_count; ++k)
+        {
+            const reg::DecodeSlot& slot = plan.slots[plan.order[k]];
+            planned[k] = reg::words_to_float32(words[slot.hi], words[slot.lo]);
+        }
+        // Компилаторът не може да премахне повторенията, защото резултатът се чете
+        words[r % plan.word_count] ^= static_cast<uint16_t>(planned[r % plan.float_count] != 0.0f);
+    }
+    double plan_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (double(repeats) * plan.float_count);
+    std::cout << "план (" << plan.float_count << " числа): " << plan_ns << " ns/число" << std::endl;
+
+    std::vector<float> reference(count), block(count);
+    word_decode::Isa isas[] = { word_decode::Isa::SCALAR, word_decode::Isa::SSSE3, word_decode::Isa::AVX2 };
+    for (word_decode::Isa isa : isas)
+    {
+        if (word_decode::set_isa(isa) != isa)
+            continue;
+
+        start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < repeats; ++r)
+        {
+            word_decode::be_to_float32(bytes.data(), block.data(), count, (r & 1) != 0);
+            bytes[r % bytes.size()] ^= static_cast<uint8_t>(block[r % count] != 0.0f);
+        }
+        double block_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (double(repeats) * count);
+
+        // Проверка срещу варианта без SIMD за двата реда на думите
+        bool same = true;
+        for (bool lo_first : { false, true })
+        {
+            word_decode::set_isa(word_decode::Isa::SCALAR);
+            word_decode::be_to_float32(bytes.data(), reference.data(), count, lo_first);
+            word_decode::set_isa(isa);
+            word_decode::be_to_float32(bytes.data(), block.data(), count, lo_first);
+            same = same && std::memcmp(block.data(), reference.data(), count * sizeof(float)) == 0;
+        }
+
+        std::cout << word_decode::isa_name(isa) << ":\n"
+                  << "  блок:             " << block_ns << " ns/число\n"
+                  << "  съвпада:          " << (same ? "да" : "НЕ") << std::endl;
+        if (!same)
+            return 1;
+    }
+    return 0;
+}
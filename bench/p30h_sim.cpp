@@ -0,0 +1,63 @@
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "sim_server.hpp"
+
+static std::atomic<bool> stop_flag(false);
+
+static void signal_handler(int)
+{
+    stop_flag.store(true);
+}
+
+/**
+* Самостоятелен симулатор на P30H устройства за ръчни тестове на програмата (например с --reactors и --pipeline).
+* Слуша на порт (по подразбиране 1502) на N адреса: 127.0.0.1, 127.0.0.2, ... Работи до Ctrl+C.
+* Употреба: p30h_sim [--port 1502] [--devices 1] [--latency ms] [--jitter ms] [--split байтове] [--split-delay ms] [--exceptions дял]
+*/
+int main(int argc, char** argv)
+{
+    uint16_t port = 1502;
+    size_t devices = 1;
+    sim::SimOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (sim::parse_sim_option(argc, argv, i, options))
+            continue;
+        if (arg == "--port" && i + 1 < argc)
+            port = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--devices" && i + 1 < argc)
+            devices = std::strtoul(argv[++i], nullptr, 10);
+        else
+        {
+            std::cerr << "Непознат аргумент: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (devices == 0)
+        devices = 1;
+
+    try
+    {
+        sim::SimServer server(options);
+        for (size_t i = 0; i < devices; ++i)
+            server.listen_on(port, sim::device_address(i));
+        std::cout << "Симулатор на " << devices << " устройства на " << sim::device_address(0) << ".." << sim::device_address(devices - 1)
+                  << ":" << port << " (закъснение " << options.latency_ms << " ± " << options.jitter_ms << " ms, части " << options.split
+                  << " байта, изключения " << 100.0 * options.exception_rate << "%)" << std::endl;
+        std::signal(SIGINT, signal_handler);
+        std::signal(SIGTERM, signal_handler);
+        server.run(stop_flag);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
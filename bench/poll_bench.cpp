@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "p30h_pollSchedule.hpp"
+#include "p30h_registers.hpp"
+#include "p30h_tcpReader.hpp"
+#include "program.hpp"
+#include "ring_store.hpp"
+#include "sim_server.hpp"
+
+/**
+* Резултатите от четенето на едно устройство в режим 'reader'.
+*/
+struct ReaderStats
+{
+    uint64_t samples = 0;
+    uint64_t valid = 0;
+    std::vector<uint32_t> latency_us;
+};
+
+static double cpu_seconds()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+/**
+* Чете едно устройство с P30HTcpReader (по една нишка за устройство, както при 'program::poll_gateway').
+* Измерва се само времето след 'warmup', за да не влизат свързването и първите отчети.
+*/
+static void read_device(uint16_t port, float interval, size_t pipeline_depth, std::chrono::steady_clock::time_point warmup,
+                        const std::atomic<bool>& stop, ReaderStats& stats)
+{
+    P30HTcpReader reader("127.0.0.1", port, 1);
+    reader.set_pipeline_depth(pipeline_depth);
+    if (!reader.connect())
+        return;
+    reg::PollSchedule schedule(reg::reg_plan, interval > 0 ? interval : 1.0f);
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval));
+    auto next = std::chrono::steady_clock::now();
+    for (uint64_t tick = 0; !stop.load(std::memory_order_relaxed); ++tick)
+    {
+        auto start = std::chrono::steady_clock::now();
+        reg::RegisterResult* results = reader.read_plan(schedule.plan_for_tick(tick));
+        auto end = std::chrono::steady_clock::now();
+        if (start >= warmup)
+        {
+            ++stats.samples;
+            if (results[0].valid) ++stats.valid;
+            stats.latency_us.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()));
+        }
+        if (interval > 0)
+        {
+            next += period;
+            std::this_thread::sleep_until(next);
+        }
+    }
+    reader.close();
+}
+
+/**
+* Режим 'reader': N нишки с P30HTcpReader срещу един порт на симулатора. Отчита отчети/s, p50/p99 на времето за един отчет и CPU.
+*/
+static void bench_reader(size_t devices, int seconds, float interval, size_t pipeline_depth, uint16_t port)
+{
+    std::atomic<bool> stop(false);
+    std::vector<ReaderStats> stats(devices);
+    std::vector<std::thread> threads;
+    auto warmup = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    for (size_t i = 0; i < devices; ++i)
+        threads.emplace_back(read_device, port, interval, pipeline_depth, warmup, std::cref(stop), std::ref(stats[i]));
+
+    std::this_thread::sleep_until(warmup);
+    double cpu0 = cpu_seconds();
+    auto wall0 = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    double cpu1 = cpu_seconds();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall0).count();
+    stop.store(true);
+    for (std::thread& t : threads)
+        t.join();
+
+    uint64_t samples = 0, valid = 0;
+    std::vector<uint32_t> latency;
+    for (const ReaderStats& s : stats)
+    {
+        samples += s.samples;
+        valid += s.valid;
+        latency.insert(latency.end(), s.latency_us.begin(), s.latency_us.end());
+    }
+    std::sort(latency.begin(), latency.end());
+    double rate = samples / wall;
+    double cpu = (cpu1 - cpu0) / wall;
+    std::cout << "режим:              reader (P30HTcpReader, нишка за устройство)\n"
+              << "устройства:         " << devices << "\n"
+              << "отчети/s:           " << rate << "\n"
+              << "валидни отчети:     " << (samples > 0 ? 100.0 * valid / samples : 0.0) << "%\n"
+              << "време за отчет:     p50 " << percentile(latency, 0.5) / 1000.0 << " ms, p99 " << percentile(latency, 0.99) / 1000.0
+              << " ms, max " << (latency.empty() ? 0.0 : latency.back() / 1000.0) << " ms\n"
+              << "CPU:                " << 100.0 * cpu << "% от едно ядро\n"
+              << "CPU за устройство:  " << 100.0 * cpu / devices << "%" << std::endl;
+}
+
+/**
+* Режим 'program': целият 'program::run' (конфигурационен файл, четене, запис на лог файлове) срещу N устройства с отделни адреси.
+* Отчетите се броят през файловете на 'ring_store' (--ring), а времената се вземат от 'program::registry' (за цялото време на работа, заедно със загряването).
+*/
+static void bench_program(size_t devices, int seconds, float interval, uint16_t port, const std::vector<std::string>& extra)
+{
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / ("poll_bench_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    {
+        std::ofstream json(dir / "devices.json");
+        json << "[\n";
+        for (size_t i = 0; i < devices; ++i)
+            json << "    { \"ip\": \"" << sim::device_address(i) << "\", \"port\": " << port << ", \"id\": 1 }" << (i + 1 < devices ? ",\n" : "\n");
+        json << "]\n";
+    }
+
+    std::vector<std::string> arguments = { "poll_bench", "--config", dir.string(), "--json", "devices.json", "--log", (dir / "log").string(),
+                                           "--interval", std::to_string(interval), "--ring", "4", "--ring-path", (dir / "ring").string() };
+    arguments.insert(arguments.end(), extra.begin(), extra.end());
+    std::vector<char*> argv;
+    for (std::string& a : arguments)
+        argv.push_back(&a[0]);
+    argv.push_back(nullptr);
+    int argc = static_cast<int>(arguments.size());
+    char** argv_ptr = argv.data();
+
+    std::thread runner([&]() { program::run(argc, argv_ptr); });
+    std::this_thread::sleep_for(std::chrono::seconds(3));
+
+    std::vector<std::unique_ptr<ring_store::Reader>> rings(devices);
+    for (size_t i = 0; i < devices; ++i)
+    {
+        try
+        {
+            device::Device device;
+            device.ip = sim::device_address(i);
+            device.port = port;
+            rings[i].reset(new ring_store::Reader(ring_store::ring_file_name((dir / "ring").string(), device)));
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
+    auto published = [&rings]()
+    {
+        uint64_t sum = 0;
+        for (const auto& r : rings)
+            if (r) sum += r->head();
+        return sum;
+    };
+
+    uint64_t samples0 = published();
+    double cpu0 = cpu_seconds();
+    auto wall0 = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    uint64_t samples1 = published();
+    double cpu1 = cpu_seconds();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall0).count();
+
+    size_t connected = static_cast<size_t>(std::count_if(rings.begin(), rings.end(), [](const auto& r) { return r && r->head() > 0; }));
+    std::unique_ptr<metrics::DeviceMetrics> total(new metrics::DeviceMetrics("общо"));
+    program::registry.sum(*total);
+    rings.clear();
+    program::stop_flag.store(true);
+    runner.join();
+    std::filesystem::remove_all(dir);
+
+    double rate = (samples1 - samples0) / wall;
+    double cpu = (cpu1 - cpu0) / wall;
+    std::cout << "\nрежим:              program (program::run)\n"
+              << "устройства:         " << devices << " (с отчети: " << connected << ")\n"
+              << "отчети/s:           " << rate << " (очаквани " << devices / interval << ")\n"
+              << "време за отчет:     p50 " << total->sample_latency.percentile(0.5) / 1000.0 << " ms, p99 " << total->sample_latency.percentile(0.99) / 1000.0
+              << " ms, max " << total->sample_latency.max() / 1000.0 << " ms\n"
+              << "RTT на заявка:      p50 " << total->request_rtt.percentile(0.5) / 1000.0 << " ms, p99 " << total->request_rtt.percentile(0.99) / 1000.0 << " ms\n"
+              << "без отговор:        " << total->timeouts.load() << ", изключения: " << total->exceptions.load()
+              << ", пропуснати интервали: " << total->missed_deadlines.load() << "\n"
+              << "CPU:                " << 100.0 * cpu << "% от едно ядро\n"
+              << "CPU за устройство:  " << 100.0 * cpu / devices << "%" << std::endl;
+}
+
+/**
+* Бенчмарк от край до край: симулатор на P30H устройства в отделен процес и програмата, която ги чете.
+* Употреба: poll_bench [--mode reader|program] [--devices 100] [--seconds 10] [--interval 1.0] [--pipeline 1]
+*                      [--latency ms] [--jitter ms] [--split байтове] [--split-delay ms] [--exceptions дял] [-- аргументи на програмата]
+* При --interval 0 в режим 'reader' всяка нишка чете без пауза (максимална пропускателна способност).
+* Аргументите след '--' се подават на 'program::run' (например -- --reactors 1 --pipeline 2 --format bin).
+*/
+int main(int argc, char** argv)
+{
+    std::string mode = "reader";
+    size_t devices = 100;
+    int seconds = 10;
+    float interval = 1.0f;
+    size_t pipeline_depth = 1;
+    sim::SimOptions options;
+    std::vector<std::string> extra;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--")
+        {
+            extra.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        if (sim::parse_sim_option(argc, argv, i, options))
+            continue;
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Липсва стойност за " << arg << std::endl;
+            return 1;
+        }
+        if (arg == "--mode") mode = argv[++i];
+        else if (arg == "--devices") devices = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--seconds") seconds = std::atoi(argv[++i]);
+        else if (arg == "--interval") interval = std::strtof(argv[++i], nullptr);
+        else if (arg == "--pipeline") pipeline_depth = std::strtoul(argv[++i], nullptr, 10);
+        else
+        {
+            std::cerr << "Непознат аргумент: " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (devices == 0 || (mode == "program" && interval <= 0) || (mode != "reader" && mode != "program"))
+    {
+        std::cerr << "Невалидни аргументи." << std::endl;
+        return 1;
+    }
+
+    rlimit limit{};
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    // Симулаторът работи в отделен процес, за да се измерва само процесорното време на програмата, която чете
+    sim::SimServer server(options);
+    uint16_t port = server.listen_on(0, sim::device_address(0));
+    if (mode == "program")
+        for (size_t i = 1; i < devices; ++i)
+            server.listen_on(port, sim::device_address(i));
+    pid_t child = fork();
+    if (child == 0)
+    {
+        std::atomic<bool> never(false);
+        server.run(never);
+        _exit(0);
+    }
+    server.close_all();
+
+    std::cout << "Симулатор: закъснение " << options.latency_ms << " ± " << options.jitter_ms << " ms, части " << options.split
+              << " байта, изключения " << 100.0 * options.exception_rate << "%" << std::endl;
+    if (mode == "reader")
+        bench_reader(devices, seconds, interval, pipeline_depth, port);
+    else
+        bench_program(devices, seconds, interval, port, extra);
+
+    kill(child, SIGTERM);
+    waitpid(child, nullptr, 0);
+    return 0;
+}
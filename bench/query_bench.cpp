@@ -0,0 +1,114 @@
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "bin_log.hpp"
+#include "log_compact.hpp"
+#include "log_index.hpp"
+#include "log_query.hpp"
+#include "p30h_registers.hpp"
+#include "timestamp.hpp"
+
+/**
+* Помощна функция, която изпълнява заявката и извежда времето, редовете и прочетените байтове.
+*/
+static void measure(const std::string& dir, const log_query::Query& query, const char* label)
+{
+    std::ostringstream out;
+    auto start = std::chrono::steady_clock::now();
+    log_query::Stats stats = log_query::run(dir, query, out);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << label << ms << " ms, " << stats.rows << " реда, " << stats.bytes_read / 1024 << " KB прочетени" << std::endl;
+}
+
+/**
+* Бенчмарк на 'log_query': заявка за една минута от двоичен лог с отчети на 100 ms с индекс по време
+* и същата заявка с четене от началото на файла, преди и след компресиране с най-добрия наличен алгоритъм.
+* Употреба: query_bench [записи=2000000] [записи в блок=256]
+*/
+int main(int argc, char** argv)
+{
+    namespace fs = std::filesystem;
+    size_t rows = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+    uint32_t block = argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 256;
+
+    fs::path dir = fs::temp_directory_path() / "p30h_query_bench";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    std::string path = (dir / "P30H(bench)_data_2024-01-01_00-00-00.bin").string();
+
+    // Лог файл и индекс, както ги записва 'LogWriter'
+    const reg::ReadPlanView& plan = reg::reg_plan;
+    int64_t start_ms = 0;
+    timestamp::parse_local("2024-01-01", start_ms);
+    std::mt19937 random(1);
+    std::vector<reg::RegisterResult> results(plan.reg_count);
+    std::string data, index;
+    bin_log::append_header(data, plan);
+    log_index::append_header(index, 0, block);
+    std::ofstream file(path, std::ios::binary);
+    uint64_t bytes = 0;
+    int64_t timestamp_ms = start_ms;
+    for (size_t r = 0; r < rows; ++r, timestamp_ms += 100)
+    {
+        if (block > 0 && r % block == 0)
+            log_index::append_entry(index, timestamp_ms, bytes + data.size());
+        for (reg::RegisterResult& result : results)
+        {
+            result.valid = true;
+            result.value.val_float32 = static_cast<float>(random() % 100000) / 100.0f;
+        }
+        bin_log::append_record(data, timestamp_ms, plan, results.data());
+        if (data.size() >= 1 << 20)
+        {
+            file.write(data.data(), static_cast<std::streamsize>(data.size()));
+            bytes += data.size();
+            data.clear();
+        }
+    }
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    bytes += data.size();
+    file.close();
+    log_index::append_entry(index, timestamp_ms - 100, bytes);
+    if (block > 0)
+        std::ofstream(log_index::index_path(path), std::ios::binary).write(index.data(), static_cast<std::streamsize>(index.size()));
+
+    log_query::Query query;
+    query.host = "bench";
+    query.from_ms = start_ms + static_cast<int64_t>(rows) * 100 / 2;
+    query.to_ms = query.from_ms + 60000;
+    query.columns = { "U", "T" };
+    std::cout << "файл:               " << bytes / (1024 * 1024) << " MB, " << rows << " записа" << std::endl;
+
+    log_query::Query full = query;
+    full.use_index = false;
+    measure(dir.string(), query, "с индекс:           ");
+    measure(dir.string(), full, "без индекс:         ");
+
+    log_compact::CompactOptions options;
+    options.workers = 1;
+    if (options.codec != log_compact::Codec::NONE)
+    {
+        auto compress_start = std::chrono::steady_clock::now();
+        {
+            log_compact::Compactor compactor(options);
+            compactor.submit(path);
+            while (compactor.completed() + compactor.failed() == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - compress_start).count();
+        std::string compressed = path + log_compact::codec_extension(options.codec);
+        std::cout << log_compact::codec_name(options.codec) << ":               " << fs::file_size(compressed) / (1024 * 1024) << " MB за "
+                  << seconds << " s" << std::endl;
+        measure(dir.string(), query, "  с индекс:         ");
+        measure(dir.string(), full, "  без индекс:       ");
+    }
+    fs::remove_all(dir);
+    return 0;
+}
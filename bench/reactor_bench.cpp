@@ -0,0 +1,122 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "Device.hpp"
+#include "p30h_registers.hpp"
+#include "reactor.hpp"
+#include "sim_server.hpp"
+#include "snapshot.hpp"
+
+/**
+* Бенчмарк на reactor::PollReactor: N симулирани устройства на localhost, четени с интервал от една секунда.
+* Симулаторът работи в отделен процес, за да се измерва само процесорното време на програмата, която чете.
+* Употреба: reactor_bench [устройства=10000] [секунди=10] [нишки=1] [интервал=1.0]
+*/
+int main(int argc, char** argv)
+{
+    size_t devices = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    int seconds = argc > 2 ? std::atoi(argv[2]) : 10;
+    size_t threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1;
+    float interval = argc > 4 ? std::strtof(argv[4], nullptr) : 1.0f;
+
+    // Всяко устройство е една връзка - нужни са повече файлови дескриптори от стандартните 1024
+    rlimit limit{};
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < devices + 64)
+        std::cerr << "Внимание: лимитът за файлови дескриптори (" << limit.rlim_cur << ") е по-малък от броя на устройствата." << std::endl;
+
+    sim::SimServer server;
+    uint16_t port = server.listen_on(0);
+    pid_t child = fork();
+    if (child == 0)
+    {
+        std::atomic<bool> never(false);
+        server.run(never);
+        _exit(0);
+    }
+    server.close_all();
+
+    std::atomic<uint64_t> samples(0), valid(0);
+    reactor::Options options;
+    options.interval = interval;
+    options.pipeline_depth = 2;
+    options.share_connections = false; // Всички симулирани устройства са на един адрес, но всяко трябва да има собствена връзка
+    options.align = false;
+    snapshot::FleetSnapshot fleet(reg::reg_plan, devices);
+    reactor::PollReactor engine(reg::reg_plan, [&](size_t device, int64_t timestamp_ms, const reg::RegisterResult* results)
+    {
+        fleet.store(device, timestamp_ms, results);
+        samples.fetch_add(1, std::memory_order_relaxed);
+        if (results[0].valid) valid.fetch_add(1, std::memory_order_relaxed);
+    }, options);
+    device::Device device;
+    device.ip = "127.0.0.1";
+    device.port = port;
+    for (size_t i = 0; i < devices; ++i)
+        engine.add_device(device);
+
+    std::atomic<bool> stop(false);
+    std::thread runner([&]() { engine.run(stop, threads); });
+
+    // Загряване: свързване на всички устройства
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    auto cpu_seconds = []()
+    {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    };
+    uint64_t samples0 = samples.load(), valid0 = valid.load();
+    double cpu0 = cpu_seconds();
+    auto wall0 = std::chrono::steady_clock::now();
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+    uint64_t samples1 = samples.load(), valid1 = valid.load();
+    double cpu1 = cpu_seconds();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall0).count();
+
+    // Един интервал на цялата група: копие на всички устройства и сума на мощността на валидните (цикъл без разклонения, който се векторизира)
+    size_t power = 0;
+    while (power + 1 < reg::reg_plan.reg_count && reg::reg_plan.map[power].symbol != "P")
+        ++power;
+    snapshot::Snapshot tick;
+    fleet.copy_to(tick);
+    auto copy0 = std::chrono::steady_clock::now();
+    fleet.copy_to(tick);
+    auto copy1 = std::chrono::steady_clock::now();
+    const float* values = tick.column(power);
+    const uint64_t* ok = tick.valid_column(power);
+    float total = 0.0f;
+    for (size_t d = 0; d < tick.stride(); ++d)
+        total += values[d] * static_cast<float>((ok[d / 64] >> (d % 64)) & 1);
+    auto sum1 = std::chrono::steady_clock::now();
+
+    stop.store(true);
+    runner.join();
+    kill(child, SIGTERM);
+    waitpid(child, nullptr, 0);
+
+    double rate = (samples1 - samples0) / wall;
+    double expected = devices / interval;
+    double cpu = (cpu1 - cpu0) / wall;
+    std::cout << "устройства:         " << devices << "\n"
+              << "нишки:              " << threads << "\n"
+              << "отчети/s:           " << rate << " (очаквани " << expected << ", " << 100.0 * rate / expected << "%)\n"
+              << "валидни отчети:     " << (samples1 > samples0 ? 100.0 * (valid1 - valid0) / (samples1 - samples0) : 0.0) << "%\n"
+              << "CPU:                " << 100.0 * cpu << "% от едно ядро\n"
+              << "CPU за отчет:       " << (rate > 0 ? 1e6 * cpu / rate : 0.0) << " us\n"
+              << "копие на групата:   " << std::chrono::duration<double, std::micro>(copy1 - copy0).count() << " us\n"
+              << "сума на P:          " << total << " W за " << std::chrono::duration<double, std::micro>(sum1 - copy1).count() << " us" << std::endl;
+    return 0;
+}
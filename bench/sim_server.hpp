@@ -0,0 +1,407 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "p30h_registers.hpp"
+
+namespace sim
+{
+    /**
+    * Настройки на симулатора.
+    * @param latency_ms Закъснение на всеки отговор в милисекунди. По подразбиране стойност: 0.
+    * @param jitter_ms Случайно отклонение на закъснението (равномерно в [-jitter_ms, jitter_ms]). По подразбиране стойност: 0.
+    * @param split Размер на частите в байтове, на които се разделя всеки отговор (при 0 отговорът се изпраща наведнъж). По подразбиране стойност: 0.
+    * @param split_delay_ms Пауза между частите на един отговор в милисекунди. По подразбиране стойност: 1.
+    * @param exception_rate Дял на заявките FC03 (от 0 до 1), на които се отговаря с изключение 4 (грешка в устройството). По подразбиране стойност: 0.
+    * @param seed Начална стойност на генератора на случайни числа. По подразбиране стойност: 1.
+    */
+    struct SimOptions
+    {
+        double latency_ms = 0.0;
+        double jitter_ms = 0.0;
+        size_t split = 0;
+        double split_delay_ms = 1.0;
+        double exception_rate = 0.0;
+        uint32_t seed = 1;
+    };
+
+    /**
+    * Помощна функция за аргументите на командния ред, общи за симулатора и бенчмарковете:
+    * --latency <ms>, --jitter <ms>, --split <байтове>, --split-delay <ms>, --exceptions <дял>.
+    * @param argc Броят на аргументите.
+    * @param argv Аргументите.
+    * @param i Индексът на текущия аргумент. При разпознат аргумент се премества на стойността му.
+    * @param options Настройките, в които се записва стойността.
+    * @return False, ако аргументът не е от тези настройки.
+    */
+    inline bool parse_sim_option(int argc, char** argv, int& i, SimOptions& options)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        if (arg == "--latency") options.latency_ms = std::strtod(argv[++i], nullptr);
+        else if (arg == "--jitter") options.jitter_ms = std::strtod(argv[++i], nullptr);
+        else if (arg == "--split") options.split = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--split-delay") options.split_delay_ms = std::strtod(argv[++i], nullptr);
+        else if (arg == "--exceptions") options.exception_rate = std::strtod(argv[++i], nullptr);
+        else return false;
+        return true;
+    }
+
+    /**
+    * Функция, която връща адреса на n-тото симулирано устройство: 127.0.0.1, 127.0.0.2, ..., 127.0.0.250, 127.0.1.1, ...
+    * Отделните адреси са нужни, защото името на лог файла се съставя от IP адреса на устройството.
+    * @param n Номерът на устройството (от 0).
+    */
+    inline std::string device_address(size_t n)
+    {
+        return "127." + std::to_string(n / 250 / 250 % 250) + "." + std::to_string(n / 250 % 250) + "." + std::to_string(n % 250 + 1);
+    }
+
+    /**
+    * Симулатор на Modbus/TCP slave устройство за бенчмарковете.
+    * Един epoll цикъл обслужва произволен брой връзки - всяка връзка е отделно симулирано устройство.
+    * На FC03 връща регистрите на P30H: величините от 'reg::reg_map' са валидни float стойности в разположението 6000/7000,
+    * а останалите адреси съдържат собствения си адрес. На FC06/FC16 връща потвърждение, на останалите - изключение 1.
+    */
+    class SimServer
+    {
+    public:
+        explicit SimServer(const SimOptions& options = SimOptions())
+         : _options(options)
+         , _random(options.seed)
+         , _registers(65536)
+        {
+            for (size_t i = 0; i < _registers.size(); ++i)
+                _registers[i] = static_cast<uint16_t>(i);
+            for (size_t i = 0; i < reg::reg_count; ++i)
+            {
+                const reg::RegisterRead& r = reg::reg_map[i];
+                uint16_t hi_addr = 0, lo_addr = 0;
+                reg::word_addresses(r, hi_addr, lo_addr);
+                if (r.type != reg::REG_FLOAT32)
+                    continue;
+                float value = 10.0f * static_cast<float>(i + 1) + 0.25f;
+                uint32_t bits = 0;
+                std::memcpy(&bits, &value, sizeof(bits));
+                _registers[hi_addr] = static_cast<uint16_t>(bits >> 16);
+                _registers[lo_addr] = static_cast<uint16_t>(bits & 0xFFFF);
+            }
+        }
+
+        SimServer(const SimServer&) = delete;
+        SimServer& operator=(const SimServer&) = delete;
+
+        ~SimServer()
+        {
+            close_all();
+        }
+
+        /**
+        * Отваря сокет за слушане. Може да се извика няколко пъти с различни адреси (127.0.0.0/8 е изцяло на loopback),
+        * за да има всяко симулирано устройство собствен IP адрес.
+        * @param port Порт (0 - произволен свободен порт).
+        * @param address IPv4 адрес. По подразбиране стойност: "127.0.0.1".
+        * @return Портът, на който слуша сървърът.
+        */
+        uint16_t listen_on(uint16_t port = 0, const std::string& address = "127.0.0.1")
+        {
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) throw std::runtime_error("socket: " + std::string(std::strerror(errno)));
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+            {
+                close(fd);
+                throw std::runtime_error("Невалиден адрес: " + address);
+            }
+            if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+            {
+                int error = errno;
+                close(fd);
+                throw std::runtime_error("bind/listen " + address + ": " + std::strerror(error));
+            }
+            socklen_t len = sizeof(addr);
+            getsockname(fd, (sockaddr*)&addr, &len);
+            grow(fd);
+            _listening[fd] = true;
+            _listen_fds.push_back(fd);
+            return ntohs(addr.sin_port);
+        }
+
+        /**
+        * Обслужва връзките, докато не се вдигне stop_flag.
+        */
+        void run(std::atomic<bool>& stop_flag)
+        {
+            _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            for (int fd : _listen_fds)
+            {
+                epoll_event ev{};
+                ev.events = EPOLLIN;
+                ev.data.fd = fd;
+                epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+            }
+
+            epoll_event events[256];
+            while (!stop_flag.load(std::memory_order_relaxed))
+            {
+                int n = epoll_wait(_epoll_fd, events, 256, wait_ms());
+                for (int i = 0; i < n; ++i)
+                {
+                    if (_listening[events[i].data.fd])
+                        accept_all(events[i].data.fd);
+                    else
+                        serve(events[i].data.fd);
+                }
+                send_due();
+            }
+        }
+
+        /**
+        * Затваря всички сокети (слушащите и връзките).
+        */
+        void close_all()
+        {
+            for (size_t fd = 0; fd < _open.size(); ++fd)
+                if (_open[fd] || _listening[fd]) close(static_cast<int>(fd));
+            _rx.clear();
+            _open.clear();
+            _listening.clear();
+            _generation.clear();
+            _last_due.clear();
+            _listen_fds.clear();
+            _pending = decltype(_pending)();
+            if (_epoll_fd >= 0) close(_epoll_fd);
+            _epoll_fd = -1;
+        }
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+        * Отговор (или част от отговор), който чака времето си за изпращане.
+        * 'generation' отхвърля отговорите за затворена връзка, чийто дескриптор вече е използван отново.
+        */
+        struct Pending
+        {
+            Clock::time_point due;
+            uint64_t sequence;
+            int fd;
+            uint32_t generation;
+            std::string data;
+
+            bool operator>(const Pending& other) const
+            {
+                return due != other.due ? due > other.due : sequence > other.sequence;
+            }
+        };
+
+        SimOptions _options;
+        std::minstd_rand _random;
+        std::vector<uint16_t> _registers;
+        std::vector<int> _listen_fds;
+        int _epoll_fd = -1;
+        std::vector<std::string> _rx;
+        std::vector<bool> _open;
+        std::vector<bool> _listening;
+        std::vector<uint32_t> _generation;
+        std::vector<Clock::time_point> _last_due;
+        std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> _pending;
+        uint64_t _sequence = 0;
+
+        void grow(int fd)
+        {
+            if (_open.size() > static_cast<size_t>(fd)) return;
+            _rx.resize(fd + 1);
+            _open.resize(fd + 1, false);
+            _listening.resize(fd + 1, false);
+            _generation.resize(fd + 1, 0);
+            _last_due.resize(fd + 1);
+        }
+
+        bool delayed() const
+        {
+            return _options.latency_ms > 0 || _options.jitter_ms > 0 || _options.split > 0;
+        }
+
+        int wait_ms() const
+        {
+            if (_pending.empty()) return 100;
+            auto left = std::chrono::duration_cast<std::chrono::microseconds>(_pending.top().due - Clock::now()).count();
+            if (left <= 0) return 0;
+            return static_cast<int>(std::min<long long>(100, (left + 999) / 1000));
+        }
+
+        void accept_all(int listen_fd)
+        {
+            while (true)
+            {
+                int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) return;
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                grow(fd);
+                _rx[fd].clear();
+                _open[fd] = true;
+                ++_generation[fd];
+                _last_due[fd] = Clock::time_point();
+                epoll_event ev{};
+                ev.events = EPOLLIN;
+                ev.data.fd = fd;
+                epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+            }
+        }
+
+        void drop(int fd)
+        {
+            epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            _open[fd] = false;
+            _rx[fd].clear();
+        }
+
+        void serve(int fd)
+        {
+            char buf[4096];
+            ssize_t k = recv(fd, buf, sizeof(buf), 0);
+            if (k <= 0)
+            {
+                if (k == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) drop(fd);
+                return;
+            }
+            std::string& rx = _rx[fd];
+            rx.append(buf, static_cast<size_t>(k));
+
+            std::string tx;
+            size_t pos = 0;
+            while (rx.size() - pos >= 7)
+            {
+                const uint8_t* h = reinterpret_cast<const uint8_t*>(rx.data() + pos);
+                size_t length = static_cast<size_t>(h[4] << 8 | h[5]);
+                if (length < 2 || length > 254)
+                {
+                    drop(fd);
+                    return;
+                }
+                if (rx.size() - pos < length + 6) break;
+                size_t start = tx.size();
+                respond(h, length + 6, tx);
+                if (delayed())
+                {
+                    schedule(fd, tx.substr(start));
+                    tx.resize(start);
+                }
+                pos += length + 6;
+            }
+            rx.erase(0, pos);
+            if (!tx.empty()) send(fd, tx.data(), tx.size(), MSG_NOSIGNAL);
+        }
+
+        /**
+        * Поставя отговора в опашката с времето на изпращане (закъснение ± отклонение, на части при 'split').
+        * Отговорите по една връзка не се разменят, както при истинско устройство.
+        */
+        void schedule(int fd, std::string response)
+        {
+            double delay_ms = _options.latency_ms;
+            if (_options.jitter_ms > 0)
+                delay_ms += std::uniform_real_distribution<double>(-_options.jitter_ms, _options.jitter_ms)(_random);
+            Clock::time_point due = Clock::now() + std::chrono::microseconds(static_cast<long long>(std::max(0.0, delay_ms) * 1000.0));
+            if (due < _last_due[fd]) due = _last_due[fd];
+
+            size_t chunk = _options.split > 0 ? _options.split : response.size();
+            auto gap = std::chrono::microseconds(static_cast<long long>(_options.split_delay_ms * 1000.0));
+            for (size_t offset = 0; offset < response.size(); offset += chunk)
+            {
+                _pending.push({ due, _sequence++, fd, _generation[fd], response.substr(offset, chunk) });
+                _last_due[fd] = due;
+                due += gap;
+            }
+        }
+
+        void send_due()
+        {
+            Clock::time_point now = Clock::now();
+            while (!_pending.empty() && _pending.top().due <= now)
+            {
+                const Pending& p = _pending.top();
+                if (_open[p.fd] && _generation[p.fd] == p.generation)
+                    send(p.fd, p.data.data(), p.data.size(), MSG_NOSIGNAL);
+                _pending.pop();
+            }
+        }
+
+        void respond(const uint8_t* req, size_t size, std::string& tx)
+        {
+            uint8_t out[260];
+            std::memcpy(out, req, 7);
+            uint8_t func = req[7];
+            size_t pdu = 0;
+            if (func == 0x03 && size >= 12)
+            {
+                uint16_t address = static_cast<uint16_t>(req[8] << 8 | req[9]);
+                uint16_t amount = static_cast<uint16_t>(req[10] << 8 | req[11]);
+                if (amount == 0 || amount > 125)
+                {
+                    out[7] = func | 0x80;
+                    out[8] = 0x03;
+                    pdu = 2;
+                }
+                else if (_options.exception_rate > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(_random) < _options.exception_rate)
+                {
+                    out[7] = func | 0x80;
+                    out[8] = 0x04;
+                    pdu = 2;
+                }
+                else
+                {
+                    out[7] = func;
+                    out[8] = static_cast<uint8_t>(2 * amount);
+                    for (uint16_t i = 0; i < amount; ++i)
+                    {
+                        uint16_t word = _registers[static_cast<uint16_t>(address + i)];
+                        out[9 + 2 * i] = static_cast<uint8_t>(word >> 8);
+                        out[10 + 2 * i] = static_cast<uint8_t>(word & 0xFF);
+                    }
+                    pdu = 2 + 2 * amount;
+                }
+            }
+            else if ((func == 0x06 || func == 0x10) && size >= 12)
+            {
+                std::memcpy(out + 7, req + 7, 5);
+                pdu = 5;
+            }
+            else
+            {
+                out[7] = func | 0x80;
+                out[8] = 0x01;
+                pdu = 2;
+            }
+            out[4] = static_cast<uint8_t>((pdu + 1) >> 8);
+            out[5] = static_cast<uint8_t>((pdu + 1) & 0xFF);
+            tx.append(reinterpret_cast<const char*>(out), 7 + pdu);
+        }
+    };
+};
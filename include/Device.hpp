@@ -1,5 +1,9 @@
+#pragma once
+
 #include <stdint.h>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace device
 {
@@ -8,15 +12,36 @@ namespace device
     * @param ip IP адреса на устройството.
     * @param port Порт за връзка (по подразбиране 502).
     * @param device_id Идентификатор на устройството (по подразбиране 1).
+    * @param name Име на устройството в статистиката (по подразбиране празно - използва се <ip>:<port>/<id>).
+    * @param interval Собствен интервал на четене в секунди. При 0 се използва '--interval'.
+    * @param pipeline_depth Собствен брой заявки, които чакат отговор едновременно. При 0 се използва '--pipeline'.
     */
     struct Device
     {
         std::string ip;
         uint16_t port = 502;
         int device_id = 1;
+        std::string name;
+        float interval = 0.0f;
+        size_t pipeline_depth = 0;
+    };
+
+    /**
+    * Разлика между два списъка с устройства (при презареждане на конфигурационния файл). Устройствата се сравняват по ip, port и id.
+    * @param previous За всяко устройство от новия списък - индексът му в стария списък или NEW_DEVICE.
+    * @param changed За всяко устройство от новия списък - дали "name", "interval" или "pipeline" са различни от стария списък.
+    * @param removed Индексите на устройствата от стария списък, които липсват в новия.
+    */
+    struct DeviceDiff
+    {
+        static constexpr size_t NEW_DEVICE = SIZE_MAX;
+        std::vector<size_t> previous;
+        std::vector<uint8_t> changed;
+        std::vector<size_t> removed;
     };
 
-    std::string extract_string(const std::string& src, const std::string& key);
-    int extract_int(const std::string& src, const std::string& key);
+    Device* parse_devices(std::string_view json, size_t& device_count, std::string_view source = "devices.json");
     Device* load_devices(const std::string& config_path, const std::string& json_name, size_t& device_count);
+    DeviceDiff diff_devices(const Device* old_devices, size_t old_count, const Device* new_devices, size_t new_count);
+    std::string connection_key(const Device& dev, bool shared);
 };
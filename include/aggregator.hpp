@@ -0,0 +1,54 @@
+#pragma once
+
+#include <ctime>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+#include "p30h_readPlan.hpp"
+
+namespace export_data
+{
+    /**
+    * Клас, който натрупва min/max/средна стойност/стандартно отклонение/последна стойност на всяка величина за един
+    * неприпокриващ се прозорец от време (tumbling window), подравнен на границите на прозореца от 1970-01-01 UTC.
+    * Паметта е фиксирана (няколко масива с по един елемент за величина), независимо от броя на отчетите в прозореца.
+    * Масивите са отделни за всяка статистика (struct-of-arrays), за да може цикълът в 'add' да се векторизира от компилатора.
+    * Стандартното отклонение се изчислява от сумите на отклоненията от първата стойност в прозореца, затова не губи точност
+    * при големи стойности (например енергии).
+    */
+    class WindowAggregator
+    {
+    public:
+        WindowAggregator(const reg::ReadPlanView& plan, uint32_t window_seconds);
+        ~WindowAggregator();
+        WindowAggregator(const WindowAggregator&) = delete;
+        WindowAggregator& operator=(const WindowAggregator&) = delete;
+
+        bool due(std::time_t timestamp) const;
+        void add(std::time_t timestamp, const reg::RegisterResult* results);
+        void reset(std::time_t timestamp);
+        uint32_t window() const;
+        std::time_t window_start() const;
+        uint32_t samples() const;
+        void append_csv_header(std::string& out) const;
+        void append_csv_row(std::string& out, std::string_view timestamp) const;
+
+    private:
+        const reg::RegisterRead* _map;
+        size_t _count;
+        uint32_t _window;
+        std::time_t _start;
+        uint32_t _samples;
+
+        float* _value;
+        uint8_t* _valid;
+        uint32_t* _n;
+        float* _min;
+        float* _max;
+        float* _last;
+        double* _shift;
+        double* _sum;
+        double* _sum_sq;
+    };
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+namespace retry
+{
+    /**
+    * Клас, който изчислява времето до следващия опит за свързване с експоненциално нарастване (exponential backoff).
+    * Към всяко изчакване се добавя случайно отклонение, за да не се свързват едновременно всички недостъпни устройства.
+    */
+    class Backoff
+    {
+    public:
+        Backoff(std::chrono::milliseconds initial = std::chrono::seconds(1), std::chrono::milliseconds max = std::chrono::seconds(60), uint32_t seed = 1);
+
+        std::chrono::milliseconds next();
+        void reset();
+        uint32_t attempts() const;
+
+    private:
+        std::chrono::milliseconds _initial;
+        std::chrono::milliseconds _max;
+        std::chrono::milliseconds _current;
+        uint32_t _attempts;
+        std::minstd_rand _random;
+    };
+};
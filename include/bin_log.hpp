@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "p30h_readPlan.hpp"
+
+/**
+* Двоичен формат на лог файловете (.bin). Всички числа са little-endian.
+*
+* Заглавие:
+*   char[8]  magic "P30HLOG\0"
+*   uint16   версия (1 - пълни записи, 2 - записи само с промените)
+*   uint16   брой колони N
+*   uint32   размер на един запис в байтове (при версия 2 - най-големият възможен размер)
+*   N пъти:  uint8 тип (RegType), uint8 дължина + символ, uint8 дължина + мерна единица, uint8 дължина + име
+*
+* Записи с фиксирана дължина:
+*   int64    време в милисекунди от 1970-01-01 UTC
+*   uint8[(N + 7) / 8]  битова маска на валидните стойности (бит i на байт i / 8 е за колона i % 8)
+*   стойностите в реда на колоните: float32 за REG_FLOAT32, uint16 за REG_INT16 (невалидните са 0)
+*
+* Записи с променлива дължина (версия 2, режим 'само промени' - вижте 'export_data::ChangeFilter'):
+*   int64    време в милисекунди от 1970-01-01 UTC
+*   uint8[(N + 7) / 8]  битова маска на записаните колони (останалите не са се променили от предишния запис)
+*   uint8[(N + 7) / 8]  битова маска на валидните стойности сред записаните колони
+*   стойностите само на записаните валидни колони, в реда на колоните
+*/
+namespace bin_log
+{
+    constexpr char MAGIC[8] = { 'P', '3', '0', 'H', 'L', 'O', 'G', '\0' };
+    constexpr uint16_t VERSION = 1;
+    constexpr uint16_t VERSION_DELTA = 2;
+
+    size_t record_size(const reg::ReadPlanView& plan, bool delta = false);
+    void append_header(std::string& out, const reg::ReadPlanView& plan, bool delta = false);
+    void append_record(std::string& out, int64_t timestamp_ms, const reg::ReadPlanView& plan, const reg::RegisterResult* results);
+    void append_delta_record(std::string& out, int64_t timestamp_ms, const reg::ReadPlanView& plan, const reg::RegisterResult* results, const uint8_t* changed);
+
+    /**
+    * Колони, прочетени от заглавие на двоичен лог. Обектът пази копие на низовете, към които сочат колоните.
+    */
+    class Columns
+    {
+    public:
+        Columns() = default;
+        Columns(const Columns&) = delete;
+        Columns& operator=(const Columns&) = delete;
+
+        void add(reg::RegType type, std::string_view symbol, std::string_view unit, std::string_view name);
+        size_t size() const;
+        const reg::RegisterRead* data() const;
+        const reg::ReadPlanView& plan() const;
+
+    private:
+        std::vector<std::unique_ptr<std::string>> _strings;
+        std::vector<reg::RegisterRead> _columns;
+        std::string _csv_header;
+        reg::ReadPlanView _plan{};
+    };
+
+    size_t read_header(std::istream& in, Columns& columns, bool* delta = nullptr);
+
+    /**
+    * Клас за четене на двоичен лог файл. Колоните се възстановяват от заглавието на файла.
+    * При файл само с промените (версия 2) непроменените стойности се взимат от предишните записи, затова 'next' винаги връща пълен отчет.
+    * Може да чете и от друг поток, например от разархивиран файл (вижте 'log_query').
+    */
+    class Reader
+    {
+    public:
+        explicit Reader(const std::string& path);
+        explicit Reader(std::istream& in);
+
+        const Columns& columns() const;
+        bool next(int64_t& timestamp_ms, reg::RegisterResult* results);
+
+    private:
+        std::ifstream _file;
+        std::istream& _in;
+        Columns _columns;
+        size_t _record_size;
+        bool _delta;
+        std::string _record;
+        std::vector<reg::RegisterResult> _state;
+
+        void init();
+        bool next_delta(int64_t& timestamp_ms, reg::RegisterResult* results);
+    };
+
+    size_t to_csv(const std::string& bin_path, const std::string& csv_path);
+};
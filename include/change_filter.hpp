@@ -0,0 +1,54 @@
+#pragma once
+
+#include <ctime>
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+#include "p30h_readPlan.hpp"
+
+namespace export_data
+{
+    /**
+    * Мъртва зона на една величина: промяна, която не я надхвърля, не се записва.
+    * @param value Размерът на зоната (в мерната единица на величината или в проценти). При 0 се записва всяка промяна.
+    * @param percent Дали 'value' е в проценти от последната записана стойност.
+    */
+    struct Deadband
+    {
+        float value = 0.0f;
+        bool percent = false;
+    };
+
+    std::vector<Deadband> parse_deadbands(std::string_view spec, const reg::ReadPlanView& plan);
+
+    /**
+    * Клас, който решава кои стойности от един отчет да се запишат в режим 'само промени'.
+    * Стойността се записва, ако се е променила повече от мъртвата си зона спрямо последната записана стойност, ако е станала
+    * валидна/невалидна или ако не е записвана от 'heartbeat' секунди. Първият отчет се записва целият.
+    * Така от записаните стойности може да се възстанови всеки отчет с точност до мъртвата зона.
+    */
+    class ChangeFilter
+    {
+    public:
+        ChangeFilter(const reg::ReadPlanView& plan, const std::vector<Deadband>& deadbands, float heartbeat);
+        ~ChangeFilter();
+        ChangeFilter(const ChangeFilter&) = delete;
+        ChangeFilter& operator=(const ChangeFilter&) = delete;
+
+        size_t update(std::time_t timestamp, const reg::RegisterResult* results, uint8_t* changed);
+        void restart();
+        size_t mask_size() const;
+
+    private:
+        const reg::RegisterRead* _map;
+        size_t _count;
+        Deadband* _bands;
+        reg::RegisterResult* _last;
+        std::time_t* _last_time;
+        std::time_t _heartbeat;
+        bool _first;
+
+        bool differs(size_t i, const reg::RegisterResult& value) const;
+    };
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+namespace config_watch
+{
+    /**
+    * Клас, който следи за промени в един файл (конфигурационния файл с устройствата).
+    * В Linux се използва inotify върху директорията на файла, за да се открие и записът чрез преименуване на временен файл
+    * (както правят повечето редактори). В останалите системи се проверява времето на последната промяна.
+    */
+    class Watcher
+    {
+    public:
+        explicit Watcher(const std::string& path);
+        ~Watcher();
+        Watcher(const Watcher&) = delete;
+        Watcher& operator=(const Watcher&) = delete;
+
+        bool wait(std::chrono::milliseconds timeout);
+
+    private:
+        std::filesystem::path _path;
+        std::string _name;
+        int _fd;
+        std::filesystem::file_time_type _mtime;
+
+        bool poll_events(std::chrono::milliseconds timeout);
+        bool modified();
+    };
+};
@@ -1,10 +1,42 @@
 #pragma once
 
 #include <atomic>
+#include <ostream>
+#include "log_writer.hpp"
 #include "p30h_tcpReader.hpp"
+#include "ring_store.hpp"
 
 namespace export_data
 {
+    /**
+    * Едно устройство (slave id) при четене на няколко устройства през една връзка (вижте 'poll_units_to_csv').
+    * @param host Името на устройството в името на лог файла (вижте 'csv_file_name').
+    * @param slave_id Идентификаторът на устройството.
+    * @param interval Интервал на четене в секунди.
+    * @param pipeline_depth Брой заявки, които чакат отговор едновременно. При 0 не се променя настройката на връзката.
+    * @param align Дали отчетите да са на границите на интервала по системния часовник (например точно в началото на секундата).
+    * @param phase Изместване на отчетите в интервала в секунди (вижте 'ticker::spread_phase').
+    * @param metrics Статистиката на устройството (nullptr - не се записва).
+    * @param ring Файл с последните отчети за други процеси (nullptr - не се използва).
+    */
+    struct PollUnit
+    {
+        std::string host;
+        int slave_id = 1;
+        float interval = 1.0f;
+        size_t pipeline_depth = 0;
+        bool align = true;
+        float phase = 0.0f;
+        metrics::DeviceMetrics* metrics = nullptr;
+        ring_store::Writer* ring = nullptr;
+    };
+
     std::string current_timestamp();
-    void poll_to_csv(P30HTcpReader& reader, reg::RegisterRead* reg_map, size_t reg_count, std::atomic<bool>* stop_flag = nullptr, std::string_view log_path = "log", float interval = 1.0f, size_t max_samples = 0);
+    std::string format_timestamp(std::time_t t);
+    std::string csv_file_name(std::string_view log_path, const std::string& host, std::string_view extension = ".csv", std::time_t time = 0);
+    void write_csv_row(std::ostream& csv, const std::string& timestamp, const reg::ReadPlanView& plan, const reg::RegisterResult* results);
+    void append_csv_row(std::string& out, std::string_view timestamp, const reg::ReadPlanView& plan, const reg::RegisterResult* results);
+    void append_csv_changes(std::string& out, std::string_view timestamp, const reg::ReadPlanView& plan, const reg::RegisterResult* results, const uint8_t* changed);
+    void poll_units_to_csv(P30HTcpReader& reader, const reg::ReadPlanView& plan, const PollUnit* units, size_t unit_count, std::atomic<bool>* stop_flag = nullptr, std::string_view log_path = "log", size_t max_samples = 0, const WriterOptions& options = WriterOptions());
+    void poll_to_csv(P30HTcpReader& reader, const reg::ReadPlanView& plan, std::atomic<bool>* stop_flag = nullptr, std::string_view log_path = "log", float interval = 1.0f, size_t max_samples = 0, const WriterOptions& options = WriterOptions(), ring_store::Writer* ring = nullptr);
 };
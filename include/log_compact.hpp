@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace log_compact
+{
+    /**
+    * Алгоритъм за компресиране на затворените лог файлове. Наличните зависят от библиотеките при компилиране (вижте 'available').
+    * @param NONE Файловете не се компресират (само се обединяват, ако е зададено 'CompactOptions::merge_below').
+    * @param GZIP gzip чрез zlib (.gz).
+    * @param ZSTD Zstandard (.zst) - по-малки файлове от gzip при по-голяма скорост.
+    * @param LZ4 LZ4 frame (.lz4) - най-бързо, но с най-големи файлове.
+    */
+    enum class Codec
+    {
+        NONE,
+        GZIP,
+        ZSTD,
+        LZ4
+    };
+
+    bool available(Codec codec);
+    Codec best_codec();
+    const char* codec_name(Codec codec);
+    const char* codec_extension(Codec codec);
+    bool parse_codec(const std::string& text, Codec& codec);
+    Codec codec_of(const std::string& file_name);
+    size_t default_workers(size_t busy_threads);
+
+    /**
+    * Части на името на лог файл: P30H(<host>)_data_<day>_<time><suffix><extension><компресия> (вижте 'export_data::csv_file_name').
+    * @param host Името на устройството.
+    * @param day Датата във вида YYYY-mm-dd.
+    * @param time Часът във вида HH-MM-SS (и "_<n>", ако в същата секунда е създаден повече от един файл). Празен за общия файл за деня.
+    * @param suffix Празен за отделните отчети или "_agg<секунди>s" за статистиките за прозорци.
+    * @param extension ".csv" или ".bin".
+    * @param codec Компресията според разширението след 'extension' (Codec::NONE - некомпресиран файл).
+    */
+    struct LogName
+    {
+        std::string host;
+        std::string day;
+        std::string time;
+        std::string suffix;
+        std::string extension;
+        Codec codec = Codec::NONE;
+    };
+
+    bool parse_log_name(const std::string& file_name, LogName& name);
+
+    /**
+    * Клас за поточно четене на лог файл, компресиран от 'Compactor' (или некомпресиран при Codec::NONE), от началото на някоя рамка,
+    * например от отместване в индекса (вижте 'log_index.hpp'). Следващите рамки се разархивират една след друга до края на файла.
+    */
+    class Decoder
+    {
+    public:
+        Decoder(const std::string& path, Codec codec, uint64_t offset = 0);
+        ~Decoder();
+        Decoder(const Decoder&) = delete;
+        Decoder& operator=(const Decoder&) = delete;
+
+        size_t read(char* out, size_t size);
+        bool failed() const;
+
+    private:
+        struct State;
+        std::unique_ptr<State> _state;
+    };
+
+    /**
+    * Настройки на 'Compactor'.
+    * @param codec Алгоритъмът за компресиране.
+    * @param workers Брой нишки за компресиране (0 - 'default_workers(1)').
+    * @param merge_below Файловете, по-малки от толкова байта, се добавят към общ файл за устройството за деня
+    *                    (P30H(<host>)_data_<day><suffix><extension><компресия>) вместо да се компресират поотделно. При 0 не се обединяват.
+    */
+    struct CompactOptions
+    {
+        Codec codec = best_codec();
+        size_t workers = 0;
+        uint64_t merge_below = 0;
+    };
+
+    /**
+    * Клас, който компресира затворените лог файлове в отделни нишки с най-нисък приоритет (SCHED_IDLE на Linux),
+    * затова използва само ядрата, които не са заети от четенето и записа.
+    * Файлът се компресира в <име><компресия>.part, който се преименува след успешен край, и чак тогава оригиналът се изтрива.
+    * Всеки блок от индекса на файла (вижте 'log_index.hpp') става отделна рамка, а индексът се записва отново с отместванията
+    * в компресирания файл, затова и компресираните файлове се четат от произволен блок (вижте 'Decoder').
+    * Малките файлове (вижте 'CompactOptions::merge_below') се добавят към общия файл за деня като нова рамка (gzip, zstd и lz4 позволяват
+    * рамки една след друга) без повторното заглавие, а файловете за един и същи общ файл се обработват един след друг в реда на 'submit'.
+    * При унищожаване незапочнатите файлове остават некомпресирани, а започнатите се прекъсват (вижте 'scan').
+    */
+    class Compactor
+    {
+    public:
+        explicit Compactor(const CompactOptions& options = CompactOptions());
+        ~Compactor();
+        Compactor(const Compactor&) = delete;
+        Compactor& operator=(const Compactor&) = delete;
+
+        void submit(const std::string& path);
+        size_t scan(const std::string& log_path);
+        size_t pending() const;
+        uint64_t completed() const;
+        uint64_t failed() const;
+        size_t workers() const;
+
+    private:
+        /**
+        * Затворен файл, който чака компресиране. 'archive' е общият файл за деня (празен - файлът се компресира отделно).
+        */
+        struct Job
+        {
+            std::string path;
+            std::string archive;
+        };
+
+        CompactOptions _options;
+        std::deque<Job> _jobs;
+        std::set<std::string> _busy;
+        mutable std::mutex _mutex;
+        std::condition_variable _wake;
+        std::atomic<bool> _stop;
+        std::atomic<uint64_t> _completed;
+        std::atomic<uint64_t> _failed;
+        std::vector<std::thread> _threads;
+
+        void worker_loop();
+        bool compress(const std::string& path);
+        bool merge(const std::string& path, const std::string& archive);
+    };
+};
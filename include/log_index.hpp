@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+* Разреден индекс по време на лог файл (<име на лог файла>.idx). Всички числа са little-endian.
+*
+* Заглавие:
+*   char[8]  magic "P30HIDX\0"
+*   uint16   версия (1)
+*   uint16   флагове (FLAG_CHANGES - лог файлът е в режим 'само промени')
+*   uint32   брой записи на лог файла в един блок
+*
+* Записи по 16 байта, по един за всеки блок от записи на лог файла, в реда на блоковете:
+*   int64    време на първия запис в блока в милисекунди от 1970-01-01 UTC
+*   uint64   отместване на блока в лог файла (в компресиран файл - в компресирания файл, където всеки блок е отделна рамка)
+*
+* При затварянето на лог файла се добавя последен запис с времето на последния запис и отместване, равно на размера на файла.
+* В режим 'само промени' първият запис на всеки блок е пълен, затова четенето може да започне от всеки блок.
+* Незавършен последен запис на индекса (например при спиране на тока) се пропуска.
+*/
+namespace log_index
+{
+    constexpr char MAGIC[8] = { 'P', '3', '0', 'H', 'I', 'D', 'X', '\0' };
+    constexpr uint16_t VERSION = 1;
+    constexpr uint16_t FLAG_CHANGES = 1;
+    constexpr size_t HEADER_SIZE = 16;
+    constexpr size_t ENTRY_SIZE = 16;
+
+    /**
+    * Един блок от лог файла.
+    * @param timestamp_ms Времето на първия запис в блока в милисекунди от 1970-01-01 UTC.
+    * @param offset Отместването на блока в лог файла.
+    */
+    struct Entry
+    {
+        int64_t timestamp_ms = 0;
+        uint64_t offset = 0;
+    };
+
+    /**
+    * Прочетен индекс.
+    * @param flags Флаговете от заглавието.
+    * @param block Броят на записите в един блок.
+    * @param entries Блоковете в реда на лог файла.
+    */
+    struct Index
+    {
+        uint16_t flags = 0;
+        uint32_t block = 0;
+        std::vector<Entry> entries;
+    };
+
+    std::string index_path(const std::string& log_path);
+    void append_header(std::string& out, uint16_t flags, uint32_t block);
+    void append_entry(std::string& out, int64_t timestamp_ms, uint64_t offset);
+    bool read_index(const std::string& path, Index& index);
+    const Entry* find_block(const Index& index, int64_t timestamp_ms);
+};
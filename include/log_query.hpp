@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+* Заявки по време към историческите лог файлове на едно устройство. Файловете, които не покриват периода, се пропускат
+* само по индекса им (вижте 'log_index.hpp'), а в останалите четенето започва направо от блока в началото на периода,
+* включително в компресираните файлове (вижте 'log_compact::Decoder'). Извеждат се само избраните колони.
+*/
+namespace log_query
+{
+    /**
+    * Заявка към лог файловете на едно устройство.
+    * @param host Името на устройството в имената на лог файловете (вижте 'export_data::csv_file_name').
+    * @param from_ms Началото на периода в милисекунди от 1970-01-01 UTC (включително).
+    * @param to_ms Краят на периода в милисекунди от 1970-01-01 UTC (включително).
+    * @param columns Символите на величините, които се извеждат, в този ред (празен - всички).
+    * @param use_index Дали четенето да започва от блока в индекса. При 'false' всеки файл се чете от началото (за сравнение).
+    */
+    struct Query
+    {
+        std::string host;
+        int64_t from_ms = std::numeric_limits<int64_t>::min();
+        int64_t to_ms = std::numeric_limits<int64_t>::max();
+        std::vector<std::string> columns;
+        bool use_index = true;
+    };
+
+    /**
+    * Статистика на една заявка.
+    * @param rows Изведените редове.
+    * @param files_read Прочетените файлове.
+    * @param files_skipped Файловете, пропуснати само по индекса им, без да се четат.
+    * @param bytes_read Разархивираните байтове, прочетени от файловете.
+    */
+    struct Stats
+    {
+        uint64_t rows = 0;
+        size_t files_read = 0;
+        size_t files_skipped = 0;
+        uint64_t bytes_read = 0;
+    };
+
+    std::vector<std::string> split_columns(const std::string& text);
+    std::vector<std::string> list_files(const std::string& log_path, const std::string& host);
+    Stats run(const std::string& log_path, const Query& query, std::ostream& out);
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "aggregator.hpp"
+#include "change_filter.hpp"
+#include "log_compact.hpp"
+#include "metrics.hpp"
+#include "p30h_readPlan.hpp"
+#include "spsc_queue.hpp"
+#include "timestamp.hpp"
+
+namespace export_data
+{
+    /**
+    * Формат на лог файловете.
+    * @param CSV Текстов .csv файл.
+    * @param BIN Двоичен файл със записи с фиксирана дължина (вижте 'bin_log.hpp').
+    */
+    enum class LogFormat
+    {
+        CSV,
+        BIN
+    };
+
+    /**
+    * Настройки на 'LogWriter'.
+    * @param format Форматът на файловете.
+    * @param queue_capacity Брой отчети, които могат да чакат запис за един файл. При пълна опашка новите отчети се изхвърлят, без да се чака диска.
+    * @param buffer_size Размер в байтове, след който натрупаните редове се записват на диска.
+    * @param flush_interval Максимално време в секунди, през което редовете стоят само в паметта. При 0 се записват веднага.
+    * @param fsync Дали след всеки запис данните да се изпращат до диска (fsync). По-бавно, но не се губят данни при спиране на тока.
+    * @param changes_only Дали да се записват само променените стойности (вижте 'ChangeFilter'). В .csv файла непроменените клетки са празни,
+    *                     а невалидните стойности се записват като "N/A". Двоичният файл е с записи само с промените (версия 2 в 'bin_log.hpp').
+    * @param deadbands Мъртвата зона на всяка величина в реда на плана (празен - записва се всяка промяна). Само при 'changes_only'.
+    * @param heartbeat Максимално време в секунди, през което една стойност може да не се записва. Само при 'changes_only'.
+    * @param aggregate_windows Дължини в секунди на прозорците, за които се записват min/max/avg/std/last на всяка величина
+    *                          (по един .csv файл за прозорец до файла на устройството, вижте 'WindowAggregator').
+    * @param raw Дали да се записват и отделните отчети. При 'false' се записват само статистиките за прозорците.
+    * @param rotate_size Размер в байтове на файла с отделните отчети, след който файловете на устройството се затварят и се създават нови. При 0 не се ограничава.
+    * @param rotate_interval Интервал в секунди, на който файловете на устройството се сменят, на границите по местно време
+    *                        (например 3600 - в началото на всеки час, 86400 - в полунощ). При 0 не се сменят.
+    * @param index_block Брой записи в един блок на индекса по време на файла с отделните отчети (<файл>.idx, вижте 'log_index.hpp'). При 0 няма индекс.
+    * @param compactor Получава затворените файлове за компресиране във фонов режим (nullptr - остават некомпресирани).
+    *                  Активните файлове никога не се компресират. Трябва да е валиден, докато обектът 'LogWriter' съществува.
+    */
+    struct WriterOptions
+    {
+        LogFormat format = LogFormat::CSV;
+        size_t queue_capacity = 64;
+        size_t buffer_size = 64 * 1024;
+        float flush_interval = 1.0f;
+        bool fsync = false;
+        bool changes_only = false;
+        std::vector<Deadband> deadbands;
+        float heartbeat = 60.0f;
+        std::vector<uint32_t> aggregate_windows;
+        bool raw = true;
+        uint64_t rotate_size = 0;
+        uint32_t rotate_interval = 0;
+        uint32_t index_block = 256;
+        log_compact::Compactor* compactor = nullptr;
+    };
+
+    /**
+    * Клас, който записва отчетите в .csv (или двоични) файлове в отделна нишка.
+    * Нишките, които четат от устройствата, само копират резултатите в опашка без заключване (по една опашка за файл),
+    * а форматирането и записът на диска стават на големи порции в нишката на класа. Така бавен диск не забавя четенето.
+    * Файлове могат да се добавят и премахват и докато нишката работи (при презареждане на конфигурационния файл).
+    * Файловете са в таблица с фиксиран размер ('MAX_FILES'), затова 'push' намира файла без заключване, а затварянето на файловете
+    * при премахване става в нишката на класа, без да спира нишките, които четат от устройствата.
+    * Смяната на файловете ('WriterOptions::rotate_size' и 'rotate_interval') също е в нишката на класа, а затворените файлове
+    * се компресират от 'WriterOptions::compactor' в неговите нишки.
+    */
+    class LogWriter
+    {
+    public:
+        static constexpr size_t MAX_FILES = 1024;
+
+        LogWriter(const reg::ReadPlanView& plan, const WriterOptions& options = WriterOptions());
+        ~LogWriter();
+        LogWriter(const LogWriter&) = delete;
+        LogWriter& operator=(const LogWriter&) = delete;
+
+        size_t add_file(std::string_view log_path, const std::string& host, metrics::DeviceMetrics* device_metrics = nullptr);
+        void remove_file(size_t file);
+        void start();
+        void stop();
+        bool push(size_t file, int64_t timestamp_ms, const reg::RegisterResult* results);
+        uint64_t dropped() const;
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+        * Копие на резултатите от един отчет. Масивът 'values' се заделя предварително за всеки елемент на опашката.
+        * 'timestamp_ms' е календарното време на отчета в милисекунди, а 'seconds' връща същото време в секунди (за статистиките и филтъра).
+        */
+        struct Sample
+        {
+            int64_t timestamp_ms = 0;
+            reg::RegisterResult* values = nullptr;
+
+            std::time_t seconds() const { return static_cast<std::time_t>(timestamp_ms / 1000); }
+        };
+
+        /**
+        * Файл със статистиките на едно устройство за прозорци с дадена дължина.
+        */
+        struct Aggregation
+        {
+            std::FILE* file;
+            std::string path;
+            WindowAggregator window;
+            std::string pending;
+
+            Aggregation(std::FILE* f, const reg::ReadPlanView& plan, uint32_t window_seconds);
+            ~Aggregation();
+        };
+
+        /**
+        * Един лог файл със собствена опашка и буфер с форматирани записи, които още не са записани.
+        * 'metrics' е статистиката на устройството, в която се записва времето за запис (може да е nullptr).
+        * 'changes' избира променените стойности в режим 'само промени' (иначе е nullptr), а 'changed' е битовата маска за него.
+        * 'file' е nullptr, ако отделните отчети не се записват ('WriterOptions::raw'), а 'aggregations' са файловете със статистиките.
+        * 'closing' се вдига от 'remove_file', а 'closed' - от нишката за запис, след като е записала всички чакащи отчети.
+        * 'log_path' и 'host' са за имената на следващите файлове, 'path' е текущият файл с отделните отчети, 'bytes' - записаните в него байтове,
+        * а 'rotate_at' - времето на следващата смяна по 'WriterOptions::rotate_interval' (0 - няма).
+        * 'index' е индексът на файла (nullptr - няма), 'index_pending' - неговите записи, които още не са записани, 'block_rows' - броят на
+        * записите в текущия блок, а 'last_row_ms' - времето на последния запис (0 - още няма).
+        */
+        struct Channel
+        {
+            std::FILE* file;
+            std::string log_path;
+            std::string host;
+            std::string path;
+            uint64_t bytes = 0;
+            std::time_t rotate_at = 0;
+            std::FILE* index = nullptr;
+            std::string index_pending;
+            uint32_t block_rows = 0;
+            int64_t last_row_ms = 0;
+            SpscQueue<Sample> queue;
+            std::string pending;
+            Clock::time_point next_write;
+            metrics::DeviceMetrics* metrics = nullptr;
+            std::unique_ptr<ChangeFilter> changes;
+            std::vector<uint8_t> changed;
+            std::vector<std::unique_ptr<Aggregation>> aggregations;
+            std::atomic<bool> closing{false};
+            bool closed = false;
+
+            Channel(std::FILE* f, size_t capacity, size_t reg_count);
+            ~Channel();
+        };
+
+        reg::ReadPlanView _plan;
+        WriterOptions _options;
+        Clock::duration _flush_interval;
+        std::unique_ptr<std::atomic<Channel*>[]> _channels;
+        std::atomic<size_t> _channel_count;
+        std::mutex _channels_mutex;
+        std::atomic<uint64_t> _dropped;
+        std::atomic<bool> _stop;
+        std::atomic<bool> _close_requested;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _closed;
+        std::thread _thread;
+
+        timestamp::Formatter _formatter;
+
+        void writer_loop();
+        void release_closed();
+        void retire(Channel* ch);
+        void open_files(Channel& ch, std::time_t now);
+        void close_files(Channel& ch);
+        void index_row(Channel& ch, int64_t timestamp_ms);
+        void end_index(Channel& ch);
+        bool rotation_due(const Channel& ch, std::time_t now) const;
+        void rotate(Channel& ch, std::time_t now);
+        bool drain(Channel& ch);
+        void aggregate(Channel& ch, const Sample& sample);
+        void close_windows(Channel& ch);
+        void write_out(Channel& ch, Clock::time_point now);
+        void write_file(std::FILE* file, const std::string& data);
+    };
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+* Измерване на времената и грешките при четенето на устройствата.
+* Записването на стойност е няколко атомарни операции без заключване, затова може да се извиква от нишките, които четат,
+* докато друга нишка показва статистиката или я изпраща по HTTP.
+*/
+namespace metrics
+{
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+    * Хистограма на времена в микросекунди с логаритмично-линейни интервали (като HDR Histogram):
+    * всеки интервал [2^k, 2^(k+1)) е разделен на 8 равни части, затова грешката на процентилите е под 12.5%,
+    * а паметта е фиксирана (200 брояча). Стойностите над MAX_VALUE (около 134 секунди) се записват като MAX_VALUE.
+    */
+    class Histogram
+    {
+    public:
+        static constexpr size_t SUB_BUCKETS = 8;
+        static constexpr size_t BUCKET_COUNT = 200;
+        static constexpr uint64_t MAX_VALUE = (uint64_t(1) << 27) - 1;
+
+        Histogram();
+        Histogram(const Histogram&) = delete;
+        Histogram& operator=(const Histogram&) = delete;
+
+        void record(uint64_t value_us);
+        void record(Clock::duration duration);
+        void add(const Histogram& other);
+        uint64_t count() const;
+        uint64_t sum() const;
+        uint64_t max() const;
+        uint64_t percentile(double p) const;
+
+        static size_t bucket_index(uint64_t value_us);
+        static uint64_t bucket_lower(size_t index);
+
+    private:
+        std::atomic<uint32_t> _buckets[BUCKET_COUNT];
+        std::atomic<uint64_t> _count;
+        std::atomic<uint64_t> _sum;
+        std::atomic<uint64_t> _max;
+    };
+
+    /**
+    * Статистика на едно устройство.
+    * @param device Името на устройството (ip:port/id).
+    * @param request_rtt Време от изпращането на една заявка FC03 до получаването на отговора ѝ.
+    * @param sample_latency Време за един отчет (всички заявки на плана за четене).
+    * @param write_latency Време за един запис на натрупаните отчети в лог файла.
+    * @param start_lag Закъснение на началото на отчета спрямо планираното време (неравномерност на интервалите между отчетите).
+    * @param samples Брой отчети.
+    * @param timeouts Брой заявки без отговор в рамките на времето за изчакване.
+    * @param exceptions Брой отговори с Modbus изключение.
+    * @param reconnects Брой опити за свързване след първия.
+    * @param missed_deadlines Брой интервали, в които отчетът не е започнал навреме, защото предишният е продължил твърде дълго.
+    */
+    struct DeviceMetrics
+    {
+        std::string device;
+        Histogram request_rtt;
+        Histogram sample_latency;
+        Histogram write_latency;
+        Histogram start_lag;
+        std::atomic<uint64_t> samples{0};
+        std::atomic<uint64_t> timeouts{0};
+        std::atomic<uint64_t> exceptions{0};
+        std::atomic<uint64_t> reconnects{0};
+        std::atomic<uint64_t> missed_deadlines{0};
+
+        explicit DeviceMetrics(const std::string& name);
+    };
+
+    /**
+    * Помощна функция за увеличаване на брояч от DeviceMetrics.
+    */
+    inline void increment(std::atomic<uint64_t>& counter, uint64_t amount = 1)
+    {
+        counter.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    /**
+    * Списък със статистиките на всички устройства. Устройствата се добавят при стартиране и при презареждане на конфигурационния файл.
+    */
+    class Registry
+    {
+    public:
+        Registry() = default;
+        Registry(const Registry&) = delete;
+        Registry& operator=(const Registry&) = delete;
+
+        DeviceMetrics& add(const std::string& device);
+        void remove(const DeviceMetrics* device_metrics);
+        void rename(DeviceMetrics& device_metrics, const std::string& device);
+        size_t size() const;
+        void sum(DeviceMetrics& total) const;
+        void append_prometheus(std::string& out) const;
+        void append_summary(std::string& out) const;
+
+    private:
+        mutable std::mutex _mutex;
+        std::vector<std::unique_ptr<DeviceMetrics>> _devices;
+    };
+
+    #ifdef __linux__
+    /**
+    * Минимален HTTP сървър, който връща статистиката във формата на Prometheus на GET /metrics.
+    * Слуша само на 127.0.0.1 и обслужва заявките една по една в собствена нишка.
+    */
+    class HttpExporter
+    {
+    public:
+        HttpExporter(const Registry& registry, uint16_t port);
+        ~HttpExporter();
+        HttpExporter(const HttpExporter&) = delete;
+        HttpExporter& operator=(const HttpExporter&) = delete;
+
+        void start();
+        void stop();
+
+    private:
+        const Registry& _registry;
+        int _listen_fd;
+        std::atomic<bool> _stop;
+        std::thread _thread;
+
+        void serve_loop();
+        void serve(int fd);
+    };
+    #endif
+};
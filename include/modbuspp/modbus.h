@@ -19,6 +19,8 @@
 #ifndef MODBUSPP_MODBUS_H
 #define MODBUSPP_MODBUS_H
 
+#include <cerrno>
+#include <chrono>
 #include <cstring>
 #include <stdint.h>
 #include <string>
@@ -48,27 +50,49 @@ using X_SOCKET = SOCKET;
 #endif
 #endif
 
+#define X_INVALID_SOCKET INVALID_SOCKET
 #define X_ISVALIDSOCKET(s) ((s) != INVALID_SOCKET)
 #define X_CLOSE_SOCKET(s) closesocket(s)
 #define X_ISCONNECTSUCCEED(s) ((s) != SOCKET_ERROR)
+#define X_WOULDBLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
+#define X_INPROGRESS() (WSAGetLastError() == WSAEWOULDBLOCK)
+using X_SOCKLEN = int;
 
 #else
 // Berkeley socket
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 using X_SOCKET = int;
 
+#define X_INVALID_SOCKET (-1)
 #define X_ISVALIDSOCKET(s) ((s) >= 0)
 #define X_CLOSE_SOCKET(s) close(s)
 #define X_ISCONNECTSUCCEED(s) ((s) >= 0)
+#define X_WOULDBLOCK() (errno == EAGAIN || errno == EWOULDBLOCK)
+#define X_INPROGRESS() (errno == EINPROGRESS)
+using X_SOCKLEN = socklen_t;
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define X_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define X_SEND_FLAGS 0
 #endif
 
 using SOCKADDR = struct sockaddr;
 using SOCKADDR_IN = struct sockaddr_in;
 
 #define MAX_MSG_LENGTH 260
+#define MAX_WRITE_REGS 123   // largest FC16 request that fits into MAX_MSG_LENGTH
+#define MAX_WRITE_COILS 1968 // largest FC15 request that fits into MAX_MSG_LENGTH
+#define TX_BUFFER_LENGTH 1024
+#define RX_BUFFER_LENGTH 2048 // must be a power of two, the RX buffer is a ring
 
 ///Function Code
 #define READ_COILS 0x01
@@ -95,6 +119,26 @@ using SOCKADDR_IN = struct sockaddr_in;
 #define EX_BAD_DATA 0XFF         // Bad Data lenght or Address
 
 #define BAD_CON -1
+#define PENDING_REQ -2
+#define TIMEOUT_REQ -3
+
+/// Pipelined Request
+/**
+ * One register read or write of a pipelined batch
+ * address/amount/buffer are set by the caller, buffer holds the values read
+ * or the values to write. status is filled by the call:
+ * 0 on success, BAD_CON, TIMEOUT_REQ, EX_BAD_DATA or the Modbus exception code of the response.
+ * sent_at is set when the request is sent, rtt_us when its response arrives.
+ */
+struct modbus_request
+{
+    uint16_t address;
+    uint16_t amount;
+    uint16_t *buffer;
+    int status;
+    std::chrono::steady_clock::time_point sent_at;
+    uint32_t rtt_us;
+};
 
 /// Modbus Operator Class
 /**
@@ -113,50 +157,97 @@ public:
     ~modbus();
 
     bool modbus_connect();
-    void modbus_close() const;
+    void modbus_close();
 
     bool is_connected() const { return _connected; }
 
     void modbus_set_slave_id(int id);
+    void modbus_set_pipeline_depth(size_t depth);
+    void modbus_set_connect_timeout(int timeout_ms);
+    void modbus_set_response_timeout(int timeout_ms);
 
     int modbus_read_coils(uint16_t address, uint16_t amount, bool *buffer);
     int modbus_read_input_bits(uint16_t address, uint16_t amount, bool *buffer);
     int modbus_read_holding_registers(uint16_t address, uint16_t amount, uint16_t *buffer);
     int modbus_read_input_registers(uint16_t address, uint16_t amount, uint16_t *buffer);
+    int modbus_read_holding_registers_pipelined(modbus_request *requests, size_t count);
 
     int modbus_write_coil(uint16_t address, const bool &to_write);
     int modbus_write_register(uint16_t address, const uint16_t &value);
     int modbus_write_coils(uint16_t address, uint16_t amount, const bool *value);
     int modbus_write_registers(uint16_t address, uint16_t amount, const uint16_t *value);
+    int modbus_write_registers_batched(modbus_request *requests, size_t count);
+
+    /// Non-Blocking Interface, Driven by an External Event Loop
+    X_SOCKET modbus_get_socket() const { return _socket; }
+    uint16_t modbus_next_tid() const { return (uint16_t)_msg_id; }
+    size_t modbus_get_pipeline_depth() const { return _pipeline_depth; }
+    bool modbus_has_pending_tx() const { return _tx_sent < _tx_len; }
+
+    bool modbus_connect_async();
+    bool modbus_finish_connect();
+    bool modbus_queue_read(uint16_t address, uint16_t amount, int func);
+    bool modbus_queue_write(uint16_t address, uint16_t amount, const uint16_t *value);
+    int modbus_flush();
+    ssize_t modbus_fill();
+    ssize_t modbus_pop_frame(uint8_t *frame);
+    int modbus_route_response(const uint8_t *frame, ssize_t length, modbus_request *requests, size_t sent, uint16_t base_tid);
 
 private:
     bool _connected{};
     uint16_t PORT{};
     uint32_t _msg_id{};
+    uint16_t _last_tid{};
+    size_t _pipeline_depth{};
+    int _connect_timeout_ms{};
+    int _response_timeout_ms{};
     int _slaveid{};
     std::string HOST;
 
-    X_SOCKET _socket{};
+    X_SOCKET _socket{X_INVALID_SOCKET};
     SOCKADDR_IN _server{};
 
+    uint8_t _tx_buf[TX_BUFFER_LENGTH]{};
+    size_t _tx_len{};
+    size_t _tx_sent{};
+    uint8_t _rx_buf[RX_BUFFER_LENGTH]{};
+    size_t _rx_head{};
+    size_t _rx_len{};
+
 #ifdef _WIN32
     WSADATA wsadata;
 #endif
 
     void modbus_build_request(uint8_t *to_send, uint16_t address, int func) const;
+    size_t modbus_build_write(uint8_t *to_send, uint16_t address, uint16_t amount, int func, const uint16_t *value) const;
 
     int modbus_read(uint16_t address, uint16_t amount, int func);
     int modbus_write(uint16_t address, uint16_t amount, int func, const uint16_t *value);
+    int modbus_write_response(int func);
+
+    void modbus_set_blocking(bool blocking) const;
+    void modbus_apply_response_timeout() const;
+    bool modbus_wait_writable(int timeout_ms) const;
 
     ssize_t modbus_send(uint8_t *to_send, size_t length);
-    ssize_t modbus_receive(uint8_t *buffer) const;
+    ssize_t modbus_receive(uint8_t *buffer);
+    ssize_t modbus_receive_frame(uint8_t *buffer);
+    ssize_t modbus_wait_frame(uint8_t *frame);
+    int modbus_fail_pending(modbus_request *requests, size_t count, int status);
+    int modbus_route_write_response(const uint8_t *frame, ssize_t length, modbus_request *requests, size_t sent, uint16_t base_tid);
+    uint8_t modbus_rx_at(size_t i) const { return _rx_buf[(_rx_head + i) & (RX_BUFFER_LENGTH - 1)]; }
+    bool modbus_check_response(const uint8_t *msg, ssize_t length, int func, size_t data_bytes);
 
     void modbuserror_handle(const uint8_t *msg, int func);
 
     void set_bad_con();
     void set_bad_input();
+    void set_bad_data();
 };
 
+static_assert((RX_BUFFER_LENGTH & (RX_BUFFER_LENGTH - 1)) == 0, "RX_BUFFER_LENGTH must be a power of two");
+static_assert(RX_BUFFER_LENGTH >= 2 * MAX_MSG_LENGTH, "RX_BUFFER_LENGTH must hold at least two frames");
+
 /**
  * Main Constructor of Modbus Connector Object
  * @param host IP Address of Host
@@ -169,6 +260,10 @@ inline modbus::modbus(std::string host, uint16_t port = 502)
     PORT = port;
     _slaveid = 1;
     _msg_id = 1;
+    _last_tid = 0;
+    _pipeline_depth = 1;
+    _connect_timeout_ms = 20000;
+    _response_timeout_ms = 20000;
     _connected = false;
     err = false;
     err_no = 0;
@@ -189,8 +284,46 @@ inline void modbus::modbus_set_slave_id(int id)
     _slaveid = id;
 }
 
+/**
+ * Pipeline Depth Setter
+ * Maximum number of requests kept in flight by modbus_read_holding_registers_pipelined.
+ * 1 (default) sends the next request only after the previous response arrived.
+ * @param depth  Number of Outstanding Requests, 0 is treated as 1
+ */
+inline void modbus::modbus_set_pipeline_depth(size_t depth)
+{
+    _pipeline_depth = depth == 0 ? 1 : depth;
+}
+
+/**
+ * Connect Timeout Setter
+ * Upper bound for modbus_connect, so an unreachable host fails fast instead
+ * of waiting for the operating system TCP timeout.
+ * @param timeout_ms  Timeout in Milliseconds (default 20000)
+ */
+inline void modbus::modbus_set_connect_timeout(int timeout_ms)
+{
+    _connect_timeout_ms = timeout_ms > 0 ? timeout_ms : 1;
+}
+
+/**
+ * Response Timeout Setter
+ * Upper bound for a blocking send or receive, so a silent server fails the
+ * request as TIMEOUT_REQ instead of holding the caller. Applied immediately
+ * when connected, otherwise on the next modbus_connect.
+ * @param timeout_ms  Timeout in Milliseconds (default 20000)
+ */
+inline void modbus::modbus_set_response_timeout(int timeout_ms)
+{
+    _response_timeout_ms = timeout_ms > 0 ? timeout_ms : 1;
+    if (_connected)
+        modbus_apply_response_timeout();
+}
+
 /**
  * Build up a Modbus/TCP Connection
+ * The connect itself is non-blocking and bounded by the connect timeout,
+ * afterwards the socket is switched back to blocking mode.
  * @return   If A Connection Is Successfully Built
  */
 inline bool modbus::modbus_connect()
@@ -205,6 +338,8 @@ inline bool modbus::modbus_connect()
         LOG("Found Proper Host %s and Port %d", HOST.c_str(), PORT);
     }
 
+    modbus_close(); // a previous connection is released instead of leaked
+
 #ifdef _WIN32
     if (WSAStartup(0x0202, &wsadata))
     {
@@ -226,31 +361,163 @@ inline bool modbus::modbus_connect()
         LOG("Socket Opened Successfully");
     }
 
-#ifdef WIN32
-    const DWORD timeout = 20;
+    modbus_apply_response_timeout();
+    // Small requests must not wait for the ACK of the previous one, otherwise pipelining is lost to Nagle
+    int nodelay = 1;
+    setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+    _server.sin_family = AF_INET;
+    _server.sin_addr.s_addr = inet_addr(HOST.c_str());
+    _server.sin_port = htons(PORT);
+
+    modbus_set_blocking(false);
+    if (!X_ISCONNECTSUCCEED(connect(_socket, (SOCKADDR *)&_server, sizeof(_server))))
+    {
+        int so_error = 0;
+        X_SOCKLEN length = sizeof(so_error);
+        if (!X_INPROGRESS() || !modbus_wait_writable(_connect_timeout_ms) ||
+            getsockopt(_socket, SOL_SOCKET, SO_ERROR, (char *)&so_error, &length) != 0 || so_error != 0)
+        {
+            LOG("Connection Error");
+            modbus_close();
+            return false;
+        }
+    }
+    modbus_set_blocking(true);
+
+    LOG("Connected");
+    _tx_len = _tx_sent = _rx_head = _rx_len = 0;
+    _connected = true;
+    return true;
+}
+
+/**
+ * Start a Non-Blocking Modbus/TCP Connection
+ * The socket is switched to non-blocking mode. Wait for it to become writable
+ * and call modbus_finish_connect to learn the result.
+ * @return   If the Connection Was Started (or Already Completed)
+ */
+inline bool modbus::modbus_connect_async()
+{
+    if (HOST.empty() || PORT == 0)
+    {
+        LOG("Missing Host and Port");
+        return false;
+    }
+
+    modbus_close(); // a previous connection is released instead of leaked
+
+#ifdef _WIN32
+    if (WSAStartup(0x0202, &wsadata))
+    {
+        return false;
+    }
+#endif
+
+    _connected = false;
+    _tx_len = _tx_sent = _rx_head = _rx_len = 0;
+    _socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (!X_ISVALIDSOCKET(_socket))
+    {
+        LOG("Error Opening Socket");
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return false;
+    }
+
+    modbus_set_blocking(false);
+    int nodelay = 1;
+    setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+    _server.sin_family = AF_INET;
+    _server.sin_addr.s_addr = inet_addr(HOST.c_str());
+    _server.sin_port = htons(PORT);
+
+    if (connect(_socket, (SOCKADDR *)&_server, sizeof(_server)) == 0)
+    {
+        _connected = true;
+        return true;
+    }
+    if (X_INPROGRESS())
+        return true;
+
+    LOG("Connection Error");
+    modbus_close();
+    return false;
+}
+
+/**
+ * Switch the Socket between Blocking and Non-Blocking Mode
+ * @param blocking  If Socket Calls Should Block
+ */
+inline void modbus::modbus_set_blocking(bool blocking) const
+{
+#ifdef _WIN32
+    u_long nonblocking = blocking ? 0 : 1;
+    ioctlsocket(_socket, FIONBIO, &nonblocking);
+#else
+    int flags = fcntl(_socket, F_GETFL, 0);
+    fcntl(_socket, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+#endif
+}
+
+/**
+ * Apply the Response Timeout to Blocking Sends and Receives of the Socket
+ */
+inline void modbus::modbus_apply_response_timeout() const
+{
+#ifdef _WIN32
+    const DWORD timeout = (DWORD)_response_timeout_ms;
 #else
     struct timeval timeout
     {
     };
-    timeout.tv_sec = 20; // after 20 seconds connect() will timeout
-    timeout.tv_usec = 0;
+    timeout.tv_sec = _response_timeout_ms / 1000;
+    timeout.tv_usec = (_response_timeout_ms % 1000) * 1000;
 #endif
 
     setsockopt(_socket, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout));
     setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
-    _server.sin_family = AF_INET;
-    _server.sin_addr.s_addr = inet_addr(HOST.c_str());
-    _server.sin_port = htons(PORT);
+}
 
-    if (!X_ISCONNECTSUCCEED(connect(_socket, (SOCKADDR *)&_server, sizeof(_server))))
-    {
-        LOG("Connection Error");
+/**
+ * Wait Until the Socket Becomes Writable (Connect Completed or Failed)
+ * @param timeout_ms  Timeout in Milliseconds
+ * @return            If the Socket Became Writable in Time
+ */
+inline bool modbus::modbus_wait_writable(int timeout_ms) const
+{
 #ifdef _WIN32
-        WSACleanup();
+    fd_set writable, failed;
+    FD_ZERO(&writable);
+    FD_ZERO(&failed);
+    FD_SET(_socket, &writable);
+    FD_SET(_socket, &failed);
+    struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    return select(0, nullptr, &writable, &failed, &timeout) > 0;
+#else
+    struct pollfd pfd = {_socket, POLLOUT, 0};
+    int rc;
+    do
+    {
+        rc = poll(&pfd, 1, timeout_ms);
+    } while (rc < 0 && errno == EINTR);
+    return rc > 0;
 #endif
+}
+
+/**
+ * Complete a Connection Started by modbus_connect_async
+ * @return   If the Connection Is Established
+ */
+inline bool modbus::modbus_finish_connect()
+{
+    int so_error = 0;
+    X_SOCKLEN length = sizeof(so_error);
+    if (getsockopt(_socket, SOL_SOCKET, SO_ERROR, (char *)&so_error, &length) != 0 || so_error != 0)
+    {
+        LOG("Connection Error");
         return false;
     }
-
     LOG("Connected");
     _connected = true;
     return true;
@@ -258,10 +525,16 @@ inline bool modbus::modbus_connect()
 
 /**
  * Close the Modbus/TCP Connection
+ * Closing an already closed connection does nothing, so the descriptor number
+ * can never be closed twice after the system has given it to another socket.
  */
-inline void modbus::modbus_close() const
+inline void modbus::modbus_close()
 {
+    _connected = false;
+    if (!X_ISVALIDSOCKET(_socket))
+        return;
     X_CLOSE_SOCKET(_socket);
+    _socket = X_INVALID_SOCKET;
 #ifdef _WIN32
     WSACleanup();
 #endif
@@ -288,58 +561,66 @@ inline void modbus::modbus_build_request(uint8_t *to_send, uint16_t address, int
 }
 
 /**
- * Write Request Builder and Sender
+ * Write Request Builder
+ * Encodes a FC05, FC06 or FC16 request into a caller provided buffer, so
+ * the write path needs no heap allocation.
+ * @param to_send   Buffer for the ADU, at least MAX_MSG_LENGTH Bytes
  * @param address   Reference Address
- * @param amount    Amount of data to be Written
+ * @param amount    Amount of data to be Written, 1 for FC05 and FC06
  * @param func      Modbus Functional Code
  * @param value     Data to Be Written
+ * @return          Size of the ADU, 0 if the Function or Amount Is Invalid
  */
-inline int modbus::modbus_write(uint16_t address, uint16_t amount, int func, const uint16_t *value)
+inline size_t modbus::modbus_build_write(uint8_t *to_send, uint16_t address, uint16_t amount, int func, const uint16_t *value) const
 {
-    int status = 0;
-    uint8_t *to_send;
     if (func == WRITE_COIL || func == WRITE_REG)
     {
-        to_send = new uint8_t[12];
         modbus_build_request(to_send, address, func);
         to_send[5] = 6;
         to_send[10] = (uint8_t)(value[0] >> 8u);
         to_send[11] = (uint8_t)(value[0] & 0x00FFu);
-        status = modbus_send(to_send, 12);
+        return 12;
     }
-    else if (func == WRITE_REGS)
+    if (func != WRITE_REGS || amount == 0 || amount > MAX_WRITE_REGS)
+        return 0;
+    modbus_build_request(to_send, address, func);
+    to_send[5] = (uint8_t)(7 + 2 * amount);
+    to_send[10] = (uint8_t)(amount >> 8u);
+    to_send[11] = (uint8_t)(amount & 0x00FFu);
+    to_send[12] = (uint8_t)(2 * amount);
+    for (int i = 0; i < amount; i++)
     {
-        to_send = new uint8_t[13 + 2 * amount];
-        modbus_build_request(to_send, address, func);
-        to_send[5] = (uint8_t)(7 + 2 * amount);
-        to_send[10] = (uint8_t)(amount >> 8u);
-        to_send[11] = (uint8_t)(amount & 0x00FFu);
-        to_send[12] = (uint8_t)(2 * amount);
-        for (int i = 0; i < amount; i++)
-        {
-            to_send[13 + 2 * i] = (uint8_t)(value[i] >> 8u);
-            to_send[14 + 2 * i] = (uint8_t)(value[i] & 0x00FFu);
-        }
-        status = modbus_send(to_send, 13 + 2 * amount);
+        to_send[13 + 2 * i] = (uint8_t)(value[i] >> 8u);
+        to_send[14 + 2 * i] = (uint8_t)(value[i] & 0x00FFu);
     }
-    else if (func == WRITE_COILS)
+    return 13u + 2u * amount;
+}
+
+/**
+ * Write Request Builder and Sender
+ * @param address   Reference Address
+ * @param amount    Amount of data to be Written
+ * @param func      Modbus Functional Code
+ * @param value     Data to Be Written
+ * @return          0 if the Request Was Sent, EX_BAD_DATA on Invalid Input, BAD_CON on Send Failure
+ */
+inline int modbus::modbus_write(uint16_t address, uint16_t amount, int func, const uint16_t *value)
+{
+    uint8_t to_send[MAX_MSG_LENGTH];
+    size_t length = modbus_build_write(to_send, address, amount, func, value);
+    if (length == 0)
     {
-        to_send = new uint8_t[14 + (amount - 1) / 8];
-        modbus_build_request(to_send, address, func);
-        to_send[5] = (uint8_t)(7 + (amount + 7) / 8);
-        to_send[10] = (uint8_t)(amount >> 8u);
-        to_send[11] = (uint8_t)(amount & 0x00FFu);
-        to_send[12] = (uint8_t)((amount + 7) / 8);
-        for (int i = 0; i < (amount + 7) / 8; i++)
-            to_send[13 + i] = 0; // init needed before summing!
-        for (int i = 0; i < amount; i++)
-        {
-            to_send[13 + i / 8] += (uint8_t)(value[i] << (i % 8u));
-        }
-        status = modbus_send(to_send, 14 + (amount - 1) / 8);
+        set_bad_input();
+        err_no = EX_BAD_DATA;
+        return EX_BAD_DATA;
     }
-    delete[] to_send;
-    return status;
+    if (modbus_send(to_send, length) != (ssize_t)length)
+    {
+        set_bad_con();
+        err_no = BAD_CON;
+        return BAD_CON;
+    }
+    return 0;
 }
 
 /**
@@ -380,6 +661,8 @@ inline int modbus::modbus_read_holding_registers(uint16_t address, uint16_t amou
         modbuserror_handle(to_rec, READ_REGS);
         if (err)
             return err_no;
+        if (!modbus_check_response(to_rec, k, READ_REGS, 2u * amount))
+            return EX_BAD_DATA;
         for (auto i = 0; i < amount; i++)
         {
             buffer[i] = ((uint16_t)to_rec[9u + 2u * i]) << 8u;
@@ -416,6 +699,8 @@ inline int modbus::modbus_read_input_registers(uint16_t address, uint16_t amount
         modbuserror_handle(to_rec, READ_INPUT_REGS);
         if (err)
             return err_no;
+        if (!modbus_check_response(to_rec, k, READ_INPUT_REGS, 2u * amount))
+            return EX_BAD_DATA;
         for (auto i = 0; i < amount; i++)
         {
             buffer[i] = ((uint16_t)to_rec[9u + 2u * i]) << 8u;
@@ -430,6 +715,119 @@ inline int modbus::modbus_read_input_registers(uint16_t address, uint16_t amount
     }
 }
 
+/**
+ * Read Holding Registers, Pipelined
+ * MODBUS FUNCTION 0x03
+ * Keeps up to the pipeline depth requests in flight on the socket and routes
+ * every response to its request by the MBAP transaction ID, so the round trip
+ * time is paid once per batch instead of once per request.
+ * @param requests   Requests to Perform, status of each one is filled in
+ * @param count      Number of Requests
+ * @return           0 if all requests succeeded, otherwise the first failing status
+ */
+inline int modbus::modbus_read_holding_registers_pipelined(modbus_request *requests, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        requests[i].status = PENDING_REQ;
+    if (!_connected)
+    {
+        for (size_t i = 0; i < count; i++)
+            requests[i].status = BAD_CON;
+        set_bad_con();
+        return BAD_CON;
+    }
+
+    int result = 0;
+    std::string failed_msg;
+    const uint16_t base_tid = (uint16_t)_msg_id;
+    size_t sent = 0, done = 0;
+    uint8_t to_rec[MAX_MSG_LENGTH];
+    while (done < count)
+    {
+        while (sent < count && sent - done < _pipeline_depth)
+        {
+            if (requests[sent].amount == 0 || requests[sent].amount > 125)
+            {
+                requests[sent].status = EX_BAD_DATA;
+                if (result == 0)
+                {
+                    result = EX_BAD_DATA;
+                    failed_msg = "BAD FUNCTION INPUT";
+                }
+                _msg_id++; // the transaction ID stays reserved, so IDs keep matching request indexes
+                sent++;
+                done++;
+                continue;
+            }
+            if (modbus_read(requests[sent].address, requests[sent].amount, READ_REGS) <= 0)
+                break;
+            requests[sent].sent_at = std::chrono::steady_clock::now();
+            sent++;
+        }
+        if (done == count)
+            break;
+
+        ssize_t k = sent > done ? modbus_wait_frame(to_rec) : BAD_CON;
+        if (k < 0)
+            return modbus_fail_pending(requests, count, (int)k);
+
+        int idx = modbus_route_response(to_rec, k, requests, sent, base_tid);
+        if (idx < 0)
+            continue;
+        if (requests[idx].status != 0 && result == 0)
+        {
+            result = requests[idx].status;
+            failed_msg = error_msg;
+        }
+        done++;
+    }
+
+    err = result != 0;
+    error_msg = err ? failed_msg : "NO ERR";
+    err_no = result;
+    return result;
+}
+
+/**
+ * Response Router
+ * Matches a received read response to its request by the MBAP transaction ID
+ * and decodes the register values into the request buffer.
+ * @param frame      Complete ADU Received from the Server
+ * @param length     Size of the ADU
+ * @param requests   Requests of the Batch
+ * @param sent       Number of Requests Sent so Far
+ * @param base_tid   Transaction ID of requests[0]
+ * @return           Index of the Completed Request, -1 if the Response Is Stale or Unknown
+ */
+inline int modbus::modbus_route_response(const uint8_t *frame, ssize_t length, modbus_request *requests, size_t sent, uint16_t base_tid)
+{
+    uint16_t tid = (uint16_t)(frame[0] << 8u | frame[1]);
+    size_t idx = (uint16_t)(tid - base_tid);
+    if (idx >= sent || requests[idx].status != PENDING_REQ)
+    {
+        LOG("Discarding Response With Unexpected Transaction ID %u", tid);
+        return -1;
+    }
+
+    modbus_request &req = requests[idx];
+    req.rtt_us = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - req.sent_at).count();
+    modbuserror_handle(frame, READ_REGS);
+    if (err)
+        req.status = frame[8] != 0 ? frame[8] : EX_BAD_DATA;
+    else if (!modbus_check_response(frame, length, READ_REGS, 2u * req.amount))
+        req.status = EX_BAD_DATA;
+    else
+    {
+        for (auto i = 0; i < req.amount; i++)
+        {
+            req.buffer[i] = ((uint16_t)frame[9u + 2u * i]) << 8u;
+            req.buffer[i] += (uint16_t)frame[10u + 2u * i];
+        }
+        req.status = 0;
+    }
+    return (int)idx;
+}
+
 /**
  * Read Coils
  * MODBUS FUNCTION 0x01
@@ -457,6 +855,8 @@ inline int modbus::modbus_read_coils(uint16_t address, uint16_t amount, bool *bu
         modbuserror_handle(to_rec, READ_COILS);
         if (err)
             return err_no;
+        if (!modbus_check_response(to_rec, k, READ_COILS, (amount + 7u) / 8u))
+            return EX_BAD_DATA;
         for (auto i = 0; i < amount; i++)
         {
             buffer[i] = (bool)((to_rec[9u + i / 8u] >> (i % 8u)) & 1u);
@@ -494,13 +894,15 @@ inline int modbus::modbus_read_input_bits(uint16_t address, uint16_t amount, boo
             set_bad_con();
             return BAD_CON;
         }
+        modbuserror_handle(to_rec, READ_INPUT_BITS);
         if (err)
             return err_no;
+        if (!modbus_check_response(to_rec, k, READ_INPUT_BITS, (amount + 7u) / 8u))
+            return EX_BAD_DATA;
         for (auto i = 0; i < amount; i++)
         {
             buffer[i] = (bool)((to_rec[9u + i / 8u] >> (i % 8u)) & 1u);
         }
-        modbuserror_handle(to_rec, READ_INPUT_BITS);
         return 0;
     }
     else
@@ -509,6 +911,27 @@ inline int modbus::modbus_read_input_bits(uint16_t address, uint16_t amount, boo
     }
 }
 
+/**
+ * Write Response Receiver
+ * Waits for the echo of the last sent write request.
+ * @param func   Modbus Functional Code of the Request
+ * @return       0 on Success, BAD_CON or the Modbus Exception Code
+ */
+inline int modbus::modbus_write_response(int func)
+{
+    uint8_t to_rec[MAX_MSG_LENGTH];
+    ssize_t k = modbus_receive(to_rec);
+    if (k == -1)
+    {
+        set_bad_con();
+        return BAD_CON;
+    }
+    modbuserror_handle(to_rec, func);
+    if (err)
+        return err_no;
+    return 0;
+}
+
 /**
  * Write Single Coils
  * MODBUS FUNCTION 0x05
@@ -519,19 +942,11 @@ inline int modbus::modbus_write_coil(uint16_t address, const bool &to_write)
 {
     if (_connected)
     {
-        int value = to_write * 0xFF00;
-        modbus_write(address, 1, WRITE_COIL, (uint16_t *)&value);
-        uint8_t to_rec[MAX_MSG_LENGTH];
-        ssize_t k = modbus_receive(to_rec);
-        if (k == -1)
-        {
-            set_bad_con();
-            return BAD_CON;
-        }
-        modbuserror_handle(to_rec, WRITE_COIL);
-        if (err)
-            return err_no;
-        return 0;
+        uint16_t value = to_write ? 0xFF00 : 0x0000;
+        int status = modbus_write(address, 1, WRITE_COIL, &value);
+        if (status != 0)
+            return status;
+        return modbus_write_response(WRITE_COIL);
     }
     else
     {
@@ -550,18 +965,10 @@ inline int modbus::modbus_write_register(uint16_t address, const uint16_t &value
 {
     if (_connected)
     {
-        modbus_write(address, 1, WRITE_REG, &value);
-        uint8_t to_rec[MAX_MSG_LENGTH];
-        ssize_t k = modbus_receive(to_rec);
-        if (k == -1)
-        {
-            set_bad_con();
-            return BAD_CON;
-        }
-        modbuserror_handle(to_rec, WRITE_COIL);
-        if (err)
-            return err_no;
-        return 0;
+        int status = modbus_write(address, 1, WRITE_REG, &value);
+        if (status != 0)
+            return status;
+        return modbus_write_response(WRITE_REG);
     }
     else
     {
@@ -573,6 +980,7 @@ inline int modbus::modbus_write_register(uint16_t address, const uint16_t &value
 /**
  * Write Multiple Coils
  * MODBUS FUNCTION 0x0F
+ * The coils are packed straight into the request, without a temporary copy.
  * @param address  Reference Address
  * @param amount   Amount of Coils to Write
  * @param value    Values to Be Written to Coils
@@ -581,24 +989,29 @@ inline int modbus::modbus_write_coils(uint16_t address, uint16_t amount, const b
 {
     if (_connected)
     {
-        uint16_t *temp = new uint16_t[amount];
+        if (amount == 0 || amount > MAX_WRITE_COILS)
+        {
+            set_bad_input();
+            return EX_BAD_DATA;
+        }
+        uint8_t to_send[MAX_MSG_LENGTH];
+        size_t bytes = (amount + 7u) / 8u;
+        modbus_build_request(to_send, address, WRITE_COILS);
+        to_send[5] = (uint8_t)(7 + bytes);
+        to_send[10] = (uint8_t)(amount >> 8u);
+        to_send[11] = (uint8_t)(amount & 0x00FFu);
+        to_send[12] = (uint8_t)bytes;
+        std::memset(to_send + 13, 0, bytes);
         for (int i = 0; i < amount; i++)
         {
-            temp[i] = (uint16_t)value[i];
+            to_send[13 + i / 8] |= (uint8_t)((value[i] ? 1u : 0u) << (i % 8u));
         }
-        modbus_write(address, amount, WRITE_COILS, temp);
-        delete[] temp;
-        uint8_t to_rec[MAX_MSG_LENGTH];
-        ssize_t k = modbus_receive(to_rec);
-        if (k == -1)
+        if (modbus_send(to_send, 13 + bytes) != (ssize_t)(13 + bytes))
         {
             set_bad_con();
             return BAD_CON;
         }
-        modbuserror_handle(to_rec, WRITE_COILS);
-        if (err)
-            return err_no;
-        return 0;
+        return modbus_write_response(WRITE_COILS);
     }
     else
     {
@@ -618,18 +1031,10 @@ inline int modbus::modbus_write_registers(uint16_t address, uint16_t amount, con
 {
     if (_connected)
     {
-        modbus_write(address, amount, WRITE_REGS, value);
-        uint8_t to_rec[MAX_MSG_LENGTH];
-        ssize_t k = modbus_receive(to_rec);
-        if (k == -1)
-        {
-            set_bad_con();
-            return BAD_CON;
-        }
-        modbuserror_handle(to_rec, WRITE_REGS);
-        if (err)
-            return err_no;
-        return 0;
+        int status = modbus_write(address, amount, WRITE_REGS, value);
+        if (status != 0)
+            return status;
+        return modbus_write_response(WRITE_REGS);
     }
     else
     {
@@ -638,6 +1043,128 @@ inline int modbus::modbus_write_registers(uint16_t address, uint16_t amount, con
     }
 }
 
+/**
+ * Write Registers, Batched
+ * MODBUS FUNCTION 0x06 / 0x10
+ * Every request becomes a FC06 (one register) or FC16 request. Up to the
+ * pipeline depth requests are encoded into the connection TX buffer and sent
+ * with a single send, then the responses are routed by the transaction ID.
+ * With the default depth of 1 the requests go out one after another.
+ * @param requests   Requests to Perform, buffer holds the values, status of each one is filled in
+ * @param count      Number of Requests
+ * @return           0 if all requests succeeded, otherwise the first failing status
+ */
+inline int modbus::modbus_write_registers_batched(modbus_request *requests, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        requests[i].status = PENDING_REQ;
+    if (!_connected)
+    {
+        for (size_t i = 0; i < count; i++)
+            requests[i].status = BAD_CON;
+        set_bad_con();
+        return BAD_CON;
+    }
+
+    int result = 0;
+    std::string failed_msg;
+    const uint16_t base_tid = (uint16_t)_msg_id;
+    size_t sent = 0, done = 0;
+    uint8_t to_rec[MAX_MSG_LENGTH];
+    _tx_len = _tx_sent = 0;
+    while (done < count)
+    {
+        size_t first = sent;
+        while (sent < count && sent - done < _pipeline_depth)
+        {
+            if (requests[sent].amount == 0 || requests[sent].amount > MAX_WRITE_REGS)
+            {
+                requests[sent].status = EX_BAD_DATA;
+                if (result == 0)
+                {
+                    result = EX_BAD_DATA;
+                    failed_msg = "BAD FUNCTION INPUT";
+                }
+                _msg_id++; // the transaction ID stays reserved, so IDs keep matching request indexes
+                sent++;
+                done++;
+                continue;
+            }
+            if (!modbus_queue_write(requests[sent].address, requests[sent].amount, requests[sent].buffer))
+                break; // TX buffer is full, the rest goes out with the next send
+            sent++;
+        }
+        if (_tx_len > 0)
+        {
+            if (modbus_flush() != 1)
+            {
+                _tx_len = _tx_sent = 0;
+                return modbus_fail_pending(requests, count, BAD_CON);
+            }
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for (size_t i = first; i < sent; i++)
+                requests[i].sent_at = now;
+        }
+        if (done == count)
+            break;
+
+        ssize_t k = modbus_wait_frame(to_rec);
+        if (k < 0)
+            return modbus_fail_pending(requests, count, (int)k);
+        int idx = modbus_route_write_response(to_rec, k, requests, sent, base_tid);
+        if (idx < 0)
+            continue;
+        if (requests[idx].status != 0 && result == 0)
+        {
+            result = requests[idx].status;
+            failed_msg = error_msg;
+        }
+        done++;
+    }
+
+    err = result != 0;
+    error_msg = err ? failed_msg : "NO ERR";
+    err_no = result;
+    return result;
+}
+
+/**
+ * Write Response Router
+ * Matches a received write response to its request by the MBAP transaction ID
+ * and checks that the server echoed the function code and the address.
+ * @param frame      Complete ADU Received from the Server
+ * @param length     Size of the ADU
+ * @param requests   Requests of the Batch
+ * @param sent       Number of Requests Sent so Far
+ * @param base_tid   Transaction ID of requests[0]
+ * @return           Index of the Completed Request, -1 if the Response Is Stale or Unknown
+ */
+inline int modbus::modbus_route_write_response(const uint8_t *frame, ssize_t length, modbus_request *requests, size_t sent, uint16_t base_tid)
+{
+    uint16_t tid = (uint16_t)(frame[0] << 8u | frame[1]);
+    size_t idx = (uint16_t)(tid - base_tid);
+    if (idx >= sent || requests[idx].status != PENDING_REQ)
+    {
+        LOG("Discarding Response With Unexpected Transaction ID %u", tid);
+        return -1;
+    }
+
+    modbus_request &req = requests[idx];
+    int func = req.amount == 1 ? WRITE_REG : WRITE_REGS;
+    req.rtt_us = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - req.sent_at).count();
+    modbuserror_handle(frame, func);
+    if (err)
+        req.status = frame[8] != 0 ? frame[8] : EX_BAD_DATA;
+    else if (length < 12 || frame[7] != func || (uint16_t)(frame[8] << 8u | frame[9]) != req.address)
+    {
+        set_bad_data();
+        req.status = EX_BAD_DATA;
+    }
+    else
+        req.status = 0;
+    return (int)idx;
+}
+
 /**
  * Data Sender
  * @param to_send Request to Be Sent to Server
@@ -646,18 +1173,228 @@ inline int modbus::modbus_write_registers(uint16_t address, uint16_t amount, con
  */
 inline ssize_t modbus::modbus_send(uint8_t *to_send, size_t length)
 {
+    _last_tid = (uint16_t)_msg_id;
     _msg_id++;
-    return send(_socket, (const char *)to_send, (size_t)length, 0);
+    return send(_socket, (const char *)to_send, (size_t)length, X_SEND_FLAGS);
 }
 
 /**
  * Data Receiver
+ * Receives the response to the last sent request. Responses carrying another
+ * transaction ID (late answers to timed out requests) are discarded.
  * @param buffer Buffer to Store the Data Retrieved
  * @return       Size of Incoming Data
  */
-inline ssize_t modbus::modbus_receive(uint8_t *buffer) const
+inline ssize_t modbus::modbus_receive(uint8_t *buffer)
 {
-    return recv(_socket, (char *)buffer, MAX_MSG_LENGTH, 0);
+    while (true)
+    {
+        ssize_t k = modbus_receive_frame(buffer);
+        if (k == -1)
+            return -1;
+        if ((uint16_t)(buffer[0] << 8u | buffer[1]) == _last_tid)
+            return k;
+        LOG("Discarding Response With Unexpected Transaction ID");
+    }
+}
+
+/**
+ * Queue a Read Request Without Sending It
+ * The request is appended to the connection TX buffer, call modbus_flush to send it.
+ * @param address   Reference Address
+ * @param amount    Amount of Data to Read
+ * @param func      Modbus Functional Code
+ * @return          If the Request Fit into the TX Buffer
+ */
+inline bool modbus::modbus_queue_read(uint16_t address, uint16_t amount, int func)
+{
+    if (_tx_len + 12 > TX_BUFFER_LENGTH)
+        return false;
+    uint8_t *to_send = _tx_buf + _tx_len;
+    modbus_build_request(to_send, address, func);
+    to_send[5] = 6;
+    to_send[10] = (uint8_t)(amount >> 8u);
+    to_send[11] = (uint8_t)(amount & 0x00FFu);
+    _tx_len += 12;
+    _last_tid = (uint16_t)_msg_id;
+    _msg_id++;
+    return true;
+}
+
+/**
+ * Queue a Register Write Without Sending It
+ * One register is written with FC06, more with FC16. The request is encoded
+ * straight into the connection TX buffer, call modbus_flush to send it.
+ * @param address   Reference Address
+ * @param amount    Amount of Registers to Write, 1 to MAX_WRITE_REGS
+ * @param value     Values to Be Written
+ * @return          If the Request Is Valid and Fit into the TX Buffer
+ */
+inline bool modbus::modbus_queue_write(uint16_t address, uint16_t amount, const uint16_t *value)
+{
+    size_t length = amount == 1 ? 12u : 13u + 2u * amount;
+    if (amount == 0 || amount > MAX_WRITE_REGS || _tx_len + length > TX_BUFFER_LENGTH)
+        return false;
+    modbus_build_write(_tx_buf + _tx_len, address, amount, amount == 1 ? WRITE_REG : WRITE_REGS, value);
+    _tx_len += length;
+    _last_tid = (uint16_t)_msg_id;
+    _msg_id++;
+    return true;
+}
+
+/**
+ * Send the Queued Requests on a Non-Blocking Socket
+ * @return  1 if Everything Was Sent, 0 if the Socket Would Block, -1 on Error
+ */
+inline int modbus::modbus_flush()
+{
+    while (_tx_sent < _tx_len)
+    {
+        ssize_t k = send(_socket, (const char *)_tx_buf + _tx_sent, _tx_len - _tx_sent, X_SEND_FLAGS);
+        if (k < 0)
+            return X_WOULDBLOCK() ? 0 : -1;
+        _tx_sent += (size_t)k;
+    }
+    _tx_len = _tx_sent = 0;
+    return 1;
+}
+
+/**
+ * Read Available Data into the RX Ring Buffer
+ * Everything the socket has is read with one syscall (both free segments of the
+ * ring), so several back-to-back responses cost a single read.
+ * On a non-blocking socket 0 means no data is available yet.
+ * @return  Number of Bytes Read, 0 if Nothing Is Available, -1 on Error or Closed Connection
+ */
+inline ssize_t modbus::modbus_fill()
+{
+    if (_rx_len == 0)
+        _rx_head = 0; // keeps the free space contiguous while the buffer is empty
+    if (_rx_len == RX_BUFFER_LENGTH)
+        return 0;
+    size_t tail = (_rx_head + _rx_len) & (RX_BUFFER_LENGTH - 1);
+    size_t first = tail >= _rx_head ? RX_BUFFER_LENGTH - tail : _rx_head - tail;
+    size_t second = tail >= _rx_head ? _rx_head : 0;
+#ifdef _WIN32
+    (void)second;
+    ssize_t k = recv(_socket, (char *)_rx_buf + tail, (int)first, 0);
+#else
+    struct iovec parts[2] = {{_rx_buf + tail, first}, {_rx_buf, second}};
+    ssize_t k = readv(_socket, parts, second > 0 ? 2 : 1);
+#endif
+    if (k == 0)
+        return -1;
+    if (k < 0)
+        return X_WOULDBLOCK() ? 0 : -1;
+    _rx_len += (size_t)k;
+    return k;
+}
+
+/**
+ * Take the Next Complete ADU from the RX Ring Buffer
+ * The MBAP length field tells where the frame ends, so short reads and
+ * several frames per read are both handled. A malformed header means the
+ * stream lost synchronisation, the buffered data is dropped.
+ * @param frame  Buffer to Store the Frame, at least MAX_MSG_LENGTH Bytes
+ * @return       Size of the Frame, 0 if No Complete Frame Is Buffered, -1 on Malformed Header
+ */
+inline ssize_t modbus::modbus_pop_frame(uint8_t *frame)
+{
+    if (_rx_len < 7)
+        return 0;
+    size_t length = (size_t)(modbus_rx_at(4) << 8u | modbus_rx_at(5));
+    if (modbus_rx_at(2) != 0 || modbus_rx_at(3) != 0 || length < 2 || length + 6 > MAX_MSG_LENGTH)
+    {
+        LOG("Malformed MBAP Header");
+        _rx_head = _rx_len = 0;
+        return -1;
+    }
+    size_t size = length + 6;
+    if (_rx_len < size)
+        return 0;
+    size_t first = RX_BUFFER_LENGTH - _rx_head < size ? RX_BUFFER_LENGTH - _rx_head : size;
+    std::memcpy(frame, _rx_buf + _rx_head, first);
+    std::memcpy(frame + first, _rx_buf, size - first);
+    _rx_head = (_rx_head + size) & (RX_BUFFER_LENGTH - 1);
+    _rx_len -= size;
+    return (ssize_t)size;
+}
+
+/**
+ * Frame Receiver
+ * Returns the next complete ADU, reading from the socket only when the RX
+ * buffer does not already hold one.
+ * @param buffer Buffer to Store the Frame, at least MAX_MSG_LENGTH Bytes
+ * @return       Size of the Frame, -1 on Connection Error, Timeout or Malformed Header
+ */
+inline ssize_t modbus::modbus_receive_frame(uint8_t *buffer)
+{
+    while (true)
+    {
+        ssize_t k = modbus_pop_frame(buffer);
+        if (k != 0)
+            return k;
+        if (modbus_fill() <= 0)
+            return -1;
+    }
+}
+
+/**
+ * Wait for the Next Frame of a Pipelined Batch
+ * modbus_fill returns 0 on a blocking socket only when the receive timeout
+ * expires, which is reported separately from a broken connection.
+ * @param frame  Buffer to Store the Frame, at least MAX_MSG_LENGTH Bytes
+ * @return       Size of the Frame, TIMEOUT_REQ or BAD_CON
+ */
+inline ssize_t modbus::modbus_wait_frame(uint8_t *frame)
+{
+    while (true)
+    {
+        ssize_t k = modbus_pop_frame(frame);
+        if (k > 0)
+            return k;
+        if (k < 0)
+            return BAD_CON;
+        ssize_t r = modbus_fill();
+        if (r <= 0)
+            return r == 0 ? TIMEOUT_REQ : BAD_CON;
+    }
+}
+
+/**
+ * Fail the Outstanding Requests of a Pipelined Batch
+ * @param requests   Requests of the Batch
+ * @param count      Number of Requests
+ * @param status     TIMEOUT_REQ or BAD_CON
+ * @return           status
+ */
+inline int modbus::modbus_fail_pending(modbus_request *requests, size_t count, int status)
+{
+    for (size_t i = 0; i < count; i++)
+        if (requests[i].status == PENDING_REQ)
+            requests[i].status = status;
+    set_bad_con();
+    if (status == TIMEOUT_REQ)
+        error_msg = "TIMEOUT";
+    err_no = status;
+    return status;
+}
+
+/**
+ * Response Validator
+ * Checks the function code, the byte count and that the frame really holds the data.
+ * @param msg         Message Received from the Server
+ * @param length      Size of the Message
+ * @param func        Modbus Functional Code of the Request
+ * @param data_bytes  Expected Number of Data Bytes
+ * @return            If the Response Is Well Formed
+ */
+inline bool modbus::modbus_check_response(const uint8_t *msg, ssize_t length, int func, size_t data_bytes)
+{
+    if (length >= 9 && msg[7] == func && msg[8] == data_bytes && (size_t)length >= 9u + data_bytes)
+        return true;
+    set_bad_data();
+    return false;
 }
 
 inline void modbus::set_bad_con()
@@ -672,6 +1409,13 @@ inline void modbus::set_bad_input()
     error_msg = "BAD FUNCTION INPUT";
 }
 
+inline void modbus::set_bad_data()
+{
+    err = true;
+    err_no = EX_BAD_DATA;
+    error_msg = "BAD RESPONSE LENGTH";
+}
+
 /**
  * Error Code Handler
  * @param msg   Message Received from the Server
@@ -680,10 +1424,12 @@ inline void modbus::set_bad_input()
 inline void modbus::modbuserror_handle(const uint8_t *msg, int func)
 {
     err = false;
+    err_no = 0;
     error_msg = "NO ERR";
     if (msg[7] == func + 0x80)
     {
         err = true;
+        err_no = msg[8];
         switch (msg[8])
         {
         case EX_ILLEGAL_FUNCTION:
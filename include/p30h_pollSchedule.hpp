@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "p30h_readPlan.hpp"
+
+namespace reg
+{
+    /**
+    * Максимален брой непотребни регистри, които се прочитат, за да се обединят две заявки в една.
+    * 8 регистъра (16 байта) струват по-малко от отделна заявка (MBAP заглавие, отговор и време за отговор).
+    */
+    constexpr uint16_t DEFAULT_MERGE_GAP = 8;
+
+    /**
+    * Клас, който разпределя четенето на величините по интервали според техния 'period_ms'.
+    * Величините с еднакъв период образуват група. За всяка комбинация от групи, които трябва да се прочетат заедно,
+    * планът се съставя предварително, затова 'plan_for_tick' не заделя памет и може да се извиква от няколко нишки.
+    * Величина, която не трябва да се чете, но чиито регистри така или иначе са в прочетените блокове, също се декодира.
+    */
+    class PollSchedule
+    {
+    public:
+        PollSchedule(const ReadPlanView& plan, float interval, uint16_t max_gap = DEFAULT_MERGE_GAP);
+        ~PollSchedule();
+        PollSchedule(const PollSchedule&) = delete;
+        PollSchedule& operator=(const PollSchedule&) = delete;
+
+        const ReadPlanView& plan_for_tick(uint64_t tick) const;
+        size_t group_count() const;
+        uint32_t group_every(size_t group) const;
+
+    private:
+        /**
+        * План за една комбинация от групи. Масивите са заделени с new[].
+        */
+        struct TickPlan
+        {
+            ReadBlock* blocks = nullptr;
+            DecodeSlot* slots = nullptr;
+            uint16_t* order = nullptr;
+            ReadPlanView view{};
+        };
+
+        ReadPlanView _plan;
+        std::vector<uint32_t> _every;
+        std::vector<uint8_t> _group;
+        std::vector<TickPlan> _plans;
+
+        void build(TickPlan& tick_plan, uint32_t mask, uint16_t max_gap);
+    };
+};
@@ -0,0 +1,321 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "p30h_regTypeDef.hpp"
+
+namespace reg
+{
+    /**
+    * Максимален брой регистри, които могат да се прочетат с една заявка FC03 (ограничение от Modbus спецификацията).
+    */
+    constexpr uint16_t MAX_READ_BLOCK = 125;
+
+    /**
+    * Структура, която описва една заявка за четене на последователни регистри.
+    * @param start Адрес на първия регистър в блока.
+    * @param count Брой на регистрите в блока.
+    * @param offset Позиция на първия регистър от блока в общия буфер с прочетените регистри.
+    */
+    typedef struct
+    {
+        uint16_t start;
+        uint16_t count;
+        uint16_t offset;
+    } ReadBlock;
+
+    /**
+    * Структура, която указва откъде в общия буфер се взимат думите на една величина.
+    * @param hi Позиция на старшата дума (редът от 'lo_first' вече е отчетен).
+    * @param lo Позиция на младшата дума. За REG_INT16 съвпада с 'hi'.
+    * @param hi_block Индекс на блока, в който се намира старшата дума.
+    * @param lo_block Индекс на блока, в който се намира младшата дума.
+    */
+    typedef struct
+    {
+        uint16_t hi;
+        uint16_t lo;
+        uint16_t hi_block;
+        uint16_t lo_block;
+    } DecodeSlot;
+
+    /**
+    * Структура, която дава достъп до готов план за четене, независимо дали е съставен по време на компилация или по време на изпълнение.
+    * @param map Масивът с регистрите, за който е съставен планът.
+    * @param reg_count Броя на елементите в map.
+    * @param blocks Блоковете (заявките FC03), подредени по адрес.
+    * @param block_count Броя на блоковете.
+    * @param slots Откъде да се декодира всяка величина (в реда на map).
+    * @param order Индексите на величините в map, които се декодират - първо всички REG_FLOAT32, след тях всички REG_INT16.
+    * @param order_count Броя на елементите в order. За пълен план е равен на reg_count, за план на 'PollSchedule' може да е по-малък
+    *                    (стойностите на останалите величини не се променят).
+    * @param float_count Броя на величините от тип REG_FLOAT32 в началото на order.
+    * @param word_count Общият брой регистри във всички блокове (размерът на буфера).
+    * @param csv_header Заглавният ред на .csv файла (без знак за нов ред).
+    */
+    typedef struct
+    {
+        const RegisterRead* map;
+        size_t reg_count;
+        const ReadBlock* blocks;
+        size_t block_count;
+        const DecodeSlot* slots;
+        const uint16_t* order;
+        size_t order_count;
+        size_t float_count;
+        size_t word_count;
+        std::string_view csv_header;
+    } ReadPlanView;
+
+    /**
+    * Функция, която връща максималния брой блокове, който може да се получи за reg_count величини.
+    * @param reg_count Броят на величините.
+    */
+    constexpr size_t plan_max_blocks(size_t reg_count)
+    {
+        return 2 * reg_count;
+    }
+
+    /**
+    * Функция, която връща адреса на старшата и младшата дума на една величина.
+    * @param r Величината.
+    * @param hi_addr Променлива, в която се записва адресът на старшата дума.
+    * @param lo_addr Променлива, в която се записва адресът на младшата дума.
+    * @throws std::runtime_error При непознат тип на регистъра (при план по време на компилация - грешка при компилация).
+    */
+    constexpr void word_addresses(const RegisterRead& r, uint16_t& hi_addr, uint16_t& lo_addr)
+    {
+        if (r.type == REG_INT16)
+        {
+            hi_addr = lo_addr = r.address;
+        }
+        else if (r.type == REG_FLOAT32)
+        {
+            uint16_t first = r.address;
+            uint16_t second = r.addr2 < 0 ? static_cast<uint16_t>(r.address + 1) : static_cast<uint16_t>(r.addr2);
+            hi_addr = r.lo_first ? second : first;
+            lo_addr = r.lo_first ? first : second;
+        }
+        else
+        {
+            throw std::runtime_error("Непознат тип за " + std::string(r.name));
+        }
+    }
+
+    /**
+    * Функция, която търси блока, съдържащ даден адрес (блоковете са подредени по адрес).
+    * @return Индексът на блока или -1, ако адресът не попада в нито един блок.
+    */
+    constexpr int32_t search_block(const ReadBlock* blocks, size_t block_count, uint16_t address)
+    {
+        size_t lo = 0, hi = block_count;
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (address < blocks[mid].start) hi = mid;
+            else if (address >= blocks[mid].start + blocks[mid].count) lo = mid + 1;
+            else return static_cast<int32_t>(mid);
+        }
+        return -1;
+    }
+
+    /**
+    * Функция, която намира блока, съдържащ даден адрес (блоковете са подредени по адрес).
+    * @throws std::logic_error Ако адресът не попада в нито един блок.
+    */
+    constexpr uint16_t find_block(const ReadBlock* blocks, size_t block_count, uint16_t address)
+    {
+        int32_t block = search_block(blocks, block_count, address);
+        if (block < 0) throw std::logic_error("Адресът не попада в нито един блок.");
+        return static_cast<uint16_t>(block);
+    }
+
+    /**
+    * Функция, която групира регистрите от reg_map в най-малкия брой заявки FC03 (до MAX_READ_BLOCK регистъра всяка).
+    * Регистрите между две величини се прочитат заедно с тях, ако целият блок се побира в една заявка и празнината е до max_gap регистъра.
+    * Може да се използва както по време на компилация, така и по време на изпълнение.
+    * @param reg_map Масив с регистрите, които трябва да се прочетат.
+    * @param reg_count Броя на елементите в масива reg_map.
+    * @param blocks Масив, в който се записват блоковете. Трябва да има място за поне 'plan_max_blocks(reg_count)' елемента.
+    * @param slots Масив с 'reg_count' елемента, в който се записва откъде да се декодира всяка величина.
+    * @param word_count Променлива, в която се записва общият брой регистри във всички блокове (размерът на буфера).
+    * @param include Масив с 'reg_count' елемента, който указва кои величини да се прочетат (nullptr - всички).
+    *                Слотовете на пропуснатите величини не се променят.
+    * @param max_gap Максимален брой непотребни регистри, които се прочитат, за да се обединят две заявки в една.
+    * @return Броят на блоковете.
+    */
+    constexpr size_t plan_reads(const RegisterRead* reg_map, size_t reg_count, ReadBlock* blocks, DecodeSlot* slots, size_t& word_count,
+                                const bool* include = nullptr, uint16_t max_gap = MAX_READ_BLOCK)
+    {
+        size_t block_count = 0;
+        word_count = 0;
+        int32_t prev = -1;
+        while (true)
+        {
+            // Адресите се обхождат във възходящ ред без сортиране на временен масив, за да работи и по време на компилация
+            int32_t next = -1;
+            for (size_t i = 0; i < reg_count; ++i)
+            {
+                if (include && !include[i]) continue;
+                uint16_t hi_addr = 0, lo_addr = 0;
+                word_addresses(reg_map[i], hi_addr, lo_addr);
+                if (hi_addr > prev && (next < 0 || hi_addr < next)) next = hi_addr;
+                if (lo_addr > prev && (next < 0 || lo_addr < next)) next = lo_addr;
+            }
+            if (next < 0) break;
+            prev = next;
+
+            if (block_count > 0 && next - blocks[block_count - 1].start < MAX_READ_BLOCK &&
+                next - (blocks[block_count - 1].start + blocks[block_count - 1].count) <= max_gap)
+            {
+                ReadBlock& last = blocks[block_count - 1];
+                word_count += next - (last.start + last.count) + 1;
+                last.count = static_cast<uint16_t>(next - last.start + 1);
+                continue;
+            }
+            blocks[block_count].start = static_cast<uint16_t>(next);
+            blocks[block_count].count = 1;
+            blocks[block_count].offset = static_cast<uint16_t>(word_count);
+            ++block_count;
+            ++word_count;
+        }
+
+        for (size_t i = 0; i < reg_count; ++i)
+        {
+            if (include && !include[i]) continue;
+            uint16_t hi_addr = 0, lo_addr = 0;
+            word_addresses(reg_map[i], hi_addr, lo_addr);
+            slots[i].hi_block = find_block(blocks, block_count, hi_addr);
+            slots[i].lo_block = find_block(blocks, block_count, lo_addr);
+            slots[i].hi = static_cast<uint16_t>(blocks[slots[i].hi_block].offset + (hi_addr - blocks[slots[i].hi_block].start));
+            slots[i].lo = static_cast<uint16_t>(blocks[slots[i].lo_block].offset + (lo_addr - blocks[slots[i].lo_block].start));
+        }
+        return block_count;
+    }
+
+    /**
+    * Функция, която подрежда индексите на величините по тип, за да може декодирането да става без проверка на типа за всяка стойност.
+    * @param reg_map Масив с регистрите.
+    * @param reg_count Броя на елементите в масива reg_map.
+    * @param order Масив с 'reg_count' елемента, в който се записват индексите - първо REG_FLOAT32, след тях REG_INT16.
+    * @return Броят на величините от тип REG_FLOAT32.
+    */
+    constexpr size_t plan_order(const RegisterRead* reg_map, size_t reg_count, uint16_t* order)
+    {
+        size_t float_count = 0;
+        for (size_t i = 0; i < reg_count; ++i)
+            if (reg_map[i].type == REG_FLOAT32) order[float_count++] = static_cast<uint16_t>(i);
+        size_t pos = float_count;
+        for (size_t i = 0; i < reg_count; ++i)
+            if (reg_map[i].type != REG_FLOAT32) order[pos++] = static_cast<uint16_t>(i);
+        return float_count;
+    }
+
+    /**
+    * Функция, която връща дължината на заглавния ред на .csv файла: "timestamp,<symbol> (<unit>),...".
+    */
+    constexpr size_t csv_header_length(const RegisterRead* reg_map, size_t reg_count)
+    {
+        size_t length = std::string_view("timestamp").size();
+        for (size_t i = 0; i < reg_count; ++i)
+            length += reg_map[i].symbol.size() + reg_map[i].unit.size() + 4; // ',' + ' (' + ')'
+        return length;
+    }
+
+    /**
+    * Функция, която записва заглавния ред на .csv файла в 'out' (поне 'csv_header_length' знака).
+    */
+    constexpr void build_csv_header(const RegisterRead* reg_map, size_t reg_count, char* out)
+    {
+        size_t pos = 0;
+        auto append = [&](std::string_view text)
+        {
+            for (char c : text) out[pos++] = c;
+        };
+        append("timestamp");
+        for (size_t i = 0; i < reg_count; ++i)
+        {
+            append(",");
+            append(reg_map[i].symbol);
+            append(" (");
+            append(reg_map[i].unit);
+            append(")");
+        }
+    }
+
+    /**
+    * План за четене, изцяло изчислен по време на компилация. Размерите са параметри на шаблона.
+    * @tparam N Броят на величините.
+    * @tparam B Броят на блоковете.
+    * @tparam H Дължината на заглавния ред на .csv файла.
+    */
+    template <size_t N, size_t B, size_t H>
+    struct ReadPlan
+    {
+        const RegisterRead* map;
+        ReadBlock blocks[B];
+        DecodeSlot slots[N];
+        uint16_t order[N];
+        size_t float_count;
+        size_t word_count;
+        char csv_header[H + 1];
+
+        constexpr ReadPlanView view() const
+        {
+            return { map, N, blocks, B, slots, order, N, float_count, word_count, std::string_view(csv_header, H) };
+        }
+    };
+
+    /**
+    * Функция, която връща броя на блоковете за даден масив с регистри. Служи за параметъра B на 'ReadPlan'.
+    */
+    template <size_t N>
+    constexpr size_t count_blocks(const RegisterRead (&reg_map)[N])
+    {
+        ReadBlock blocks[plan_max_blocks(N)]{};
+        DecodeSlot slots[N]{};
+        size_t word_count = 0;
+        return plan_reads(reg_map, N, blocks, slots, word_count);
+    }
+
+    /**
+    * Функция, която съставя плана за четене по време на компилация.
+    * Пример: constexpr auto plan = make_read_plan<count_blocks(map), csv_header_length(map, N)>(map);
+    */
+    template <size_t B, size_t H, size_t N>
+    constexpr ReadPlan<N, B, H> make_read_plan(const RegisterRead (&reg_map)[N])
+    {
+        ReadPlan<N, B, H> plan{};
+        ReadBlock blocks[plan_max_blocks(N)]{};
+        size_t word_count = 0;
+        size_t block_count = plan_reads(reg_map, N, blocks, plan.slots, word_count);
+        if (block_count != B) throw std::logic_error("Неправилен брой блокове.");
+        for (size_t b = 0; b < B; ++b) plan.blocks[b] = blocks[b];
+        plan.map = reg_map;
+        plan.word_count = word_count;
+        plan.float_count = plan_order(reg_map, N, plan.order);
+        build_csv_header(reg_map, N, plan.csv_header);
+        return plan;
+    }
+
+    /**
+    * Сглобява 32-битово число с плаваща запетая от две 16-битови думи.
+    * @param hi Старшата дума.
+    * @param lo Младшата дума.
+    * @return Стойността на 32-битовото число с плаваща запетая.
+    */
+    inline float words_to_float32(uint16_t hi, uint16_t lo)
+    {
+        uint32_t as_int = (uint32_t)hi << 16 | (uint32_t)lo;
+        float value;
+        // Проверка по време на компилация: уверяваме се, че float е 32 бита (съвпада с размера на as_int)
+        static_assert(sizeof(value) == sizeof(as_int), "float не е 32 битa!");
+        // Използва се memcpy, за да се избегне проблеми със strict aliasing
+        std::memcpy(&value, &as_int, sizeof(value));
+        return value;
+    }
+};
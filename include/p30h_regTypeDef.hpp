@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <string_view>
 
 namespace reg
 {
@@ -19,24 +20,26 @@ namespace reg
     } RegType;
 
     /**
-    * Структура с параметри за четене от регистър/регистри.
-    * @param name Променлива от тип string, която указва името на величината.
-    * @param symbol Променлива от тип string, която указва обозначението на величината.
-    * @param unit Променлива от тип string, която указва мерната единица.
+    * Структура с параметри за четене от регистър/регистри. Може да се използва в constexpr масиви.
+    * @param name Променлива от тип string_view, която указва името на величината.
+    * @param symbol Променлива от тип string_view, която указва обозначението на величината.
+    * @param unit Променлива от тип string_view, която указва мерната единица.
     * @param type Променлива от тип RegType (структура за изброяване на раличните видове регистри).
     * @param address Адрес на първия регистър от тип unsigned short.
     * @param addr2 Адрес на втория регистър от тип short.
     * @param lo_first Променлива от тип bool, която указва как да се запишат байтовете в регистрите.
+    * @param period_ms Период на четене в милисекунди (закръглява се до цял брой интервали на четене). При 0 се чете при всеки интервал.
     */
     typedef struct
     {
-        std::string name;
-        std::string symbol;
-        std::string unit;
+        std::string_view name;
+        std::string_view symbol;
+        std::string_view unit;
         RegType type;
         uint16_t address;
         int16_t addr2 = -1;
         bool lo_first = false;
+        uint32_t period_ms = 0;
     } RegisterRead;
 
     /**
@@ -68,13 +71,13 @@ namespace reg
 
     /**
     * Структура с параметри за получаване на резултат при четете от регистър/регистри.
-    * @param name Променлива от тип string.
+    * @param name Променлива от тип string_view, която сочи към името в масива с регистри (не се копира).
     * @param value Променлива, която указва стойността в регистъра/регистрите.
     * @param valid Променлива от тип bool, която указва на всеки получен резултат дали е успешен.
     */
     typedef struct
     {
-        std::string name;
+        std::string_view name;
         union
         {
             uint16_t val_int16;
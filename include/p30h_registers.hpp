@@ -1,13 +1,16 @@
 #pragma once
 
 #include "p30h_regTypeDef.hpp"
+#include "p30h_readPlan.hpp"
 
 namespace reg
 {
     /**
     * Едмомерен масив от елементи от тип RegisterRead.
+    * Масивът е constexpr, за да може планът за четене да се изчисли по време на компилация.
+    * Бавно променящите се величини (средни стойности, енергии, минимуми и максимуми) имат по-дълъг период на четене (вижте 'PollSchedule').
     */
-    RegisterRead reg_map[]
+    inline constexpr RegisterRead reg_map[]
     {
         // Стандартни параметри
         {"Напрежение", "U", "V", REG_FLOAT32, 6000, 7000, true},
@@ -16,41 +19,51 @@ namespace reg
         {"Измерената промяна на напрежение за интервал от време (по подразбиране: 5 секунди)", "dU", "V", REG_FLOAT32, 6006, 7006, true},
         {"Измерената Промяна на ток за интервал от време (по подразбиране: 5 секунди)", "dI", "A", REG_FLOAT32, 6008, 7008, true},
         {"Капацитет", "C", "Ah", REG_FLOAT32, 6014, 7014, true},
-        {"Средна измерена мощност", "P_avg", "W", REG_FLOAT32, 6016, 7016, true},
-        {"Средно измерено напрежение", "U_avg", "V", REG_FLOAT32, 6018, 7018, true},
-        {"Среден измерен ток", "I_avg", "A", REG_FLOAT32, 6020, 7020, true},
-        {"Температура", "T", "Degrees Celsius", REG_FLOAT32, 6028, 7028, true},
+        {"Средна измерена мощност", "P_avg", "W", REG_FLOAT32, 6016, 7016, true, 5000},
+        {"Средно измерено напрежение", "U_avg", "V", REG_FLOAT32, 6018, 7018, true, 5000},
+        {"Среден измерен ток", "I_avg", "A", REG_FLOAT32, 6020, 7020, true, 5000},
+        {"Температура", "T", "Degrees Celsius", REG_FLOAT32, 6028, 7028, true, 5000},
         // Енергийни стойности
-        {"Внесена енергия", "E_in", "Wh", REG_FLOAT32, 6030, 7030, true},
-        {"Изнесена енергия", "E_out", "Wh", REG_FLOAT32, 6032, 7032, true},
-        {"Обща енергия", "E_total", "Wh", REG_FLOAT32, 6034, 7034, true},
-        {"Разлика в енергията", "E_diff", "Wh", REG_FLOAT32, 6038, 7038, true},
-        {"Брояч на капацитет", "C_counter", "Ah", REG_FLOAT32, 6036, 7036, true},
+        {"Внесена енергия", "E_in", "Wh", REG_FLOAT32, 6030, 7030, true, 10000},
+        {"Изнесена енергия", "E_out", "Wh", REG_FLOAT32, 6032, 7032, true, 10000},
+        {"Обща енергия", "E_total", "Wh", REG_FLOAT32, 6034, 7034, true, 10000},
+        {"Разлика в енергията", "E_diff", "Wh", REG_FLOAT32, 6038, 7038, true, 10000},
+        {"Брояч на капацитет", "C_counter", "Ah", REG_FLOAT32, 6036, 7036, true, 10000},
         // Минимално/максимално измерени стойности
-        {"Минимално напрежение", "U_min", "V", REG_FLOAT32, 6064, 7064, true},
-        {"Максимално напрежение", "U_max", "V", REG_FLOAT32, 6066, 7066, true},
-        {"Минимален ток", "I_min", "A", REG_FLOAT32, 6068, 7068, true},
-        {"Максимален ток", "I_max", "A", REG_FLOAT32, 6070, 7070, true},
-        {"Минимална мощност", "P_min", "W", REG_FLOAT32, 6072, 7072, true},
-        {"Максимална мощност", "P_max", "W", REG_FLOAT32, 6074, 7074, true},
-        {"Минимална промяна на напрежение", "dU_min", "V", REG_FLOAT32, 6076, 7076, true},
-        {"Максимална промяна на напрежение", "dU_max", "V", REG_FLOAT32, 6078, 7078, true},
-        {"Минимална промяна на ток", "dI_min", "A", REG_FLOAT32, 6080, 7080, true},
-        {"Максимална промяна на ток", "dI_max", "A", REG_FLOAT32, 6082, 7082, true},
-        {"Минимален капацитет", "C_min", "Ah", REG_FLOAT32, 6092, 7092, true},
-        {"Максимален капацитет", "C_max", "Ah", REG_FLOAT32, 6094, 7094, true},
-        {"Средна минимална мощност", "P_avg_min", "W", REG_FLOAT32, 6096, 7096, true},
-        {"Средна максимална мощност", "P_avg_max", "W", REG_FLOAT32, 6098, 7098, true},
-        {"Средно минимално напрежение", "U_avg_min", "V", REG_FLOAT32, 6100, 7100, true},
-        {"Средно максимално напрежение", "U_avg_max", "V", REG_FLOAT32, 6102, 7102, true},
-        {"Среден минимален ток", "I_avg_min", "A", REG_FLOAT32, 6104, 7104, true},
-        {"Среден максимален ток", "I_avg_max", "A", REG_FLOAT32, 6106, 7106, true},
-        {"Минимална температура", "T_min", "Degrees Celsius", REG_FLOAT32, 6120, 7120, true},
-        {"Максимална температура", "T_max", "Degrees Celsius", REG_FLOAT32, 6122, 7122, true}
+        {"Минимално напрежение", "U_min", "V", REG_FLOAT32, 6064, 7064, true, 10000},
+        {"Максимално напрежение", "U_max", "V", REG_FLOAT32, 6066, 7066, true, 10000},
+        {"Минимален ток", "I_min", "A", REG_FLOAT32, 6068, 7068, true, 10000},
+        {"Максимален ток", "I_max", "A", REG_FLOAT32, 6070, 7070, true, 10000},
+        {"Минимална мощност", "P_min", "W", REG_FLOAT32, 6072, 7072, true, 10000},
+        {"Максимална мощност", "P_max", "W", REG_FLOAT32, 6074, 7074, true, 10000},
+        {"Минимална промяна на напрежение", "dU_min", "V", REG_FLOAT32, 6076, 7076, true, 10000},
+        {"Максимална промяна на напрежение", "dU_max", "V", REG_FLOAT32, 6078, 7078, true, 10000},
+        {"Минимална промяна на ток", "dI_min", "A", REG_FLOAT32, 6080, 7080, true, 10000},
+        {"Максимална промяна на ток", "dI_max", "A", REG_FLOAT32, 6082, 7082, true, 10000},
+        {"Минимален капацитет", "C_min", "Ah", REG_FLOAT32, 6092, 7092, true, 10000},
+        {"Максимален капацитет", "C_max", "Ah", REG_FLOAT32, 6094, 7094, true, 10000},
+        {"Средна минимална мощност", "P_avg_min", "W", REG_FLOAT32, 6096, 7096, true, 10000},
+        {"Средна максимална мощност", "P_avg_max", "W", REG_FLOAT32, 6098, 7098, true, 10000},
+        {"Средно минимално напрежение", "U_avg_min", "V", REG_FLOAT32, 6100, 7100, true, 10000},
+        {"Средно максимално напрежение", "U_avg_max", "V", REG_FLOAT32, 6102, 7102, true, 10000},
+        {"Среден минимален ток", "I_avg_min", "A", REG_FLOAT32, 6104, 7104, true, 10000},
+        {"Среден максимален ток", "I_avg_max", "A", REG_FLOAT32, 6106, 7106, true, 10000},
+        {"Минимална температура", "T_min", "Degrees Celsius", REG_FLOAT32, 6120, 7120, true, 10000},
+        {"Максимална температура", "T_max", "Degrees Celsius", REG_FLOAT32, 6122, 7122, true, 10000}
     };
 
     /**
     * Константа, която съдържа броя на елементите в reg_map
     */
-    const size_t reg_count = sizeof(reg_map) / sizeof(reg_map[0]);
+    inline constexpr size_t reg_count = sizeof(reg_map) / sizeof(reg_map[0]);
+
+    /**
+    * План за четене на reg_map, изчислен по време на компилация: блоковите заявки, позициите за декодиране и заглавният ред на .csv файла.
+    */
+    inline constexpr auto reg_plan_data = make_read_plan<count_blocks(reg_map), csv_header_length(reg_map, reg_count)>(reg_map);
+
+    /**
+    * Изглед към reg_plan_data, който се подава на P30HTcpReader::read_plan и export_data::poll_to_csv.
+    */
+    inline constexpr ReadPlanView reg_plan = reg_plan_data.view();
 };
@@ -1,35 +1,149 @@
 #pragma once
 
+#include <vector>
+
 #include "modbuspp/modbus.h"
+#include "backoff.hpp"
+#include "metrics.hpp"
 #include "p30h_regTypeDef.hpp"
+#include "p30h_readPlan.hpp"
+#include "timestamp.hpp"
 
 class P30HTcpReader
 {
 public:
+    /**
+    * Състояние на връзката при блокиращо четене ('read_plan', 'read_registers', 'read_16bit' и 'read_float32').
+    * @param HEALTHY Всички заявки от последния отчет са с отговор.
+    * @param DEGRADED Връзката работи, но част от заявките от последния отчет са без отговор или с Modbus изключение.
+    * @param RECONNECTING Връзката е затворена (прекъсната или без нито един отговор). Следващото четене се свързва отново.
+    * @param BACKOFF Последният опит за свързване е неуспешен. Четенията до следващия опит връщат невалидни стойности веднага,
+    *                без да чакат устройството, а изчакването между опитите нараства (вижте 'retry::Backoff').
+    */
+    enum class LinkState
+    {
+        HEALTHY,
+        DEGRADED,
+        RECONNECTING,
+        BACKOFF
+    };
+
     P30HTcpReader(std::string host, uint16_t port = 502, int id = 1);
     ~P30HTcpReader();
 
     std::string get_host() const;
     uint16_t get_port() const;
     int get_slave_id() const;
+    void set_slave_id(int id);
+    void set_pipeline_depth(size_t depth);
+    void set_connect_timeout(float seconds);
+    void set_response_timeout(float seconds);
+    void set_silent_limit(size_t samples);
+    void set_metrics(metrics::DeviceMetrics* device_metrics);
+    metrics::DeviceMetrics* get_metrics() const;
+    const timestamp::Stamp& sample_sent() const;
+    const timestamp::Stamp& sample_received() const;
+    LinkState get_link_state() const;
+    metrics::Clock::time_point get_retry_time() const;
 
     bool connect();
     void close();
 
     uint16_t read_16bit(uint16_t address);
     float read_float32(uint16_t address, int16_t addr2 = -1, bool lo_first = false);
-    reg::RegisterResult* read_registers(reg::RegisterRead *reg_map, size_t reg_count);
+    reg::RegisterResult* read_registers(const reg::RegisterRead *reg_map, size_t reg_count);
+    reg::RegisterResult* read_plan(const reg::ReadPlanView& plan);
     
-    void write_16bit(uint16_t value, uint16_t address);
-    void write_float32(float value, uint16_t address, int16_t addr2 = -1, bool lo_first = false);
-    void write_registers(reg::RegisterWrite *write_map, size_t reg_count);
+    bool write_16bit(uint16_t value, uint16_t address);
+    bool write_float32(float value, uint16_t address, int16_t addr2 = -1, bool lo_first = false);
+    bool write_registers(const reg::RegisterWrite *write_map, size_t reg_count);
+
+    // Неблокиращ режим - използва се от reactor::PollReactor, който следи сокета чрез epoll.
+    X_SOCKET get_socket() const;
+    bool start_connect();
+    bool finish_connect();
+    bool start_read(const reg::ReadPlanView& plan);
+    bool wants_write() const;
+    int on_writable();
+    int on_readable();
+    void expire_read();
+    reg::RegisterResult* finish_read();
 
 private:
+    /**
+    * Една 16-битова дума за запис. 'order' пази реда на подаване, за да остане последната стойност при повтарящ се адрес.
+    */
+    struct WordWrite
+    {
+        uint16_t address;
+        uint16_t value;
+        uint32_t order;
+    };
+
+    /**
+    * Последните резултати на едно устройство зад шлюз, докато се чете друго (вижте 'set_slave_id').
+    * Величините, които не се четат при всеки отчет, така запазват собствените си стойности, а не тези на другото устройство.
+    */
+    struct SlaveResults
+    {
+        int id;
+        reg::RegisterResult* results;
+        size_t count;
+        const reg::RegisterRead* map;
+    };
+
     modbus client;
     std::string _host;
     uint16_t _port;
     int _id;
     reg::RegisterResult* _cached_results;
     size_t _cached_count;
-    
+    const reg::RegisterRead* _results_map;
+
+    reg::ReadPlanView _plan;
+    reg::ReadBlock* _blocks;
+    reg::DecodeSlot* _slots;
+    uint16_t* _order;
+    std::string _csv_header;
+
+    uint16_t* _words;
+    size_t _words_cap;
+    modbus_request* _requests;
+    size_t _request_cap;
+
+    WordWrite* _write_words;
+    uint16_t* _write_values;
+    modbus_request* _write_requests;
+    size_t _write_cap;
+
+    reg::ReadPlanView _async_plan;
+    size_t _async_sent;
+    size_t _async_done;
+    uint16_t _async_base;
+    timestamp::Stamp _sample_sent;
+    timestamp::Stamp _sample_received;
+
+    metrics::DeviceMetrics* _metrics;
+    uint64_t _connect_attempts;
+
+    std::vector<SlaveResults> _slave_results;
+    LinkState _link_state;
+    retry::Backoff _backoff;
+    metrics::Clock::time_point _retry_at;
+    size_t _silent_samples;
+    size_t _silent_limit;
+
+    void build_plan(const reg::RegisterRead *reg_map, size_t reg_count);
+    void release_plan();
+    void prepare_buffers(const reg::ReadPlanView& plan);
+    reg::RegisterResult* decode(const reg::ReadPlanView& plan);
+    void account(const reg::ReadPlanView& plan, metrics::Clock::time_point started);
+    bool ensure_link();
+    void update_link(const modbus_request* requests, size_t count);
+    void invalidate_results();
+    void read_words(uint16_t address, uint16_t amount, uint16_t* buffer);
+    bool queue_window();
+    void reserve_writes(size_t word_count);
+    size_t push_float32(size_t n, float value, uint16_t address, int16_t addr2, bool lo_first);
+    bool send_writes(size_t n);
 };
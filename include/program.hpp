@@ -1,7 +1,13 @@
+#pragma once
+
 #include <string>
 #include <atomic>
+#include <limits>
+#include <vector>
 
 #include "Device.hpp"
+#include "log_writer.hpp"
+#include "metrics.hpp"
 #include "p30h_tcpReader.hpp"
 
 namespace program
@@ -11,6 +17,39 @@ namespace program
     * @param config_path Пътят към конфигурационния файл. По подразбиране стойност: "conf".
     * @param json_name Името на конфигурационния файл. По подразбиране стойност: "devices.json".
     * @param log_path Пътят към .csv файла/файловете. По подразбиране стойност: "log".
+    * @param interval Интервал на четене в секунди. Величините с по-дълъг 'period_ms' се четат по-рядко. По подразбиране стойност: 1.
+    * @param pipeline_depth Брой заявки, които могат да чакат отговор едновременно по една връзка. По подразбиране стойност: 1.
+    * @param reactors Брой нишки, които четат от всички устройства чрез epoll. При 0 се стартира по една нишка за връзка (вижте 'share'). По подразбиране стойност: 0.
+    * @param timeout Максимално време за един отчет в секунди при reactors > 0 или за един отговор при reactors = 0. По подразбиране стойност: 3.
+    * @param connect_timeout Максимално време за един опит за свързване в секунди. Недостъпните устройства се свързват отново във фонов режим. По подразбиране стойност: 2.
+    * @param flush_interval Максимално време в секунди, през което записите стоят само в паметта преди да се запишат в .csv файла. По подразбиране стойност: 1.
+    * @param fsync Дали след всеки запис данните да се изпращат до диска (fsync). По подразбиране стойност: 'false'.
+    * @param log_format Форматът на лог файловете (CSV или BIN). По подразбиране стойност: CSV.
+    * @param to_csv Път до двоичен лог файл, който да се преобразува в .csv файл вместо да се четат устройствата. По подразбиране е празен.
+    * @param ring_capacity Брой последни отчети на всяко устройство, които се пазят във файл за други процеси (само Linux). При 0 не се създава файл. По подразбиране стойност: 0.
+    * @param ring_path Директорията на тези файлове. По подразбиране стойност: "/dev/shm" (в паметта, без запис на диска).
+    * @param stats_interval Интервал в секунди, през който на конзолата се извежда статистиката на устройствата (времена и грешки). При 0 не се извежда. По подразбиране стойност: 0.
+    * @param metrics_port Порт на 127.0.0.1, на който статистиката е достъпна по HTTP във формата на Prometheus (само Linux). При 0 не се отваря. По подразбиране стойност: 0.
+    * @param changes_only Дали в лог файловете да се записват само променените стойности (вижте 'export_data::ChangeFilter'). По подразбиране стойност: 'false'.
+    * @param deadband Мъртвите зони на величините при 'changes_only', например "0.5%,T=0.2" (вижте 'export_data::parse_deadbands'). По подразбиране е празен - записва се всяка промяна.
+    * @param heartbeat Максимално време в секунди, през което една стойност може да не се записва при 'changes_only'. При 0 няма ограничение. По подразбиране стойност: 60.
+    * @param aggregate_windows Дължини в секунди на прозорците, за които се записват min/max/avg/std/last на всяка величина (вижте 'export_data::WindowAggregator'). По подразбиране е празен.
+    * @param raw Дали да се записват и отделните отчети. При 'false' (--no-raw) се записват само статистиките за прозорците. По подразбиране стойност: 'true'.
+    * @param rotate_interval Интервал в секунди, на който се създават нови лог файлове (на границите по местно време). При 0 не се сменят. По подразбиране стойност: 0.
+    * @param rotate_size Размер в байтове, след който се създават нови лог файлове за устройството. При 0 не се ограничава. По подразбиране стойност: 0.
+    * @param compress Алгоритъмът за компресиране на затворените лог файлове (вижте 'log_compact::parse_codec'). Ако е празен, се избира най-добрият наличен,
+    *                 но файловете се компресират само при зададени 'rotate_interval', 'rotate_size' или 'merge_small'. По подразбиране е празен.
+    * @param merge_small Затворените файлове под толкова байта се добавят към общ файл за устройството за деня. При 0 не се обединяват. По подразбиране стойност: 0.
+    * @param compact_workers Брой нишки за компресиране. При 0 - по една за всяко свободно ядро. По подразбиране стойност: 0.
+    * @param index_block Брой записи в един блок на индекса по време на лог файловете (вижте 'log_index.hpp'). При 0 няма индекс. По подразбиране стойност: 256.
+    * @param query_host Устройство, чиито записи от лог файловете да се изведат вместо да се четат устройствата (вижте 'log_query'). По подразбиране е празен.
+    * @param query_from Началото на периода на заявката в милисекунди от 1970-01-01 UTC. По подразбиране - от най-стария запис.
+    * @param query_to Краят на периода на заявката в милисекунди от 1970-01-01 UTC. По подразбиране - до най-новия запис.
+    * @param query_columns Символите на величините в заявката, разделени със запетаи. По подразбиране е празен - всички.
+    * @param watch Дали промените в конфигурационния файл да се прилагат, без да се рестартира програмата. При 'false' (--no-watch) файлът се чете само при стартиране. По подразбиране стойност: 'true'.
+    * @param share Дали устройствата с еднакви ip и port (няколко slave id зад един Modbus шлюз) да се четат през една връзка. При 'false' (--no-share) всяко устройство има отделна връзка. По подразбиране стойност: 'true'.
+    * @param align Дали отчетите да са на границите на интервала по системния часовник (например точно в началото на секундата). При 'false' (--no-align) първият отчет е веднага. По подразбиране стойност: 'true'.
+    * @param spread Дали отчетите на устройствата да са разпределени равномерно в интервала (--spread), вместо всички да са в един и същи момент. По подразбиране стойност: 'false'.
     * @param show_help Помощна променлива, която при стойност 'true' се извиква 'print_help()'. По подразбиране стойност: 'false'.
     */
     struct Args
@@ -18,9 +57,44 @@ namespace program
         std::string config_path = "conf";
         std::string json_name = "devices.json";
         std::string log_path = "log";
+        float interval = 1.0f;
+        size_t pipeline_depth = 1;
+        size_t reactors = 0;
+        float timeout = 3.0f;
+        float connect_timeout = 2.0f;
+        float flush_interval = 1.0f;
+        bool fsync = false;
+        export_data::LogFormat log_format = export_data::LogFormat::CSV;
+        std::string to_csv;
+        size_t ring_capacity = 0;
+        std::string ring_path = "/dev/shm";
+        float stats_interval = 0.0f;
+        size_t metrics_port = 0;
+        bool changes_only = false;
+        std::string deadband;
+        float heartbeat = 60.0f;
+        std::vector<uint32_t> aggregate_windows;
+        bool raw = true;
+        uint32_t rotate_interval = 0;
+        uint64_t rotate_size = 0;
+        std::string compress;
+        uint64_t merge_small = 0;
+        size_t compact_workers = 0;
+        uint32_t index_block = 256;
+        std::string query_host;
+        int64_t query_from = std::numeric_limits<int64_t>::min();
+        int64_t query_to = std::numeric_limits<int64_t>::max();
+        std::string query_columns;
+        bool watch = true;
+        bool share = true;
+        bool align = true;
+        bool spread = false;
         bool show_help = false;
     };
 
+    extern std::atomic<bool> stop_flag;
+    extern metrics::Registry registry;
+
     #ifdef _WIN32
     BOOL WINAPI console_ctrl_handler(DWORD signal);
     #else
@@ -29,6 +103,12 @@ namespace program
 
     void print_help();
     Args* parse_args(int& argc, char**& argv);
-    void poll_device(const device::Device& dev, const std::string& log_path);
+    void poll_gateway(const std::vector<device::Device>& devices, const std::vector<uint64_t>& slots, const std::vector<metrics::DeviceMetrics*>& device_metrics, const Args& args, std::atomic<bool>& stop);
+    void poll_devices_threads(const device::Device* devices, size_t device_count, const Args& args);
+    #ifdef __linux__
+    void poll_devices_reactor(const device::Device* devices, size_t device_count, const Args& args);
+    #endif
+    void convert_to_csv(const std::string& bin_path);
+    void query_logs(const Args& args);
     int run(int& argc, char**& argv);
 };
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "backoff.hpp"
+#include "Device.hpp"
+#include "p30h_pollSchedule.hpp"
+#include "p30h_tcpReader.hpp"
+#include "ticker.hpp"
+
+namespace reactor
+{
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+    * Функция, която се извиква след всеки завършен отчет на устройство.
+    * Извиква се от нишката, която обслужва устройството, затова за едно устройство никога не се извиква едновременно от две нишки.
+    * @param device Индексът на устройството (върнат от 'PollReactor::add_device').
+    * @param timestamp_ms Календарното време на изпращане на първата заявка от отчета в милисекунди от 1970-01-01 UTC.
+    * @param results Резултатите в реда на плана за четене. Валидни са само по време на извикването.
+    */
+    typedef std::function<void(size_t device, int64_t timestamp_ms, const reg::RegisterResult* results)> SampleHandler;
+
+    /**
+    * Настройки на 'PollReactor'. Времената са в секунди.
+    * @param interval Интервал между два отчета на едно устройство. Величините с по-дълъг 'period_ms' се четат само в част от отчетите.
+    * @param timeout Максимално време за получаване на всички отговори от един отчет.
+    * @param connect_timeout Максимално време за свързване. Всички устройства се свързват едновременно, затова недостъпните не забавят останалите.
+    * @param retry_initial Изчакване след първия неуспешен опит за свързване. Следващите изчаквания се удвояват.
+    * @param retry_max Максимално изчакване между два опита за свързване.
+    * @param pipeline_depth Брой заявки, които могат да чакат отговор едновременно по една връзка.
+    * @param share_connections Дали устройствата с еднакви ip и port (няколко slave id зад един Modbus шлюз) да се четат през една връзка.
+    * @param align Дали отчетите да са на границите на интервала по системния часовник (например точно в началото на секундата).
+    * @param spread Дали отчетите на различните устройства да са разпределени равномерно в интервала (вижте 'ticker::spread_phase').
+    */
+    struct Options
+    {
+        float interval = 1.0f;
+        float timeout = 3.0f;
+        float connect_timeout = 3.0f;
+        float retry_initial = 1.0f;
+        float retry_max = 60.0f;
+        size_t pipeline_depth = 1;
+        bool share_connections = true;
+        bool align = true;
+        bool spread = false;
+    };
+
+    /**
+    * Клас, който чете от много устройства с малък и фиксиран брой нишки.
+    * Всяка нишка обслужва своя част от устройствата чрез epoll с неблокиращи сокети и таймер за всяка заявка,
+    * вместо по една блокираща нишка за устройство. Няколко устройства зад един Modbus шлюз (еднакви ip и port, различен slave id)
+    * се четат през една връзка. Устройства могат да се добавят, променят и премахват и докато 'run' работи,
+    * без да се прекъсват връзките с останалите устройства.
+    */
+    class PollReactor
+    {
+    public:
+        PollReactor(const reg::ReadPlanView& plan, SampleHandler handler, const Options& options = Options());
+        ~PollReactor();
+
+        size_t add_device(const device::Device& dev, metrics::DeviceMetrics* device_metrics = nullptr);
+        void update_device(size_t device, const device::Device& dev, metrics::DeviceMetrics* device_metrics = nullptr);
+        void remove_device(size_t device);
+        size_t device_count() const;
+        void run(std::atomic<bool>& stop_flag, size_t threads = 1);
+
+    private:
+        enum class State
+        {
+            DISCONNECTED,
+            CONNECTING,
+            IDLE,
+            READING
+        };
+
+        /**
+        * Едно устройство (slave id) в една връзка.
+        * @param index Индексът на устройството (върнат от 'add_device').
+        * @param interval Интервалът между два отчета ('Device::interval' или 'Options::interval').
+        * @param phase Изместването на отчетите в интервала (при 'Options::spread').
+        * @param ticker Времето и поредният номер на следващия отчет.
+        * @param schedule Планът за четене за този интервал (общ за всички устройства с еднакъв интервал).
+        * @param pipeline_depth Брой заявки на устройството, които могат да чакат отговор едновременно.
+        * @param metrics Статистиката на устройството (може да е nullptr).
+        */
+        struct Unit
+        {
+            size_t index = 0;
+            int slave_id = 1;
+            Clock::duration interval{};
+            Clock::duration phase{};
+            ticker::Ticker ticker;
+            const reg::PollSchedule* schedule = nullptr;
+            size_t pipeline_depth = 1;
+            metrics::DeviceMetrics* metrics = nullptr;
+        };
+
+        /**
+        * Една TCP връзка и устройствата, които се четат през нея (едно устройство или няколко slave id зад един Modbus шлюз).
+        * Отчетите на устройствата в една връзка са един след друг (шлюзът така или иначе ги изпраща едно по едно по RS485), а следващ е
+        * отчетът с най-ранно време (earliest deadline first), затова всички устройства получават равен дял от капацитета на шлюза.
+        * @param timer_gen Номер на последния зареден таймер. Таймерите с друг номер са остарели и се пропускат.
+        * @param events Събитията, за които сокетът е регистриран в epoll (0 ако не е регистриран).
+        * @param backoff Изчакване до следващия опит за свързване, ако устройството е недостъпно.
+        * @param worker Индексът на нишката, която обслужва връзката.
+        * @param units Устройствата във връзката. Променят се само от нишката на връзката (или преди 'run').
+        * @param current Индексът на устройството, чийто отчет се чете в момента.
+        * @param key Ключът, по който устройствата се групират във връзки (вижте 'Options::share_connections').
+        * @param members Броят на устройствата във връзката според главната нишка (пази се от '_control_mutex').
+        * @param timeouts Брой поредни отчети с изтекло време. Връзката се затваря едва когато не отговаря нито едно устройство в нея,
+        * защото при шлюз изтеклото време обикновено означава само недостъпно устройство зад него.
+        */
+        struct Session
+        {
+            P30HTcpReader reader;
+            State state = State::DISCONNECTED;
+            uint32_t timer_gen = 0;
+            uint32_t events = 0;
+            retry::Backoff backoff;
+            size_t worker = 0;
+            std::vector<Unit> units;
+            size_t current = 0;
+            std::string key;
+            size_t members = 0;
+            size_t timeouts = 0;
+
+            Session(const device::Device& dev, size_t id, const Options& options);
+        };
+
+        enum class CommandType
+        {
+            START,
+            ADD,
+            UPDATE,
+            REMOVE
+        };
+
+        /**
+        * Промяна на връзка, която се изпълнява от нишката, обслужваща връзката (вижте 'add_device', 'update_device' и 'remove_device').
+        * START започва четенето на нова връзка, ADD добавя 'unit' към връзката, UPDATE сменя настройките на 'unit.index',
+        * а REMOVE премахва устройството 'unit.index' (и връзката, ако е последното).
+        */
+        struct Command
+        {
+            CommandType type;
+            Session* session;
+            Unit unit;
+        };
+
+        struct Timer
+        {
+            Clock::time_point when;
+            Session* session;
+            uint32_t gen;
+
+            bool operator>(const Timer& other) const { return when > other.when; }
+        };
+
+        /**
+        * Данни на една нишка: собствен epoll, собствена опашка с таймери и командите, които чакат изпълнение.
+        * 'commands' се пази от '_control_mutex', а 'wake_fd' (eventfd в epoll) събужда нишката при нова команда.
+        */
+        struct Worker
+        {
+            int epoll_fd = -1;
+            int wake_fd = -1;
+            std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+            std::vector<Command> commands;
+        };
+
+        const reg::ReadPlanView& _plan;
+        std::vector<std::pair<float, std::unique_ptr<reg::PollSchedule>>> _schedules;
+        SampleHandler _handler;
+        Options _options;
+        Clock::duration _timeout;
+        Clock::duration _connect_timeout;
+        mutable std::mutex _control_mutex;
+        std::condition_variable _control_changed;
+        std::vector<std::unique_ptr<Session>> _sessions;
+        std::vector<Session*> _devices;
+        std::unordered_map<std::string, Session*> _links;
+        size_t _next_link;
+        std::vector<std::unique_ptr<Worker>> _workers;
+
+        const reg::PollSchedule* schedule_for(float interval);
+        Unit make_unit(size_t index, const device::Device& dev, metrics::DeviceMetrics* device_metrics);
+        void send(const Command& command);
+        Unit* find_unit(Session& s, size_t index);
+        void add_unit(Worker& w, Session& s, const Unit& unit, Clock::time_point now);
+        void update_unit(Session& s, const Unit& unit, Clock::time_point now);
+        void remove_unit(Session& s, size_t index);
+        void remove_sessions(Worker& w, std::vector<Session*>& removed);
+        void apply_commands(Worker& w, Clock::time_point now);
+        void worker_loop(size_t worker, std::atomic<bool>& stop_flag);
+        void arm(Worker& w, Session& s, Clock::time_point when);
+        void arm_next_unit(Worker& w, Session& s, Clock::time_point now);
+        void schedule_next(Unit& unit, Clock::time_point now);
+        void watch(Worker& w, Session& s, uint32_t events);
+        void disconnect(Worker& w, Session& s);
+        void start_connect(Worker& w, Session& s, Clock::time_point now);
+        void retry_connect(Worker& w, Session& s, Clock::time_point now);
+        void start_sample(Worker& w, Session& s, Clock::time_point now);
+        void complete_sample(Worker& w, Session& s, Clock::time_point now, bool ok);
+        void on_timer(Worker& w, Session& s, Clock::time_point now);
+        void on_event(Worker& w, Session& s, uint32_t events, Clock::time_point now);
+    };
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+#include "bin_log.hpp"
+#include "Device.hpp"
+#include "p30h_readPlan.hpp"
+
+/**
+* Файл с последните N отчета на едно устройство, достъпен чрез mmap от други процеси (табла, аларми) без четене на .csv файлове.
+*
+* Разположение във файла:
+*   [0, 128)          RingHeader
+*   [128, ...)        описание на колоните във формата на заглавието на 'bin_log' (columns_size байта)
+*   [slots_offset, )  capacity елемента по slot_size байта, подравнени на 64 байта:
+*                       uint64  sequence  (нечетен, докато записът се променя; 2 * (номер на отчета + 1) след това)
+*                       int64   време в милисекунди от 1970-01-01 UTC
+*                       uint32  стойностите в реда на колоните (float32 или uint16 в младшите 16 бита)
+*                       uint8   валидност на всяка стойност (0 или 1)
+*
+* Отчет с номер k се намира в елемент k % capacity. 'head' е броят на публикуваните отчети - последният е head - 1.
+*/
+namespace ring_store
+{
+    constexpr char MAGIC[8] = { 'P', '3', '0', 'H', 'R', 'I', 'N', 'G' };
+    constexpr uint32_t VERSION = 1;
+
+    /**
+    * Заглавието на файла. 'head' е в отделна кеш линия, защото се променя при всеки отчет.
+    */
+    struct RingHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t column_count;
+        uint32_t capacity;
+        uint32_t slot_size;
+        uint32_t slots_offset;
+        uint32_t columns_size;
+        alignas(64) std::atomic<uint64_t> head;
+    };
+
+    static_assert(sizeof(RingHeader) == 128, "RingHeader трябва да е 128 байта.");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "Нужен е lock-free std::atomic<uint64_t> за споделена памет.");
+
+    std::string ring_file_name(const std::string& dir, const device::Device& dev);
+
+    /**
+    * Клас, който записва отчетите на едно устройство във файла. За един файл трябва да има само един Writer.
+    */
+    class Writer
+    {
+    public:
+        Writer(const std::string& path, const reg::ReadPlanView& plan, uint32_t capacity);
+        ~Writer();
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        void push(int64_t timestamp_ms, const reg::RegisterResult* results);
+
+    private:
+        char* _data;
+        size_t _size;
+        RingHeader* _header;
+        const reg::RegisterRead* _map;
+        size_t _column_count;
+    };
+
+    /**
+    * Клас, който чете отчетите от файла (обикновено от друг процес). Не блокира Writer.
+    */
+    class Reader
+    {
+    public:
+        explicit Reader(const std::string& path);
+        ~Reader();
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        const bin_log::Columns& columns() const;
+        uint32_t capacity() const;
+        uint64_t head() const;
+        bool read(uint64_t index, int64_t& timestamp_ms, reg::RegisterResult* results) const;
+        bool latest(int64_t& timestamp_ms, reg::RegisterResult* results) const;
+
+    private:
+        const char* _data;
+        size_t _size;
+        const RingHeader* _header;
+        bin_log::Columns _columns;
+    };
+};
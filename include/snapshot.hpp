@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "p30h_readPlan.hpp"
+
+namespace snapshot
+{
+    /**
+    * Последните стойности на всички устройства като structure-of-arrays, удобни за обработка на цял интервал със SIMD цикли.
+    * Всяка величина е колона от 'stride()' стойности float32 (по една за устройство, REG_INT16 е преобразувана), подравнена на 64 байта.
+    * Валидността е битова маска за всяка колона - бит d % 64 от думата d / 64 е за устройство d.
+    * 'timestamps' е времето на последния отчет на всяко устройство в милисекунди от 1970-01-01 UTC (0 - все още няма отчет),
+    * а 'versions' е броят на отчетите му, по който се разбира кои устройства имат нов отчет от предишното копие.
+    * Няма низове и не се заделя памет при всяко копиране (само при промяна на размера).
+    */
+    class Snapshot
+    {
+    public:
+        Snapshot();
+        ~Snapshot();
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        void resize(size_t device_count, size_t reg_count);
+
+        size_t device_count() const { return _device_count; }
+        size_t reg_count() const { return _reg_count; }
+        size_t stride() const { return _stride; }
+        const float* column(size_t reg) const { return _values + reg * _stride; }
+        const uint64_t* valid_column(size_t reg) const { return _valid + reg * (_stride / 64); }
+        const int64_t* timestamps() const { return _timestamps; }
+        const uint64_t* versions() const { return _versions; }
+        bool is_valid(size_t reg, size_t device) const { return (valid_column(reg)[device / 64] >> (device % 64)) & 1; }
+
+    private:
+        friend class FleetSnapshot;
+
+        size_t _device_count;
+        size_t _reg_count;
+        size_t _stride;
+        unsigned char* _memory;
+        float* _values;
+        uint64_t* _valid;
+        int64_t* _timestamps;
+        uint64_t* _versions;
+    };
+
+    /**
+    * Клас, в който нишките, които четат устройствата, записват всеки отчет, а анализите и експортът копират всички устройства наведнъж.
+    * Записът на едно устройство не заключва и не заделя памет. Копието е последователно за всяко устройство (стойностите, валидността и
+    * времето са от един и същи отчет) - всяко устройство има брояч като в 'ring_store', а копирането повтаря само устройствата,
+    * чийто отчет се е променил по време на копирането.
+    * За едно устройство 'store' трябва да се извиква само от една нишка (както 'reactor::SampleHandler').
+    */
+    class FleetSnapshot
+    {
+    public:
+        FleetSnapshot(const reg::ReadPlanView& plan, size_t device_count);
+        ~FleetSnapshot();
+        FleetSnapshot(const FleetSnapshot&) = delete;
+        FleetSnapshot& operator=(const FleetSnapshot&) = delete;
+
+        void store(size_t device, int64_t timestamp_ms, const reg::RegisterResult* results);
+        void clear(size_t device);
+        void copy_to(Snapshot& out) const;
+        size_t device_count() const;
+        size_t reg_count() const;
+
+    private:
+        const reg::RegisterRead* _map;
+        Snapshot _live;
+        std::atomic<uint64_t>* _sequence;
+
+        std::atomic<uint64_t>& valid_word(size_t reg, size_t device) const;
+        void copy_device(size_t device, Snapshot& out) const;
+    };
+};
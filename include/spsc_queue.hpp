@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace export_data
+{
+    /**
+    * Опашка без заключване (lock-free) за един производител и един консуматор (SPSC).
+    * Елементите са предварително създадени и се попълват на място, затова добавянето не заделя памет.
+    * Производителят използва 'begin_push'/'commit_push', консуматорът - 'front'/'pop'.
+    * @tparam T Типът на елементите.
+    */
+    template <typename T>
+    class SpscQueue
+    {
+    public:
+        /**
+        * @param capacity Минимален брой елементи. Закръгля се нагоре до степен на двойката.
+        */
+        explicit SpscQueue(size_t capacity)
+        {
+            _capacity = 1;
+            while (_capacity < capacity) _capacity <<= 1;
+            _mask = _capacity - 1;
+            _slots = new T[_capacity];
+        }
+
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        ~SpscQueue()
+        {
+            delete[] _slots;
+        }
+
+        size_t capacity() const
+        {
+            return _capacity;
+        }
+
+        /**
+        * Достъп до елемент по индекс, например за първоначалното му подготвяне. Не трябва да се извиква, докато опашката се използва.
+        */
+        T& slot(size_t index)
+        {
+            return _slots[index];
+        }
+
+        /**
+        * Връща свободния елемент, който да се попълни от производителя, или nullptr, ако опашката е пълна.
+        */
+        T* begin_push()
+        {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head.load(std::memory_order_acquire) == _capacity)
+                return nullptr;
+            return &_slots[tail & _mask];
+        }
+
+        /**
+        * Публикува елемента, върнат от 'begin_push', към консуматора.
+        */
+        void commit_push()
+        {
+            _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        /**
+        * Връща най-стария елемент или nullptr, ако опашката е празна.
+        */
+        T* front()
+        {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail.load(std::memory_order_acquire))
+                return nullptr;
+            return &_slots[head & _mask];
+        }
+
+        /**
+        * Освобождава елемента, върнат от 'front', за повторно използване от производителя.
+        */
+        void pop()
+        {
+            _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        T* _slots;
+        size_t _capacity;
+        size_t _mask;
+        // Двата индекса са в отделни кеш линии, за да не си пречат нишките на производителя и консуматора
+        alignas(64) std::atomic<size_t> _head{0};
+        alignas(64) std::atomic<size_t> _tail{0};
+    };
+};
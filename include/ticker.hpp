@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace ticker
+{
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::duration period_from_seconds(float seconds);
+    Clock::duration spread_phase(uint64_t index, Clock::duration period);
+
+    /**
+    * Клас, който изчислява абсолютните времена на отчетите на едно устройство: начало + k * период.
+    * Следващото време не зависи от продължителността на отчетите и от закъснението при събуждане, затова отчетите
+    * са на равни интервали (за FFT и интегриране на енергията) и не се изместват с времето.
+    * Началото може да е подравнено на границата на периода по системния часовник (например точно в началото на секундата),
+    * а фазата измества отчетите на устройството в рамките на периода (вижте 'spread_phase').
+    */
+    class Ticker
+    {
+    public:
+        Ticker();
+
+        void start(Clock::duration period, Clock::duration phase, bool align, Clock::time_point now);
+        void set_period(Clock::duration period, Clock::time_point now);
+        uint64_t advance(Clock::time_point now);
+        void resume(Clock::time_point now);
+        Clock::time_point deadline() const;
+        uint64_t tick() const;
+        Clock::duration period() const;
+
+    private:
+        Clock::time_point _origin;
+        Clock::duration _period;
+        Clock::duration _phase;
+        bool _align;
+        uint64_t _tick;
+    };
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <string_view>
+
+namespace timestamp
+{
+    /**
+    * Един момент по двата часовника: календарното време (CLOCK_REALTIME) и монотонното време (CLOCK_MONOTONIC).
+    * Календарното време е за лог файловете, а монотонното - за интервали, които не се влияят от корекциите на часовника (NTP).
+    * С двойката всяко друго монотонно време (например изпращането на отделна заявка) се превръща в календарно без ново четене на часовника.
+    * @param realtime_ns Календарното време в наносекунди от 1970-01-01 UTC (0 - не е записано).
+    * @param monotonic Монотонното време.
+    */
+    struct Stamp
+    {
+        int64_t realtime_ns = 0;
+        std::chrono::steady_clock::time_point monotonic{};
+
+        static Stamp now();
+        Stamp at(std::chrono::steady_clock::time_point t) const;
+        int64_t realtime_ms() const;
+        bool valid() const { return realtime_ns != 0; }
+    };
+
+    std::tm local_time(std::time_t t);
+    bool parse_local(std::string_view text, int64_t& realtime_ms);
+
+    /**
+    * Клас, който форматира календарно време като локална дата и час с милисекунди ("%Y-%m-%d %H:%M:%S.mmm").
+    * Датата и часът се форматират само при смяна на секундата, а милисекундите - с целочислени операции,
+    * затова форматирането на всеки ред е няколко наносекунди. Всяка нишка трябва да използва собствен обект.
+    */
+    class Formatter
+    {
+    public:
+        Formatter();
+
+        std::string_view format(int64_t realtime_ms);
+        std::string_view format_seconds(std::time_t t);
+
+    private:
+        int64_t _second;
+        size_t _length;
+        char _text[32];
+    };
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace word_decode
+{
+    /**
+    * Наборът от инструкции, с който се декодира.
+    * @param SCALAR Обикновен цикъл (на всички процесори).
+    * @param SSSE3 128-битови регистри (x86, pshufb).
+    * @param AVX2 256-битови регистри (x86).
+    */
+    enum class Isa
+    {
+        SCALAR,
+        SSSE3,
+        AVX2
+    };
+
+    Isa detect();
+    Isa active();
+    Isa set_isa(Isa isa);
+    const char* isa_name(Isa isa);
+
+    void be_to_float32(const uint8_t* bytes, float* out, size_t count, bool lo_first = false);
+};
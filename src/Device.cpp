@@ -1,103 +1,531 @@
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <filesystem>
 #include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <stdexcept>
+#include <vector>
 
 #include "Device.hpp"
 
 namespace device
 {
     /**
-    * Функция, която извлича стойността на низ от даден JSON-форматиран текст.
-    * Стойността се извлича по ключа, който е подаден като аргумент.
-    * @param src String, съдържащ JSON съдържание.
-    * @param key Ключът, за който да се извлече съответната стойност.
-    * @return Стойността, свързана с дадения ключ, или празен низ, ако ключът не бъде намерен.
+    * Максимална дълбочина на вложените масиви и обекти в непознатите ключове, които се пропускат.
     */
-    std::string extract_string(const std::string& src, const std::string& key)
+    static const int MAX_DEPTH = 64;
+
+    /**
+    * Помощен клас, който чете JSON текст с едно преминаване, без да копира текста.
+    * Низовете без escape последователности се връщат като изглед към текста, затова паметта се заделя само за стойностите на устройствата.
+    * Грешките съдържат името на файла, реда и колоната.
+    */
+    class JsonParser
+    {
+    public:
+        JsonParser(std::string_view text, std::string_view source)
+         : _text(text)
+         , _source(source)
+         , _pos(0)
+        {
+        }
+
+        /**
+        * Връща позицията на следващата стойност (след интервалите).
+        */
+        size_t position()
+        {
+            peek();
+            return _pos;
+        }
+
+        /**
+        * Спира четенето с грешка на дадена позиция в текста.
+        * @throws std::runtime_error Винаги.
+        */
+        [[noreturn]] void fail_at(size_t pos, const std::string& message) const
+        {
+            size_t line = 1, column = 1;
+            for (size_t i = 0; i < pos && i < _text.size(); ++i)
+            {
+                if (_text[i] == '\n')
+                {
+                    ++line;
+                    column = 1;
+                }
+                else
+                    ++column;
+            }
+            throw std::runtime_error(std::string(_source) + ":" + std::to_string(line) + ":" + std::to_string(column) + ": " + message);
+        }
+
+        [[noreturn]] void fail(const std::string& message) const
+        {
+            fail_at(_pos, message);
+        }
+
+        /**
+        * Връща следващия знак след интервалите (0 в края на текста), без да го прочита.
+        */
+        char peek()
+        {
+            while (_pos < _text.size() && (_text[_pos] == ' ' || _text[_pos] == '\t' || _text[_pos] == '\n' || _text[_pos] == '\r'))
+                ++_pos;
+            return _pos < _text.size() ? _text[_pos] : '\0';
+        }
+
+        /**
+        * Прочита знака 'c', ако е следващият след интервалите.
+        */
+        bool consume(char c)
+        {
+            if (peek() != c)
+                return false;
+            ++_pos;
+            return true;
+        }
+
+        void expect(char c)
+        {
+            if (!consume(c))
+                fail(std::string("очаква се '") + c + "'");
+        }
+
+        bool at_end()
+        {
+            return peek() == '\0';
+        }
+
+        /**
+        * Прочита низ. Ако низът съдържа escape последователности, се декодира в 'scratch'.
+        * @return Изглед към текста или към 'scratch'. Валиден е до следващото извикване със същия 'scratch'.
+        */
+        std::string_view string(std::string& scratch)
+        {
+            expect('"');
+            size_t start = _pos;
+            while (_pos < _text.size() && _text[_pos] != '"' && _text[_pos] != '\\')
+            {
+                if (static_cast<unsigned char>(_text[_pos]) < 0x20)
+                    fail("непозволен знак в низ");
+                ++_pos;
+            }
+            if (_pos < _text.size() && _text[_pos] == '"')
+                return _text.substr(start, _pos++ - start);
+
+            scratch.assign(_text.data() + start, _pos - start);
+            while (_pos < _text.size() && _text[_pos] != '"')
+            {
+                char c = _text[_pos++];
+                if (static_cast<unsigned char>(c) < 0x20)
+                    fail_at(_pos - 1, "непозволен знак в низ");
+                if (c != '\\')
+                {
+                    scratch.push_back(c);
+                    continue;
+                }
+                if (_pos >= _text.size())
+                    break;
+                c = _text[_pos++];
+                switch (c)
+                {
+                    case '"': case '\\': case '/': scratch.push_back(c); break;
+                    case 'b': scratch.push_back('\b'); break;
+                    case 'f': scratch.push_back('\f'); break;
+                    case 'n': scratch.push_back('\n'); break;
+                    case 'r': scratch.push_back('\r'); break;
+                    case 't': scratch.push_back('\t'); break;
+                    case 'u': append_utf8(scratch, hex4()); break;
+                    default: fail_at(_pos - 1, "непозната escape последователност");
+                }
+            }
+            if (_pos >= _text.size())
+                fail_at(start - 1, "незавършен низ");
+            ++_pos;
+            return scratch;
+        }
+
+        /**
+        * Прочита число.
+        */
+        double number()
+        {
+            peek();
+            size_t start = _pos;
+            while (_pos < _text.size() && (std::isdigit(static_cast<unsigned char>(_text[_pos])) || _text[_pos] == '-' || _text[_pos] == '+' ||
+                                          _text[_pos] == '.' || _text[_pos] == 'e' || _text[_pos] == 'E'))
+                ++_pos;
+            double value = 0;
+            std::from_chars_result r = std::from_chars(_text.data() + start, _text.data() + _pos, value);
+            if (start == _pos || r.ec != std::errc() || r.ptr != _text.data() + _pos)
+                fail_at(start, "очаква се число");
+            return value;
+        }
+
+        /**
+        * Прочита true или false.
+        */
+        bool boolean()
+        {
+            peek();
+            if (_text.substr(_pos, 4) == "true")
+            {
+                _pos += 4;
+                return true;
+            }
+            if (_text.substr(_pos, 5) == "false")
+            {
+                _pos += 5;
+                return false;
+            }
+            fail("очаква се true или false");
+        }
+
+        /**
+        * Пропуска една стойност от произволен тип (включително вложени масиви и обекти).
+        */
+        void skip_value(int depth = 0)
+        {
+            if (depth > MAX_DEPTH)
+                fail("твърде дълбоко вложени стойности");
+            char c = peek();
+            if (c == '"')
+                string(_skipped);
+            else if (c == '{' || c == '[')
+            {
+                char close = c == '{' ? '}' : ']';
+                ++_pos;
+                if (consume(close))
+                    return;
+                do
+                {
+                    if (c == '{')
+                    {
+                        string(_skipped);
+                        expect(':');
+                    }
+                    skip_value(depth + 1);
+                } while (consume(','));
+                expect(close);
+            }
+            else if (c == 't' || c == 'f')
+                boolean();
+            else if (_text.substr(_pos, 4) == "null")
+                _pos += 4;
+            else
+                number();
+        }
+
+    private:
+        std::string_view _text;
+        std::string_view _source;
+        size_t _pos;
+        std::string _skipped;
+
+        uint32_t hex4()
+        {
+            if (_pos + 4 > _text.size())
+                fail("непълна \\u последователност");
+            uint32_t value = 0;
+            std::from_chars_result r = std::from_chars(_text.data() + _pos, _text.data() + _pos + 4, value, 16);
+            if (r.ptr != _text.data() + _pos + 4)
+                fail("невалидна \\u последователност");
+            _pos += 4;
+            return value;
+        }
+
+        static void append_utf8(std::string& out, uint32_t code)
+        {
+            if (code < 0x80)
+                out.push_back(static_cast<char>(code));
+            else if (code < 0x800)
+            {
+                out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+                out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+            }
+            else
+            {
+                out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+            }
+        }
+    };
+
+    /**
+    * Помощна функция, която проверява IPv4 адрес във вида a.b.c.d.
+    * @param text Адресът.
+    * @param address Променлива, в която се записва адресът като число.
+    * @return False, ако адресът не е валиден.
+    */
+    static bool parse_ipv4(std::string_view text, uint32_t& address)
+    {
+        address = 0;
+        size_t pos = 0;
+        for (int part = 0; part < 4; ++part)
+        {
+            if (part > 0 && (pos >= text.size() || text[pos++] != '.'))
+                return false;
+            size_t start = pos;
+            uint32_t value = 0;
+            while (pos < text.size() && pos - start < 3 && std::isdigit(static_cast<unsigned char>(text[pos])))
+                value = value * 10 + static_cast<uint32_t>(text[pos++] - '0');
+            if (pos == start || value > 255)
+                return false;
+            address = address << 8 | value;
+        }
+        return pos == text.size();
+    }
+
+    /**
+    * Помощна функция, която връща ключа на устройство (ip, port и id в едно число), по който се търсят повтарящи се устройства.
+    */
+    static uint64_t device_key(const Device& dev)
     {
-        std::string pattern = "\"" + key + "\""; // "key"
-        size_t pos = src.find(pattern);
-        if (pos == std::string::npos) return "";
-        pos = src.find(':', pos); // "key" :
-        if (pos == std::string::npos) return "";
-        pos = src.find('"', pos); // "key" : "
-        if (pos == std::string::npos) return "";
-        size_t end = src.find('"', pos + 1); // "key" : "value"
-        if (end == std::string::npos) return "";
-        return src.substr(pos + 1, end - pos - 1); // value
+        uint32_t address = 0;
+        parse_ipv4(dev.ip, address);
+        return static_cast<uint64_t>(address) << 24 | static_cast<uint64_t>(dev.port) << 8 | static_cast<uint64_t>(dev.device_id & 0xFF);
     }
 
     /**
-    * Функция, която извлича числовата стойност от даден JSON-форматиран текст.
-    * Стойността се извлича по ключа, който е подаден като аргумент.
-    * @param src String, съдържащ JSON съдържание.
-    * @param key Ключът, за който да се извлече съответната стойност.
-    * @return Числовата стойност, свързана с дадения ключ, или 0, ако ключът не бъде намерен.
+    * Помощна функция, която прочита цяло число в даден интервал.
     */
-    int extract_int(const std::string& src, const std::string& key)
+    static long parse_integer(JsonParser& json, const char* key, long min, long max)
     {
-        std::string pattern = "\"" + key + "\""; // "key"
-        size_t pos = src.find(pattern);
-        if (pos == std::string::npos) return 0;
-        pos = src.find(':', pos); // "key" :
-        if (pos == std::string::npos) return 0;
-        std::string num_str;
-        for (size_t i = pos + 1; i < src.size() && (isdigit(src[i]) || src[i] == ' '); ++i)
-            if (isdigit(src[i])) num_str.push_back(src[i]);
-        return std::stoi(num_str);
+        size_t start = json.position();
+        double value = json.number();
+        if (value != static_cast<double>(static_cast<long>(value)) || value < min || value > max)
+            json.fail_at(start, std::string("\"") + key + "\" трябва да е цяло число от " + std::to_string(min) + " до " + std::to_string(max));
+        return static_cast<long>(value);
+    }
+
+    /**
+    * Помощна функция, която прочита обект с параметрите на едно устройство (или "defaults") и ги записва върху 'dev'.
+    * Непознатите ключове се пропускат, а стойностите на познатите се проверяват.
+    * @param json Текстът, позициониран преди '{'.
+    * @param dev Устройството, чиито стойности (започващи от "defaults") се променят.
+    * @param enabled Променлива, в която се записва стойността на "enabled".
+    */
+    static void parse_device(JsonParser& json, Device& dev, bool& enabled)
+    {
+        std::string key_buffer, value_buffer;
+        json.expect('{');
+        if (json.consume('}'))
+            return;
+        do
+        {
+            std::string_view key = json.string(key_buffer);
+            json.expect(':');
+            size_t start = json.position();
+            if (key == "ip")
+            {
+                std::string_view ip = json.string(value_buffer);
+                uint32_t address = 0;
+                if (!parse_ipv4(ip, address))
+                    json.fail_at(start, "невалиден IPv4 адрес \"" + std::string(ip) + "\"");
+                dev.ip.assign(ip);
+            }
+            else if (key == "port")
+                dev.port = static_cast<uint16_t>(parse_integer(json, "port", 1, 65535));
+            else if (key == "id")
+                dev.device_id = static_cast<int>(parse_integer(json, "id", 0, 255));
+            else if (key == "name")
+                dev.name.assign(json.string(value_buffer));
+            else if (key == "enabled")
+                enabled = json.boolean();
+            else if (key == "interval")
+            {
+                double value = json.number();
+                if (!(value > 0 && value <= 86400))
+                    json.fail_at(start, "\"interval\" трябва да е между 0 и 86400 секунди");
+                dev.interval = static_cast<float>(value);
+            }
+            else if (key == "pipeline")
+                dev.pipeline_depth = static_cast<size_t>(parse_integer(json, "pipeline", 1, 1024));
+            else
+                json.skip_value();
+        } while (json.consume(','));
+        json.expect('}');
+    }
+
+    /**
+    * Функция, която извлича данните за устройствата от JSON текст с едно преминаване.
+    * Текстът е масив от обекти с ключове "ip" (задължителен), "port", "id", "name", "enabled", "interval" и "pipeline",
+    * или обект { "defaults": { ... }, "devices": [ ... ] }, в който "defaults" задава стойностите по подразбиране на всички
+    * устройства, а всяко устройство може да ги промени. "defaults" трябва да е преди "devices". Устройствата с "enabled": false се пропускат.
+    * @param json JSON текстът.
+    * @param device_count Променлива, в която се записва броят на устройствата.
+    * @param source Името на файла в съобщенията за грешка.
+    * @return Указател към новосъздаден масив от структури 'Device'. Трябва да се освободи паметта след използването на масива.
+    * @throws std::runtime_error При синтактична грешка, невалидна стойност, липсващ "ip" или повтарящо се устройство (ip, port и id).
+    */
+    Device* parse_devices(std::string_view json, size_t& device_count, std::string_view source)
+    {
+        JsonParser parser(json, source);
+        Device defaults;
+        bool default_enabled = true;
+        std::vector<Device> devices;
+        std::vector<std::pair<uint64_t, size_t>> keys; // (ip, port, id) и позицията на устройството
+        std::string key_buffer;
+
+        auto parse_list = [&]()
+        {
+            parser.expect('[');
+            if (parser.consume(']'))
+                return;
+            do
+            {
+                size_t start = parser.position();
+                Device dev = defaults;
+                bool enabled = default_enabled;
+                parse_device(parser, dev, enabled);
+                if (dev.ip.empty())
+                    parser.fail_at(start, "липсва \"ip\"");
+                keys.emplace_back(device_key(dev), start);
+                if (enabled)
+                    devices.push_back(std::move(dev));
+            } while (parser.consume(','));
+            parser.expect(']');
+        };
+
+        if (parser.peek() == '[')
+            parse_list();
+        else
+        {
+            bool has_devices = false;
+            parser.expect('{');
+            if (!parser.consume('}'))
+            {
+                do
+                {
+                    size_t start = parser.position();
+                    std::string_view key = parser.string(key_buffer);
+                    parser.expect(':');
+                    if (key == "devices")
+                    {
+                        parse_list();
+                        has_devices = true;
+                    }
+                    else if (key == "defaults" && has_devices)
+                        parser.fail_at(start, "\"defaults\" трябва да е преди \"devices\"");
+                    else if (key == "defaults")
+                    {
+                        parse_device(parser, defaults, default_enabled);
+                        if (!defaults.ip.empty())
+                            parser.fail_at(start, "\"ip\" не може да е в \"defaults\"");
+                    }
+                    else
+                        parser.skip_value();
+                } while (parser.consume(','));
+                parser.expect('}');
+            }
+            if (!has_devices)
+                parser.fail("липсва \"devices\"");
+        }
+        if (!parser.at_end())
+            parser.fail("излишен текст след края на JSON");
+
+        // Повтарящите се устройства се търсят след сортиране, вместо с хеш таблица с по един възел за устройство
+        std::sort(keys.begin(), keys.end());
+        for (size_t i = 1; i < keys.size(); ++i)
+        {
+            if (keys[i].first != keys[i - 1].first)
+                continue;
+            uint64_t key = keys[i].first;
+            parser.fail_at(keys[i].second, "повтарящо се устройство " + std::to_string(key >> 48) + "." + std::to_string(key >> 40 & 0xFF) + "." +
+                           std::to_string(key >> 32 & 0xFF) + "." + std::to_string(key >> 24 & 0xFF) + ":" + std::to_string(key >> 8 & 0xFFFF) + "/" + std::to_string(key & 0xFF));
+        }
+
+        device_count = devices.size();
+        Device* result = new Device[device_count];
+        std::move(devices.begin(), devices.end(), result);
+        return result;
     }
 
     /**
-    * Функция, която извлича данни за устройствата от конфигурационния JSON файл и ги записва в динамично създаден масив.
+    * Функция, която извлича данни за устройствата от конфигурационния JSON файл и ги записва в динамично създаден масив (вижте 'parse_devices').
     * @param config_path Пътят до директорията, в която се намира конфигурационния файл.
     * @param json_name Името на JSON файла, който съдържа информация за устройствата.
     * @param device_count Променлива, в която се записва броят на намерените устройствата в конфигурационния файл.
     * @return Указател към новосъздаден масив от структури 'Device', съдържащ информация за устройствата. Трябва да се освободи паметта след използването на масива.
-    * @throws std::runtime_error Ако файлът не може да бъде отворен или ако не се съдържа информация за устройства.
+    * @throws std::runtime_error Ако файлът не може да бъде отворен, не е валиден или не съдържа информация за устройства.
     */
     Device* load_devices(const std::string& config_path, const std::string& json_name, size_t& device_count)
     {
         std::string filename = (std::filesystem::path(config_path) / json_name).string();
-        std::ifstream file(filename);
+        std::ifstream file(filename, std::ios::binary);
         if (!file.is_open()) throw std::runtime_error("Не може да се отвори файл: " + filename);
 
-        std::stringstream buffer;
-        buffer << file.rdbuf();
-        std::string content = buffer.str();
+        std::string content;
+        file.seekg(0, std::ios::end);
+        std::streamoff size = file.tellg();
+        file.seekg(0, std::ios::beg);
+        content.resize(size > 0 ? static_cast<size_t>(size) : 0);
+        if (size > 0 && !file.read(&content[0], size))
+            throw std::runtime_error("Грешка при четенето на файл: " + filename);
         file.close();
 
-        device_count = 0;
-        device_count = std::count(content.begin(), content.end(), '{');
-        if (device_count <= 0) throw std::runtime_error("Не е открита информация за устройства в файла.");
-        else if (device_count >= SIZE_MAX) throw std::runtime_error("Неправилна стойност за 'device_count'.");
-        std::cout << "Брой намерени устройства в конфигурационния файл: " << device_count << std::endl;
-        Device* devices = new Device[device_count];
-        if (!devices) throw std::runtime_error("Грешка при инициализацията на 'devices'.");
-        size_t pos = 0;
-        size_t index = 0;
-        while ((pos = content.find('{', pos)) != std::string::npos && index < device_count)
+        Device* devices = parse_devices(content, device_count, filename);
+        if (device_count == 0)
         {
-            size_t end = content.find('}', pos);
-            if (end == std::string::npos) break;
-
-            std::string obj = content.substr(pos, end - pos + 1);
+            delete[] devices;
+            throw std::runtime_error("Не е открита информация за устройства в файла.");
+        }
+        std::cout << "Брой намерени устройства в конфигурационния файл: " << device_count << std::endl;
+        return devices;
+    }
 
-            try
-            {
-                devices[index].ip = extract_string(obj, "ip");
-                devices[index].port = static_cast<uint16_t>(extract_int(obj, "port"));
-                devices[index].device_id = extract_int(obj, "id");
-            }
-            catch(const std::exception& e)
-            {
-                std::cerr << "\n Грешка при задаването на параметрите на устройствата: " << e.what() << '\n' << std::endl;;
-            }
+    /**
+    * Функция, която сравнява стария и новия списък с устройства при презареждане на конфигурационния файл (вижте 'DeviceDiff').
+    * @param old_devices Устройствата, които се четат в момента.
+    * @param old_count Броят на елементите в old_devices.
+    * @param new_devices Устройствата от новия конфигурационен файл.
+    * @param new_count Броят на елементите в new_devices.
+    */
+    DeviceDiff diff_devices(const Device* old_devices, size_t old_count, const Device* new_devices, size_t new_count)
+    {
+        std::vector<std::pair<uint64_t, size_t>> old_keys(old_count);
+        for (size_t i = 0; i < old_count; ++i)
+            old_keys[i] = { device_key(old_devices[i]), i };
+        std::sort(old_keys.begin(), old_keys.end());
 
-            ++index;
-            pos = end + 1;
+        DeviceDiff diff;
+        diff.previous.assign(new_count, DeviceDiff::NEW_DEVICE);
+        diff.changed.assign(new_count, 0);
+        std::vector<uint8_t> kept(old_count, 0);
+        for (size_t i = 0; i < new_count; ++i)
+        {
+            std::pair<uint64_t, size_t> key(device_key(new_devices[i]), 0);
+            auto it = std::lower_bound(old_keys.begin(), old_keys.end(), key);
+            if (it == old_keys.end() || it->first != key.first)
+                continue;
+            const Device& old_dev = old_devices[it->second];
+            const Device& new_dev = new_devices[i];
+            diff.previous[i] = it->second;
+            diff.changed[i] = old_dev.name != new_dev.name || old_dev.interval != new_dev.interval || old_dev.pipeline_depth != new_dev.pipeline_depth;
+            kept[it->second] = 1;
         }
-        return devices;
+        for (size_t i = 0; i < old_count; ++i)
+        {
+            if (!kept[i])
+                diff.removed.push_back(i);
+        }
+        return diff;
+    }
+
+    /**
+    * Функция, която връща ключа на връзката на устройство. Устройствата с еднакъв ключ се четат през една TCP връзка
+    * (няколко slave id зад един Modbus шлюз).
+    * @param dev Устройството.
+    * @param shared Дали устройствата с еднакви ip и port споделят връзка. При 'false' ключът включва и идентификатора.
+    * @return "<ip>:<port>" или "<ip>:<port>/<id>".
+    */
+    std::string connection_key(const Device& dev, bool shared)
+    {
+        std::string key = dev.ip + ":" + std::to_string(dev.port);
+        if (!shared)
+            key += "/" + std::to_string(dev.device_id);
+        return key;
     }
 };
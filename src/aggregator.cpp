@@ -0,0 +1,205 @@
+#include <charconv>
+#include <cmath>
+#include <limits>
+
+#include "aggregator.hpp"
+
+namespace export_data
+{
+    /**
+    * Помощна функция, която добавя число към 'out' като 'append_csv_row' (6 значещи цифри).
+    */
+    static void append_number(std::string& out, double value)
+    {
+        char number[32];
+        std::to_chars_result r = std::to_chars(number, number + sizeof(number), value, std::chars_format::general, 6);
+        out.append(number, r.ptr);
+    }
+
+    /**
+    * Помощна функция, която добавя цяло число към 'out' без загуба на цифри (например броят на отчетите в прозореца).
+    */
+    static void append_number(std::string& out, uint32_t value)
+    {
+        char number[16];
+        std::to_chars_result r = std::to_chars(number, number + sizeof(number), value);
+        out.append(number, r.ptr);
+    }
+
+    /**
+    * Клас за натрупване на статистиките за един прозорец от време.
+    * @param plan Планът за четене, по който са получени резултатите.
+    * @param window_seconds Дължината на прозореца в секунди (поне 1).
+    */
+    WindowAggregator::WindowAggregator(const reg::ReadPlanView& plan, uint32_t window_seconds)
+     : _map(plan.map)
+     , _count(plan.reg_count)
+     , _window(window_seconds > 0 ? window_seconds : 1)
+     , _start(0)
+     , _samples(0)
+     , _value(new float[plan.reg_count]{})
+     , _valid(new uint8_t[plan.reg_count]{})
+     , _n(new uint32_t[plan.reg_count]{})
+     , _min(new float[plan.reg_count]{})
+     , _max(new float[plan.reg_count]{})
+     , _last(new float[plan.reg_count]{})
+     , _shift(new double[plan.reg_count]{})
+     , _sum(new double[plan.reg_count]{})
+     , _sum_sq(new double[plan.reg_count]{})
+    {
+        reset(0);
+    }
+
+    WindowAggregator::~WindowAggregator()
+    {
+        delete[] _value;
+        delete[] _valid;
+        delete[] _n;
+        delete[] _min;
+        delete[] _max;
+        delete[] _last;
+        delete[] _shift;
+        delete[] _sum;
+        delete[] _sum_sq;
+    }
+
+    /**
+    * Проверява дали отчет с дадено време е след края на текущия прозорец, в който вече има отчети.
+    * Тогава прозорецът трябва да се запише ('append_csv_row') преди да се извика 'add'.
+    */
+    bool WindowAggregator::due(std::time_t timestamp) const
+    {
+        return _samples > 0 && (timestamp < _start || timestamp >= _start + static_cast<std::time_t>(_window));
+    }
+
+    /**
+    * Добавя един отчет. Ако отчетът е извън текущия прозорец, статистиките се нулират и започва неговият прозорец.
+    * @param timestamp Времето на прочитане.
+    * @param results Резултатите в реда на плана за четене.
+    */
+    void WindowAggregator::add(std::time_t timestamp, const reg::RegisterResult* results)
+    {
+        if (_samples == 0 || due(timestamp))
+            reset(timestamp);
+
+        // Стойностите се събират в плътни масиви, след което всички статистики се обновяват без разклонения
+        for (size_t i = 0; i < _count; ++i)
+        {
+            _valid[i] = results[i].valid;
+            _value[i] = _map[i].type == reg::REG_FLOAT32 ? results[i].value.val_float32 : static_cast<float>(results[i].value.val_int16);
+        }
+        for (size_t i = 0; i < _count; ++i)
+        {
+            float v = _value[i];
+            bool ok = _valid[i] != 0;
+            _shift[i] = _n[i] == 0 && ok ? v : _shift[i];
+            double d = ok ? v - _shift[i] : 0.0;
+            _sum[i] += d;
+            _sum_sq[i] += d * d;
+            _n[i] += ok ? 1 : 0;
+            _min[i] = ok && v < _min[i] ? v : _min[i];
+            _max[i] = ok && v > _max[i] ? v : _max[i];
+            _last[i] = ok ? v : _last[i];
+        }
+        ++_samples;
+    }
+
+    /**
+    * Нулира статистиките и започва прозореца, в който попада дадено време.
+    */
+    void WindowAggregator::reset(std::time_t timestamp)
+    {
+        std::time_t window = static_cast<std::time_t>(_window);
+        _start = timestamp - ((timestamp % window) + window) % window;
+        _samples = 0;
+        for (size_t i = 0; i < _count; ++i)
+        {
+            _n[i] = 0;
+            _min[i] = std::numeric_limits<float>::infinity();
+            _max[i] = -std::numeric_limits<float>::infinity();
+            _last[i] = 0.0f;
+            _shift[i] = _sum[i] = _sum_sq[i] = 0.0;
+        }
+    }
+
+    /**
+    * Функция за получаване на дължината на прозореца в секунди.
+    */
+    uint32_t WindowAggregator::window() const
+    {
+        return _window;
+    }
+
+    /**
+    * Функция за получаване на началото на текущия прозорец.
+    */
+    std::time_t WindowAggregator::window_start() const
+    {
+        return _start;
+    }
+
+    /**
+    * Функция за получаване на броя на отчетите в текущия прозорец.
+    */
+    uint32_t WindowAggregator::samples() const
+    {
+        return _samples;
+    }
+
+    /**
+    * Функция, която добавя заглавния ред на .csv файла със статистиките (заедно със знака за нов ред).
+    * За всяка величина има пет колони: <символ>_min, <символ>_max, <символ>_avg, <символ>_std и <символ>_last.
+    */
+    void WindowAggregator::append_csv_header(std::string& out) const
+    {
+        static const char* const suffixes[] = { "_min (", "_max (", "_avg (", "_std (", "_last (" };
+        out.append("timestamp,samples");
+        for (size_t i = 0; i < _count; ++i)
+        {
+            for (const char* suffix : suffixes)
+            {
+                out.push_back(',');
+                out.append(_map[i].symbol);
+                out.append(suffix);
+                out.append(_map[i].unit);
+                out.push_back(')');
+            }
+        }
+        out.push_back('\n');
+    }
+
+    /**
+    * Функция, която добавя реда със статистиките на текущия прозорец (заедно със знака за нов ред).
+    * Величина без валидна стойност в прозореца има празни клетки.
+    * @param out Низът, към който се добавя редът.
+    * @param timestamp Началото на прозореца, форматирано като останалите времена в лог файловете.
+    */
+    void WindowAggregator::append_csv_row(std::string& out, std::string_view timestamp) const
+    {
+        out.append(timestamp);
+        out.push_back(',');
+        append_number(out, _samples);
+        for (size_t i = 0; i < _count; ++i)
+        {
+            if (_n[i] == 0)
+            {
+                out.append(",,,,,");
+                continue;
+            }
+            double n = _n[i];
+            double mean = _sum[i] / n;
+            double variance = _sum_sq[i] / n - mean * mean;
+            out.push_back(',');
+            append_number(out, _min[i]);
+            out.push_back(',');
+            append_number(out, _max[i]);
+            out.push_back(',');
+            append_number(out, _shift[i] + mean);
+            out.push_back(',');
+            append_number(out, variance > 0 ? std::sqrt(variance) : 0.0);
+            out.push_back(',');
+            append_number(out, _last[i]);
+        }
+        out.push_back('\n');
+    }
+};
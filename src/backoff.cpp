@@ -0,0 +1,51 @@
+#include <algorithm>
+
+#include "backoff.hpp"
+
+namespace retry
+{
+    /**
+    * Клас за изчисляване на времето между опитите за свързване.
+    * @param initial Изчакване след първия неуспешен опит.
+    * @param max Максимално изчакване.
+    * @param seed Начална стойност за случайното отклонение (например индексът на устройството).
+    */
+    Backoff::Backoff(std::chrono::milliseconds initial, std::chrono::milliseconds max, uint32_t seed)
+     : _initial(std::max(initial, std::chrono::milliseconds(1)))
+     , _max(std::max(max, _initial))
+     , _current(_initial)
+     , _attempts(0)
+     , _random(seed + 1)
+    {
+    }
+
+    /**
+    * Връща изчакването преди следващия опит и удвоява следващото (до максималното).
+    * @return Случайно време между половината и цялото текущо изчакване.
+    */
+    std::chrono::milliseconds Backoff::next()
+    {
+        std::chrono::milliseconds half = _current / 2;
+        std::chrono::milliseconds delay = half + std::chrono::milliseconds(_random() % (half.count() + 1));
+        _current = std::min(_current * 2, _max);
+        ++_attempts;
+        return delay;
+    }
+
+    /**
+    * Връща началното изчакване след успешно свързване.
+    */
+    void Backoff::reset()
+    {
+        _current = _initial;
+        _attempts = 0;
+    }
+
+    /**
+    * Функция за получаване на броя на неуспешните опити от последното успешно свързване.
+    */
+    uint32_t Backoff::attempts() const
+    {
+        return _attempts;
+    }
+};
@@ -0,0 +1,419 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "bin_log.hpp"
+#include "export_data.hpp"
+#include "timestamp.hpp"
+
+namespace bin_log
+{
+    /**
+    * Помощни функции за запис и четене на числа в little-endian ред, независимо от процесора.
+    */
+    static void put_u16(std::string& out, uint16_t v)
+    {
+        out.push_back(static_cast<char>(v & 0xFF));
+        out.push_back(static_cast<char>(v >> 8));
+    }
+
+    static void put_u32(std::string& out, uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+
+    static void put_u64(std::string& out, uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+
+    static void put_text(std::string& out, std::string_view text)
+    {
+        size_t length = text.size() < 255 ? text.size() : 255;
+        out.push_back(static_cast<char>(length));
+        out.append(text.data(), length);
+    }
+
+    static uint64_t get_le(const char* p, int bytes)
+    {
+        uint64_t v = 0;
+        for (int i = bytes - 1; i >= 0; --i) v = v << 8 | static_cast<uint8_t>(p[i]);
+        return v;
+    }
+
+    /**
+    * Функция, която връща размера на един запис в байтове за даден план.
+    * @param delta Дали записите са само с промените (тогава връща най-големия възможен размер).
+    */
+    size_t record_size(const reg::ReadPlanView& plan, bool delta)
+    {
+        size_t size = 8 + (delta ? 2 : 1) * ((plan.reg_count + 7) / 8);
+        for (size_t i = 0; i < plan.reg_count; ++i)
+            size += plan.map[i].type == reg::REG_FLOAT32 ? 4 : 2;
+        return size;
+    }
+
+    /**
+    * Функция, която добавя заглавието на файла (описанието на колоните) към 'out'.
+    * @param out Низът, към който се добавя заглавието.
+    * @param plan Планът за четене, чиито величини са колоните.
+    * @param delta Дали следват записи само с промените ('append_delta_record').
+    */
+    void append_header(std::string& out, const reg::ReadPlanView& plan, bool delta)
+    {
+        out.append(MAGIC, sizeof(MAGIC));
+        put_u16(out, delta ? VERSION_DELTA : VERSION);
+        put_u16(out, static_cast<uint16_t>(plan.reg_count));
+        put_u32(out, static_cast<uint32_t>(record_size(plan, delta)));
+        for (size_t i = 0; i < plan.reg_count; ++i)
+        {
+            out.push_back(static_cast<char>(plan.map[i].type));
+            put_text(out, plan.map[i].symbol);
+            put_text(out, plan.map[i].unit);
+            put_text(out, plan.map[i].name);
+        }
+    }
+
+    /**
+    * Функция, която добавя един запис към 'out'.
+    * @param out Низът, към който се добавя записът.
+    * @param timestamp_ms Времето на прочитане в милисекунди от 1970-01-01 UTC.
+    * @param plan Планът за четене, по който са получени резултатите.
+    * @param results Резултатите в реда на plan.map.
+    */
+    void append_record(std::string& out, int64_t timestamp_ms, const reg::ReadPlanView& plan, const reg::RegisterResult* results)
+    {
+        put_u64(out, static_cast<uint64_t>(timestamp_ms));
+        uint8_t bits = 0;
+        for (size_t i = 0; i < plan.reg_count; ++i)
+        {
+            if (results[i].valid) bits |= static_cast<uint8_t>(1u << (i % 8));
+            if (i % 8 == 7 || i + 1 == plan.reg_count)
+            {
+                out.push_back(static_cast<char>(bits));
+                bits = 0;
+            }
+        }
+        for (size_t i = 0; i < plan.reg_count; ++i)
+        {
+            if (plan.map[i].type == reg::REG_FLOAT32)
+            {
+                uint32_t as_int = 0;
+                if (results[i].valid) std::memcpy(&as_int, &results[i].value.val_float32, sizeof(as_int));
+                put_u32(out, as_int);
+            }
+            else
+            {
+                put_u16(out, results[i].valid ? results[i].value.val_int16 : 0);
+            }
+        }
+    }
+
+    /**
+    * Функция, която добавя запис само с променените стойности към 'out' (файлът трябва да е със заглавие на версия 2).
+    * @param out Низът, към който се добавя записът.
+    * @param timestamp_ms Времето на прочитане в милисекунди от 1970-01-01 UTC.
+    * @param plan Планът за четене, по който са получени резултатите.
+    * @param results Резултатите в реда на plan.map.
+    * @param changed Битова маска на стойностите за запис (от 'export_data::ChangeFilter::update').
+    */
+    void append_delta_record(std::string& out, int64_t timestamp_ms, const reg::ReadPlanView& plan, const reg::RegisterResult* results, const uint8_t* changed)
+    {
+        put_u64(out, static_cast<uint64_t>(timestamp_ms));
+        size_t mask_size = (plan.reg_count + 7) / 8;
+        out.append(reinterpret_cast<const char*>(changed), mask_size);
+        for (size_t b = 0; b < mask_size; ++b)
+        {
+            uint8_t bits = 0;
+            for (size_t i = 8 * b; i < plan.reg_count && i < 8 * b + 8; ++i)
+                if (results[i].valid) bits |= static_cast<uint8_t>(1u << (i % 8));
+            out.push_back(static_cast<char>(bits & changed[b]));
+        }
+        for (size_t i = 0; i < plan.reg_count; ++i)
+        {
+            if (!((changed[i / 8] >> (i % 8)) & 1) || !results[i].valid)
+                continue;
+            if (plan.map[i].type == reg::REG_FLOAT32)
+            {
+                uint32_t as_int = 0;
+                std::memcpy(&as_int, &results[i].value.val_float32, sizeof(as_int));
+                put_u32(out, as_int);
+            }
+            else
+            {
+                put_u16(out, results[i].value.val_int16);
+            }
+        }
+    }
+
+    /**
+    * Добавя колона. Низовете се копират.
+    */
+    void Columns::add(reg::RegType type, std::string_view symbol, std::string_view unit, std::string_view name)
+    {
+        // Колоните сочат към низовете в '_strings', затова всеки низ е в отделен unique_ptr и не се мести
+        auto keep = [this](std::string_view text) -> std::string_view
+        {
+            _strings.emplace_back(new std::string(text));
+            return *_strings.back();
+        };
+        reg::RegisterRead column{};
+        column.type = type;
+        column.symbol = keep(symbol);
+        column.unit = keep(unit);
+        column.name = keep(name);
+        _columns.push_back(column);
+
+        _plan.map = _columns.data();
+        _plan.reg_count = _columns.size();
+        _csv_header.resize(reg::csv_header_length(_plan.map, _plan.reg_count));
+        reg::build_csv_header(_plan.map, _plan.reg_count, &_csv_header[0]);
+        _plan.csv_header = _csv_header;
+    }
+
+    /**
+    * Функция за получаване на броя на колоните.
+    */
+    size_t Columns::size() const
+    {
+        return _columns.size();
+    }
+
+    /**
+    * Функция за получаване на колоните (само name, symbol, unit и type са попълнени).
+    */
+    const reg::RegisterRead* Columns::data() const
+    {
+        return _columns.data();
+    }
+
+    /**
+    * Функция за получаване на план с колоните. Попълнени са само map, reg_count и csv_header,
+    * което е достатъчно за 'export_data::append_csv_row' и за 'record_size'.
+    */
+    const reg::ReadPlanView& Columns::plan() const
+    {
+        return _plan;
+    }
+
+    /**
+    * Функция, която прочита заглавието (записано с 'append_header') от поток.
+    * @param in Потокът, позициониран в началото на заглавието.
+    * @param columns Обект, в който се добавят прочетените колони.
+    * @param delta Променлива, в която се записва дали записите са само с промените (nullptr - приемат се само пълни записи).
+    * @return Размерът на един запис в байтове (при записи само с промените - най-големият възможен размер).
+    * @throws std::runtime_error Ако заглавието не е валидно.
+    */
+    size_t read_header(std::istream& in, Columns& columns, bool* delta)
+    {
+        char fixed[16];
+        if (!in.read(fixed, sizeof(fixed)) || std::memcmp(fixed, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::runtime_error("Данните не са двоичен лог.");
+        uint64_t version = get_le(fixed + 8, 2);
+        if (version != VERSION && !(delta && version == VERSION_DELTA))
+            throw std::runtime_error("Неподдържана версия на двоичен лог: " + std::to_string(version));
+        if (delta)
+            *delta = version == VERSION_DELTA;
+        size_t count = static_cast<size_t>(get_le(fixed + 10, 2));
+        size_t size = static_cast<size_t>(get_le(fixed + 12, 4));
+
+        auto read_text = [&in]()
+        {
+            char length = 0;
+            std::string text;
+            if (in.get(length))
+            {
+                text.resize(static_cast<uint8_t>(length));
+                in.read(&text[0], static_cast<uint8_t>(length));
+            }
+            return text;
+        };
+        for (size_t i = 0; i < count; ++i)
+        {
+            char type = 0;
+            in.get(type);
+            std::string symbol = read_text();
+            std::string unit = read_text();
+            std::string name = read_text();
+            columns.add(static_cast<uint8_t>(type) < reg::REG_UNKNOWN ? static_cast<reg::RegType>(type) : reg::REG_UNKNOWN, symbol, unit, name);
+        }
+        if (!in)
+            throw std::runtime_error("Непълно заглавие на двоичен лог.");
+        if (record_size(columns.plan(), version == VERSION_DELTA) != size)
+            throw std::runtime_error("Неправилен размер на записите в двоичен лог.");
+        return size;
+    }
+
+    /**
+    * Клас за четене на двоичен лог файл.
+    * @param path Пътят до файла.
+    * @throws std::runtime_error Ако файлът не може да се отвори или заглавието не е валидно.
+    */
+    Reader::Reader(const std::string& path)
+     : _file(path, std::ios::binary)
+     , _in(_file)
+     , _record_size(0)
+     , _delta(false)
+    {
+        if (!_file.is_open())
+            throw std::runtime_error("Грешка при отварянето на файл: " + path);
+        try
+        {
+            init();
+        }
+        catch (const std::exception& e)
+        {
+            throw std::runtime_error(path + ": " + e.what());
+        }
+    }
+
+    /**
+    * Клас за четене на двоичен лог от поток. Потокът трябва да съществува, докато обектът се използва.
+    * @param in Потокът, позициониран в началото на заглавието.
+    * @throws std::runtime_error Ако заглавието не е валидно.
+    */
+    Reader::Reader(std::istream& in)
+     : _in(in)
+     , _record_size(0)
+     , _delta(false)
+    {
+        init();
+    }
+
+    /**
+    * Прочита заглавието и подготвя буферите за записите.
+    */
+    void Reader::init()
+    {
+        _record_size = read_header(_in, _columns, &_delta);
+        _record.resize(_record_size);
+        _state.resize(_columns.size());
+        for (size_t i = 0; i < _columns.size(); ++i)
+            _state[i].name = _columns.data()[i].name;
+    }
+
+    /**
+    * Функция за получаване на колоните на файла.
+    */
+    const Columns& Reader::columns() const
+    {
+        return _columns;
+    }
+
+    /**
+    * Прочита следващия запис.
+    * @param timestamp_ms Променлива, в която се записва времето в милисекунди от 1970-01-01 UTC.
+    * @param results Масив с 'columns().size()' елемента, в който се записват стойностите.
+    * @return False в края на файла (непълен последен запис също се пропуска).
+    */
+    bool Reader::next(int64_t& timestamp_ms, reg::RegisterResult* results)
+    {
+        if (_delta)
+            return next_delta(timestamp_ms, results);
+        if (!_in.read(&_record[0], static_cast<std::streamsize>(_record_size)))
+            return false;
+        const char* p = _record.data();
+        timestamp_ms = static_cast<int64_t>(get_le(p, 8));
+        const char* bitmap = p + 8;
+        const char* value = bitmap + (_columns.size() + 7) / 8;
+        for (size_t i = 0; i < _columns.size(); ++i)
+        {
+            const reg::RegisterRead& column = _columns.data()[i];
+            results[i].name = column.name;
+            results[i].valid = (static_cast<uint8_t>(bitmap[i / 8]) >> (i % 8)) & 1;
+            if (column.type == reg::REG_FLOAT32)
+            {
+                uint32_t as_int = static_cast<uint32_t>(get_le(value, 4));
+                std::memcpy(&results[i].value.val_float32, &as_int, sizeof(as_int));
+                value += 4;
+            }
+            else
+            {
+                results[i].value.val_int16 = static_cast<uint16_t>(get_le(value, 2));
+                value += 2;
+            }
+        }
+        return true;
+    }
+
+    /**
+    * Прочита следващия запис само с промените и го прилага към последния възстановен отчет.
+    */
+    bool Reader::next_delta(int64_t& timestamp_ms, reg::RegisterResult* results)
+    {
+        size_t mask_size = (_columns.size() + 7) / 8;
+        size_t fixed = 8 + 2 * mask_size;
+        if (!_in.read(&_record[0], static_cast<std::streamsize>(fixed)))
+            return false;
+        const char* changed = _record.data() + 8;
+        const char* valid = changed + mask_size;
+        size_t size = fixed;
+        for (size_t i = 0; i < _columns.size(); ++i)
+            if ((static_cast<uint8_t>(valid[i / 8]) >> (i % 8)) & 1)
+                size += _columns.data()[i].type == reg::REG_FLOAT32 ? 4 : 2;
+        if (size > _record_size || !_in.read(&_record[fixed], static_cast<std::streamsize>(size - fixed)))
+            return false;
+
+        timestamp_ms = static_cast<int64_t>(get_le(_record.data(), 8));
+        const char* value = _record.data() + fixed;
+        for (size_t i = 0; i < _columns.size(); ++i)
+        {
+            if ((static_cast<uint8_t>(changed[i / 8]) >> (i % 8)) & 1)
+            {
+                reg::RegisterResult& state = _state[i];
+                state.valid = (static_cast<uint8_t>(valid[i / 8]) >> (i % 8)) & 1;
+                if (state.valid && _columns.data()[i].type == reg::REG_FLOAT32)
+                {
+                    uint32_t as_int = static_cast<uint32_t>(get_le(value, 4));
+                    std::memcpy(&state.value.val_float32, &as_int, sizeof(as_int));
+                    value += 4;
+                }
+                else if (state.valid)
+                {
+                    state.value.val_int16 = static_cast<uint16_t>(get_le(value, 2));
+                    value += 2;
+                }
+            }
+            results[i] = _state[i];
+        }
+        return true;
+    }
+
+    /**
+    * Функция, която преобразува двоичен лог файл в .csv файл.
+    * @param bin_path Пътят до двоичния файл.
+    * @param csv_path Пътят до новия .csv файл.
+    * @return Броят на преобразуваните записи.
+    * @throws std::runtime_error При грешка в някой от файловете.
+    */
+    size_t to_csv(const std::string& bin_path, const std::string& csv_path)
+    {
+        Reader reader(bin_path);
+        std::ofstream csv(csv_path);
+        if (!csv.is_open())
+            throw std::runtime_error("Грешка при отварянето на файл: " + csv_path);
+
+        std::vector<reg::RegisterResult> results(reader.columns().size());
+        std::string buffer;
+        buffer.reserve(128 * 1024);
+        buffer.append(reader.columns().plan().csv_header);
+        buffer.push_back('\n');
+
+        timestamp::Formatter formatter;
+        size_t count = 0;
+        int64_t timestamp_ms = 0;
+        while (reader.next(timestamp_ms, results.data()))
+        {
+            export_data::append_csv_row(buffer, formatter.format(timestamp_ms), reader.columns().plan(), results.data());
+            ++count;
+            if (buffer.size() >= 64 * 1024)
+            {
+                csv.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                buffer.clear();
+            }
+        }
+        csv.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (!csv)
+            throw std::runtime_error("Грешка при записа в .csv файл: " + csv_path);
+        return count;
+    }
+};
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include "change_filter.hpp"
+
+namespace export_data
+{
+    /**
+    * Помощна функция, която преобразува една мъртва зона: "0.5" (в мерната единица) или "1%" (от последната записана стойност).
+    * @throws std::runtime_error Ако стойността не е неотрицателно число.
+    */
+    static Deadband parse_deadband(std::string_view text)
+    {
+        Deadband band;
+        if (!text.empty() && text.back() == '%')
+        {
+            band.percent = true;
+            text.remove_suffix(1);
+        }
+        std::string number(text);
+        char* end = nullptr;
+        band.value = std::strtof(number.c_str(), &end);
+        if (number.empty() || end != number.c_str() + number.size() || !(band.value >= 0))
+            throw std::runtime_error("Невалидна мъртва зона: " + number);
+        return band;
+    }
+
+    /**
+    * Функция, която преобразува описанието на мъртвите зони от аргумента '--deadband'.
+    * Описанието е списък, разделен със запетаи: стойност без символ се отнася за всички величини, а "символ=стойност" - само за
+    * величината с този символ (независимо от реда в списъка). Пример: "0.5%,T=0.2,E_in=1".
+    * @param spec Описанието на мъртвите зони.
+    * @param plan Планът за четене, чиито символи се използват.
+    * @return Мъртвата зона на всяка величина в реда на plan.map.
+    * @throws std::runtime_error При непознат символ или невалидна стойност.
+    */
+    std::vector<Deadband> parse_deadbands(std::string_view spec, const reg::ReadPlanView& plan)
+    {
+        std::vector<Deadband> bands(plan.reg_count);
+        std::vector<std::string_view> overrides;
+        while (!spec.empty())
+        {
+            size_t comma = spec.find(',');
+            std::string_view item = spec.substr(0, comma);
+            spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+            if (item.empty())
+                continue;
+            if (item.find('=') != std::string_view::npos)
+                overrides.push_back(item);
+            else
+                bands.assign(plan.reg_count, parse_deadband(item));
+        }
+        for (std::string_view item : overrides)
+        {
+            size_t eq = item.find('=');
+            std::string_view symbol = item.substr(0, eq);
+            size_t i = 0;
+            while (i < plan.reg_count && plan.map[i].symbol != symbol)
+                ++i;
+            if (i == plan.reg_count)
+                throw std::runtime_error("Непознат символ в мъртвите зони: " + std::string(symbol));
+            bands[i] = parse_deadband(item.substr(eq + 1));
+        }
+        return bands;
+    }
+
+    /**
+    * Клас за избор на променените стойности.
+    * @param plan Планът за четене, по който са получени резултатите.
+    * @param deadbands Мъртвата зона на всяка величина в реда на plan.map (празен - записва се всяка промяна).
+    * @param heartbeat Максимално време в секунди, през което една стойност може да не се записва. При 0 няма ограничение.
+    */
+    ChangeFilter::ChangeFilter(const reg::ReadPlanView& plan, const std::vector<Deadband>& deadbands, float heartbeat)
+     : _map(plan.map)
+     , _count(plan.reg_count)
+     , _bands(new Deadband[plan.reg_count])
+     , _last(new reg::RegisterResult[plan.reg_count]{})
+     , _last_time(new std::time_t[plan.reg_count]{})
+     , _heartbeat(heartbeat > 0 ? std::max<std::time_t>(1, static_cast<std::time_t>(std::lround(heartbeat))) : 0)
+     , _first(true)
+    {
+        for (size_t i = 0; i < _count && i < deadbands.size(); ++i)
+            _bands[i] = deadbands[i];
+    }
+
+    ChangeFilter::~ChangeFilter()
+    {
+        delete[] _bands;
+        delete[] _last;
+        delete[] _last_time;
+    }
+
+    /**
+    * Функция, която връща размера в байтове на битовата маска, подавана на 'update'.
+    */
+    size_t ChangeFilter::mask_size() const
+    {
+        return (_count + 7) / 8;
+    }
+
+    /**
+    * Следващият отчет се записва целият, както първият. Така четенето на файла може да започне от него (вижте 'log_index').
+    */
+    void ChangeFilter::restart()
+    {
+        _first = true;
+    }
+
+    /**
+    * Сравнява отчет с последните записани стойности и запомня стойностите, които трябва да се запишат.
+    * @param timestamp Времето на прочитане.
+    * @param results Резултатите в реда на плана за четене.
+    * @param changed Битова маска с 'mask_size()' байта, в която бит i на байт i / 8 показва дали стойност i % 8 трябва да се запише.
+    * @return Броят на стойностите за запис. При 0 отчетът може да се пропусне.
+    */
+    size_t ChangeFilter::update(std::time_t timestamp, const reg::RegisterResult* results, uint8_t* changed)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < mask_size(); ++i)
+            changed[i] = 0;
+        for (size_t i = 0; i < _count; ++i)
+        {
+            bool silent = _heartbeat > 0 && timestamp - _last_time[i] >= _heartbeat;
+            if (!_first && !silent && !differs(i, results[i]))
+                continue;
+            changed[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+            _last[i] = results[i];
+            _last_time[i] = timestamp;
+            ++count;
+        }
+        _first = false;
+        return count;
+    }
+
+    /**
+    * Проверява дали стойност i е извън мъртвата зона около последната записана стойност.
+    */
+    bool ChangeFilter::differs(size_t i, const reg::RegisterResult& value) const
+    {
+        const reg::RegisterResult& last = _last[i];
+        if (value.valid != last.valid)
+            return true;
+        if (!value.valid)
+            return false;
+        double current = 0, previous = 0;
+        if (_map[i].type == reg::REG_FLOAT32)
+        {
+            current = value.value.val_float32;
+            previous = last.value.val_float32;
+            if (std::isnan(current) || std::isnan(previous))
+                return std::isnan(current) != std::isnan(previous);
+        }
+        else
+        {
+            current = value.value.val_int16;
+            previous = last.value.val_int16;
+        }
+        if (current == previous)
+            return false;
+        double limit = _bands[i].percent ? _bands[i].value / 100.0 * std::fabs(previous) : _bands[i].value;
+        return std::fabs(current - previous) > limit;
+    }
+};
@@ -0,0 +1,107 @@
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "config_watch.hpp"
+
+namespace config_watch
+{
+    /**
+    * Време без нови промени, след което файлът се смята за записан докрай.
+    * Редакторите и скриптовете често записват файла на няколко стъпки (съкращаване, запис, преименуване).
+    */
+    static const std::chrono::milliseconds SETTLE_TIME(250);
+
+    /**
+    * Клас за следене на промените в един файл.
+    * @param path Пътят до файла. Директорията му трябва да съществува, а самият файл може да бъде заменен или създаден отново.
+    */
+    Watcher::Watcher(const std::string& path)
+     : _path(path)
+     , _name(_path.filename().string())
+     , _fd(-1)
+    {
+        std::error_code ec;
+        _mtime = std::filesystem::last_write_time(_path, ec);
+    #ifdef __linux__
+        std::filesystem::path dir = _path.parent_path();
+        _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (_fd >= 0 && inotify_add_watch(_fd, dir.empty() ? "." : dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        {
+            close(_fd);
+            _fd = -1;
+        }
+    #endif
+    }
+
+    Watcher::~Watcher()
+    {
+    #ifdef __linux__
+        if (_fd >= 0)
+            close(_fd);
+    #endif
+    }
+
+    /**
+    * Чака промяна на файла. Връща се, след като файлът не се е променял 'SETTLE_TIME', за да не се прочете наполовина записан файл.
+    * @param timeout Максимално време за изчакване на първата промяна.
+    * @return Дали файлът е променен.
+    */
+    bool Watcher::wait(std::chrono::milliseconds timeout)
+    {
+        if (!poll_events(timeout))
+            return false;
+        while (poll_events(SETTLE_TIME))
+        {
+        }
+        return true;
+    }
+
+    /**
+    * Помощна функция, която чака събитие за файла (или проверява времето на последната промяна, ако inotify не е наличен).
+    */
+    bool Watcher::poll_events(std::chrono::milliseconds timeout)
+    {
+    #ifdef __linux__
+        if (_fd >= 0)
+        {
+            pollfd pfd{ _fd, POLLIN, 0 };
+            if (poll(&pfd, 1, static_cast<int>(timeout.count())) <= 0)
+                return false;
+            bool changed = false;
+            alignas(inotify_event) char buffer[4096];
+            ssize_t len = 0;
+            while ((len = read(_fd, buffer, sizeof(buffer))) > 0)
+            {
+                for (ssize_t pos = 0; pos < len; )
+                {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + pos);
+                    if ((event->mask & IN_Q_OVERFLOW) || (event->len > 0 && _name == event->name))
+                        changed = true;
+                    pos += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                }
+            }
+            return changed;
+        }
+    #endif
+        std::this_thread::sleep_for(timeout);
+        return modified();
+    }
+
+    /**
+    * Помощна функция, която проверява дали времето на последната промяна на файла е различно от последната проверка.
+    */
+    bool Watcher::modified()
+    {
+        std::error_code ec;
+        std::filesystem::file_time_type mtime = std::filesystem::last_write_time(_path, ec);
+        if (ec || mtime == _mtime)
+            return false;
+        _mtime = mtime;
+        return true;
+    }
+};
@@ -1,11 +1,16 @@
 #include <iostream>
-#include <fstream>
 #include <filesystem>
 #include <chrono>
 #include <thread>
 #include <iomanip>
+#include <charconv>
+#include <memory>
+#include <vector>
 
 #include "export_data.hpp"
+#include "p30h_pollSchedule.hpp"
+#include "ticker.hpp"
+#include "timestamp.hpp"
 
 namespace export_data
 {
@@ -15,97 +20,271 @@ namespace export_data
     */
     std::string current_timestamp()
     {
-        std::time_t now = std::time(nullptr);
-        std::tm local_tm = *std::localtime(&now);
-        std::ostringstream oss;
-        oss << std::put_time(&local_tm, "%Y-%m-%d %H:%M:%S");
-        return oss.str();
+        return format_timestamp(std::time(nullptr));
     }
 
     /**
-    * Функция, която записва получените резултати от регистрите в .csv файл.
-    * @param reader Устройството, от което ще се чете.
-    * @param reg_map Масив, от който се извлича кои данни да бъдат прочетени от устройството.
-    * @param reg_count Броя на елементите в масива reg_map.
+    * Функция, която форматира дадено време като локална дата и час ("%Y-%m-%d %H:%M:%S").
+    * Може да се извиква едновременно от няколко нишки. За форматиране на много записи (с милисекунди) вижте 'timestamp::Formatter'.
+    * @param t Времето в секунди от 1970-01-01 UTC.
+    */
+    std::string format_timestamp(std::time_t t)
+    {
+        std::tm local_tm = timestamp::local_time(t);
+        char text[32];
+        size_t length = std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local_tm);
+        return std::string(text, length);
+    }
+
+    /**
+    * Функция, която съставя името на нов лог файл за дадено устройство: P30H(<ip>)_data_<дата>_<час><extension>.
+    * @param log_path Пътят към .csv файла/файловете.
+    * @param host IP адреса на устройството.
+    * @param extension Разширението на файла (".csv" или ".bin").
+    * @param time Времето в името на файла (0 - текущото време).
+    * @return Пълният път до файла.
+    */
+    std::string csv_file_name(std::string_view log_path, const std::string& host, std::string_view extension, std::time_t time)
+    {
+        std::tm tm = timestamp::local_time(time != 0 ? time : std::time(nullptr));
+        std::ostringstream fname;
+        fname << "P30H(" << host << ")_data_" << std::put_time(&tm, "%Y-%m-%d_%H-%M-%S") << extension;
+        return (std::filesystem::path(log_path) / fname.str()).string();
+    }
+
+    /**
+    * Функция, която записва един ред с резултати в .csv формат (без знак за нов ред).
+    * @param csv Потокът, в който се записва.
+    * @param timestamp Времето на прочитане.
+    * @param plan Планът за четене, по който са получени резултатите.
+    * @param results Резултатите в реда на plan.map.
+    */
+    void write_csv_row(std::ostream& csv, const std::string& timestamp, const reg::ReadPlanView& plan, const reg::RegisterResult* results)
+    {
+        csv << timestamp;
+        for (size_t i = 0; i < plan.reg_count; ++i)
+        {
+            if (!results[i].valid)
+            {
+                csv << ",";
+                continue;
+            }
+            if (plan.map[i].type == reg::REG_INT16)
+                csv << "," << results[i].value.val_int16;
+            else if (plan.map[i].type == reg::REG_FLOAT32)
+                csv << "," << results[i].value.val_float32;
+            else
+                csv << ",";
+        }
+    }
+
+    /**
+    * Помощна функция, която добавя една стойност към 'out' (без std::ostream и без зависимост от локала).
+    */
+    static void append_csv_value(std::string& out, reg::RegType type, const reg::RegisterResult& result)
+    {
+        char number[32];
+        std::to_chars_result r{ number, std::errc() };
+        if (type == reg::REG_INT16)
+            r = std::to_chars(number, number + sizeof(number), result.value.val_int16);
+        else if (type == reg::REG_FLOAT32)
+            r = std::to_chars(number, number + sizeof(number), result.value.val_float32, std::chars_format::general, 6);
+        out.append(number, r.ptr);
+    }
+
+    /**
+    * Функция, която добавя един ред с резултати в .csv формат към 'out' (заедно със знака за нов ред).
+    * Числата се форматират както от 'write_csv_row', но без std::ostream и без зависимост от локала.
+    * @param out Низът, към който се добавя редът.
+    * @param timestamp Времето на прочитане.
+    * @param plan Планът за четене, по който са получени резултатите.
+    * @param results Резултатите в реда на plan.map.
+    */
+    void append_csv_row(std::string& out, std::string_view timestamp, const reg::ReadPlanView& plan, const reg::RegisterResult* results)
+    {
+        out.append(timestamp);
+        for (size_t i = 0; i < plan.reg_count; ++i)
+        {
+            out.push_back(',');
+            if (results[i].valid)
+                append_csv_value(out, plan.map[i].type, results[i]);
+        }
+        out.push_back('\n');
+    }
+
+    /**
+    * Функция, която добавя ред само с променените стойности (режим 'само промени' на 'LogWriter').
+    * Клетките на непроменените стойности са празни, а невалидните стойности се записват като "N/A", за да се различават от тях.
+    * @param out Низът, към който се добавя редът.
+    * @param timestamp Времето на прочитане.
+    * @param plan Планът за четене, по който са получени резултатите.
+    * @param results Резултатите в реда на plan.map.
+    * @param changed Битова маска на стойностите за запис (от 'ChangeFilter::update').
+    */
+    void append_csv_changes(std::string& out, std::string_view timestamp, const reg::ReadPlanView& plan, const reg::RegisterResult* results, const uint8_t* changed)
+    {
+        out.append(timestamp);
+        for (size_t i = 0; i < plan.reg_count; ++i)
+        {
+            out.push_back(',');
+            if (!((changed[i / 8] >> (i % 8)) & 1))
+                continue;
+            if (results[i].valid)
+                append_csv_value(out, plan.map[i].type, results[i]);
+            else
+                out.append("N/A");
+        }
+        out.push_back('\n');
+    }
+
+    /**
+    * Функция, която чете няколко устройства (slave id) през една връзка, например зад един Modbus шлюз, и записва резултатите
+    * на всяко устройство в отделен .csv файл (или двоичен лог файл според 'options.format').
+    * Отчетите са един след друг, а следващ е отчетът с най-ранно време, затова всяко устройство получава равен дял от връзката,
+    * а бавно или недостъпно устройство забавя останалите само с времето на своите заявки.
+    * Времената на отчетите са абсолютни (вижте 'ticker::Ticker'), затова продължителността на отчета и записа не измества следващите.
+    * Форматирането и записът на диска стават в нишката на 'LogWriter', затова бавен диск не забавя следващото четене.
+    * @param reader Връзката, през която се чете. Идентификаторът, pipelining и статистиката ѝ се сменят преди всеки отчет.
+    *               Прекъсната връзка се възстановява от самия 'reader', а отчетите без връзка са с невалидни стойности.
+    * @param plan План за четене (например 'reg::reg_plan'), от който се извлича кои данни да бъдат прочетени от устройствата.
+    * @param units Масив с устройствата.
+    * @param unit_count Броят на елементите в масива units.
     * @param stop_flag Флаг, с който се прекъсва функцията при необходимост.
     * @param log_path Пътят към .csv файла/файловете (без името на файла с неговото разширение).
-    * @param interval Интервал от време, за който да се изчака преди да се направи нов запис в файла. По подразбиране е една секунда.
-    * @param max_samples Максимален позволен брой записи. По подразбиране няма ограничение.
+    * @param max_samples Максимален позволен брой записи (общо за всички устройства). По подразбиране няма ограничение.
+    * @param options Форматът на файла и кога данните да се записват на диска (вижте 'WriterOptions').
     */
-    void poll_to_csv(P30HTcpReader& reader, reg::RegisterRead* reg_map, size_t reg_count, std::atomic<bool>* stop_flag, std::string_view log_path, float interval, size_t max_samples)
+    void poll_units_to_csv(P30HTcpReader& reader, const reg::ReadPlanView& plan, const PollUnit* units, size_t unit_count, std::atomic<bool>* stop_flag, std::string_view log_path, size_t max_samples, const WriterOptions& options)
     {
         namespace fs = std::filesystem;
+        typedef std::chrono::steady_clock Clock;
         fs::create_directories(log_path);
 
-        time_t t = std::time(nullptr);
-        std::tm tm = *std::localtime(&t);
-        std::ostringstream fname;
-        fname << "P30H(" << reader.get_host() << ")_data_" << std::put_time(&tm, "%Y-%m-%d_%H-%M-%S") << ".csv";
-        
-        std::string csv_filename = (fs::path(log_path) / fname.str()).string();
-        std::ofstream csv(csv_filename);
-        if (!csv.is_open())
+        LogWriter writer(plan, options);
+        std::vector<size_t> files(unit_count);
+        try
+        {
+            for (size_t u = 0; u < unit_count; ++u)
+                files[u] = writer.add_file(log_path, units[u].host, units[u].metrics);
+        }
+        catch (const std::exception& ex)
         {
-            std::cerr << "Грешка при отварянето на файл: " << csv_filename << std::endl;
+            std::cerr << ex.what() << std::endl;
             return;
         }
+        writer.start();
+
+        // Бавно променящите се величини се четат само в част от интервалите (вижте 'RegisterRead::period_ms')
+        std::vector<std::unique_ptr<reg::PollSchedule>> schedules(unit_count);
+        std::vector<ticker::Ticker> tickers(unit_count);
+        Clock::time_point started = Clock::now();
+        for (size_t u = 0; u < unit_count; ++u)
+        {
+            schedules[u].reset(new reg::PollSchedule(plan, units[u].interval));
+            tickers[u].start(ticker::period_from_seconds(units[u].interval), ticker::period_from_seconds(units[u].phase), units[u].align, started);
+        }
+
+        // Връзка без нито един отговор се затваря едва когато не отговаря нито едно устройство в нея (вижте 'P30HTcpReader::LinkState')
+        reader.set_silent_limit(unit_count);
+        P30HTcpReader::LinkState link = reader.get_link_state();
+        Clock::time_point retry_at = reader.get_retry_time();
 
-        bool header_written = false;
         size_t count = 0;
-        while (true)
+        while (unit_count > 0)
         {
             if (stop_flag && stop_flag->load())
                 break;
 
-            std::string timestamp = current_timestamp();
+            size_t u = 0;
+            for (size_t k = 1; k < unit_count; ++k)
+                if (tickers[k].deadline() < tickers[u].deadline())
+                    u = k;
+            Clock::time_point deadline = tickers[u].deadline();
+            Clock::time_point now = Clock::now();
+            if (deadline > now)
+            {
+                // Изчакването е на части, за да се проверява флагът за спиране
+                std::this_thread::sleep_until(std::min(deadline, now + std::chrono::milliseconds(200)));
+                continue;
+            }
+
+            const PollUnit& unit = units[u];
+            reader.set_slave_id(unit.slave_id);
+            if (unit.pipeline_depth > 0)
+                reader.set_pipeline_depth(unit.pipeline_depth);
+            reader.set_metrics(unit.metrics);
+            if (unit.metrics)
+                unit.metrics->start_lag.record(now - deadline);
 
             reg::RegisterResult* results = nullptr;
             try
             {
-                results = reader.read_registers(reg_map, reg_count);
+                results = reader.read_plan(schedules[u]->plan_for_tick(tickers[u].tick()));
             }
             catch (const std::exception& ex)
             {
                 std::cerr << "Грешка по време на четене на регистрите: " << ex.what() << std::endl;
-                std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int>(interval * 1000)));
-                continue;
             }
 
-            if (!header_written)
+            // Промените в състоянието на връзката се извеждат веднъж, а не при всеки отчет без връзка
+            if (reader.get_link_state() != link || reader.get_retry_time() != retry_at)
             {
-                csv << "timestamp";
-                for (size_t i = 0; i < reg_count; ++i)
-                    csv << "," << reg_map[i].symbol << " (" << reg_map[i].unit << ")";
-                csv << "\n";
-                header_written = true;
+                P30HTcpReader::LinkState previous = link;
+                link = reader.get_link_state();
+                retry_at = reader.get_retry_time();
+                std::string address = reader.get_host() + ":" + std::to_string(reader.get_port());
+                if (link == P30HTcpReader::LinkState::RECONNECTING)
+                    std::cerr << "\nВръзката с " << address << " е прекъсната. Следва ново свързване." << std::endl;
+                else if (link == P30HTcpReader::LinkState::BACKOFF)
+                    std::cerr << "\nНеуспешна връзка с " << address << ", нов опит след "
+                              << std::chrono::duration_cast<std::chrono::milliseconds>(retry_at - Clock::now()).count() << " ms." << std::endl;
+                else if (previous == P30HTcpReader::LinkState::RECONNECTING || previous == P30HTcpReader::LinkState::BACKOFF)
+                    std::cerr << "\nВръзката с " << address << " е възстановена." << std::endl;
             }
 
-            csv << timestamp;
-            for (size_t i = 0; i < reg_count; ++i)
-            {
-                if (!results[i].valid)
-                {
-                    csv << ",";
-                    continue;
-                }
-                if (reg_map[i].type == reg::REG_INT16)
-                    csv << "," << results[i].value.val_int16;
-                else if (reg_map[i].type == reg::REG_FLOAT32)
-                    csv << "," << results[i].value.val_float32;
-                else
-                    csv << ",";
-            }
-            csv << std::endl;
-            csv.flush();
+            // Отчетите, чието време е минало по време на този отчет, не се наваксват, а се броят като пропуснати
+            uint64_t missed = tickers[u].advance(Clock::now());
+            if (missed > 0 && unit.metrics)
+                metrics::increment(unit.metrics->missed_deadlines, missed);
+            if (!results)
+                continue;
 
+            int64_t timestamp_ms = reader.sample_sent().realtime_ms();
+            writer.push(files[u], timestamp_ms, results);
+            if (unit.ring)
+                unit.ring->push(timestamp_ms, results);
             results = nullptr; // Няма нужда да се освобождава паметта. Вижте имплементацията на P30HTcpReader::read_registers.
             ++count;
 
             if (max_samples > 0 && count >= max_samples)
                 break;
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int>(interval * 1000)));
         }
-        csv.close();
+        writer.stop();
+        if (writer.dropped() > 0)
+            std::cerr << "\nИзхвърлени отчети за " << reader.get_host() << " (бавен запис на диска): " << writer.dropped() << std::endl;
+    }
+
+    /**
+    * Функция, която записва получените резултати от регистрите в .csv файл (или в двоичен лог файл според 'options.format').
+    * Форматирането и записът на диска стават в нишката на 'LogWriter', затова бавен диск не забавя следващото четене.
+    * @param reader Устройството, от което ще се чете.
+    * @param plan План за четене (например 'reg::reg_plan'), от който се извлича кои данни да бъдат прочетени от устройството.
+    * @param stop_flag Флаг, с който се прекъсва функцията при необходимост.
+    * @param log_path Пътят към .csv файла/файловете (без името на файла с неговото разширение).
+    * @param interval Интервал от време между началата на два отчета (първият отчет е веднага). По подразбиране е една секунда.
+    * @param max_samples Максимален позволен брой записи. По подразбиране няма ограничение.
+    * @param options Форматът на файла и кога данните да се записват на диска (вижте 'WriterOptions').
+    * @param ring Файл с последните отчети за други процеси (nullptr - не се използва).
+    */
+    void poll_to_csv(P30HTcpReader& reader, const reg::ReadPlanView& plan, std::atomic<bool>* stop_flag, std::string_view log_path, float interval, size_t max_samples, const WriterOptions& options, ring_store::Writer* ring)
+    {
+        PollUnit unit;
+        unit.align = false;
+        unit.host = reader.get_host();
+        unit.slave_id = reader.get_slave_id();
+        unit.interval = interval;
+        unit.metrics = reader.get_metrics();
+        unit.ring = ring;
+        poll_units_to_csv(reader, plan, &unit, 1, stop_flag, log_path, max_samples, options);
     }
 };
@@ -0,0 +1,1014 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef P30H_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef P30H_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef P30H_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "bin_log.hpp"
+#include "log_compact.hpp"
+#include "log_index.hpp"
+
+namespace log_compact
+{
+    /**
+    * Размер на порциите, на които се чете и компресира файлът. Между порциите се проверява дали обектът не се унищожава.
+    */
+    static const size_t CHUNK = 1 << 20;
+
+    /**
+    * Функция, която проверява дали алгоритъмът е наличен (дали библиотеката му е намерена при компилиране, вижте Makefile).
+    */
+    bool available(Codec codec)
+    {
+        switch (codec)
+        {
+            case Codec::NONE: return true;
+        #ifdef P30H_HAVE_ZLIB
+            case Codec::GZIP: return true;
+        #endif
+        #ifdef P30H_HAVE_ZSTD
+            case Codec::ZSTD: return true;
+        #endif
+        #ifdef P30H_HAVE_LZ4
+            case Codec::LZ4: return true;
+        #endif
+            default: return false;
+        }
+    }
+
+    /**
+    * Функция, която връща най-добрия наличен алгоритъм: zstd, lz4, gzip или NONE (ако няма нито една библиотека).
+    */
+    Codec best_codec()
+    {
+        for (Codec codec : { Codec::ZSTD, Codec::LZ4, Codec::GZIP })
+        {
+            if (available(codec))
+                return codec;
+        }
+        return Codec::NONE;
+    }
+
+    /**
+    * Функция за получаване на името на алгоритъм (както се задава с '--compress').
+    */
+    const char* codec_name(Codec codec)
+    {
+        switch (codec)
+        {
+            case Codec::GZIP: return "gzip";
+            case Codec::ZSTD: return "zstd";
+            case Codec::LZ4: return "lz4";
+            default: return "none";
+        }
+    }
+
+    /**
+    * Функция за получаване на разширението, което се добавя към името на компресирания файл.
+    */
+    const char* codec_extension(Codec codec)
+    {
+        switch (codec)
+        {
+            case Codec::GZIP: return ".gz";
+            case Codec::ZSTD: return ".zst";
+            case Codec::LZ4: return ".lz4";
+            default: return "";
+        }
+    }
+
+    /**
+    * Функция, която преобразува името на алгоритъм ("none", "gzip", "zstd" или "lz4").
+    * @return False, ако името е непознато. Не проверява дали алгоритъмът е наличен.
+    */
+    bool parse_codec(const std::string& text, Codec& codec)
+    {
+        for (Codec value : { Codec::NONE, Codec::GZIP, Codec::ZSTD, Codec::LZ4 })
+        {
+            if (text == codec_name(value))
+            {
+                codec = value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+    * Функция, която връща броя на свободните ядра - всички ядра без заетите от четенето и записа (поне 1).
+    * @param busy_threads Броят на нишките, които постоянно използват процесора.
+    */
+    size_t default_workers(size_t busy_threads)
+    {
+        size_t cores = std::thread::hardware_concurrency();
+        return cores > busy_threads ? cores - busy_threads : 1;
+    }
+
+    /**
+    * Функция, която връща компресията на лог файл според разширението му (Codec::NONE за некомпресиран файл).
+    * @param file_name Името на файла.
+    */
+    Codec codec_of(const std::string& file_name)
+    {
+        for (Codec codec : { Codec::GZIP, Codec::ZSTD, Codec::LZ4 })
+        {
+            std::string extension = codec_extension(codec);
+            if (file_name.size() > extension.size() && file_name.compare(file_name.size() - extension.size(), extension.size(), extension) == 0)
+                return codec;
+        }
+        return Codec::NONE;
+    }
+
+    /**
+    * Функция, която разделя името на лог файл на части.
+    * @param file_name Името на файла (без директорията).
+    * @param name Променлива, в която се записват частите.
+    * @return False, ако името не е на лог файл, създаден от програмата (некомпресиран, компресиран или общ файл за деня).
+    */
+    bool parse_log_name(const std::string& file_name, LogName& name)
+    {
+        static const std::string prefix = "P30H(";
+        static const std::string data = ")_data_";
+        // '0' е цифра, останалите символи трябва да съвпадат
+        static const std::string date = "0000-00-00";
+        static const std::string clock = "_00-00-00";
+
+        size_t host_end = file_name.rfind(data);
+        if (file_name.compare(0, prefix.size(), prefix) != 0 || host_end == std::string::npos || host_end <= prefix.size())
+            return false;
+        Codec codec = codec_of(file_name);
+        size_t end = file_name.size() - std::strlen(codec_extension(codec));
+        size_t day = host_end + data.size();
+        if (end < day + date.size() + 4)
+            return false;
+        size_t dot = end - 4;
+        std::string extension = file_name.substr(dot, 4);
+        if (extension != ".csv" && extension != ".bin")
+            return false;
+
+        auto matches = [&file_name, dot](size_t pos, const std::string& pattern)
+        {
+            if (pos + pattern.size() > dot)
+                return false;
+            for (size_t i = 0; i < pattern.size(); ++i)
+            {
+                char c = file_name[pos + i];
+                if (pattern[i] == '0' ? !std::isdigit(static_cast<unsigned char>(c)) : c != pattern[i])
+                    return false;
+            }
+            return true;
+        };
+        if (!matches(day, date))
+            return false;
+
+        // Общият файл за деня няма час
+        size_t time_end = day + date.size();
+        if (matches(time_end, clock))
+        {
+            time_end += clock.size();
+            // "_<n>" след часа е за файловете, създадени в една и съща секунда
+            if (time_end + 1 < dot && file_name[time_end] == '_' && std::isdigit(static_cast<unsigned char>(file_name[time_end + 1])))
+            {
+                ++time_end;
+                while (time_end < dot && std::isdigit(static_cast<unsigned char>(file_name[time_end])))
+                    ++time_end;
+            }
+        }
+        std::string suffix = file_name.substr(time_end, dot - time_end);
+        if (!suffix.empty() && (suffix.compare(0, 4, "_agg") != 0 || suffix.back() != 's'))
+            return false;
+
+        name.host = file_name.substr(prefix.size(), host_end - prefix.size());
+        name.day = file_name.substr(day, date.size());
+        name.time = time_end > day + date.size() ? file_name.substr(day + 11, time_end - day - 11) : std::string();
+        name.suffix = suffix;
+        name.extension = extension;
+        name.codec = codec;
+        return true;
+    }
+
+    /**
+    * Помощна функция за преместване в файл над 2 GB.
+    */
+    static bool seek(std::FILE* file, uint64_t offset)
+    {
+    #ifdef _WIN32
+        return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+    #else
+        return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+    #endif
+    }
+
+    /**
+    * Изходен файл, отворен за добавяне, и размерът му (отместването на следващата рамка).
+    */
+    struct Output
+    {
+        std::FILE* file;
+        uint64_t position;
+    };
+
+    static bool write_all(Output& out, const void* data, size_t size)
+    {
+        if (std::fwrite(data, 1, size, out.file) != size)
+            return false;
+        out.position += size;
+        return true;
+    }
+
+    /**
+    * Поточно компресиране в отворен файл. Всеки обект записва една цяла рамка - от първия 'update' до 'finish'.
+    */
+    class Encoder
+    {
+    public:
+        virtual ~Encoder() = default;
+        virtual bool update(const char* data, size_t size, Output& out) = 0;
+        virtual bool finish(Output& out) = 0;
+    };
+
+    /**
+    * Данните се записват без промяна (Codec::NONE при обединяване на файлове).
+    */
+    class PlainEncoder : public Encoder
+    {
+    public:
+        bool update(const char* data, size_t size, Output& out) override { return write_all(out, data, size); }
+        bool finish(Output&) override { return true; }
+    };
+
+#ifdef P30H_HAVE_ZLIB
+    class GzipEncoder : public Encoder
+    {
+    public:
+        GzipEncoder()
+         : _buffer(CHUNK)
+        {
+            std::memset(&_stream, 0, sizeof(_stream));
+            // 15 + 16: заглавие на gzip вместо на zlib, затова файлът се разархивира и с gzip -d
+            _ok = deflateInit2(&_stream, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+
+        ~GzipEncoder() override
+        {
+            if (_ok) deflateEnd(&_stream);
+        }
+
+        bool update(const char* data, size_t size, Output& out) override { return _ok && run(data, size, Z_NO_FLUSH, out); }
+        bool finish(Output& out) override { return _ok && run(nullptr, 0, Z_FINISH, out); }
+
+    private:
+        z_stream _stream;
+        std::vector<unsigned char> _buffer;
+        bool _ok;
+
+        bool run(const char* data, size_t size, int flush, Output& out)
+        {
+            _stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            _stream.avail_in = static_cast<uInt>(size);
+            while (true)
+            {
+                _stream.next_out = _buffer.data();
+                _stream.avail_out = static_cast<uInt>(_buffer.size());
+                int result = deflate(&_stream, flush);
+                if (result == Z_STREAM_ERROR || !write_all(out, _buffer.data(), _buffer.size() - _stream.avail_out))
+                    return false;
+                if (flush == Z_FINISH ? result == Z_STREAM_END : _stream.avail_out != 0)
+                    return true;
+            }
+        }
+    };
+#endif
+
+#ifdef P30H_HAVE_ZSTD
+    class ZstdEncoder : public Encoder
+    {
+    public:
+        ZstdEncoder()
+         : _context(ZSTD_createCCtx())
+         , _buffer(ZSTD_CStreamOutSize())
+        {
+            if (!_context)
+                return;
+            ZSTD_CCtx_setParameter(_context, ZSTD_c_compressionLevel, 3);
+            // Контролна сума на всяка рамка, за да се разпознае повреден файл
+            ZSTD_CCtx_setParameter(_context, ZSTD_c_checksumFlag, 1);
+        }
+
+        ~ZstdEncoder() override
+        {
+            ZSTD_freeCCtx(_context);
+        }
+
+        bool update(const char* data, size_t size, Output& out) override { return _context && run(data, size, ZSTD_e_continue, out); }
+        bool finish(Output& out) override { return _context && run(nullptr, 0, ZSTD_e_end, out); }
+
+    private:
+        ZSTD_CCtx* _context;
+        std::vector<char> _buffer;
+
+        bool run(const char* data, size_t size, ZSTD_EndDirective mode, Output& out)
+        {
+            ZSTD_inBuffer input = { data, size, 0 };
+            while (true)
+            {
+                ZSTD_outBuffer output = { _buffer.data(), _buffer.size(), 0 };
+                size_t remaining = ZSTD_compressStream2(_context, &output, &input, mode);
+                if (ZSTD_isError(remaining) || !write_all(out, _buffer.data(), output.pos))
+                    return false;
+                if (mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size)
+                    return true;
+            }
+        }
+    };
+#endif
+
+#ifdef P30H_HAVE_LZ4
+    class Lz4Encoder : public Encoder
+    {
+    public:
+        Lz4Encoder()
+         : _context(nullptr)
+         , _started(false)
+        {
+            std::memset(&_preferences, 0, sizeof(_preferences));
+            _preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+            if (LZ4F_isError(LZ4F_createCompressionContext(&_context, LZ4F_VERSION)))
+                _context = nullptr;
+            _buffer.resize(LZ4F_compressBound(CHUNK, &_preferences) + LZ4F_HEADER_SIZE_MAX);
+        }
+
+        ~Lz4Encoder() override
+        {
+            if (_context) LZ4F_freeCompressionContext(_context);
+        }
+
+        bool update(const char* data, size_t size, Output& out) override
+        {
+            if (!begin(out))
+                return false;
+            while (size > 0)
+            {
+                size_t part = std::min(size, CHUNK);
+                size_t written = LZ4F_compressUpdate(_context, _buffer.data(), _buffer.size(), data, part, nullptr);
+                if (LZ4F_isError(written) || !write_all(out, _buffer.data(), written))
+                    return false;
+                data += part;
+                size -= part;
+            }
+            return true;
+        }
+
+        bool finish(Output& out) override
+        {
+            if (!begin(out))
+                return false;
+            size_t written = LZ4F_compressEnd(_context, _buffer.data(), _buffer.size(), nullptr);
+            return !LZ4F_isError(written) && write_all(out, _buffer.data(), written);
+        }
+
+    private:
+        LZ4F_cctx* _context;
+        LZ4F_preferences_t _preferences;
+        std::vector<char> _buffer;
+        bool _started;
+
+        bool begin(Output& out)
+        {
+            if (!_context || _started)
+                return _started;
+            size_t written = LZ4F_compressBegin(_context, _buffer.data(), _buffer.size(), &_preferences);
+            _started = !LZ4F_isError(written) && write_all(out, _buffer.data(), written);
+            return _started;
+        }
+    };
+#endif
+
+    static std::unique_ptr<Encoder> make_encoder(Codec codec)
+    {
+        switch (codec)
+        {
+        #ifdef P30H_HAVE_ZLIB
+            case Codec::GZIP: return std::unique_ptr<Encoder>(new GzipEncoder());
+        #endif
+        #ifdef P30H_HAVE_ZSTD
+            case Codec::ZSTD: return std::unique_ptr<Encoder>(new ZstdEncoder());
+        #endif
+        #ifdef P30H_HAVE_LZ4
+            case Codec::LZ4: return std::unique_ptr<Encoder>(new Lz4Encoder());
+        #endif
+            default: return std::unique_ptr<Encoder>(new PlainEncoder());
+        }
+    }
+
+    /**
+    * Състояние на 'Decoder': входният файл, прочетените, но още неразархивирани байтове, и контекстът на алгоритъма.
+    */
+    struct Decoder::State
+    {
+        Codec codec = Codec::NONE;
+        std::FILE* file = nullptr;
+        std::vector<char> input;
+        size_t in_pos = 0;
+        size_t in_size = 0;
+        bool eof = false;
+        bool error = false;
+    #ifdef P30H_HAVE_ZLIB
+        z_stream zlib;
+        bool zlib_ready = false;
+    #endif
+    #ifdef P30H_HAVE_ZSTD
+        ZSTD_DCtx* zstd = nullptr;
+    #endif
+    #ifdef P30H_HAVE_LZ4
+        LZ4F_dctx* lz4 = nullptr;
+    #endif
+
+        size_t step(char* out, size_t size);
+    };
+
+    /**
+    * Разархивира част от прочетените байтове.
+    * @return Броят на байтовете, записани в 'out' (0 - нужни са още входни данни или има грешка).
+    */
+    size_t Decoder::State::step(char* out, size_t size)
+    {
+        const char* in = input.data() + in_pos;
+        size_t available = in_size - in_pos;
+        switch (codec)
+        {
+        #ifdef P30H_HAVE_ZLIB
+            case Codec::GZIP:
+            {
+                zlib.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+                zlib.avail_in = static_cast<uInt>(available);
+                zlib.next_out = reinterpret_cast<Bytef*>(out);
+                zlib.avail_out = static_cast<uInt>(size);
+                int result = inflate(&zlib, Z_NO_FLUSH);
+                in_pos += available - zlib.avail_in;
+                // Всяка рамка е отделен gzip member, затова след края на рамката декодерът започва отначало
+                if (result == Z_STREAM_END)
+                    inflateReset(&zlib);
+                else if (result != Z_OK && result != Z_BUF_ERROR)
+                    error = true;
+                return size - zlib.avail_out;
+            }
+        #endif
+        #ifdef P30H_HAVE_ZSTD
+            case Codec::ZSTD:
+            {
+                ZSTD_inBuffer input_buffer = { in, available, 0 };
+                ZSTD_outBuffer output = { out, size, 0 };
+                error = ZSTD_isError(ZSTD_decompressStream(zstd, &output, &input_buffer));
+                in_pos += input_buffer.pos;
+                return output.pos;
+            }
+        #endif
+        #ifdef P30H_HAVE_LZ4
+            case Codec::LZ4:
+            {
+                size_t produced = size;
+                size_t consumed = available;
+                error = LZ4F_isError(LZ4F_decompress(lz4, out, &produced, in, &consumed, nullptr));
+                in_pos += consumed;
+                return produced;
+            }
+        #endif
+            default:
+            {
+                size_t count = std::min(size, available);
+                std::memcpy(out, in, count);
+                in_pos += count;
+                return count;
+            }
+        }
+    }
+
+    /**
+    * Клас за поточно разархивиране на лог файл.
+    * @param path Пътят до файла.
+    * @param codec Компресията на файла (вижте 'codec_of').
+    * @param offset Отместването на рамката, от която започва четенето (0 - от началото).
+    */
+    Decoder::Decoder(const std::string& path, Codec codec, uint64_t offset)
+     : _state(new State())
+    {
+        State& state = *_state;
+        state.codec = codec;
+        state.input.resize(64 * 1024);
+        switch (codec)
+        {
+            case Codec::NONE: break;
+        #ifdef P30H_HAVE_ZLIB
+            case Codec::GZIP:
+                std::memset(&state.zlib, 0, sizeof(state.zlib));
+                state.zlib_ready = inflateInit2(&state.zlib, 15 + 16) == Z_OK;
+                state.error = !state.zlib_ready;
+                break;
+        #endif
+        #ifdef P30H_HAVE_ZSTD
+            case Codec::ZSTD:
+                state.zstd = ZSTD_createDCtx();
+                state.error = state.zstd == nullptr;
+                break;
+        #endif
+        #ifdef P30H_HAVE_LZ4
+            case Codec::LZ4:
+                state.error = LZ4F_isError(LZ4F_createDecompressionContext(&state.lz4, LZ4F_VERSION));
+                break;
+        #endif
+            default:
+                state.error = true;
+        }
+        if (!state.error)
+            state.file = std::fopen(path.c_str(), "rb");
+        state.error = state.error || !state.file || !seek(state.file, offset);
+    }
+
+    Decoder::~Decoder()
+    {
+        State& state = *_state;
+        if (state.file) std::fclose(state.file);
+    #ifdef P30H_HAVE_ZLIB
+        if (state.zlib_ready) inflateEnd(&state.zlib);
+    #endif
+    #ifdef P30H_HAVE_ZSTD
+        ZSTD_freeDCtx(state.zstd);
+    #endif
+    #ifdef P30H_HAVE_LZ4
+        if (state.lz4) LZ4F_freeDecompressionContext(state.lz4);
+    #endif
+    }
+
+    /**
+    * Прочита следващите разархивирани байтове.
+    * @return Броят на прочетените байтове. По-малко от 'size' само в края на файла или при грешка (вижте 'failed').
+    */
+    size_t Decoder::read(char* out, size_t size)
+    {
+        State& state = *_state;
+        size_t done = 0;
+        while (done < size && !state.error)
+        {
+            if (state.in_pos == state.in_size && !state.eof)
+            {
+                state.in_size = std::fread(state.input.data(), 1, state.input.size(), state.file);
+                state.in_pos = 0;
+                state.eof = state.in_size == 0;
+                state.error = std::ferror(state.file) != 0;
+            }
+            size_t produced = state.step(out + done, size - done);
+            done += produced;
+            if (produced == 0 && state.eof)
+                break;
+        }
+        return done;
+    }
+
+    /**
+    * Функция, която проверява дали при четенето е имало грешка (повреден файл или недостъпен алгоритъм).
+    */
+    bool Decoder::failed() const
+    {
+        return _state->error;
+    }
+
+    /**
+    * Помощна функция, която прочита първите 'size' байта от компресиран файл.
+    * Използва се за сравнение на заглавието на общия файл за деня със заглавието на новия файл.
+    * @return False, ако файлът не може да се прочете или е по-къс от 'size' байта.
+    */
+    static bool read_prefix(const std::string& path, Codec codec, size_t size, std::string& out)
+    {
+        out.assign(size, '\0');
+        Decoder decoder(path, codec);
+        return size == 0 || decoder.read(&out[0], size) == size;
+    }
+
+    /**
+    * Помощна функция, която прочита заглавието на некомпресиран лог файл - първия ред на .csv или заглавието на .bin (вижте 'bin_log.hpp').
+    * @return False, ако файлът не може да се прочете или няма цяло заглавие.
+    */
+    static bool read_log_header(const std::string& path, const std::string& extension, std::string& header)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        std::streamoff size = 0;
+        if (extension == ".bin")
+        {
+            try
+            {
+                bin_log::Columns columns;
+                bool delta = false;
+                bin_log::read_header(in, columns, &delta);
+            }
+            catch (const std::exception&)
+            {
+                return false;
+            }
+            size = in.tellg();
+        }
+        else
+        {
+            std::string line;
+            if (!std::getline(in, line) || in.eof())
+                return false;
+            size = static_cast<std::streamoff>(line.size() + 1);
+        }
+        if (size <= 0)
+            return false;
+        header.assign(static_cast<size_t>(size), '\0');
+        in.clear();
+        in.seekg(0);
+        return static_cast<bool>(in.read(&header[0], size));
+    }
+
+    /**
+    * Помощна функция, която компресира файла от дадено отместване в края на отворен файл. Всеки блок от индекса на файла
+    * започва нова рамка, затова компресираният файл може да се чете от всеки блок (вижте 'Decoder').
+    * @param splits Отместванията на блоковете във файла (във възходящ ред, вижте 'log_index.hpp').
+    * @param positions Променлива, в която се записват отместванията на блоковете в 'out' (по едно за всяко от 'splits').
+    * @return False при грешка или ако 'stop' е вдигнат по време на компресирането.
+    */
+    static bool compress_into(const std::string& path, uint64_t offset, const std::vector<uint64_t>& splits, Output& out, Codec codec,
+                              const std::atomic<bool>& stop, std::vector<uint64_t>& positions)
+    {
+        std::FILE* in = std::fopen(path.c_str(), "rb");
+        if (!in)
+            return false;
+        std::unique_ptr<Encoder> encoder = make_encoder(codec);
+        uint64_t start = out.position;
+        uint64_t position = offset;
+        bool started = false;
+        size_t next = 0;
+        std::vector<char> buffer(CHUNK);
+        positions.clear();
+        bool ok = seek(in, offset);
+        while (ok && !stop.load())
+        {
+            // Блоковете преди 'offset' (заглавието при обединяване) започват заедно с първата рамка
+            while (ok && next < splits.size() && splits[next] <= position)
+            {
+                if (started)
+                {
+                    ok = encoder->finish(out);
+                    encoder = make_encoder(codec);
+                    started = false;
+                }
+                positions.push_back(out.position);
+                ++next;
+            }
+            size_t want = buffer.size();
+            if (next < splits.size())
+                want = static_cast<size_t>(std::min<uint64_t>(want, splits[next] - position));
+            size_t size = ok ? std::fread(buffer.data(), 1, want, in) : 0;
+            if (size == 0)
+                break;
+            ok = encoder->update(buffer.data(), size, out);
+            started = true;
+            position += size;
+        }
+        // Празен файл също е една (празна) рамка, но след последния блок не започва нова
+        ok = ok && !stop.load() && !std::ferror(in) && (started || out.position == start ? encoder->finish(out) : true);
+        std::fclose(in);
+        // Последният запис на индекса (и блоковете след края на файла) сочат края на рамките
+        while (positions.size() < splits.size())
+            positions.push_back(out.position);
+        return ok && std::fflush(out.file) == 0;
+    }
+
+    /**
+    * Помощна функция, която връща отместванията на блоковете от индекса.
+    */
+    static std::vector<uint64_t> block_offsets(const log_index::Index& index)
+    {
+        std::vector<uint64_t> offsets;
+        for (const log_index::Entry& entry : index.entries)
+            offsets.push_back(entry.offset);
+        return offsets;
+    }
+
+    /**
+    * Помощна функция, която записва блоковете на индекса с отместванията им в компресирания файл.
+    * @param path Пътят до индекса на компресирания файл.
+    * @param positions Новите отмествания (вижте 'compress_into').
+    * @param create True - нов индекс със заглавие, false - добавяне към съществуващ индекс.
+    */
+    static bool write_index(const std::string& path, const log_index::Index& index, const std::vector<uint64_t>& positions, bool create)
+    {
+        std::string data;
+        if (create)
+            log_index::append_header(data, index.flags, index.block);
+        for (size_t i = 0; i < index.entries.size(); ++i)
+            log_index::append_entry(data, index.entries[i].timestamp_ms, positions[i]);
+        std::FILE* file = std::fopen(path.c_str(), create ? "wb" : "ab");
+        if (!file)
+            return false;
+        bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+        return std::fclose(file) == 0 && ok;
+    }
+
+    /**
+    * Клас за компресиране на затворените лог файлове във фонов режим.
+    * @param options Алгоритъмът, броят на нишките и кои файлове се обединяват (вижте 'CompactOptions').
+    * @throws std::runtime_error Ако алгоритъмът не е наличен в тази компилация.
+    */
+    Compactor::Compactor(const CompactOptions& options)
+     : _options(options)
+     , _stop(false)
+     , _completed(0)
+     , _failed(0)
+    {
+        if (!available(_options.codec))
+            throw std::runtime_error(std::string("Компресирането с ") + codec_name(_options.codec) + " не е налично в тази компилация.");
+        // Без компресиране и без обединяване няма работа за нишките
+        if (_options.codec == Codec::NONE && _options.merge_below == 0)
+            return;
+        size_t workers = _options.workers > 0 ? _options.workers : default_workers(1);
+        for (size_t i = 0; i < workers; ++i)
+            _threads.emplace_back(&Compactor::worker_loop, this);
+    }
+
+    /**
+    * Прекъсва започнатите файлове (остават некомпресирани) и спира нишките.
+    */
+    Compactor::~Compactor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop.store(true);
+        }
+        _wake.notify_all();
+        for (std::thread& thread : _threads)
+            thread.join();
+    }
+
+    /**
+    * Добавя затворен лог файл за компресиране. Не чака компресирането, затова може да се извиква от нишката за запис.
+    * @param path Пълният път до файла. Файлове с други имена (вижте 'parse_log_name') и вече компресираните файлове се пропускат.
+    */
+    void Compactor::submit(const std::string& path)
+    {
+        namespace fs = std::filesystem;
+        fs::path file(path);
+        LogName name;
+        // Само некомпресираните файлове с час в името (общите файлове за деня вече са обработени)
+        if (!parse_log_name(file.filename().string(), name) || name.codec != Codec::NONE || name.time.empty())
+            return;
+        std::error_code error;
+        uint64_t size = fs::file_size(file, error);
+        if (error)
+            return;
+
+        Job job;
+        job.path = path;
+        if (_options.merge_below > 0 && size < _options.merge_below)
+            job.archive = (file.parent_path() / ("P30H(" + name.host + ")_data_" + name.day + name.suffix + name.extension + codec_extension(_options.codec))).string();
+        else if (_options.codec == Codec::NONE)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_threads.empty() || _stop.load())
+                return;
+            _jobs.push_back(std::move(job));
+        }
+        _wake.notify_one();
+    }
+
+    /**
+    * Добавя за компресиране всички некомпресирани лог файлове в директорията (в реда на създаването им за всяко устройство)
+    * и изтрива недовършените .part файлове. Трябва да се извика при стартиране, преди да се създадат новите лог файлове,
+    * затова взима файловете, останали от предишно стартиране (включително затворените при спиране на програмата).
+    * @param log_path Директорията с лог файловете.
+    * @return Броят на намерените файлове.
+    */
+    size_t Compactor::scan(const std::string& log_path)
+    {
+        namespace fs = std::filesystem;
+        std::vector<std::string> files;
+        std::vector<fs::path> parts;
+        std::error_code error;
+        for (fs::directory_iterator it(log_path, error), end; !error && it != end; it.increment(error))
+        {
+            std::string name = it->path().filename().string();
+            LogName parsed;
+            if (name.compare(0, 5, "P30H(") == 0 && name.size() > 5 && name.compare(name.size() - 5, 5, ".part") == 0)
+                parts.push_back(it->path());
+            else if (parse_log_name(name, parsed) && parsed.codec == Codec::NONE && !parsed.time.empty())
+                files.push_back(it->path().string());
+        }
+        for (const fs::path& part : parts)
+            fs::remove(part, error);
+        // Датата и часът са в името, затова подредбата по име е по време за всяко устройство
+        std::sort(files.begin(), files.end());
+        for (const std::string& file : files)
+            submit(file);
+        return files.size();
+    }
+
+    /**
+    * Функция за получаване на броя на файловете, които чакат компресиране.
+    */
+    size_t Compactor::pending() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _jobs.size();
+    }
+
+    /**
+    * Функция за получаване на броя на компресираните (или обединените) файлове.
+    */
+    uint64_t Compactor::completed() const
+    {
+        return _completed.load(std::memory_order_relaxed);
+    }
+
+    /**
+    * Функция за получаване на броя на файловете, които не са компресирани поради грешка (остават некомпресирани).
+    */
+    uint64_t Compactor::failed() const
+    {
+        return _failed.load(std::memory_order_relaxed);
+    }
+
+    /**
+    * Функция за получаване на броя на нишките за компресиране.
+    */
+    size_t Compactor::workers() const
+    {
+        return _threads.size();
+    }
+
+    /**
+    * Главният цикъл на една нишка: взима най-стария файл, чийто общ файл за деня не се обработва от друга нишка.
+    */
+    void Compactor::worker_loop()
+    {
+    #ifdef __linux__
+        // SCHED_IDLE: нишката получава процесор само когато ядрото няма друга работа, затова не забавя четенето и записа
+        sched_param param{};
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    #endif
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                std::deque<Job>::iterator next = _jobs.end();
+                _wake.wait(lock, [this, &next]()
+                {
+                    next = std::find_if(_jobs.begin(), _jobs.end(), [this](const Job& j) { return j.archive.empty() || _busy.count(j.archive) == 0; });
+                    return _stop.load() || next != _jobs.end();
+                });
+                if (_stop.load())
+                    return;
+                job = std::move(*next);
+                _jobs.erase(next);
+                if (!job.archive.empty())
+                    _busy.insert(job.archive);
+            }
+
+            bool ok = job.archive.empty() ? compress(job.path) : merge(job.path, job.archive);
+            if (ok)
+                _completed.fetch_add(1, std::memory_order_relaxed);
+            else if (!_stop.load())
+            {
+                _failed.fetch_add(1, std::memory_order_relaxed);
+                std::cerr << "\nГрешка при компресирането на " << job.path << std::endl;
+            }
+
+            if (!job.archive.empty())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _busy.erase(job.archive);
+                }
+                _wake.notify_all();
+            }
+        }
+    }
+
+    /**
+    * Компресира файла в <име><компресия>.part, преименува го и изтрива оригинала. Индексът на файла се записва отново
+    * с отместванията на рамките в компресирания файл преди преименуването, затова компресираният файл винаги има индекс.
+    * @return False при грешка или прекъсване (оригиналът остава).
+    */
+    bool Compactor::compress(const std::string& path)
+    {
+        namespace fs = std::filesystem;
+        std::string target = path + codec_extension(_options.codec);
+        std::string part = target + ".part";
+        log_index::Index index;
+        bool indexed = log_index::read_index(log_index::index_path(path), index);
+        std::FILE* file = std::fopen(part.c_str(), "wb");
+        if (!file)
+            return false;
+        Output out = { file, 0 };
+        std::vector<uint64_t> positions;
+        bool ok = compress_into(path, 0, block_offsets(index), out, _options.codec, _stop, positions);
+        ok = std::fclose(file) == 0 && ok;
+        ok = ok && (!indexed || write_index(log_index::index_path(target), index, positions, true));
+        std::error_code error;
+        if (ok)
+            fs::rename(part, target, error);
+        if (!ok || error)
+        {
+            fs::remove(part, error);
+            if (indexed)
+                fs::remove(log_index::index_path(target), error);
+            return false;
+        }
+        fs::remove(path, error);
+        fs::remove(log_index::index_path(path), error);
+        return true;
+    }
+
+    /**
+    * Добавя файла като нова рамка в края на общия файл за деня и изтрива оригинала.
+    * Ако общият файл вече съществува, заглавието не се повтаря. Файл с различно заглавие (например с други колони)
+    * или друг формат на индекса ('само промени') не може да се добави и се компресира отделно.
+    * Блоковете на индекса се добавят към индекса на общия файл, ако общият файл е започнал с индекс.
+    * @return False при грешка или прекъсване (общият файл и индексът му се връщат към предишния си размер, а оригиналът остава).
+    */
+    bool Compactor::merge(const std::string& path, const std::string& archive)
+    {
+        namespace fs = std::filesystem;
+        std::string header;
+        if (!read_log_header(path, fs::path(path).extension().string(), header))
+            return _options.codec == Codec::NONE || compress(path);
+
+        log_index::Index index;
+        bool indexed = log_index::read_index(log_index::index_path(path), index);
+        std::string archive_index = log_index::index_path(archive);
+        std::error_code error;
+        bool exists = fs::exists(archive, error);
+        bool archive_indexed = false;
+        size_t offset = 0;
+        uint64_t before = 0;
+        uint64_t index_before = 0;
+        if (exists)
+        {
+            std::string existing;
+            log_index::Index existing_index;
+            archive_indexed = log_index::read_index(archive_index, existing_index);
+            if (!read_prefix(archive, _options.codec, header.size(), existing) || existing != header ||
+                (indexed && archive_indexed && existing_index.flags != index.flags))
+                return _options.codec == Codec::NONE || compress(path);
+            offset = header.size();
+            before = fs::file_size(archive, error);
+            if (!error && archive_indexed)
+                index_before = fs::file_size(archive_index, error);
+            if (error)
+                return false;
+        }
+        // Индекс без част от файловете би пропуснал записи, затова общ файл без индекс не получава индекс
+        bool write_archive_index = exists ? archive_indexed : indexed;
+
+        std::FILE* file = std::fopen(archive.c_str(), "ab");
+        if (!file)
+            return false;
+        Output out = { file, before };
+        std::vector<uint64_t> positions;
+        bool ok = compress_into(path, offset, block_offsets(index), out, _options.codec, _stop, positions);
+        ok = std::fclose(file) == 0 && ok;
+        ok = ok && (!write_archive_index || write_index(archive_index, index, positions, !exists));
+        if (!ok)
+        {
+            if (exists)
+            {
+                fs::resize_file(archive, before, error);
+                if (archive_indexed)
+                    fs::resize_file(archive_index, index_before, error);
+            }
+            else
+            {
+                fs::remove(archive, error);
+                fs::remove(archive_index, error);
+            }
+            return false;
+        }
+        fs::remove(path, error);
+        fs::remove(log_index::index_path(path), error);
+        return true;
+    }
+};
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "log_index.hpp"
+
+namespace log_index
+{
+    /**
+    * Помощни функции за запис и четене на числа в little-endian ред (както в 'bin_log').
+    */
+    static void put_le(std::string& out, uint64_t v, int bytes)
+    {
+        for (int i = 0; i < bytes; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+
+    static uint64_t get_le(const char* p, int bytes)
+    {
+        uint64_t v = 0;
+        for (int i = bytes - 1; i >= 0; --i) v = v << 8 | static_cast<uint8_t>(p[i]);
+        return v;
+    }
+
+    /**
+    * Функция, която връща пътя до индекса на лог файл.
+    * @param log_path Пътят до лог файла (некомпресиран или компресиран).
+    */
+    std::string index_path(const std::string& log_path)
+    {
+        return log_path + ".idx";
+    }
+
+    /**
+    * Функция, която добавя заглавието на индекса към 'out'.
+    * @param flags Флаговете (например FLAG_CHANGES).
+    * @param block Броят на записите на лог файла в един блок.
+    */
+    void append_header(std::string& out, uint16_t flags, uint32_t block)
+    {
+        out.append(MAGIC, sizeof(MAGIC));
+        put_le(out, VERSION, 2);
+        put_le(out, flags, 2);
+        put_le(out, block, 4);
+    }
+
+    /**
+    * Функция, която добавя един блок към 'out'.
+    * @param timestamp_ms Времето на първия запис в блока.
+    * @param offset Отместването на блока в лог файла.
+    */
+    void append_entry(std::string& out, int64_t timestamp_ms, uint64_t offset)
+    {
+        put_le(out, static_cast<uint64_t>(timestamp_ms), 8);
+        put_le(out, offset, 8);
+    }
+
+    /**
+    * Функция, която прочита целия индекс.
+    * @param path Пътят до индекса (вижте 'index_path').
+    * @param index Променлива, в която се записва индексът.
+    * @return False, ако файлът не съществува или не е индекс.
+    */
+    bool read_index(const std::string& path, Index& index)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (data.size() < HEADER_SIZE || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0 || get_le(data.data() + 8, 2) != VERSION)
+            return false;
+        index.flags = static_cast<uint16_t>(get_le(data.data() + 10, 2));
+        index.block = static_cast<uint32_t>(get_le(data.data() + 12, 4));
+        size_t count = (data.size() - HEADER_SIZE) / ENTRY_SIZE;
+        index.entries.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const char* p = data.data() + HEADER_SIZE + i * ENTRY_SIZE;
+            index.entries[i].timestamp_ms = static_cast<int64_t>(get_le(p, 8));
+            index.entries[i].offset = get_le(p + 8, 8);
+        }
+        return true;
+    }
+
+    /**
+    * Функция, която намира блока, от който започва четенето на записите от даден момент нататък - последния блок,
+    * който започва преди този момент (двоично търсене).
+    * @param index Индексът.
+    * @param timestamp_ms Началото на търсения период.
+    * @return Блокът или nullptr, ако четенето трябва да започне от началото на файла.
+    */
+    const Entry* find_block(const Index& index, int64_t timestamp_ms)
+    {
+        std::vector<Entry>::const_iterator it = std::lower_bound(index.entries.begin(), index.entries.end(), timestamp_ms,
+            [](const Entry& entry, int64_t t) { return entry.timestamp_ms < t; });
+        if (it == index.entries.begin())
+            return nullptr;
+        return &*(it - 1);
+    }
+};
@@ -0,0 +1,426 @@
+#include <algorithm>
+#include <filesystem>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <streambuf>
+
+#include "bin_log.hpp"
+#include "export_data.hpp"
+#include "log_compact.hpp"
+#include "log_index.hpp"
+#include "log_query.hpp"
+#include "timestamp.hpp"
+
+namespace log_query
+{
+    /**
+    * Размер на порциите, на които се разархивират файловете и се извеждат редовете.
+    */
+    static const size_t CHUNK = 64 * 1024;
+
+    /**
+    * Буфер на поток, който чете разархивираните данни от 'log_compact::Decoder'. С 'jump' четенето продължава от друго
+    * място във файла, например след заглавието - от блока в индекса.
+    */
+    class DecoderBuffer : public std::streambuf
+    {
+    public:
+        explicit DecoderBuffer(std::unique_ptr<log_compact::Decoder> decoder)
+         : _decoder(std::move(decoder))
+         , _buffer(CHUNK)
+         , _bytes(0)
+        {
+            setg(_buffer.data(), _buffer.data(), _buffer.data());
+        }
+
+        void jump(std::unique_ptr<log_compact::Decoder> decoder)
+        {
+            // Прочетените, но неизползвани байтове не се броят
+            _bytes -= static_cast<uint64_t>(egptr() - gptr());
+            _decoder = std::move(decoder);
+            setg(_buffer.data(), _buffer.data(), _buffer.data());
+        }
+
+        bool failed() const { return _decoder->failed(); }
+        uint64_t bytes() const { return _bytes - static_cast<uint64_t>(egptr() - gptr()); }
+
+    protected:
+        int_type underflow() override
+        {
+            size_t size = _decoder->read(_buffer.data(), _buffer.size());
+            _bytes += size;
+            if (size == 0)
+                return traits_type::eof();
+            setg(_buffer.data(), _buffer.data(), _buffer.data() + size);
+            return traits_type::to_int_type(*gptr());
+        }
+
+    private:
+        std::unique_ptr<log_compact::Decoder> _decoder;
+        std::vector<char> _buffer;
+        uint64_t _bytes;
+    };
+
+    /**
+    * Помощен клас, който преобразува времето на ред от .csv файл ("YYYY-mm-dd HH:MM:SS.mmm") в милисекунди.
+    * Датата и часът се преобразуват само при смяна на секундата, затова 'mktime' не се извиква за всеки ред.
+    */
+    class RowClock
+    {
+    public:
+        bool parse(std::string_view text, int64_t& realtime_ms)
+        {
+            if (text.size() != 23 || text[19] != '.')
+                return false;
+            if (text.substr(0, 19) != _second)
+            {
+                if (!timestamp::parse_local(text.substr(0, 19), _second_ms))
+                    return false;
+                _second.assign(text.data(), 19);
+            }
+            int millis = 0;
+            for (size_t i = 20; i < 23; ++i)
+            {
+                if (text[i] < '0' || text[i] > '9')
+                    return false;
+                millis = millis * 10 + (text[i] - '0');
+            }
+            realtime_ms = _second_ms + millis;
+            return true;
+        }
+
+    private:
+        std::string _second;
+        int64_t _second_ms = 0;
+    };
+
+    /**
+    * Лог файл с отчетите на устройството (некомпресиран, компресиран или общ файл за деня).
+    * @param start_ms Времето на първия запис според индекса или, ако няма индекс, според името на файла.
+    */
+    struct LogFile
+    {
+        std::string path;
+        log_compact::Codec codec = log_compact::Codec::NONE;
+        bool bin = false;
+        bool indexed = false;
+        log_index::Index index;
+        int64_t start_ms = 0;
+    };
+
+    /**
+    * Помощна функция, която намира лог файловете с отчетите на устройството и ги подрежда по време.
+    */
+    static std::vector<LogFile> find_files(const std::string& log_path, const std::string& host)
+    {
+        namespace fs = std::filesystem;
+        std::vector<LogFile> files;
+        std::error_code error;
+        for (fs::directory_iterator it(log_path, error), end; !error && it != end; it.increment(error))
+        {
+            log_compact::LogName name;
+            if (!log_compact::parse_log_name(it->path().filename().string(), name) || name.host != host || !name.suffix.empty())
+                continue;
+            LogFile file;
+            file.path = it->path().string();
+            file.codec = name.codec;
+            file.bin = name.extension == ".bin";
+            file.indexed = log_index::read_index(log_index::index_path(file.path), file.index) && !file.index.entries.empty();
+            if (file.indexed)
+                file.start_ms = file.index.entries.front().timestamp_ms;
+            else
+            {
+                // Общият файл за деня няма час в името
+                std::string time = name.time.empty() ? "00:00:00" : name.time.substr(0, 8);
+                std::replace(time.begin(), time.end(), '-', ':');
+                timestamp::parse_local(name.day + " " + time, file.start_ms);
+            }
+            files.push_back(std::move(file));
+        }
+        std::sort(files.begin(), files.end(), [](const LogFile& a, const LogFile& b)
+        {
+            return a.start_ms != b.start_ms ? a.start_ms < b.start_ms : a.path < b.path;
+        });
+        return files;
+    }
+
+    /**
+    * Функция, която разделя списък със символи на величини, разделени със запетаи (например "U,I,P").
+    */
+    std::vector<std::string> split_columns(const std::string& text)
+    {
+        std::vector<std::string> columns;
+        size_t start = 0;
+        while (start < text.size())
+        {
+            size_t comma = std::min(text.find(',', start), text.size());
+            if (comma > start)
+                columns.push_back(text.substr(start, comma - start));
+            start = comma + 1;
+        }
+        return columns;
+    }
+
+    /**
+    * Функция, която връща лог файловете с отчетите на устройството, подредени по време.
+    * @param log_path Директорията с лог файловете.
+    * @param host Името на устройството.
+    */
+    std::vector<std::string> list_files(const std::string& log_path, const std::string& host)
+    {
+        std::vector<std::string> paths;
+        for (const LogFile& file : find_files(log_path, host))
+            paths.push_back(file.path);
+        return paths;
+    }
+
+    /**
+    * Помощна функция, която разделя ред от .csv файл на клетки.
+    */
+    static void split_cells(std::string_view line, std::vector<std::string_view>& cells)
+    {
+        cells.clear();
+        size_t start = 0;
+        while (true)
+        {
+            size_t comma = line.find(',', start);
+            cells.push_back(line.substr(start, comma == std::string_view::npos ? std::string_view::npos : comma - start));
+            if (comma == std::string_view::npos)
+                return;
+            start = comma + 1;
+        }
+    }
+
+    /**
+    * Помощна функция, която намира колоните на заявката сред колоните на файла.
+    * @param symbols Символите на колоните на файла.
+    * @return Номерата на колоните на заявката във файла (при празна заявка - всички).
+    * @throws std::runtime_error Ако някоя колона на заявката я няма във файла.
+    */
+    static std::vector<size_t> select_columns(const std::vector<std::string_view>& symbols, const Query& query, const std::string& path)
+    {
+        std::vector<size_t> selected;
+        if (query.columns.empty())
+        {
+            for (size_t i = 0; i < symbols.size(); ++i)
+                selected.push_back(i);
+            return selected;
+        }
+        for (const std::string& column : query.columns)
+        {
+            std::vector<std::string_view>::const_iterator it = std::find(symbols.begin(), symbols.end(), column);
+            if (it == symbols.end())
+                throw std::runtime_error(path + ": няма колона " + column);
+            selected.push_back(static_cast<size_t>(it - symbols.begin()));
+        }
+        return selected;
+    }
+
+    /**
+    * Помощен клас с общото състояние на изхода на една заявка: натрупаните редове и последното изведено заглавие
+    * (заглавието се извежда отново само ако колоните в следващия файл са различни).
+    */
+    struct Output
+    {
+        std::ostream& out;
+        std::string buffer;
+        std::string header;
+
+        void begin(const std::string& file_header)
+        {
+            if (file_header == header)
+                return;
+            header = file_header;
+            buffer.append(header);
+            buffer.push_back('\n');
+        }
+
+        void flush(bool force)
+        {
+            if (!force && buffer.size() < CHUNK)
+                return;
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    };
+
+    /**
+    * Помощна функция, която извежда записите от .csv файл. В режим 'само промени' празните клетки се попълват
+    * с последната стойност, а "N/A" става празна клетка, затова всеки изведен ред е пълен.
+    * @param offset Отместването на първия блок за четене (0 - от началото).
+    */
+    static void read_csv(const LogFile& file, uint64_t offset, const Query& query, Output& output, Stats& stats)
+    {
+        DecoderBuffer source(std::unique_ptr<log_compact::Decoder>(new log_compact::Decoder(file.path, file.codec)));
+        std::istream in(&source);
+        std::string header;
+        if (!std::getline(in, header) || in.eof())
+            return;
+        bool changes = file.indexed && (file.index.flags & log_index::FLAG_CHANGES) != 0;
+
+        std::vector<std::string_view> cells;
+        split_cells(header, cells);
+        std::vector<std::string_view> symbols;
+        for (size_t i = 1; i < cells.size(); ++i)
+            symbols.push_back(cells[i].substr(0, cells[i].find(" (")));
+        std::vector<size_t> selected = select_columns(symbols, query, file.path);
+        std::string selected_header = "timestamp";
+        for (size_t column : selected)
+        {
+            selected_header.push_back(',');
+            selected_header.append(cells[column + 1]);
+        }
+        output.begin(selected_header);
+        // Всички колони без 'само промени' - редовете се извеждат без промяна
+        bool whole = !changes && selected.size() == symbols.size();
+
+        if (offset > 0)
+            source.jump(std::unique_ptr<log_compact::Decoder>(new log_compact::Decoder(file.path, file.codec, offset)));
+        RowClock clock;
+        std::vector<std::string> last(selected.size());
+        std::string line;
+        while (std::getline(in, line) && !in.eof())
+        {
+            int64_t timestamp_ms = 0;
+            std::string_view text(line);
+            if (!clock.parse(text.substr(0, text.find(',')), timestamp_ms))
+                continue;
+            if (timestamp_ms > query.to_ms)
+                break;
+            if (timestamp_ms < query.from_ms && !changes)
+                continue;
+            if (whole)
+            {
+                output.buffer.append(line);
+                output.buffer.push_back('\n');
+            }
+            else
+            {
+                split_cells(text, cells);
+                for (size_t j = 0; j < selected.size(); ++j)
+                {
+                    size_t cell = selected[j] + 1;
+                    std::string_view value = cell < cells.size() ? cells[cell] : std::string_view();
+                    if (!changes)
+                        last[j].assign(value);
+                    else if (value == "N/A")
+                        last[j].clear();
+                    else if (!value.empty())
+                        last[j].assign(value);
+                }
+                if (timestamp_ms < query.from_ms)
+                    continue;
+                output.buffer.append(cells[0]);
+                for (const std::string& value : last)
+                {
+                    output.buffer.push_back(',');
+                    output.buffer.append(value);
+                }
+                output.buffer.push_back('\n');
+            }
+            ++stats.rows;
+            output.flush(false);
+        }
+        stats.bytes_read += source.bytes();
+        if (source.failed())
+            throw std::runtime_error("Грешка при четенето на " + file.path);
+    }
+
+    /**
+    * Помощна функция, която извежда записите от двоичен лог файл (вижте 'bin_log::Reader').
+    * @param offset Отместването на първия блок за четене (0 - от началото).
+    */
+    static void read_bin(const LogFile& file, uint64_t offset, const Query& query, Output& output, Stats& stats)
+    {
+        DecoderBuffer source(std::unique_ptr<log_compact::Decoder>(new log_compact::Decoder(file.path, file.codec)));
+        std::istream in(&source);
+        std::unique_ptr<bin_log::Reader> reader;
+        try
+        {
+            reader.reset(new bin_log::Reader(in));
+        }
+        catch (const std::exception& e)
+        {
+            throw std::runtime_error(file.path + ": " + e.what());
+        }
+        const bin_log::Columns& columns = reader->columns();
+        std::vector<std::string_view> symbols;
+        for (size_t i = 0; i < columns.size(); ++i)
+            symbols.push_back(columns.data()[i].symbol);
+        std::vector<size_t> selected = select_columns(symbols, query, file.path);
+        bin_log::Columns picked;
+        for (size_t column : selected)
+        {
+            const reg::RegisterRead& read = columns.data()[column];
+            picked.add(read.type, read.symbol, read.unit, read.name);
+        }
+        output.begin(std::string(picked.plan().csv_header));
+
+        if (offset > 0)
+            source.jump(std::unique_ptr<log_compact::Decoder>(new log_compact::Decoder(file.path, file.codec, offset)));
+        timestamp::Formatter formatter;
+        std::vector<reg::RegisterResult> results(columns.size());
+        std::vector<reg::RegisterResult> values(selected.size());
+        int64_t timestamp_ms = 0;
+        while (reader->next(timestamp_ms, results.data()))
+        {
+            if (timestamp_ms > query.to_ms)
+                break;
+            if (timestamp_ms < query.from_ms)
+                continue;
+            for (size_t j = 0; j < selected.size(); ++j)
+                values[j] = results[selected[j]];
+            export_data::append_csv_row(output.buffer, formatter.format(timestamp_ms), picked.plan(), values.data());
+            ++stats.rows;
+            output.flush(false);
+        }
+        stats.bytes_read += source.bytes();
+        if (source.failed())
+            throw std::runtime_error("Грешка при четенето на " + file.path);
+    }
+
+    /**
+    * Функция, която извежда в .csv формат записите на устройството за даден период от всички негови лог файлове
+    * (.csv и .bin, некомпресирани и компресирани), подредени по време.
+    * @param log_path Директорията с лог файловете.
+    * @param query Устройството, периодът и колоните.
+    * @param out Потокът, в който се извеждат редовете.
+    * @return Статистиката на заявката.
+    * @throws std::runtime_error При повреден файл или ако някоя колона я няма във файл от периода.
+    */
+    Stats run(const std::string& log_path, const Query& query, std::ostream& out)
+    {
+        namespace fs = std::filesystem;
+        Stats stats;
+        Output output{ out, std::string(), std::string() };
+        for (const LogFile& file : find_files(log_path, query.host))
+        {
+            uint64_t offset = 0;
+            if (file.indexed)
+            {
+                const log_index::Entry& last = file.index.entries.back();
+                std::error_code error;
+                uint64_t size = fs::file_size(file.path, error);
+                // Последният запис на индекса сочи края на завършен файл, затова времето му е времето на последния ред
+                bool complete = !error && file.index.entries.size() > 1 && last.offset == size;
+                if (file.start_ms > query.to_ms || (complete && last.timestamp_ms < query.from_ms))
+                {
+                    ++stats.files_skipped;
+                    continue;
+                }
+                const log_index::Entry* block = query.use_index ? log_index::find_block(file.index, query.from_ms) : nullptr;
+                if (block)
+                    offset = block->offset;
+            }
+            ++stats.files_read;
+            if (file.bin)
+                read_bin(file, offset, query, output, stats);
+            else
+                read_csv(file, offset, query, output, stats);
+            output.flush(true);
+        }
+        output.flush(true);
+        return stats;
+    }
+};
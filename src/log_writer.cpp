@@ -0,0 +1,590 @@
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "bin_log.hpp"
+#include "log_index.hpp"
+#include "log_writer.hpp"
+#include "export_data.hpp"
+
+namespace export_data
+{
+    /**
+    * Време, за което нишката за запис заспива, когато няма нови отчети.
+    */
+    static const std::chrono::milliseconds IDLE_WAIT(50);
+
+    LogWriter::Channel::Channel(std::FILE* f, size_t capacity, size_t reg_count)
+     : file(f)
+     , queue(capacity)
+    {
+        for (size_t i = 0; i < queue.capacity(); ++i)
+            queue.slot(i).values = new reg::RegisterResult[reg_count];
+    }
+
+    LogWriter::Channel::~Channel()
+    {
+        for (size_t i = 0; i < queue.capacity(); ++i)
+            delete[] queue.slot(i).values;
+        if (file) std::fclose(file);
+        if (index) std::fclose(index);
+    }
+
+    LogWriter::Aggregation::Aggregation(std::FILE* f, const reg::ReadPlanView& plan, uint32_t window_seconds)
+     : file(f)
+     , window(plan, window_seconds)
+    {
+    }
+
+    LogWriter::Aggregation::~Aggregation()
+    {
+        if (file) std::fclose(file);
+    }
+
+    /**
+    * Помощна функция, която отваря лог файл без буфер на stdio.
+    * Редовете се натрупват в 'pending', затова буферът на stdio само би копирал данните още веднъж.
+    * @throws std::runtime_error Ако файлът не може да се отвори.
+    */
+    static std::FILE* open_log(const std::string& path, bool binary)
+    {
+        std::FILE* file = std::fopen(path.c_str(), binary ? "wb" : "w");
+        if (!file)
+            throw std::runtime_error("Грешка при отварянето на файл: " + path);
+        std::setvbuf(file, nullptr, _IONBF, 0);
+        return file;
+    }
+
+    /**
+    * Помощна функция, която съставя името на файла със статистиките за прозорци с дадена дължина: <име на лог файла>_agg<секунди>s.csv.
+    */
+    static std::string aggregate_file_name(const std::string& path, uint32_t window)
+    {
+        std::filesystem::path name(path);
+        name.replace_extension();
+        return name.string() + "_agg" + std::to_string(window) + "s.csv";
+    }
+
+    /**
+    * Клас за запис на отчетите в .csv файлове в отделна нишка.
+    * @param plan Планът за четене, по който са получени резултатите. Трябва да е валиден, докато обектът съществува.
+    * @param options Размер на опашките и буферите и кога данните да се записват на диска (вижте 'WriterOptions').
+    */
+    LogWriter::LogWriter(const reg::ReadPlanView& plan, const WriterOptions& options)
+     : _plan(plan)
+     , _options(options)
+     , _flush_interval(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(options.flush_interval)))
+     , _channels(new std::atomic<Channel*>[MAX_FILES])
+     , _channel_count(0)
+     , _dropped(0)
+     , _stop(false)
+     , _close_requested(false)
+    {
+        for (size_t i = 0; i < MAX_FILES; ++i)
+            _channels[i].store(nullptr);
+    }
+
+    LogWriter::~LogWriter()
+    {
+        stop();
+        for (size_t i = 0; i < _channel_count.load(); ++i)
+            delete _channels[i].load();
+    }
+
+    /**
+    * Помощна функция, която проверява дали файлът съществува некомпресиран или компресиран (вижте 'log_compact::Compactor').
+    */
+    static bool log_exists(const std::string& path)
+    {
+        std::error_code error;
+        for (log_compact::Codec codec : { log_compact::Codec::NONE, log_compact::Codec::GZIP, log_compact::Codec::ZSTD, log_compact::Codec::LZ4 })
+        {
+            if (std::filesystem::exists(path + log_compact::codec_extension(codec), error))
+                return true;
+        }
+        return false;
+    }
+
+    /**
+    * Помощна функция, която връща времето на следващата смяна на файловете след 'now' (0 - без смяна по време).
+    * Границите се броят от местната полунощ (например при 3600 - в началото на всеки час), а интервалите над едно денонощие - от 'now'.
+    */
+    static std::time_t next_rotation(std::time_t now, uint32_t interval)
+    {
+        if (interval == 0)
+            return 0;
+        if (interval > 86400)
+            return now + interval;
+        std::tm local_tm = timestamp::local_time(now);
+        std::time_t of_day = local_tm.tm_hour * 3600 + local_tm.tm_min * 60 + local_tm.tm_sec;
+        return now - of_day % interval + interval;
+    }
+
+    /**
+    * Създава нов лог файл и записва заглавието му. Може да се извика и докато нишката за запис работи.
+    * За всеки прозорец от 'WriterOptions::aggregate_windows' до файла се създава и .csv файл със статистиките.
+    * Името на файла е от 'csv_file_name', а при смяна на файловете ('WriterOptions::rotate_size' и 'rotate_interval') се създават нови файлове със същото устройство.
+    * @param log_path Директорията на файла.
+    * @param host Името на устройството в името на файла.
+    * @param device_metrics Статистиката на устройството, в която се записва времето за запис (nullptr - не се записва).
+    * @return Индексът на файла, който се подава на 'push'. Индексите на премахнатите файлове се използват повторно.
+    * @throws std::runtime_error Ако файлът не може да се отвори или вече има 'MAX_FILES' файла.
+    */
+    size_t LogWriter::add_file(std::string_view log_path, const std::string& host, metrics::DeviceMetrics* device_metrics)
+    {
+        std::lock_guard<std::mutex> lock(_channels_mutex);
+        size_t count = _channel_count.load();
+        size_t file = 0;
+        while (file < count && _channels[file].load())
+            ++file;
+        if (file == MAX_FILES)
+            throw std::runtime_error("Твърде много лог файлове (най-много " + std::to_string(MAX_FILES) + ")");
+
+        std::unique_ptr<Channel> channel(new Channel(nullptr, _options.queue_capacity, _plan.reg_count));
+        Channel& ch = *channel;
+        ch.log_path = std::string(log_path);
+        ch.host = host;
+        ch.metrics = device_metrics;
+        ch.pending.reserve(_options.buffer_size);
+        for (uint32_t window : _options.aggregate_windows)
+            ch.aggregations.emplace_back(new Aggregation(nullptr, _plan, window));
+        if (_options.changes_only)
+        {
+            ch.changes.reset(new ChangeFilter(_plan, _options.deadbands, _options.heartbeat));
+            ch.changed.resize(ch.changes->mask_size());
+        }
+        open_files(ch, std::time(nullptr));
+
+        _channels[file].store(channel.release(), std::memory_order_release);
+        if (file == count)
+            _channel_count.store(count + 1);
+        return file;
+    }
+
+    /**
+    * Създава файловете на устройството (с отделните отчети и със статистиките) с името за даденото време и записва заглавията им.
+    * Ако файл със същото име вече съществува (например при смяна в същата секунда), към името се добавя "_<n>".
+    * @throws std::runtime_error Ако някой файл не може да се отвори.
+    */
+    void LogWriter::open_files(Channel& ch, std::time_t now)
+    {
+        std::filesystem::path name(csv_file_name(ch.log_path, ch.host, _options.format == LogFormat::BIN ? ".bin" : ".csv", now));
+        std::string stem = (name.parent_path() / name.stem()).string();
+        std::string extension = name.extension().string();
+        std::string path = name.string();
+        for (size_t n = 2; ; ++n)
+        {
+            bool taken = log_exists(path);
+            for (uint32_t window : _options.aggregate_windows)
+                taken = taken || log_exists(aggregate_file_name(path, window));
+            if (!taken)
+                break;
+            path = stem + "_" + std::to_string(n) + extension;
+        }
+        ch.path = path;
+        ch.bytes = 0;
+        ch.rotate_at = next_rotation(now, _options.rotate_interval);
+
+        for (size_t i = 0; i < ch.aggregations.size(); ++i)
+        {
+            Aggregation& aggregation = *ch.aggregations[i];
+            aggregation.path = aggregate_file_name(path, _options.aggregate_windows[i]);
+            aggregation.file = open_log(aggregation.path, false);
+            aggregation.window.append_csv_header(aggregation.pending);
+            write_file(aggregation.file, aggregation.pending);
+            aggregation.pending.clear();
+        }
+        if (_options.raw)
+            ch.file = open_log(path, _options.format == LogFormat::BIN);
+        ch.block_rows = 0;
+        ch.last_row_ms = 0;
+        if (ch.file && _options.index_block > 0)
+        {
+            ch.index = open_log(log_index::index_path(path), true);
+            log_index::append_header(ch.index_pending, _options.changes_only ? log_index::FLAG_CHANGES : 0, _options.index_block);
+        }
+        if (ch.file && _options.format == LogFormat::BIN)
+        {
+            bin_log::append_header(ch.pending, _plan, _options.changes_only);
+        }
+        else if (ch.file)
+        {
+            ch.pending.append(_plan.csv_header);
+            ch.pending.push_back('\n');
+        }
+        write_out(ch, Clock::now());
+    }
+
+    /**
+    * Затваря файловете на устройството и ги изпраща за компресиране ('WriterOptions::compactor'). Чакащите редове трябва вече да са записани.
+    */
+    void LogWriter::close_files(Channel& ch)
+    {
+        end_index(ch);
+        for (std::unique_ptr<Aggregation>& aggregation : ch.aggregations)
+        {
+            if (!aggregation->file)
+                continue;
+            std::fclose(aggregation->file);
+            aggregation->file = nullptr;
+            if (_options.compactor)
+                _options.compactor->submit(aggregation->path);
+        }
+        if (ch.file)
+        {
+            std::fclose(ch.file);
+            ch.file = nullptr;
+            if (_options.compactor)
+                _options.compactor->submit(ch.path);
+        }
+    }
+
+    /**
+    * Отбелязва запис, който предстои да се добави към 'pending'. Първият запис на всеки блок добавя към индекса времето и отместването си.
+    */
+    void LogWriter::index_row(Channel& ch, int64_t timestamp_ms)
+    {
+        ch.last_row_ms = timestamp_ms;
+        if (!ch.index)
+            return;
+        if (ch.block_rows == 0)
+            log_index::append_entry(ch.index_pending, timestamp_ms, ch.bytes + ch.pending.size());
+        if (++ch.block_rows >= _options.index_block)
+            ch.block_rows = 0;
+    }
+
+    /**
+    * Добавя към индекса последния запис (времето на последния запис и размера на файла) и го затваря.
+    * Файлът с отчетите трябва вече да е записан, затова индекс с такъв запис принадлежи на завършен файл.
+    */
+    void LogWriter::end_index(Channel& ch)
+    {
+        if (!ch.index)
+            return;
+        if (ch.last_row_ms != 0)
+            log_index::append_entry(ch.index_pending, ch.last_row_ms, ch.bytes);
+        write_file(ch.index, ch.index_pending);
+        ch.index_pending.clear();
+        std::fclose(ch.index);
+        ch.index = nullptr;
+    }
+
+    /**
+    * Функция, която проверява дали файловете на устройството трябва да се сменят - при достигане на 'WriterOptions::rotate_size'
+    * (заедно с чакащите редове) или на границата на 'WriterOptions::rotate_interval'.
+    * @param now Времето на отчета, който предстои да се запише (или текущото време).
+    */
+    bool LogWriter::rotation_due(const Channel& ch, std::time_t now) const
+    {
+        if (ch.rotate_at != 0 && now >= ch.rotate_at)
+            return true;
+        return _options.rotate_size > 0 && ch.file && ch.bytes + ch.pending.size() >= _options.rotate_size;
+    }
+
+    /**
+    * Записва чакащите редове в текущите файлове, затваря ги и създава нови. В режим 'само промени' филтърът започва отначало,
+    * затова всеки файл започва с всички стойности и може да се чете самостоятелно.
+    * Ако новите файлове не могат да се отворят, отчетите не се записват до следващата смяна по време.
+    */
+    void LogWriter::rotate(Channel& ch, std::time_t now)
+    {
+        write_out(ch, Clock::now());
+        close_files(ch);
+        if (ch.changes)
+            ch.changes.reset(new ChangeFilter(_plan, _options.deadbands, _options.heartbeat));
+        try
+        {
+            open_files(ch, now);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "\n" << e.what() << std::endl;
+            ch.pending.clear();
+            ch.rotate_at = next_rotation(now, _options.rotate_interval);
+        }
+    }
+
+    /**
+    * Записва всички чакащи отчети на файла (и статистиките на незавършените прозорци) и го затваря.
+    * Ако нишката за запис работи, функцията чака, докато тя затвори файла. След това индексът на файла може да се върне от 'add_file' за нов файл.
+    * @param file Индексът на файла (върнат от 'add_file'). Нишката, която извиква 'push' за този файл, трябва вече да е спряла.
+    */
+    void LogWriter::remove_file(size_t file)
+    {
+        // Докато файлът се затваря, 'add_file' не може да използва индекса му за нов файл
+        std::lock_guard<std::mutex> channels_lock(_channels_mutex);
+        if (file >= _channel_count.load() || !_channels[file].load())
+            return;
+        if (!_thread.joinable())
+        {
+            Channel* ch = _channels[file].exchange(nullptr);
+            drain(*ch);
+            close_windows(*ch);
+            write_out(*ch, Clock::now());
+            retire(ch);
+            return;
+        }
+        _channels[file].load()->closing.store(true);
+        std::unique_lock<std::mutex> lock(_mutex);
+        _close_requested.store(true);
+        _wake.notify_one();
+        _closed.wait(lock, [this, file]() { return !_channels[file].load(); });
+    }
+
+    /**
+    * Стартира нишката за запис.
+    */
+    void LogWriter::start()
+    {
+        if (_thread.joinable())
+            return;
+        _stop.store(false);
+        _thread = std::thread(&LogWriter::writer_loop, this);
+    }
+
+    /**
+    * Записва всички чакащи отчети и спира нишката за запис.
+    */
+    void LogWriter::stop()
+    {
+        if (!_thread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop.store(true);
+        }
+        _wake.notify_one();
+        _thread.join();
+    }
+
+    /**
+    * Копира резултатите от един отчет в опашката на файла. Никога не чака нишката за запис.
+    * За всеки файл трябва да се извиква само от една нишка. Файлът се намира без заключване, затова затварянето на други файлове не забавя функцията.
+    * @param file Индексът на файла (върнат от 'add_file').
+    * @param timestamp_ms Времето на прочитане в милисекунди от 1970-01-01 UTC (вижте 'P30HTcpReader::sample_sent').
+    * @param results Резултатите в реда на плана за четене.
+    * @return False, ако опашката е пълна и отчетът е изхвърлен.
+    */
+    bool LogWriter::push(size_t file, int64_t timestamp_ms, const reg::RegisterResult* results)
+    {
+        Channel* ch = file < MAX_FILES ? _channels[file].load(std::memory_order_acquire) : nullptr;
+        if (!ch)
+            return false;
+        Sample* sample = ch->queue.begin_push();
+        if (!sample)
+        {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        sample->timestamp_ms = timestamp_ms;
+        for (size_t i = 0; i < _plan.reg_count; ++i)
+            sample->values[i] = results[i];
+        ch->queue.commit_push();
+        return true;
+    }
+
+    /**
+    * Функция за получаване на броя на изхвърлените отчети (поради пълна опашка).
+    */
+    uint64_t LogWriter::dropped() const
+    {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+    /**
+    * Главният цикъл на нишката за запис: форматира новите отчети и записва буферите, които са пълни или чакат от 'flush_interval'.
+    */
+    void LogWriter::writer_loop()
+    {
+        while (true)
+        {
+            bool stopping = _stop.load();
+            bool idle = true;
+            bool closed = false;
+            _close_requested.store(false);
+            size_t count = _channel_count.load();
+            for (size_t i = 0; i < count; ++i)
+            {
+                Channel* ch = _channels[i].load(std::memory_order_acquire);
+                if (!ch)
+                    continue;
+                bool closing = ch->closing.load();
+                if (drain(*ch))
+                    idle = false;
+                // Смяна по време и на устройство без нови отчети (например недостъпно)
+                std::time_t seconds = std::time(nullptr);
+                if (!stopping && !closing && rotation_due(*ch, seconds))
+                    rotate(*ch, seconds);
+                if (stopping || closing)
+                    close_windows(*ch);
+                Clock::time_point now = Clock::now();
+                if (!ch->pending.empty() && (stopping || closing || ch->pending.size() >= _options.buffer_size || now >= ch->next_write))
+                    write_out(*ch, now);
+                // Индексът на файл, който остава отворен при спиране, също е завършен
+                if (stopping)
+                    end_index(*ch);
+                ch->closed = closing;
+                closed = closed || closing;
+            }
+            if (closed)
+                release_closed();
+            if (stopping)
+                break;
+            if (idle)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait_for(lock, IDLE_WAIT, [this]() { return _stop.load() || _close_requested.load(); });
+            }
+        }
+    }
+
+    /**
+    * Премахва от таблицата файловете, които 'remove_file' е отбелязал и чиито отчети вече са записани, затваря ги и събужда чакащите 'remove_file'.
+    * Извиква се само от нишката за запис, затова файловете се затварят без заключване.
+    */
+    void LogWriter::release_closed()
+    {
+        size_t count = _channel_count.load();
+        for (size_t i = 0; i < count; ++i)
+        {
+            Channel* ch = _channels[i].load();
+            if (!ch || !ch->closed)
+                continue;
+            _channels[i].store(nullptr);
+            retire(ch);
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed.notify_all();
+    }
+
+    /**
+    * Затваря файловете на файл, който вече е премахнат от таблицата, и освобождава паметта му.
+    */
+    void LogWriter::retire(Channel* ch)
+    {
+        close_files(*ch);
+        delete ch;
+    }
+
+    /**
+    * Форматира всички отчети от опашката на файла в неговия буфер (като .csv редове или двоични записи).
+    * В режим 'само промени' се записват само променените стойности, а отчетите без промени се пропускат.
+    * Всеки отчет се добавя и към статистиките за прозорците (вижте 'aggregate').
+    * @return Дали е имало нови отчети.
+    */
+    bool LogWriter::drain(Channel& ch)
+    {
+        bool any = false;
+        while (Sample* sample = ch.queue.front())
+        {
+            aggregate(ch, *sample);
+            if (rotation_due(ch, sample->seconds()))
+                rotate(ch, sample->seconds());
+            if (ch.file && ch.changes)
+            {
+                // Всеки блок на индекса започва с пълен запис, затова четенето може да започне от него
+                if (ch.index && ch.block_rows == 0)
+                    ch.changes->restart();
+                size_t count = ch.changes->update(sample->seconds(), sample->values, ch.changed.data());
+                if (count > 0)
+                    index_row(ch, sample->timestamp_ms);
+                if (count > 0 && _options.format == LogFormat::BIN)
+                    bin_log::append_delta_record(ch.pending, sample->timestamp_ms, _plan, sample->values, ch.changed.data());
+                else if (count > 0)
+                    append_csv_changes(ch.pending, _formatter.format(sample->timestamp_ms), _plan, sample->values, ch.changed.data());
+            }
+            else if (ch.file)
+            {
+                index_row(ch, sample->timestamp_ms);
+                if (_options.format == LogFormat::BIN)
+                    bin_log::append_record(ch.pending, sample->timestamp_ms, _plan, sample->values);
+                else
+                    append_csv_row(ch.pending, _formatter.format(sample->timestamp_ms), _plan, sample->values);
+            }
+            ch.queue.pop();
+            any = true;
+        }
+        return any;
+    }
+
+    /**
+    * Добавя отчета към статистиките за всеки прозорец. Статистиките на завършил прозорец се записват веднага (по един ред за прозорец).
+    */
+    void LogWriter::aggregate(Channel& ch, const Sample& sample)
+    {
+        for (std::unique_ptr<Aggregation>& aggregation : ch.aggregations)
+        {
+            if (aggregation->window.due(sample.seconds()))
+            {
+                aggregation->window.append_csv_row(aggregation->pending, format_timestamp(aggregation->window.window_start()));
+                write_file(aggregation->file, aggregation->pending);
+                aggregation->pending.clear();
+            }
+            aggregation->window.add(sample.seconds(), sample.values);
+        }
+    }
+
+    /**
+    * Записва статистиките на незавършените прозорци при спиране (колоната 'samples' показва колко отчета съдържат).
+    */
+    void LogWriter::close_windows(Channel& ch)
+    {
+        for (std::unique_ptr<Aggregation>& aggregation : ch.aggregations)
+        {
+            if (aggregation->window.samples() == 0)
+                continue;
+            aggregation->window.append_csv_row(aggregation->pending, format_timestamp(aggregation->window.window_start()));
+            write_file(aggregation->file, aggregation->pending);
+            aggregation->pending.clear();
+            aggregation->window.reset(aggregation->window.window_start());
+        }
+    }
+
+    /**
+    * Записва буфера на файла на диска (и извиква fsync, ако е зададено).
+    */
+    void LogWriter::write_out(Channel& ch, Clock::time_point now)
+    {
+        if (ch.file)
+        {
+            write_file(ch.file, ch.pending);
+            ch.bytes += ch.pending.size();
+        }
+        // Индексът се записва след данните, затова никога не сочи след края на файла
+        if (ch.index && !ch.index_pending.empty())
+        {
+            write_file(ch.index, ch.index_pending);
+            ch.index_pending.clear();
+        }
+        if (ch.metrics)
+            ch.metrics->write_latency.record(Clock::now() - now);
+        ch.pending.clear();
+        ch.next_write = now + _flush_interval;
+    }
+
+    /**
+    * Записва данните във файла (и извиква fsync, ако е зададено). Ако файлът не е отворен (след грешка при смяната), данните се пропускат.
+    */
+    void LogWriter::write_file(std::FILE* file, const std::string& data)
+    {
+        if (!file)
+            return;
+        if (std::fwrite(data.data(), 1, data.size(), file) != data.size())
+            std::cerr << "\nГрешка при записа в лог файл." << std::endl;
+        if (_options.fsync)
+        {
+            std::fflush(file);
+    #ifdef _WIN32
+            _commit(_fileno(file));
+    #else
+            fsync(fileno(file));
+    #endif
+        }
+    }
+};
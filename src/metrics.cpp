@@ -0,0 +1,466 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "metrics.hpp"
+
+#ifdef __linux__
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+namespace metrics
+{
+    Histogram::Histogram()
+     : _count(0)
+     , _sum(0)
+     , _max(0)
+    {
+        for (std::atomic<uint32_t>& b : _buckets)
+            b.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+    * Функция, която връща номера на интервала за дадена стойност.
+    * Стойностите под 8 имат собствен интервал, а всеки следващ интервал [2^k, 2^(k+1)) е разделен на 8 части.
+    */
+    size_t Histogram::bucket_index(uint64_t value_us)
+    {
+        if (value_us > MAX_VALUE) value_us = MAX_VALUE;
+        if (value_us < SUB_BUCKETS) return static_cast<size_t>(value_us);
+        int exponent = 63 - __builtin_clzll(value_us);
+        return static_cast<size_t>(exponent - 2) * SUB_BUCKETS + static_cast<size_t>((value_us >> (exponent - 3)) & (SUB_BUCKETS - 1));
+    }
+
+    /**
+    * Функция, която връща най-малката стойност в даден интервал.
+    */
+    uint64_t Histogram::bucket_lower(size_t index)
+    {
+        if (index < SUB_BUCKETS) return index;
+        size_t exponent = index / SUB_BUCKETS + 2;
+        return (SUB_BUCKETS + index % SUB_BUCKETS) << (exponent - 3);
+    }
+
+    /**
+    * Записва една стойност. Не заделя памет и не заключва.
+    * @param value_us Стойността в микросекунди.
+    */
+    void Histogram::record(uint64_t value_us)
+    {
+        _buckets[bucket_index(value_us)].fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(value_us, std::memory_order_relaxed);
+        uint64_t current = _max.load(std::memory_order_relaxed);
+        while (value_us > current && !_max.compare_exchange_weak(current, value_us, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void Histogram::record(Clock::duration duration)
+    {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        record(static_cast<uint64_t>(std::max<long long>(0, us)));
+    }
+
+    /**
+    * Добавя стойностите на друга хистограма (например за обща статистика на всички устройства).
+    */
+    void Histogram::add(const Histogram& other)
+    {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i)
+            _buckets[i].fetch_add(other._buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        _count.fetch_add(other.count(), std::memory_order_relaxed);
+        _sum.fetch_add(other.sum(), std::memory_order_relaxed);
+        uint64_t value = other.max();
+        uint64_t current = _max.load(std::memory_order_relaxed);
+        while (value > current && !_max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint64_t Histogram::count() const
+    {
+        return _count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Histogram::sum() const
+    {
+        return _sum.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Histogram::max() const
+    {
+        return _max.load(std::memory_order_relaxed);
+    }
+
+    /**
+    * Функция, която връща процентил на записаните стойности.
+    * @param p Процентилът като дял (например 0.99).
+    * @return Горната граница на интервала, в който попада процентилът (но не повече от най-голямата стойност), в микросекунди. 0, ако няма стойности.
+    */
+    uint64_t Histogram::percentile(double p) const
+    {
+        uint32_t counts[BUCKET_COUNT];
+        uint64_t total = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i)
+        {
+            counts[i] = _buckets[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0)
+            return 0;
+        uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * static_cast<double>(total))));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i)
+        {
+            seen += counts[i];
+            if (seen >= target)
+            {
+                uint64_t upper = i + 1 < BUCKET_COUNT ? bucket_lower(i + 1) - 1 : MAX_VALUE;
+                return std::min(upper, max());
+            }
+        }
+        return max();
+    }
+
+    DeviceMetrics::DeviceMetrics(const std::string& name)
+     : device(name)
+    {
+    }
+
+    /**
+    * Добавя ново устройство.
+    * @param device Името на устройството (ip:port/id).
+    * @return Статистиката на устройството. Остава валидна, докато съществува Registry или до извикването на 'remove'.
+    */
+    DeviceMetrics& Registry::add(const std::string& device)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _devices.emplace_back(new DeviceMetrics(device));
+        return *_devices.back();
+    }
+
+    /**
+    * Премахва статистиката на устройство (например след премахването му от конфигурационния файл).
+    * Трябва да се извика, след като никоя нишка вече не записва в нея.
+    */
+    void Registry::remove(const DeviceMetrics* device_metrics)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _devices.size(); ++i)
+        {
+            if (_devices[i].get() == device_metrics)
+            {
+                _devices.erase(_devices.begin() + static_cast<std::ptrdiff_t>(i));
+                return;
+            }
+        }
+    }
+
+    /**
+    * Променя името на устройство, без да нулира статистиката му.
+    */
+    void Registry::rename(DeviceMetrics& device_metrics, const std::string& device)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        device_metrics.device = device;
+    }
+
+    /**
+    * Функция за получаване на броя на устройствата.
+    */
+    size_t Registry::size() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _devices.size();
+    }
+
+    /**
+    * Събира статистиката на всички устройства (например за обща статистика на програмата).
+    * @param total Обектът, към който се добавят стойностите.
+    */
+    void Registry::sum(DeviceMetrics& total) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const std::unique_ptr<DeviceMetrics>& d : _devices)
+        {
+            total.request_rtt.add(d->request_rtt);
+            total.sample_latency.add(d->sample_latency);
+            total.write_latency.add(d->write_latency);
+            total.start_lag.add(d->start_lag);
+            increment(total.samples, d->samples.load(std::memory_order_relaxed));
+            increment(total.timeouts, d->timeouts.load(std::memory_order_relaxed));
+            increment(total.exceptions, d->exceptions.load(std::memory_order_relaxed));
+            increment(total.reconnects, d->reconnects.load(std::memory_order_relaxed));
+            increment(total.missed_deadlines, d->missed_deadlines.load(std::memory_order_relaxed));
+        }
+    }
+
+    static void append_number(std::string& out, double value)
+    {
+        char buf[32];
+        auto res = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::general, 6);
+        out.append(buf, res.ptr);
+    }
+
+    static void append_number(std::string& out, uint64_t value)
+    {
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, res.ptr);
+    }
+
+    static void append_label(std::string& out, const std::string& device)
+    {
+        out.append("{device=\"");
+        for (char c : device)
+        {
+            if (c == '\\' || c == '"') out.push_back('\\');
+            out.push_back(c);
+        }
+        out.push_back('"');
+    }
+
+    static const double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    static void append_summary_metric(std::string& out, const char* name, const char* help,
+                                      const std::vector<std::unique_ptr<DeviceMetrics>>& devices, Histogram DeviceMetrics::*member)
+    {
+        out.append("# HELP ").append(name).append(" ").append(help).append("\n# TYPE ").append(name).append(" summary\n");
+        for (const std::unique_ptr<DeviceMetrics>& d : devices)
+        {
+            const Histogram& h = (*d).*member;
+            for (double q : QUANTILES)
+            {
+                out.append(name);
+                append_label(out, d->device);
+                out.append(",quantile=\"");
+                append_number(out, q);
+                out.append("\"} ");
+                append_number(out, static_cast<double>(h.percentile(q)) / 1e6);
+                out.push_back('\n');
+            }
+            out.append(name).append("_sum");
+            append_label(out, d->device);
+            out.append("} ");
+            append_number(out, static_cast<double>(h.sum()) / 1e6);
+            out.push_back('\n');
+            out.append(name).append("_count");
+            append_label(out, d->device);
+            out.append("} ");
+            append_number(out, h.count());
+            out.push_back('\n');
+        }
+    }
+
+    static void append_counter_metric(std::string& out, const char* name, const char* help,
+                                      const std::vector<std::unique_ptr<DeviceMetrics>>& devices, std::atomic<uint64_t> DeviceMetrics::*member)
+    {
+        out.append("# HELP ").append(name).append(" ").append(help).append("\n# TYPE ").append(name).append(" counter\n");
+        for (const std::unique_ptr<DeviceMetrics>& d : devices)
+        {
+            out.append(name);
+            append_label(out, d->device);
+            out.append("} ");
+            append_number(out, ((*d).*member).load(std::memory_order_relaxed));
+            out.push_back('\n');
+        }
+    }
+
+    /**
+    * Добавя статистиката на всички устройства в текстовия формат на Prometheus (времената са в секунди).
+    * @param out Низът, към който се добавя текстът.
+    */
+    void Registry::append_prometheus(std::string& out) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        append_summary_metric(out, "p30h_request_rtt_seconds", "Време за отговор на една заявка FC03.", _devices, &DeviceMetrics::request_rtt);
+        append_summary_metric(out, "p30h_sample_latency_seconds", "Време за един отчет.", _devices, &DeviceMetrics::sample_latency);
+        append_summary_metric(out, "p30h_write_latency_seconds", "Време за един запис в лог файла.", _devices, &DeviceMetrics::write_latency);
+        append_summary_metric(out, "p30h_start_lag_seconds", "Закъснение на началото на отчета спрямо планираното време.", _devices, &DeviceMetrics::start_lag);
+        append_counter_metric(out, "p30h_samples_total", "Брой отчети.", _devices, &DeviceMetrics::samples);
+        append_counter_metric(out, "p30h_timeouts_total", "Брой заявки без отговор.", _devices, &DeviceMetrics::timeouts);
+        append_counter_metric(out, "p30h_modbus_exceptions_total", "Брой отговори с Modbus изключение.", _devices, &DeviceMetrics::exceptions);
+        append_counter_metric(out, "p30h_reconnects_total", "Брой опити за свързване след първия.", _devices, &DeviceMetrics::reconnects);
+        append_counter_metric(out, "p30h_missed_deadlines_total", "Брой пропуснати интервали на четене.", _devices, &DeviceMetrics::missed_deadlines);
+    }
+
+    static void append_ms(std::string& out, uint64_t value_us)
+    {
+        append_number(out, static_cast<double>(value_us) / 1000.0);
+    }
+
+    static void append_device_line(std::string& out, const DeviceMetrics& d)
+    {
+        out.append(d.device).append(": отчети ");
+        append_number(out, d.samples.load(std::memory_order_relaxed));
+        out.append(", RTT p50/p99 ");
+        append_ms(out, d.request_rtt.percentile(0.5));
+        out.push_back('/');
+        append_ms(out, d.request_rtt.percentile(0.99));
+        out.append(" ms, отчет p50/p99 ");
+        append_ms(out, d.sample_latency.percentile(0.5));
+        out.push_back('/');
+        append_ms(out, d.sample_latency.percentile(0.99));
+        out.append(" ms, запис p99 ");
+        append_ms(out, d.write_latency.percentile(0.99));
+        out.append(" ms, закъснение p99 ");
+        append_ms(out, d.start_lag.percentile(0.99));
+        out.append(" ms, без отговор ");
+        append_number(out, d.timeouts.load(std::memory_order_relaxed));
+        out.append(", изключения ");
+        append_number(out, d.exceptions.load(std::memory_order_relaxed));
+        out.append(", повторни свързвания ");
+        append_number(out, d.reconnects.load(std::memory_order_relaxed));
+        out.append(", пропуснати интервали ");
+        append_number(out, d.missed_deadlines.load(std::memory_order_relaxed));
+        out.push_back('\n');
+    }
+
+    /**
+    * Добавя кратка статистика (по един ред за устройство и общ ред за всички устройства) за извеждане на конзолата.
+    * @param out Низът, към който се добавя текстът.
+    */
+    void Registry::append_summary(std::string& out) const
+    {
+        size_t count = 0;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (const std::unique_ptr<DeviceMetrics>& d : _devices)
+                append_device_line(out, *d);
+            count = _devices.size();
+        }
+        if (count > 1)
+        {
+            std::unique_ptr<DeviceMetrics> total(new DeviceMetrics("общо"));
+            sum(*total);
+            append_device_line(out, *total);
+        }
+    }
+
+    #ifdef __linux__
+    /**
+    * Време, през което нишката на сървъра проверява дали трябва да спре.
+    */
+    static const int ACCEPT_WAIT_MS = 200;
+
+    /**
+    * Клас за изпращане на статистиката по HTTP.
+    * @param registry Статистиката. Трябва да е валидна, докато обектът съществува.
+    * @param port Портът на 127.0.0.1, на който се слуша.
+    * @throws std::runtime_error Ако портът не може да се отвори.
+    */
+    HttpExporter::HttpExporter(const Registry& registry, uint16_t port)
+     : _registry(registry)
+     , _listen_fd(-1)
+     , _stop(false)
+    {
+        _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (_listen_fd < 0)
+            throw std::runtime_error("Грешка при създаването на сокет: " + std::string(std::strerror(errno)));
+        int one = 1;
+        setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if (bind(_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(_listen_fd, 16) != 0)
+        {
+            int error = errno;
+            close(_listen_fd);
+            throw std::runtime_error("Грешка при отварянето на порт " + std::to_string(port) + ": " + std::strerror(error));
+        }
+    }
+
+    HttpExporter::~HttpExporter()
+    {
+        stop();
+        if (_listen_fd >= 0) close(_listen_fd);
+    }
+
+    /**
+    * Стартира нишката на сървъра.
+    */
+    void HttpExporter::start()
+    {
+        if (_thread.joinable())
+            return;
+        _stop.store(false);
+        _thread = std::thread(&HttpExporter::serve_loop, this);
+    }
+
+    /**
+    * Спира нишката на сървъра (до ACCEPT_WAIT_MS).
+    */
+    void HttpExporter::stop()
+    {
+        if (!_thread.joinable())
+            return;
+        _stop.store(true);
+        _thread.join();
+    }
+
+    void HttpExporter::serve_loop()
+    {
+        while (!_stop.load())
+        {
+            pollfd pfd = { _listen_fd, POLLIN, 0 };
+            if (poll(&pfd, 1, ACCEPT_WAIT_MS) <= 0)
+                continue;
+            int fd = accept4(_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0)
+                continue;
+            serve(fd);
+            close(fd);
+        }
+    }
+
+    /**
+    * Прочита заглавието на една HTTP заявка и изпраща отговора. Бавен клиент се прекъсва след една секунда.
+    */
+    void HttpExporter::serve(int fd)
+    {
+        timeval timeout = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        std::string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+        {
+            ssize_t k = recv(fd, buf, sizeof(buf), 0);
+            if (k <= 0)
+                break;
+            request.append(buf, static_cast<size_t>(k));
+        }
+
+        std::string body;
+        std::string status = "200 OK";
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+            _registry.append_prometheus(body);
+        else
+        {
+            status = "404 Not Found";
+            body = "Not Found\n";
+        }
+        std::string response = "HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: " +
+                               std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+        response.append(body);
+        size_t sent = 0;
+        while (sent < response.size())
+        {
+            ssize_t k = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (k <= 0)
+                break;
+            sent += static_cast<size_t>(k);
+        }
+    }
+    #endif
+};
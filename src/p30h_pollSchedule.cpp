@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "p30h_pollSchedule.hpp"
+
+namespace reg
+{
+    /**
+    * Максимален брой групи (различни периоди). Плановете са 2^MAX_GROUPS.
+    */
+    static const size_t MAX_GROUPS = 8;
+
+    /**
+    * Клас за четене на величините с различен период.
+    * @param plan Пълният план за четене (например 'reg::reg_plan'). Трябва да е валиден, докато обектът съществува.
+    * @param interval Интервал на четене в секунди. Периодите на величините се закръгляват до цял брой интервали.
+    * @param max_gap Максимален брой непотребни регистри, които се прочитат, за да се обединят две заявки в една.
+    * @throws std::runtime_error При повече от 8 различни периода.
+    */
+    PollSchedule::PollSchedule(const ReadPlanView& plan, float interval, uint16_t max_gap)
+     : _plan(plan)
+     , _group(plan.reg_count, 0)
+    {
+        double interval_ms = std::max(1.0, static_cast<double>(interval) * 1000.0);
+        std::vector<uint32_t> every(plan.reg_count, 1);
+        for (size_t i = 0; i < plan.reg_count; ++i)
+        {
+            every[i] = static_cast<uint32_t>(std::max(1.0, std::round(plan.map[i].period_ms / interval_ms)));
+            if (std::find(_every.begin(), _every.end(), every[i]) == _every.end())
+                _every.push_back(every[i]);
+        }
+        if (_every.size() > MAX_GROUPS)
+            throw std::runtime_error("Твърде много различни периоди на четене (максимум " + std::to_string(MAX_GROUPS) + ").");
+        std::sort(_every.begin(), _every.end());
+        for (size_t i = 0; i < plan.reg_count; ++i)
+            _group[i] = static_cast<uint8_t>(std::find(_every.begin(), _every.end(), every[i]) - _every.begin());
+
+        uint32_t all = (1u << _every.size()) - 1;
+        _plans.resize(all + 1);
+        for (uint32_t mask = 0; mask < all; ++mask)
+            build(_plans[mask], mask, max_gap);
+    }
+
+    PollSchedule::~PollSchedule()
+    {
+        for (TickPlan& p : _plans)
+        {
+            delete[] p.blocks;
+            delete[] p.slots;
+            delete[] p.order;
+        }
+    }
+
+    /**
+    * Съставя плана за четене на дадена комбинация от групи.
+    * @param mask Битова маска на групите, които трябва да се прочетат.
+    */
+    void PollSchedule::build(TickPlan& tick_plan, uint32_t mask, uint16_t max_gap)
+    {
+        size_t count = _plan.reg_count;
+        bool* due = new bool[count];
+        for (size_t i = 0; i < count; ++i)
+            due[i] = (mask >> _group[i]) & 1;
+
+        tick_plan.blocks = new ReadBlock[plan_max_blocks(count)];
+        tick_plan.slots = new DecodeSlot[count]{};
+        tick_plan.order = new uint16_t[count];
+        size_t word_count = 0;
+        size_t block_count = plan_reads(_plan.map, count, tick_plan.blocks, tick_plan.slots, word_count, due, max_gap);
+
+        // Величините, които се съдържат изцяло в прочетените блокове, се декодират без допълнителни заявки
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (due[i]) continue;
+            uint16_t hi_addr = 0, lo_addr = 0;
+            word_addresses(_plan.map[i], hi_addr, lo_addr);
+            int32_t hi_block = search_block(tick_plan.blocks, block_count, hi_addr);
+            int32_t lo_block = search_block(tick_plan.blocks, block_count, lo_addr);
+            if (hi_block < 0 || lo_block < 0) continue;
+            const ReadBlock& hb = tick_plan.blocks[hi_block];
+            const ReadBlock& lb = tick_plan.blocks[lo_block];
+            tick_plan.slots[i] = { static_cast<uint16_t>(hb.offset + (hi_addr - hb.start)), static_cast<uint16_t>(lb.offset + (lo_addr - lb.start)),
+                                   static_cast<uint16_t>(hi_block), static_cast<uint16_t>(lo_block) };
+            due[i] = true;
+        }
+
+        size_t order_count = 0;
+        for (size_t i = 0; i < count; ++i)
+            if (due[i] && _plan.map[i].type == REG_FLOAT32) tick_plan.order[order_count++] = static_cast<uint16_t>(i);
+        size_t float_count = order_count;
+        for (size_t i = 0; i < count; ++i)
+            if (due[i] && _plan.map[i].type != REG_FLOAT32) tick_plan.order[order_count++] = static_cast<uint16_t>(i);
+        delete[] due;
+
+        tick_plan.view = { _plan.map, count, tick_plan.blocks, block_count, tick_plan.slots, tick_plan.order, order_count, float_count, word_count, _plan.csv_header };
+    }
+
+    /**
+    * Функция, която връща плана за даден интервал. При интервал 0 (и всеки общ кратен на периодите) се чете пълният план.
+    * @param tick Поредният номер на интервала.
+    * @return План, в който са само величините, които трябва да се прочетат (останалите запазват последната си стойност).
+    */
+    const ReadPlanView& PollSchedule::plan_for_tick(uint64_t tick) const
+    {
+        uint32_t mask = 0;
+        for (size_t g = 0; g < _every.size(); ++g)
+            if (tick % _every[g] == 0) mask |= 1u << g;
+        if (mask == _plans.size() - 1)
+            return _plan;
+        return _plans[mask].view;
+    }
+
+    /**
+    * Функция за получаване на броя на групите (различните периоди).
+    */
+    size_t PollSchedule::group_count() const
+    {
+        return _every.size();
+    }
+
+    /**
+    * Функция за получаване на периода на група в брой интервали.
+    */
+    uint32_t PollSchedule::group_every(size_t group) const
+    {
+        return _every[group];
+    }
+};
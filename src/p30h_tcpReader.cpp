@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <functional>
 #include <stdexcept>
 #include "p30h_tcpReader.hpp"
 
@@ -16,6 +18,32 @@ P30HTcpReader::P30HTcpReader(std::string host, uint16_t port, int id)
  , _id(id)
  , _cached_results(nullptr)
  , _cached_count(0)
+ , _results_map(nullptr)
+ , _plan{}
+ , _blocks(nullptr)
+ , _slots(nullptr)
+ , _order(nullptr)
+ , _words(nullptr)
+ , _words_cap(0)
+ , _requests(nullptr)
+ , _request_cap(0)
+ , _write_words(nullptr)
+ , _write_values(nullptr)
+ , _write_requests(nullptr)
+ , _write_cap(0)
+ , _async_plan{}
+ , _async_sent(0)
+ , _async_done(0)
+ , _async_base(0)
+ , _sample_sent{}
+ , _sample_received{}
+ , _metrics(nullptr)
+ , _connect_attempts(0)
+ , _link_state(LinkState::RECONNECTING)
+ , _backoff(std::chrono::seconds(1), std::chrono::seconds(60), static_cast<uint32_t>(std::hash<std::string>()(host) + port))
+ , _retry_at{}
+ , _silent_samples(0)
+ , _silent_limit(1)
 {
     client.modbus_set_slave_id(id);
 }
@@ -23,6 +51,14 @@ P30HTcpReader::P30HTcpReader(std::string host, uint16_t port, int id)
 P30HTcpReader::~P30HTcpReader()
 {
     delete[] _cached_results;
+    delete[] _words;
+    delete[] _requests;
+    delete[] _write_words;
+    delete[] _write_values;
+    delete[] _write_requests;
+    for (SlaveResults& slave : _slave_results)
+        delete[] slave.results;
+    release_plan();
 }
 
 /**
@@ -31,15 +67,25 @@ P30HTcpReader::~P30HTcpReader()
 */
 bool P30HTcpReader::connect()
 {
-    return client.modbus_connect();
+    if (_connect_attempts++ > 0 && _metrics)
+        metrics::increment(_metrics->reconnects);
+    if (!client.modbus_connect())
+        return false;
+    _link_state = LinkState::HEALTHY;
+    _silent_samples = 0;
+    _backoff.reset();
+    return true;
 }
 
 /**
- * Затваря връзката с устройството.
+ * Затваря връзката с устройството. Всички запазени стойности стават невалидни, а следващото блокиращо четене се свързва отново.
  */
 void P30HTcpReader::close()
 {
     client.modbus_close();
+    _link_state = LinkState::RECONNECTING;
+    _silent_samples = 0;
+    invalidate_results();
 }
 
 /**
@@ -66,15 +112,213 @@ int P30HTcpReader::get_slave_id() const
     return _id;
 }
 
+/**
+* Сменя идентификатора (slave id) на устройството, към което се изпращат следващите заявки.
+* Така една връзка към Modbus шлюз може да чете от няколко устройства зад него.
+* @param id Новият идентификатор.
+*/
+void P30HTcpReader::set_slave_id(int id)
+{
+    if (id != _id)
+    {
+        // Резултатите на предишното устройство се запазват, а тези на новото се взимат от там (ако вече е четено)
+        _slave_results.push_back({ _id, _cached_results, _cached_count, _results_map });
+        _cached_results = nullptr;
+        _cached_count = 0;
+        _results_map = nullptr;
+        for (size_t i = 0; i < _slave_results.size(); ++i)
+        {
+            if (_slave_results[i].id != id)
+                continue;
+            _cached_results = _slave_results[i].results;
+            _cached_count = _slave_results[i].count;
+            _results_map = _slave_results[i].map;
+            _slave_results[i] = _slave_results.back();
+            _slave_results.pop_back();
+            break;
+        }
+    }
+    _id = id;
+    client.modbus_set_slave_id(id);
+}
+
+/**
+* Задава колко заявки за четене могат да чакат отговор едновременно (pipelining).
+* Стойност 1 (по подразбиране) изпраща следващата заявка след получаване на отговора на предишната.
+* По-голяма стойност се използва само за устройства/шлюзове, които приемат няколко заявки наведнъж.
+* @param depth Максималният брой едновременни заявки.
+*/
+void P30HTcpReader::set_pipeline_depth(size_t depth)
+{
+    client.modbus_set_pipeline_depth(depth);
+}
+
+/**
+* Задава къде да се записват времената и грешките при четене (nullptr - не се записват).
+* @param device_metrics Статистиката на устройството. Трябва да е валидна, докато обектът съществува.
+*/
+void P30HTcpReader::set_metrics(metrics::DeviceMetrics* device_metrics)
+{
+    _metrics = device_metrics;
+}
+
+/**
+* Функция за получаване на статистиката на устройството (nullptr, ако не е зададена).
+*/
+metrics::DeviceMetrics* P30HTcpReader::get_metrics() const
+{
+    return _metrics;
+}
+
+/**
+* Функция за получаване на момента, в който е изпратена първата заявка от последния отчет.
+* Това е времето на отчета в лог файловете, защото не зависи от бързината на отговора.
+*/
+const timestamp::Stamp& P30HTcpReader::sample_sent() const
+{
+    return _sample_sent;
+}
+
+/**
+* Функция за получаване на момента, в който е получен последният отговор от последния отчет (или е изтекло времето за него).
+*/
+const timestamp::Stamp& P30HTcpReader::sample_received() const
+{
+    return _sample_received;
+}
+
+/**
+* Задава максималното време за свързване с 'connect'. Недостъпно устройство не задържа програмата до изтичането на TCP таймаута на системата.
+* @param seconds Време в секунди (по подразбиране 20).
+*/
+void P30HTcpReader::set_connect_timeout(float seconds)
+{
+    client.modbus_set_connect_timeout(static_cast<int>(seconds * 1000));
+}
+
+/**
+* Задава максималното време за изпращане на заявка и за получаване на един отговор при блокиращо четене.
+* Устройство, което не отговаря, задържа отчета най-много толкова, а не до изтичането на TCP таймаута на системата.
+* @param seconds Време в секунди (по подразбиране 20).
+*/
+void P30HTcpReader::set_response_timeout(float seconds)
+{
+    client.modbus_set_response_timeout(static_cast<int>(seconds * 1000));
+}
+
+/**
+* Задава след колко поредни отчета без нито един отговор връзката се затваря и се свързва отново (при блокиращо четене).
+* При шлюз с няколко устройства трябва да е броят им, защото едно недостъпно устройство зад шлюза не означава прекъсната връзка.
+* @param samples Брой отчети (по подразбиране 1).
+*/
+void P30HTcpReader::set_silent_limit(size_t samples)
+{
+    _silent_limit = samples > 0 ? samples : 1;
+}
+
+/**
+* Функция за получаване на състоянието на връзката (вижте 'LinkState').
+*/
+P30HTcpReader::LinkState P30HTcpReader::get_link_state() const
+{
+    return _link_state;
+}
+
+/**
+* Функция за получаване на времето на следващия опит за свързване (при LinkState::BACKOFF).
+*/
+metrics::Clock::time_point P30HTcpReader::get_retry_time() const
+{
+    return _retry_at;
+}
+
+/**
+* Проверява дали може да се чете и при нужда се свързва отново. Не чака изтичането на изчакването между два опита.
+* @return True, ако връзката е установена.
+*/
+bool P30HTcpReader::ensure_link()
+{
+    if (_link_state == LinkState::HEALTHY || _link_state == LinkState::DEGRADED)
+        return true;
+    if (_link_state == LinkState::BACKOFF && metrics::Clock::now() < _retry_at)
+        return false;
+    _link_state = LinkState::RECONNECTING;
+    if (connect())
+        return true;
+    _link_state = LinkState::BACKOFF;
+    _retry_at = metrics::Clock::now() + _backoff.next();
+    return false;
+}
+
+/**
+* Сменя състоянието на връзката според резултата от заявките на един отчет.
+* Прекъсната връзка (BAD_CON) се затваря веднага, а връзка без нито един отговор - след 'set_silent_limit' поредни такива отчета.
+* @param requests Заявките на отчета.
+* @param count Броят на заявките.
+*/
+void P30HTcpReader::update_link(const modbus_request* requests, size_t count)
+{
+    size_t answered = 0, succeeded = 0;
+    bool broken = false;
+    for (size_t b = 0; b < count; ++b)
+    {
+        if (requests[b].status == BAD_CON)
+            broken = true;
+        else if (requests[b].status >= 0)
+            ++answered;
+        if (requests[b].status == 0)
+            ++succeeded;
+    }
+    if (broken || (answered == 0 && count > 0 && ++_silent_samples >= _silent_limit))
+    {
+        close();
+        return;
+    }
+    if (answered > 0)
+        _silent_samples = 0;
+    _link_state = succeeded == count ? LinkState::HEALTHY : LinkState::DEGRADED;
+}
+
+/**
+* Отбелязва всички запазени стойности (и на устройствата зад шлюза, които не се четат в момента) като невалидни.
+* Извиква се при затваряне на връзката, за да не се записват стари стойности на величини, които не се четат при всеки отчет.
+*/
+void P30HTcpReader::invalidate_results()
+{
+    for (size_t i = 0; i < _cached_count; ++i)
+        _cached_results[i].valid = false;
+    for (SlaveResults& slave : _slave_results)
+        for (size_t i = 0; i < slave.count; ++i)
+            slave.results[i].valid = false;
+}
+
+/**
+* Прочита последователни 16-битови регистри с една заявка и сменя състоянието на връзката според резултата.
+* @param address Адресът на първия регистър.
+* @param amount Броят на регистрите.
+* @param buffer Масив с поне 'amount' елемента за стойностите.
+* @throws std::runtime_error Ако няма връзка или устройството не е върнало стойностите.
+*/
+void P30HTcpReader::read_words(uint16_t address, uint16_t amount, uint16_t* buffer)
+{
+    if (!ensure_link())
+        throw std::runtime_error("Няма връзка с " + _host + ":" + std::to_string(_port) + ".");
+    modbus_request request{ address, amount, buffer, client.modbus_read_holding_registers(address, amount, buffer), {}, 0 };
+    update_link(&request, 1);
+    if (request.status != 0)
+        throw std::runtime_error("Грешка при четене на регистър " + std::to_string(address) + " от " + _host + ": " + client.error_msg);
+}
+
 /**
 * Прочита съдържанието на 16-битов регистър от даден адрес.
 * @param address Адресът на регистъра.
 * @return Стойността на регистъра.
+* @throws std::runtime_error Ако няма връзка или устройството не е върнало стойността.
 */
 uint16_t P30HTcpReader::read_16bit(uint16_t address)
 {
     uint16_t read_holding_regs[1]{0};
-    client.modbus_read_holding_registers(address, 1, read_holding_regs);
+    read_words(address, 1, read_holding_regs);
     return read_holding_regs[0];
 }
 
@@ -84,6 +328,7 @@ uint16_t P30HTcpReader::read_16bit(uint16_t address)
 * @param addr2 Адрес на втория регистър (ако не е зададен, се използва само address).
 * @param lo_first Ако е True, редът на байтовете е обратен.
 * @return Стойността на 32-битовото число с плаваща запетая.
+* @throws std::runtime_error Ако няма връзка или устройството не е върнало някой от регистрите.
 */
 float P30HTcpReader::read_float32(uint16_t address, int16_t addr2, bool lo_first)
 {
@@ -91,146 +336,442 @@ float P30HTcpReader::read_float32(uint16_t address, int16_t addr2, bool lo_first
     if (addr2 < 0)
     {
         uint16_t read_holding_regs[2]{0, 0};
-        client.modbus_read_holding_registers(address, 2, read_holding_regs);
+        read_words(address, 2, read_holding_regs);
         hi_reg = read_holding_regs[0];
         lo_reg = read_holding_regs[1];
     }
     else
     {
         uint16_t read_holding_reg1[1]{0}, read_holding_reg2[1]{0};
-        client.modbus_read_holding_registers(address, 1, read_holding_reg1);
-        client.modbus_read_holding_registers(addr2, 1, read_holding_reg2);
+        read_words(address, 1, read_holding_reg1);
+        read_words(static_cast<uint16_t>(addr2), 1, read_holding_reg2);
         hi_reg = read_holding_reg1[0];
         lo_reg = read_holding_reg2[0];
     }
 
-    uint8_t bytes[4];
-    if (lo_first)
+    return lo_first ? reg::words_to_float32(lo_reg, hi_reg) : reg::words_to_float32(hi_reg, lo_reg);
+}
+
+/**
+* Освобождава паметта, заделена за плана, съставен от 'read_registers'.
+*/
+void P30HTcpReader::release_plan()
+{
+    delete[] _blocks;
+    delete[] _slots;
+    delete[] _order;
+    _blocks = nullptr;
+    _slots = nullptr;
+    _order = nullptr;
+    _plan = {};
+}
+
+/**
+* Съставя план за четене на reg_map по време на изпълнение. Планът се запазва, докато не се подаде друг reg_map.
+* За масиви, известни по време на компилация, използвайте 'reg::make_read_plan' и 'read_plan'.
+* @param reg_map Списък с регистри и техните параметри.
+* @param reg_count Броя на елементите в reg_map.
+*/
+void P30HTcpReader::build_plan(const reg::RegisterRead *reg_map, size_t reg_count)
+{
+    release_plan();
+    _blocks = new reg::ReadBlock[reg::plan_max_blocks(reg_count)];
+    _slots = new reg::DecodeSlot[reg_count];
+    _order = new uint16_t[reg_count];
+    size_t word_count = 0;
+    size_t block_count = 0;
+    try
     {
-        // lo_reg (2 байта) се задава да бъде първи
-        bytes[0] = static_cast<uint8_t>(lo_reg >> 8);
-        bytes[1] = static_cast<uint8_t>(lo_reg & 0xFF);
-        bytes[2] = static_cast<uint8_t>(hi_reg >> 8);
-        bytes[3] = static_cast<uint8_t>(hi_reg & 0xFF);
+        block_count = reg::plan_reads(reg_map, reg_count, _blocks, _slots, word_count);
     }
-    else
+    catch (...)
     {
-        bytes[0] = static_cast<uint8_t>(hi_reg >> 8);
-        bytes[1] = static_cast<uint8_t>(hi_reg & 0xFF);
-        bytes[2] = static_cast<uint8_t>(lo_reg >> 8);
-        bytes[3] = static_cast<uint8_t>(lo_reg & 0xFF);
+        release_plan();
+        throw;
     }
-
-    uint32_t as_int = (uint32_t)bytes[0] << 24
-                    | (uint32_t)bytes[1] << 16
-                    | (uint32_t)bytes[2] << 8
-                    | (uint32_t)bytes[3];
-
-    float value;
-    // Проверка по време на компилация: уверяваме се, че float е 32 бита (съвпада с размера на as_int)
-    static_assert(sizeof(value) == sizeof(as_int), "float не е 32 битa!");
-    // Копиране на битовото представяне от as_int в променливата value
-    // Използва се memcpy, за да се избегне проблеми със strict aliasing
-    std::memcpy(&value, &as_int, sizeof(value));
-    return value;
+    _csv_header.assign(reg::csv_header_length(reg_map, reg_count), '\0');
+    reg::build_csv_header(reg_map, reg_count, &_csv_header[0]);
+    _plan = { reg_map, reg_count, _blocks, block_count, _slots, _order, reg_count, reg::plan_order(reg_map, reg_count, _order), word_count, _csv_header };
 }
 
 /**
 * Прочита стойности от множество регистри.
+* Регистрите се групират в най-малкия брой блокови заявки FC03 (вижте 'reg::plan_reads') и всяка величина се декодира от прочетените блокове.
+* Величина, чийто блок не е прочетен успешно, се отбелязва с valid = false.
 * @param reg_map Списък с регистри и техните параметри. Задължителни параметри: "type", "address". Добре е да има и "name".
 * @return Връща указател към масив от тип RegisterResult. Не изтривайте масива след използването му.
 */
-reg::RegisterResult* P30HTcpReader::read_registers(reg::RegisterRead *reg_map, size_t reg_count)
+reg::RegisterResult* P30HTcpReader::read_registers(const reg::RegisterRead *reg_map, size_t reg_count)
+{
+    if (_plan.map != reg_map || _plan.reg_count != reg_count)
+        build_plan(reg_map, reg_count);
+    return read_plan(_plan);
+}
+
+/**
+* Заделя буферите за резултатите, думите и заявките, ако текущите са твърде малки за плана.
+* @param plan Планът за четене.
+*/
+void P30HTcpReader::prepare_buffers(const reg::ReadPlanView& plan)
 {
-    if (!_cached_results || _cached_count != reg_count)
+    if (!_cached_results || _cached_count != plan.reg_count)
     {
         delete[] _cached_results; // няма проблем дори и _cached_results да е nullptr.
-        _cached_results = new reg::RegisterResult[reg_count];
-        _cached_count = reg_count;
+        _cached_results = new reg::RegisterResult[plan.reg_count]{};
+        _cached_count = plan.reg_count;
+        _results_map = nullptr;
     }
-    for (size_t i = 0; i < reg_count; ++i)
+    if (_results_map != plan.map)
     {
-        _cached_results[i].name = reg_map[i].name;
-        _cached_results[i].valid = false;
-        switch (reg_map[i].type)
-        {
-            case reg::REG_INT16:
-                _cached_results[i].value.val_int16 = read_16bit(reg_map[i].address);
-                _cached_results[i].valid = true;
-                break;
-            case reg::REG_FLOAT32:
-                _cached_results[i].value.val_float32 = read_float32(reg_map[i].address, reg_map[i].addr2, reg_map[i].lo_first);
-                _cached_results[i].valid = true;
-                break;
-            default:
-                throw std::runtime_error("Непознат тип за " + reg_map[i].name);
-        }
+        for (size_t i = 0; i < plan.reg_count; ++i)
+            _cached_results[i].name = plan.map[i].name;
+        _results_map = plan.map;
+    }
+    if (_words_cap < plan.word_count)
+    {
+        delete[] _words;
+        _words = new uint16_t[plan.word_count]{};
+        _words_cap = plan.word_count;
     }
+    if (_request_cap < plan.block_count)
+    {
+        delete[] _requests;
+        _requests = new modbus_request[plan.block_count]{};
+        _request_cap = plan.block_count;
+    }
+    for (size_t b = 0; b < plan.block_count; ++b)
+        _requests[b] = { plan.blocks[b].start, plan.blocks[b].count, _words + plan.blocks[b].offset, PENDING_REQ, {}, 0 };
+}
+
+/**
+* Декодира величините от прочетените блокове без копиране на низове и без проверка на типа за всяка стойност.
+* Величина, чийто блок не е прочетен успешно, се отбелязва с valid = false.
+* Величините, които не са в plan.order (план на 'reg::PollSchedule'), запазват последната си стойност.
+* @param plan Планът за четене.
+* @return Указател към масива с резултати.
+*/
+reg::RegisterResult* P30HTcpReader::decode(const reg::ReadPlanView& plan)
+{
+    for (size_t k = 0; k < plan.order_count; ++k)
+    {
+        const reg::DecodeSlot& slot = plan.slots[plan.order[k]];
+        _cached_results[plan.order[k]].valid = _requests[slot.hi_block].status == 0 && _requests[slot.lo_block].status == 0;
+    }
+    for (size_t k = 0; k < plan.float_count; ++k)
+    {
+        const reg::DecodeSlot& slot = plan.slots[plan.order[k]];
+        _cached_results[plan.order[k]].value.val_float32 = reg::words_to_float32(_words[slot.hi], _words[slot.lo]);
+    }
+    for (size_t k = plan.float_count; k < plan.order_count; ++k)
+        _cached_results[plan.order[k]].value.val_int16 = _words[plan.slots[plan.order[k]].hi];
     return _cached_results;
 }
 
 /**
-* Записва 16-битово цяло число в даден регистър. Пример: value = 0b0101
-* @param value Стойността за записване.
-* @param address Адресът на регистъра.
+* Прочита стойности по готов план (например 'reg::reg_plan', изчислен по време на компилация).
+* Изпълнява по една заявка FC03 за всеки блок и декодира величините без копиране на низове и без проверка на типа за всяка стойност.
+* Прекъсната връзка се възстановява автоматично (вижте 'LinkState'). Докато няма връзка, всички величини са невалидни и отчетът завършва веднага.
+* @param plan Планът за четене.
+* @return Връща указател към масив от тип RegisterResult в реда на plan.map. Не изтривайте масива след използването му.
 */
-void P30HTcpReader::write_16bit(uint16_t value, uint16_t address)
+reg::RegisterResult* P30HTcpReader::read_plan(const reg::ReadPlanView& plan)
 {
-    client.modbus_write_register(address, value);
+    prepare_buffers(plan);
+    if (!ensure_link())
+    {
+        for (size_t b = 0; b < plan.block_count; ++b)
+            _requests[b].status = BAD_CON;
+        _sample_sent = timestamp::Stamp::now();
+        _sample_received = _sample_sent;
+        return decode(plan);
+    }
+    _sample_sent = timestamp::Stamp::now();
+    // Всеки блок е една заявка FC03, вместо по една (или две) заявки за всяка величина.
+    // Заявките се изпращат с 'modbus_read_holding_registers_pipelined' и отговорите се разпределят по transaction ID.
+    client.modbus_read_holding_registers_pipelined(_requests, plan.block_count);
+    _sample_received = timestamp::Stamp::now();
+    account(plan, _sample_sent.monotonic);
+    update_link(_requests, plan.block_count);
+    return decode(plan);
 }
 
 /**
-* Записва 32-битово число (с плаваща запетая) в един 32-битов регистър/два 16-битови регистъра. Ако се посочи само един адрес и той е на 16-битов регистър, стойността ще се запише на 'addr1' и 'addr1'+1.
-* @param value Стойността за записване.
-* @param address Адресът на първия регистър.
-* @param addr2 Адресът на втория регистър (ако е -1, се използва само address).
-* @param lo_first Ако е True, редът на байтовете е обратен.
+* Функция за получаване на сокета на връзката (за регистриране в epoll).
 */
-void P30HTcpReader::write_float32(float value, uint16_t address, int16_t addr2, bool lo_first)
+X_SOCKET P30HTcpReader::get_socket() const
 {
-    uint32_t raw;
-    memcpy(&raw, &value, sizeof(raw)); // Преобразуване на float в 32-битово цяло число
-    uint16_t high = static_cast<uint16_t>(raw >> 16), low = static_cast<uint16_t>(raw & 0xFFFF); // Разделяне на 32-битовото цяло число на двe 16-битови числа
-    uint16_t byte_seq[2];
-    if (lo_first)
+    return client.modbus_get_socket();
+}
+
+/**
+* Започва неблокиращо свързване с устройството. Когато сокетът стане готов за запис, се извиква 'finish_connect'.
+* @return False, ако свързването не може да започне.
+*/
+bool P30HTcpReader::start_connect()
+{
+    if (_connect_attempts++ > 0 && _metrics)
+        metrics::increment(_metrics->reconnects);
+    return client.modbus_connect_async();
+}
+
+/**
+* Проверява резултата от свързването, започнато със 'start_connect'.
+* @return True, ако връзката е установена.
+*/
+bool P30HTcpReader::finish_connect()
+{
+    if (!client.modbus_finish_connect())
+        return false;
+    _link_state = LinkState::HEALTHY;
+    return true;
+}
+
+/**
+* Поставя на опашка толкова заявки от текущото четене, колкото позволява дълбочината на pipeline, и ги изпраща.
+* @return False при грешка във връзката.
+*/
+bool P30HTcpReader::queue_window()
+{
+    size_t depth = client.modbus_get_pipeline_depth();
+    while (_async_sent < _async_plan.block_count && _async_sent - _async_done < depth)
     {
-        byte_seq[0] = low;
-        byte_seq[1] = high;
+        const reg::ReadBlock& block = _async_plan.blocks[_async_sent];
+        if (!client.modbus_queue_read(block.start, block.count, READ_REGS))
+            break;
+        _requests[_async_sent].sent_at = metrics::Clock::now();
+        ++_async_sent;
     }
-    else
+    return client.modbus_flush() >= 0;
+}
+
+/**
+* Започва неблокиращо четене по план. Отговорите се обработват от 'on_readable'.
+* @param plan Планът за четене. Трябва да е валиден до извикването на 'finish_read'.
+* @return False при грешка във връзката.
+*/
+bool P30HTcpReader::start_read(const reg::ReadPlanView& plan)
+{
+    prepare_buffers(plan);
+    _sample_sent = timestamp::Stamp::now();
+    _sample_received = timestamp::Stamp();
+    _async_plan = plan;
+    _async_sent = 0;
+    _async_done = 0;
+    _async_base = client.modbus_next_tid();
+    return queue_window();
+}
+
+/**
+* Функция, която указва дали има заявки, които чакат сокетът да стане готов за запис.
+*/
+bool P30HTcpReader::wants_write() const
+{
+    return client.modbus_has_pending_tx();
+}
+
+/**
+* Изпраща заявките, които не са могли да бъдат изпратени веднага.
+* @return 1 ако всичко е изпратено, 0 ако сокетът все още не е готов, -1 при грешка.
+*/
+int P30HTcpReader::on_writable()
+{
+    return client.modbus_flush();
+}
+
+/**
+* Прочита наличните данни от сокета и разпределя всички пълни отговори към заявките по transaction ID.
+* @return 1 ако всички блокове са получени, 0 ако се чакат още отговори, -1 при грешка във връзката.
+*/
+int P30HTcpReader::on_readable()
+{
+    if (client.modbus_fill() < 0)
+        return -1;
+    uint8_t frame[MAX_MSG_LENGTH];
+    ssize_t k;
+    while ((k = client.modbus_pop_frame(frame)) > 0)
     {
-        byte_seq[0] = high;
-        byte_seq[1] = low;
+        if (client.modbus_route_response(frame, k, _requests, _async_sent, _async_base) >= 0)
+            ++_async_done;
     }
-    if (addr2 < 0)
+    if (k < 0)
+        return -1;
+    if (_async_done == _async_plan.block_count)
     {
-        client.modbus_write_registers(address, 2, byte_seq);
+        _sample_received = _sample_sent.at(metrics::Clock::now());
+        return 1;
     }
-    else
+    return queue_window() ? 0 : -1;
+}
+
+/**
+* Декодира резултата от неблокиращото четене. Блоковете без отговор (при изтекло време или грешка) се отбелязват с valid = false.
+* @return Указател към масив от тип RegisterResult. Не изтривайте масива след използването му.
+*/
+reg::RegisterResult* P30HTcpReader::finish_read()
+{
+    if (!_sample_received.valid())
+        _sample_received = _sample_sent.at(metrics::Clock::now());
+    account(_async_plan, _sample_sent.monotonic);
+    return decode(_async_plan);
+}
+
+/**
+* Отбелязва заявките от неблокиращото четене, които все още чакат отговор, като заявки с изтекло време.
+* Извиква се преди 'finish_read', когато времето за отчета е изтекло.
+*/
+void P30HTcpReader::expire_read()
+{
+    for (size_t b = 0; b < _async_plan.block_count; ++b)
+        if (_requests[b].status == PENDING_REQ)
+            _requests[b].status = TIMEOUT_REQ;
+}
+
+/**
+* Записва времената на заявките и на отчета и броя на заявките без отговор и с Modbus изключение.
+* @param plan Планът, по който е направен отчетът.
+* @param started Времето на започване на отчета.
+*/
+void P30HTcpReader::account(const reg::ReadPlanView& plan, metrics::Clock::time_point started)
+{
+    if (!_metrics)
+        return;
+    for (size_t b = 0; b < plan.block_count; ++b)
     {
-        client.modbus_write_register(address, byte_seq[0]);
-        client.modbus_write_register(addr2, byte_seq[1]);
+        int status = _requests[b].status;
+        if (status >= 0)
+            _metrics->request_rtt.record(_requests[b].rtt_us);
+        if (status == TIMEOUT_REQ)
+            metrics::increment(_metrics->timeouts);
+        else if (status > 0 && status != EX_BAD_DATA)
+            metrics::increment(_metrics->exceptions);
     }
+    _metrics->sample_latency.record(metrics::Clock::now() - started);
+    metrics::increment(_metrics->samples);
+}
+
+/**
+* Записва 16-битово цяло число в даден регистър. Пример: value = 0b0101
+* @param value Стойността за записване.
+* @param address Адресът на регистъра.
+* @return True при успешен запис.
+*/
+bool P30HTcpReader::write_16bit(uint16_t value, uint16_t address)
+{
+    return client.modbus_write_register(address, value) == 0;
+}
+
+/**
+* Записва 32-битово число (с плаваща запетая) в един 32-битов регистър/два 16-битови регистъра. Ако се посочи само един адрес и той е на 16-битов регистър, стойността ще се запише на 'addr1' и 'addr1'+1.
+* Ако 'addr2' е съседен на 'address', двете думи се записват с една заявка FC16, иначе с две заявки FC06, изпратени заедно (при --pipeline > 1).
+* @param value Стойността за записване.
+* @param address Адресът на първия регистър.
+* @param addr2 Адресът на втория регистър (ако е -1, се използва само address).
+* @param lo_first Ако е True, редът на байтовете е обратен.
+* @return True при успешен запис.
+*/
+bool P30HTcpReader::write_float32(float value, uint16_t address, int16_t addr2, bool lo_first)
+{
+    reserve_writes(2);
+    return send_writes(push_float32(0, value, address, addr2, lo_first));
 }
 
 /**
 * Записва стойности в множество регистри.
+* Всички думи се подреждат по адрес (при повтарящ се адрес остава последната стойност), съседните адреси се обединяват
+* в заявки FC16 (до MAX_WRITE_REGS регистъра), а единичните - в FC06. Заявките се изпращат с 'modbus_write_registers_batched'.
 * @param write_map Списък с регистри и техните стойности. Задължителни параметри: "type", "address", "value".
+* @param reg_count Броят на регистрите в списъка.
+* @return True, ако всички заявки са успешни.
 */
-void P30HTcpReader::write_registers(reg::RegisterWrite *write_map, size_t reg_count)
+bool P30HTcpReader::write_registers(const reg::RegisterWrite *write_map, size_t reg_count)
 {
+    reserve_writes(2 * reg_count);
+    size_t n = 0;
     for (size_t i = 0; i < reg_count; ++i)
     {
         switch (write_map[i].type)
         {
             case reg::REG_INT16:
-                write_16bit(write_map[i].value.val_int16, write_map[i].address);
+                _write_words[n] = { write_map[i].address, write_map[i].value.val_int16, static_cast<uint32_t>(n) };
+                ++n;
                 break;
             case reg::REG_FLOAT32:
-                write_float32(write_map[i].value.val_float32, write_map[i].address, write_map[i].addr2, write_map[i].lo_first);
+                n = push_float32(n, write_map[i].value.val_float32, write_map[i].address, write_map[i].addr2, write_map[i].lo_first);
                 break;
             default:
                 throw std::runtime_error("Непознат тип за " + write_map[i].name);
         }
     }
+    return send_writes(n);
+}
+
+/**
+* Заделя буферите за запис на 'word_count' думи. Буферите се запазват между извикванията и се увеличават само при нужда.
+*/
+void P30HTcpReader::reserve_writes(size_t word_count)
+{
+    if (_write_cap >= word_count)
+        return;
+    delete[] _write_words;
+    delete[] _write_values;
+    delete[] _write_requests;
+    _write_words = new WordWrite[word_count]{};
+    _write_values = new uint16_t[word_count]{};
+    _write_requests = new modbus_request[word_count]{};
+    _write_cap = word_count;
+}
+
+/**
+* Добавя двете думи на 32-битово число към буфера за запис.
+* @return Новият брой думи в буфера.
+*/
+size_t P30HTcpReader::push_float32(size_t n, float value, uint16_t address, int16_t addr2, bool lo_first)
+{
+    uint32_t raw;
+    memcpy(&raw, &value, sizeof(raw)); // Преобразуване на float в 32-битово цяло число
+    uint16_t high = static_cast<uint16_t>(raw >> 16), low = static_cast<uint16_t>(raw & 0xFFFF); // Разделяне на 32-битовото цяло число на двe 16-битови числа
+    uint16_t second = addr2 < 0 ? static_cast<uint16_t>(address + 1) : static_cast<uint16_t>(addr2);
+    _write_words[n] = { address, lo_first ? low : high, static_cast<uint32_t>(n) };
+    _write_words[n + 1] = { second, lo_first ? high : low, static_cast<uint32_t>(n + 1) };
+    return n + 2;
+}
+
+/**
+* Подрежда натрупаните думи по адрес, обединява съседните адреси в заявки и ги изпраща.
+* @param n Броят на думите в буфера.
+* @return True, ако всички заявки са успешни.
+*/
+bool P30HTcpReader::send_writes(size_t n)
+{
+    if (!ensure_link())
+        return false;
+    std::sort(_write_words, _write_words + n, [](const WordWrite& a, const WordWrite& b)
+    {
+        return a.address != b.address ? a.address < b.address : a.order < b.order;
+    });
+    size_t values = 0, requests = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i + 1 < n && _write_words[i + 1].address == _write_words[i].address)
+            continue; // по-късната стойност за същия адрес печели
+        modbus_request& last = _write_requests[requests - (requests > 0 ? 1 : 0)];
+        bool extends = requests > 0 && last.amount < MAX_WRITE_REGS
+                       && static_cast<uint32_t>(last.address) + last.amount == _write_words[i].address;
+        _write_values[values] = _write_words[i].value;
+        if (extends)
+            ++last.amount;
+        else
+            _write_requests[requests++] = { _write_words[i].address, 1, _write_values + values, PENDING_REQ, {}, 0 };
+        ++values;
+    }
+    bool ok = client.modbus_write_registers_batched(_write_requests, requests) == 0;
+    for (size_t r = 0; r < requests; ++r)
+    {
+        if (_write_requests[r].status == BAD_CON)
+        {
+            close();
+            break;
+        }
+    }
+    return ok;
 }
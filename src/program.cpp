@@ -1,13 +1,26 @@
+#include <algorithm>
 #include <iostream>
 #include <locale>
 #include <chrono>
 #include <thread>
 #include <future>
 #include <csignal>
+#include <filesystem>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "program.hpp"
+#include "backoff.hpp"
+#include "bin_log.hpp"
+#include "config_watch.hpp"
 #include "p30h_registers.hpp"
 #include "export_data.hpp"
+#include "log_compact.hpp"
+#include "log_query.hpp"
+#include "reactor.hpp"
+#include "ticker.hpp"
+#include "timestamp.hpp"
 
 namespace program
 {
@@ -16,6 +29,22 @@ namespace program
     */
     std::atomic<bool> stop_flag(false);
 
+    /**
+    * Статистиката на всички устройства (вижте '--stats' и '--metrics-port').
+    */
+    metrics::Registry registry;
+
+    /**
+    * Поредният номер на следващото добавено устройство при четене с по една нишка за връзка (вижте '--spread').
+    * Номерата не се използват повторно, затова изместването на отчетите на устройство не се променя при презареждане.
+    */
+    static uint64_t next_slot = 0;
+
+    /**
+    * Компресирането на затворените лог файлове (вижте '--rotate' и '--compress'). nullptr - файловете не се компресират.
+    */
+    static std::unique_ptr<log_compact::Compactor> compactor;
+
     #ifdef _WIN32
     /**
     * Функция, която използва Windows API за прихващане на събитие за прекъсване.
@@ -58,14 +87,95 @@ namespace program
             "  --config <path>   Пътят към конфигурационния файл (по подразбиране: conf)\n"
             "  --json <file>     Името на конфигурационния файл (по подразбиране: devices.json)\n"
             "  --log <path>      Пътят към .csv файла/файловете (по подразбиране: log)\n"
+            "  --interval <s>    Интервал на четене; бавно променящите се величини се четат по-рядко (по подразбиране: 1)\n"
+            "  --pipeline <n>    Брой заявки, които чакат отговор едновременно по една връзка (по подразбиране: 1)\n"
+            "  --reactors <n>    Брой нишки, които четат от всички устройства чрез epoll; 0 - по една нишка за връзка (по подразбиране: 0)\n"
+            "  --timeout <s>     Максимално време за един отчет при --reactors или за един отговор без --reactors (по подразбиране: 3)\n"
+            "  --connect-timeout <s>  Максимално време за един опит за свързване (по подразбиране: 2)\n"
+            "  --flush <s>       Максимално време, през което записите стоят в паметта преди запис в .csv файла (по подразбиране: 1)\n"
+            "  --fsync           След всеки запис данните се изпращат до диска (по-бавно, но надеждно при спиране на тока)\n"
+            "  --format <csv|bin>  Формат на лог файловете: текстов .csv или двоичен .bin (по подразбиране: csv)\n"
+            "  --to-csv <file>   Преобразува двоичен .bin файл в .csv файл до него и завършва\n"
+            "  --ring <n>        Пази последните n отчета на всяко устройство във файл за други процеси (само Linux, по подразбиране: 0)\n"
+            "  --ring-path <path>  Директорията на тези файлове (по подразбиране: /dev/shm)\n"
+            "  --stats <s>       Извежда времената и грешките на всяко устройство през s секунди (по подразбиране: 0 - не се извеждат)\n"
+            "  --metrics-port <port>  Статистиката е достъпна на http://127.0.0.1:<port>/metrics във формата на Prometheus (само Linux)\n"
+            "  --changes         Записва само променените стойности (в .csv: празна клетка - без промяна, N/A - невалидна стойност)\n"
+            "  --deadband <spec>  Мъртви зони при --changes: за всички величини и/или за отделни символи, например 0.5%,T=0.2,E_in=1\n"
+            "  --heartbeat <s>   Всяка стойност се записва поне веднъж на s секунди при --changes; 0 - без ограничение (по подразбиране: 60)\n"
+            "  --aggregate <s,...>  Записва min/max/avg/std/last на всяка величина за прозорци от s секунди (в отделни .csv файлове)\n"
+            "  --no-raw          Записва само статистиките от --aggregate, без отделните отчети\n"
+            "  --rotate <s>      Нови лог файлове на всеки s секунди, на границите по местно време (например 3600 - всеки час, 86400 - всеки ден)\n"
+            "  --rotate-size <MB>  Нови лог файлове, когато файлът с отчетите на устройство достигне MB мегабайта\n"
+            "  --compress <zstd|lz4|gzip|none>  Компресира затворените лог файлове във фонов режим (по подразбиране при --rotate,\n"
+            "                    --rotate-size и --merge-small: най-добрият наличен); активните файлове остават некомпресирани\n"
+            "  --merge-small <MB>  Затворените файлове под MB мегабайта се добавят към общ файл за устройството за деня\n"
+            "  --compact-workers <n>  Брой нишки за компресиране; 0 - по една за всяко свободно ядро (по подразбиране: 0)\n"
+            "  --index-block <n>  Индекс по време на всеки n записа в <лог файл>.idx; 0 - без индекс (по подразбиране: 256)\n"
+            "  --query <host>    Извежда записите на устройството от лог файловете в --log (.csv формат) и завършва\n"
+            "  --from <time>     Началото на периода при --query: YYYY-mm-dd[ HH:MM[:SS[.mmm]]] по местно време\n"
+            "  --to <time>       Краят на периода при --query (включително), в същия формат\n"
+            "  --columns <s,...>  Величините при --query, например U,I,P (по подразбиране: всички)\n"
+            "  --no-watch        Не следи конфигурационния файл (по подразбиране промените се прилагат без рестартиране)\n"
+            "  --no-share        Отделна връзка за всяко устройство (по подразбиране устройствата с еднакви ip и port, например зад\n"
+            "                    един Modbus шлюз, се четат през една връзка)\n"
+            "  --no-align        Отчетите започват веднага, а не на границите на интервала (например точно в началото на секундата)\n"
+            "  --spread          Разпределя отчетите на устройствата равномерно в интервала, вместо всички да са в един и същи момент\n"
             "  -h, --help        Показва това съобщение\n\n"
             "Примери:\n"
             "  program.exe --config conf --json devices.json\n"
             "  program.exe --log log_folder\n"
+            "  program.exe --format bin\n"
+            "  program.exe --stats 60 --metrics-port 9330\n"
+            "  program.exe --changes --deadband 0.5%,T=0.2 --heartbeat 300\n"
+            "  program.exe --interval 0.1 --aggregate 60,900 --no-raw\n"
+            "  program.exe --rotate 86400 --rotate-size 256 --compress zstd --merge-small 8\n"
+            "  program.exe --to-csv \"log/P30H(192.168.1.30)_data_2024-01-01_00-00-00.bin\"\n"
+            "  program.exe --query 192.168.1.30 --from \"2024-01-01 08:00\" --to \"2024-01-01 09:00\" --columns U,I,P > part.csv\n"
             "  program.exe -h"
         << std::endl;
     }
 
+    /**
+    * Помощна функция, която преобразува стойността на числов аргумент.
+    * @param text Стойността на аргумента.
+    * @param value Променлива, в която се записва числото.
+    * @return False, ако стойността не е неотрицателно число.
+    */
+    static bool parse_number(const std::string& text, double& value)
+    {
+        try
+        {
+            size_t pos = 0;
+            value = std::stod(text, &pos);
+            return pos == text.size() && value >= 0;
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }
+
+    /**
+    * Помощна функция, която преобразува списък с дължини на прозорци в секунди, разделени със запетаи (например "60,900").
+    * @return False, ако някоя стойност не е цяло положително число.
+    */
+    static bool parse_windows(const std::string& text, std::vector<uint32_t>& windows)
+    {
+        windows.clear();
+        size_t start = 0;
+        while (start <= text.size())
+        {
+            size_t comma = std::min(text.find(',', start), text.size());
+            double value = 0;
+            if (!parse_number(text.substr(start, comma - start), value) || value < 1 || value > 86400 * 366 || value != static_cast<uint32_t>(value))
+                return false;
+            windows.push_back(static_cast<uint32_t>(value));
+            start = comma + 1;
+        }
+        return true;
+    }
+
     /**
     * Функция, която проверява за въведени аргументи към програмата.
     * @param argc Променлива, която съдържа броят на аргументите (стойността на променливата винаги е поне единица).
@@ -90,6 +200,152 @@ namespace program
             {
                 args->log_path = argv[++i];
             }
+            else if ((arg == "--interval" || arg == "--pipeline" || arg == "--reactors" || arg == "--timeout" || arg == "--connect-timeout" || arg == "--flush" || arg == "--ring" || arg == "--stats" || arg == "--metrics-port" || arg == "--heartbeat"
+                      || arg == "--rotate" || arg == "--rotate-size" || arg == "--merge-small" || arg == "--compact-workers" || arg == "--index-block") && i + 1 < argc)
+            {
+                double value = 0;
+                if (!parse_number(argv[++i], value))
+                {
+                    std::cerr << "\nНевалидна стойност за " << arg << ": " << argv[i] << '\n' << std::endl;
+                    args->show_help = true;
+                }
+                else if (arg == "--interval")
+                    args->interval = static_cast<float>(value);
+                else if (arg == "--pipeline")
+                    args->pipeline_depth = static_cast<size_t>(value);
+                else if (arg == "--reactors")
+                    args->reactors = static_cast<size_t>(value);
+                else if (arg == "--timeout")
+                    args->timeout = static_cast<float>(value);
+                else if (arg == "--connect-timeout")
+                    args->connect_timeout = static_cast<float>(value);
+                else if (arg == "--flush")
+                    args->flush_interval = static_cast<float>(value);
+                else if (arg == "--stats")
+                    args->stats_interval = static_cast<float>(value);
+                else if (arg == "--heartbeat")
+                    args->heartbeat = static_cast<float>(value);
+                else if (arg == "--rotate")
+                    args->rotate_interval = static_cast<uint32_t>(std::min(value, 86400.0 * 366));
+                else if (arg == "--rotate-size")
+                    args->rotate_size = static_cast<uint64_t>(value * 1024 * 1024);
+                else if (arg == "--merge-small")
+                    args->merge_small = static_cast<uint64_t>(value * 1024 * 1024);
+                else if (arg == "--compact-workers")
+                    args->compact_workers = static_cast<size_t>(value);
+                else if (arg == "--index-block")
+                    args->index_block = static_cast<uint32_t>(std::min(value, 1e9));
+                else if (arg == "--metrics-port" && value <= 65535)
+                    args->metrics_port = static_cast<size_t>(value);
+                else if (arg == "--metrics-port")
+                {
+                    std::cerr << "\nНевалидна стойност за " << arg << ": " << argv[i] << '\n' << std::endl;
+                    args->show_help = true;
+                }
+                else
+                    args->ring_capacity = static_cast<size_t>(value);
+            }
+            else if (arg == "--format" && i + 1 < argc)
+            {
+                std::string value = argv[++i];
+                if (value == "csv")
+                    args->log_format = export_data::LogFormat::CSV;
+                else if (value == "bin")
+                    args->log_format = export_data::LogFormat::BIN;
+                else
+                {
+                    std::cerr << "\nНевалидна стойност за " << arg << ": " << value << '\n' << std::endl;
+                    args->show_help = true;
+                }
+            }
+            else if (arg == "--compress" && i + 1 < argc)
+            {
+                args->compress = argv[++i];
+                log_compact::Codec codec;
+                if (!log_compact::parse_codec(args->compress, codec))
+                {
+                    std::cerr << "\nНевалидна стойност за " << arg << ": " << args->compress << '\n' << std::endl;
+                    args->show_help = true;
+                }
+                else if (!log_compact::available(codec))
+                {
+                    std::cerr << "\nКомпресирането с " << args->compress << " не е налично в тази компилация.\n" << std::endl;
+                    args->show_help = true;
+                }
+            }
+            else if (arg == "--deadband" && i + 1 < argc)
+            {
+                args->deadband = argv[++i];
+                try
+                {
+                    export_data::parse_deadbands(args->deadband, reg::reg_plan);
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << "\n" << e.what() << '\n' << std::endl;
+                    args->show_help = true;
+                }
+            }
+            else if (arg == "--changes")
+            {
+                args->changes_only = true;
+            }
+            else if (arg == "--aggregate" && i + 1 < argc)
+            {
+                if (!parse_windows(argv[++i], args->aggregate_windows))
+                {
+                    std::cerr << "\nНевалидна стойност за " << arg << ": " << argv[i] << '\n' << std::endl;
+                    args->show_help = true;
+                }
+            }
+            else if (arg == "--no-raw")
+            {
+                args->raw = false;
+            }
+            else if (arg == "--no-watch")
+            {
+                args->watch = false;
+            }
+            else if (arg == "--no-share")
+            {
+                args->share = false;
+            }
+            else if (arg == "--no-align")
+            {
+                args->align = false;
+            }
+            else if (arg == "--spread")
+            {
+                args->spread = true;
+            }
+            else if (arg == "--ring-path" && i + 1 < argc)
+            {
+                args->ring_path = argv[++i];
+            }
+            else if (arg == "--to-csv" && i + 1 < argc)
+            {
+                args->to_csv = argv[++i];
+            }
+            else if (arg == "--query" && i + 1 < argc)
+            {
+                args->query_host = argv[++i];
+            }
+            else if ((arg == "--from" || arg == "--to") && i + 1 < argc)
+            {
+                if (!timestamp::parse_local(argv[++i], arg == "--from" ? args->query_from : args->query_to))
+                {
+                    std::cerr << "\nНевалидна стойност за " << arg << ": " << argv[i] << '\n' << std::endl;
+                    args->show_help = true;
+                }
+            }
+            else if (arg == "--columns" && i + 1 < argc)
+            {
+                args->query_columns = argv[++i];
+            }
+            else if (arg == "--fsync")
+            {
+                args->fsync = true;
+            }
             else if (arg == "-h" || arg == "--help")
             {
                 args->show_help = true;
@@ -100,25 +356,215 @@ namespace program
                 args->show_help = true;
             }
         }
+        if (!args->raw && args->aggregate_windows.empty())
+        {
+            std::cerr << "\n--no-raw изисква --aggregate.\n" << std::endl;
+            args->show_help = true;
+        }
         return args;
     }
 
     /**
-    * Функция, която за всяко устройство извиква функцията 'poll_to_csv'.
-    * @param dev Конкретното устройство, от което ще се извличат данни.
-    * @param log_path Пътят, на който да се запазват .csv файловете.
+    * Помощна функция, която изчаква дадено време, но се връща веднага след получаване на сигнал за прекъсване.
+    * @param flag Флагът за прекъсване (по подразбиране 'stop_flag').
+    * @return False, ако е получен сигнал за прекъсване.
+    */
+    static bool sleep_unless_stopped(std::chrono::milliseconds duration, const std::atomic<bool>& flag = stop_flag)
+    {
+        auto until = std::chrono::steady_clock::now() + duration;
+        while (!flag.load())
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= until)
+                return true;
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(until - now, std::chrono::milliseconds(200)));
+        }
+        return false;
+    }
+
+    /**
+    * Помощна функция, която извежда статистиката на устройствата през даден интервал до получаване на сигнал за прекъсване.
+    * @param interval Интервалът в секунди.
+    */
+    static void report_stats(float interval)
+    {
+        std::chrono::milliseconds period(static_cast<long long>(interval * 1000));
+        while (sleep_unless_stopped(period))
+        {
+            std::string text = "\nСтатистика:\n";
+            registry.append_summary(text);
+            std::cout << text << std::flush;
+        }
+    }
+
+    /**
+    * Помощна функция, която отваря HTTP порта за статистиката ('--metrics-port') и стартира периодичното ѝ извеждане ('--stats').
+    * Портът се затваря при завършване на програмата.
+    * @return Нишката за извеждане (празна, ако не е зададен '--stats'). Завършва след получаване на сигнал за прекъсване.
+    */
+    static std::thread start_stats(const Args& args)
+    {
+    #ifdef __linux__
+        static std::unique_ptr<metrics::HttpExporter> exporter;
+        if (args.metrics_port > 0)
+        {
+            try
+            {
+                exporter.reset(new metrics::HttpExporter(registry, static_cast<uint16_t>(args.metrics_port)));
+                exporter->start();
+                std::cout << "\nСтатистика: http://127.0.0.1:" << args.metrics_port << "/metrics" << std::endl;
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "\n" << e.what() << std::endl;
+            }
+        }
+    #endif
+        if (args.stats_interval > 0)
+            return std::thread(report_stats, args.stats_interval);
+        return std::thread();
+    }
+
+    /**
+    * Помощна функция, която връща името на устройството в статистиката: "name" от конфигурационния файл или <ip>:<port>/<id>.
+    */
+    static std::string device_name(const device::Device& dev)
+    {
+        if (!dev.name.empty())
+            return dev.name;
+        return dev.ip + ":" + std::to_string(dev.port) + "/" + std::to_string(dev.device_id);
+    }
+
+    /**
+    * Помощна функция, която връща настройките за запис в .csv файловете според аргументите на програмата.
+    */
+    static export_data::WriterOptions writer_options(const Args& args)
+    {
+        export_data::WriterOptions options;
+        options.format = args.log_format;
+        options.flush_interval = args.flush_interval;
+        options.fsync = args.fsync;
+        options.changes_only = args.changes_only;
+        options.deadbands = export_data::parse_deadbands(args.deadband, reg::reg_plan);
+        options.heartbeat = args.heartbeat;
+        options.aggregate_windows = args.aggregate_windows;
+        options.raw = args.raw;
+        options.rotate_size = args.rotate_size;
+        options.rotate_interval = args.rotate_interval;
+        options.index_block = args.index_block;
+        options.compactor = compactor.get();
+        return options;
+    }
+
+    /**
+    * Помощна функция, която създава 'compactor', ако е зададено '--rotate', '--rotate-size', '--compress' или '--merge-small',
+    * и добавя за компресиране лог файловете, останали от предишните стартирания. Трябва да се извика преди създаването на новите файлове.
+    * Нишките за компресиране са по една за всяко ядро, което не е заето от reactor и нишката за запис (ако не е зададено '--compact-workers').
+    */
+    static void start_compactor(const Args& args)
+    {
+        if (args.rotate_interval == 0 && args.rotate_size == 0 && args.compress.empty() && args.merge_small == 0)
+            return;
+        log_compact::CompactOptions options;
+        if (!args.compress.empty())
+            log_compact::parse_codec(args.compress, options.codec);
+        options.workers = args.compact_workers > 0 ? args.compact_workers : log_compact::default_workers(args.reactors + 1);
+        options.merge_below = args.merge_small;
+        try
+        {
+            compactor.reset(new log_compact::Compactor(options));
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "\n" << e.what() << std::endl;
+            return;
+        }
+        size_t found = compactor->scan(args.log_path);
+        std::cout << "\nКомпресиране на затворените лог файлове: " << log_compact::codec_name(options.codec) << ", "
+                  << compactor->workers() << " нишки, " << found << " файла от предишни стартирания." << std::endl;
+    }
+
+    /**
+    * Помощна функция, която създава файла с последните отчети на устройството, ако е зададен с '--ring'.
+    * @return Обектът за запис или nullptr (ако не е зададен или не може да се създаде).
+    */
+    static std::unique_ptr<ring_store::Writer> open_ring(const device::Device& dev, const Args& args)
+    {
+    #ifdef __linux__
+        if (args.ring_capacity == 0)
+            return nullptr;
+        try
+        {
+            std::filesystem::create_directories(args.ring_path);
+            return std::unique_ptr<ring_store::Writer>(new ring_store::Writer(ring_store::ring_file_name(args.ring_path, dev), reg::reg_plan, static_cast<uint32_t>(args.ring_capacity)));
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "\n" << e.what() << std::endl;
+        }
+    #endif
+        (void)dev;
+        (void)args;
+        return nullptr;
+    }
+
+    /**
+    * Помощна функция, която връща името на устройството в името на лог файла: ip адресът, а ако идентификаторът не е 1 - и той
+    * (например "192.168.1.30_id5"), за да имат отделни файлове устройствата зад един Modbus шлюз.
+    */
+    static std::string log_host(const device::Device& dev)
+    {
+        if (dev.device_id == 1)
+            return dev.ip;
+        return dev.ip + "_id" + std::to_string(dev.device_id);
+    }
+
+    /**
+    * Функция, която чете едно или няколко устройства с еднакви ip и port (например зад един Modbus шлюз) през една връзка
+    * с 'poll_units_to_csv'. Всяко устройство има собствен лог файл, интервал и pipelining.
+    * Недостъпна връзка не спира програмата - опитите за свързване продължават с нарастващо изчакване до вдигането на 'stop'.
+    * Връзка, прекъсната по време на четенето, се възстановява от 'P30HTcpReader' (вижте 'P30HTcpReader::LinkState').
+    * @param devices Устройствата (поне едно). Всички трябва да са с еднакви ip и port.
+    * @param slots Поредният номер на всяко устройство, от който зависи изместването на отчетите му при '--spread'.
+    * @param device_metrics Статистиката на всяко устройство (nullptr - не се записва).
+    * @param args Аргументите на програмата (пътят за .csv файловете, pipelining и време за свързване).
+    * @param stop Флагът, с който се спира четенето на устройствата (при прекъсване на програмата или при презареждане на конфигурационния файл).
     */
-    void poll_device(const device::Device& dev, const std::string& log_path)
+    void poll_gateway(const std::vector<device::Device>& devices, const std::vector<uint64_t>& slots, const std::vector<metrics::DeviceMetrics*>& device_metrics, const Args& args, std::atomic<bool>& stop)
     {
+        const device::Device& dev = devices.front();
         P30HTcpReader reader(dev.ip, dev.port, dev.device_id);
-        if (!reader.connect())
+        reader.set_pipeline_depth(args.pipeline_depth);
+        reader.set_connect_timeout(args.connect_timeout);
+        reader.set_response_timeout(args.timeout);
+        reader.set_metrics(device_metrics.front());
+        retry::Backoff backoff(std::chrono::seconds(1), std::chrono::seconds(60), static_cast<uint32_t>(std::hash<std::string>()(dev.ip) + dev.port));
+        while (!reader.connect())
         {
-            stop_flag.store(true);
-            throw std::runtime_error("Неуспешна връзка с " + dev.ip + ":" + std::to_string(dev.port));
+            std::chrono::milliseconds delay = backoff.next();
+            std::cerr << "\nНеуспешна връзка с " << dev.ip << ":" << dev.port << " (опит " << backoff.attempts()
+                      << "), нов опит след " << delay.count() << " ms." << std::endl;
+            if (!sleep_unless_stopped(delay, stop))
+                return;
         }
         try
         {
-            export_data::poll_to_csv(reader, reg::reg_map, reg::reg_count, &stop_flag, log_path);
+            std::vector<std::unique_ptr<ring_store::Writer>> rings;
+            std::vector<export_data::PollUnit> units(devices.size());
+            for (size_t i = 0; i < devices.size(); ++i)
+            {
+                units[i].host = log_host(devices[i]);
+                units[i].slave_id = devices[i].device_id;
+                units[i].interval = devices[i].interval > 0 ? devices[i].interval : args.interval;
+                units[i].pipeline_depth = devices[i].pipeline_depth > 0 ? devices[i].pipeline_depth : args.pipeline_depth;
+                units[i].align = args.align;
+                if (args.spread)
+                    units[i].phase = std::chrono::duration<float>(ticker::spread_phase(slots[i], ticker::period_from_seconds(units[i].interval))).count();
+                units[i].metrics = device_metrics[i];
+                rings.push_back(open_ring(devices[i], args));
+                units[i].ring = rings.back().get();
+            }
+            export_data::poll_units_to_csv(reader, reg::reg_plan, units.data(), units.size(), &stop, args.log_path, 0, writer_options(args));
         }
         catch (const std::exception& e)
         {
@@ -127,6 +573,458 @@ namespace program
         reader.close();
     }
 
+    /**
+    * Нишката на една връзка при четене с по една нишка за връзка.
+    * @param devices Устройствата, които се четат през връзката.
+    * @param slots Поредният номер на всяко устройство (за '--spread'). Запазва се, ако нишката се стартира отново.
+    * @param stop Флагът, с който се спира само тази нишка.
+    * @param metrics Статистиката на всяко устройство. Запазва се, ако нишката се стартира отново след промяна на устройствата.
+    * @param future Резултатът от нишката.
+    */
+    struct Poller
+    {
+        std::vector<device::Device> devices;
+        std::vector<uint64_t> slots;
+        std::atomic<bool> stop{false};
+        std::vector<metrics::DeviceMetrics*> metrics;
+        std::future<void> future;
+    };
+
+    /**
+    * Помощна функция, която стартира нишката на връзка. Нишката получава копие на устройствата.
+    */
+    static std::unique_ptr<Poller> start_poller(const std::vector<device::Device>& devices, const std::vector<uint64_t>& slots, const std::vector<metrics::DeviceMetrics*>& device_metrics, const Args& args)
+    {
+        std::unique_ptr<Poller> poller(new Poller());
+        poller->devices = devices;
+        poller->slots = slots;
+        poller->metrics = device_metrics;
+        poller->future = std::async(std::launch::async, poll_gateway, devices, slots, device_metrics, std::cref(args), std::ref(poller->stop));
+        return poller;
+    }
+
+    /**
+    * Помощна функция, която изчаква спирането на нишката на връзка (флагът 'stop' трябва вече да е вдигнат) и извежда грешката ѝ, ако има.
+    */
+    static void join_poller(Poller& poller)
+    {
+        try
+        {
+            poller.future.get();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "\n[Thread] Получена е грешка: " << e.what() << std::endl;
+        }
+    }
+
+    /**
+    * Помощна функция, която групира устройствата по връзка (вижте 'device::connection_key' и '--no-share').
+    * @return Индексите на устройствата във всяка група, в реда на първото устройство от групата.
+    */
+    static std::vector<std::vector<size_t>> group_devices(const device::Device* devices, size_t device_count, const Args& args)
+    {
+        std::vector<std::vector<size_t>> groups;
+        std::unordered_map<std::string, size_t> keys;
+        for (size_t i = 0; i < device_count; ++i)
+        {
+            auto inserted = keys.emplace(device::connection_key(devices[i], args.share), groups.size());
+            if (inserted.second)
+                groups.emplace_back();
+            groups[inserted.first->second].push_back(i);
+        }
+        return groups;
+    }
+
+    /**
+    * Помощна функция, която зарежда конфигурационния файл отново след промяна.
+    * @return Устройствата (трябва да се освободи паметта) или nullptr, ако файлът не е валиден - тогава се запазват текущите устройства.
+    */
+    static device::Device* reload_devices(const Args& args, size_t& device_count)
+    {
+        try
+        {
+            return device::load_devices(args.config_path, args.json_name, device_count);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "\nКонфигурационният файл не е презареден (устройствата не са променени): " << e.what() << std::endl;
+            return nullptr;
+        }
+    }
+
+    /**
+    * Помощна функция, която извежда броя на добавените, променените и премахнатите устройства след презареждане.
+    */
+    static void print_reload(const device::DeviceDiff& diff)
+    {
+        size_t added = std::count(diff.previous.begin(), diff.previous.end(), device::DeviceDiff::NEW_DEVICE);
+        size_t changed = std::count(diff.changed.begin(), diff.changed.end(), 1);
+        std::cout << "\nПрезареден конфигурационен файл: добавени " << added << ", променени " << changed
+                  << ", премахнати " << diff.removed.size() << " устройства." << std::endl;
+    }
+
+    /**
+    * Помощна функция, която прилага новия конфигурационен файл при четене с по една нишка за връзка.
+    * Стартират се нишки само за новите връзки, спират се нишките на връзките без устройства, а връзките с нови или премахнати
+    * устройства или с устройства с променен интервал или pipelining се стартират отново. Нишките на останалите връзки не се променят.
+    */
+    static void reload_pollers(std::vector<std::unique_ptr<Poller>>& pollers, const Args& args)
+    {
+        size_t device_count = 0;
+        device::Device* devices = reload_devices(args, device_count);
+        if (!devices)
+            return;
+        // Текущите устройства подред, с нишката и мястото им в нея
+        std::vector<device::Device> current;
+        std::vector<std::pair<size_t, size_t>> owners;
+        for (size_t p = 0; p < pollers.size(); ++p)
+        {
+            for (size_t j = 0; j < pollers[p]->devices.size(); ++j)
+            {
+                current.push_back(pollers[p]->devices[j]);
+                owners.emplace_back(p, j);
+            }
+        }
+        device::DeviceDiff diff = device::diff_devices(current.data(), current.size(), devices, device_count);
+
+        // Устройствата на една нишка остават в една група, защото ключът на връзката зависи само от ip, port и id.
+        // Нишката се стартира отново при промяна на състава на групата, интервала или pipelining - новото име се прилага само към статистиката.
+        std::vector<std::vector<size_t>> groups = group_devices(devices, device_count, args);
+        std::vector<size_t> group_poller(groups.size(), SIZE_MAX);
+        std::vector<uint8_t> restart(pollers.size(), 1);
+        for (size_t g = 0; g < groups.size(); ++g)
+        {
+            bool keep = true;
+            for (size_t i : groups[g])
+            {
+                size_t previous = diff.previous[i];
+                if (previous == device::DeviceDiff::NEW_DEVICE)
+                {
+                    keep = false;
+                    continue;
+                }
+                group_poller[g] = owners[previous].first;
+                const device::Device& old_dev = current[previous];
+                if (old_dev.interval != devices[i].interval || old_dev.pipeline_depth != devices[i].pipeline_depth)
+                    keep = false;
+            }
+            if (group_poller[g] != SIZE_MAX)
+                restart[group_poller[g]] = !keep || pollers[group_poller[g]]->devices.size() != groups[g].size();
+        }
+
+        // Всички спиращи нишки получават сигнал преди изчакването, за да спират едновременно
+        for (size_t p = 0; p < pollers.size(); ++p)
+            if (restart[p])
+                pollers[p]->stop.store(true);
+
+        std::vector<std::unique_ptr<Poller>> next(groups.size());
+        for (size_t g = 0; g < groups.size(); ++g)
+        {
+            size_t p = group_poller[g];
+            if (p != SIZE_MAX && !restart[p])
+            {
+                next[g] = std::move(pollers[p]);
+                for (size_t k = 0; k < groups[g].size(); ++k)
+                {
+                    size_t i = groups[g][k];
+                    size_t j = owners[diff.previous[i]].second;
+                    if (diff.changed[i])
+                        registry.rename(*next[g]->metrics[j], device_name(devices[i]));
+                    next[g]->devices[j] = devices[i];
+                }
+                continue;
+            }
+            if (p != SIZE_MAX)
+                join_poller(*pollers[p]);
+            std::vector<device::Device> members;
+            std::vector<uint64_t> member_slots;
+            std::vector<metrics::DeviceMetrics*> member_metrics;
+            for (size_t i : groups[g])
+            {
+                size_t previous = diff.previous[i];
+                if (previous == device::DeviceDiff::NEW_DEVICE)
+                {
+                    member_slots.push_back(next_slot++);
+                    member_metrics.push_back(&registry.add(device_name(devices[i])));
+                }
+                else
+                {
+                    const Poller& owner = *pollers[owners[previous].first];
+                    member_slots.push_back(owner.slots[owners[previous].second]);
+                    member_metrics.push_back(owner.metrics[owners[previous].second]);
+                    registry.rename(*member_metrics.back(), device_name(devices[i]));
+                }
+                members.push_back(devices[i]);
+            }
+            next[g] = start_poller(members, member_slots, member_metrics, args);
+        }
+        // Нишките на връзките без устройства се спират, а статистиката на премахнатите устройства се изтрива.
+        // Премахнато устройство никога не е в запазена нишка, защото съставът на групата му се е променил.
+        for (std::unique_ptr<Poller>& poller : pollers)
+            if (poller && poller->future.valid())
+                join_poller(*poller);
+        for (size_t index : diff.removed)
+            registry.remove(pollers[owners[index].first]->metrics[owners[index].second]);
+        pollers.swap(next);
+        print_reload(diff);
+        delete[] devices;
+    }
+
+    /**
+    * Функция, която чете от устройствата с по една нишка за връзка ('poll_gateway') до получаване на сигнал за прекъсване.
+    * Устройствата с еднакви ip и port се четат през една връзка, освен ако не е зададен '--no-share'.
+    * Ако не е зададен '--no-watch', при промяна на конфигурационния файл се прилагат само разликите (вижте 'reload_pollers').
+    * @param devices Масив с устройствата.
+    * @param device_count Броя на елементите в масива devices.
+    * @param args Аргументите на програмата.
+    */
+    void poll_devices_threads(const device::Device* devices, size_t device_count, const Args& args)
+    {
+        std::vector<std::vector<size_t>> groups = group_devices(devices, device_count, args);
+        std::cout << "\nСвързване с " << device_count << " устройства през " << groups.size() << " връзки (до "
+                  << args.connect_timeout << " секунди за опит).\n" << std::endl;
+        std::vector<std::unique_ptr<Poller>> pollers;
+        for (const std::vector<size_t>& group : groups)
+        {
+            std::vector<device::Device> members;
+            std::vector<uint64_t> member_slots;
+            std::vector<metrics::DeviceMetrics*> member_metrics;
+            for (size_t i : group)
+            {
+                members.push_back(devices[i]);
+                member_slots.push_back(next_slot++);
+                member_metrics.push_back(&registry.add(device_name(devices[i])));
+            }
+            pollers.push_back(start_poller(members, member_slots, member_metrics, args));
+        }
+
+        std::unique_ptr<config_watch::Watcher> watcher;
+        if (args.watch)
+            watcher.reset(new config_watch::Watcher((std::filesystem::path(args.config_path) / args.json_name).string()));
+        while (!stop_flag.load())
+        {
+            if (!watcher)
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            else if (watcher->wait(std::chrono::milliseconds(200)) && !stop_flag.load())
+                reload_pollers(pollers, args);
+        }
+        for (std::unique_ptr<Poller>& poller : pollers)
+            poller->stop.store(true);
+        for (std::unique_ptr<Poller>& poller : pollers)
+            join_poller(*poller);
+    }
+
+    #ifdef __linux__
+    /**
+    * Лог файлът, файлът с последните отчети и статистиката на едно устройство при четене чрез 'reactor::PollReactor'.
+    */
+    struct ReactorOutput
+    {
+        device::Device dev;
+        long file = -1;
+        std::unique_ptr<ring_store::Writer> ring;
+        metrics::DeviceMetrics* metrics = nullptr;
+    };
+
+    /**
+    * Устройствата при четене чрез 'reactor::PollReactor', подредени по индекса им в reactor (nullptr - премахнато устройство).
+    * Списъкът се променя само от главната нишка (при презареждане на конфигурационния файл), а нишките на reactor го четат при всеки отчет.
+    */
+    struct ReactorOutputs
+    {
+        std::vector<std::unique_ptr<ReactorOutput>> items;
+        std::shared_mutex mutex;
+    };
+
+    /**
+    * Помощна функция, която създава файловете на устройство и го добавя към reactor (преди 'run' или докато работи).
+    */
+    static void add_reactor_device(reactor::PollReactor& engine, export_data::LogWriter& writer, ReactorOutputs& outputs, const device::Device& dev, const Args& args)
+    {
+        std::unique_ptr<ReactorOutput> output(new ReactorOutput());
+        output->dev = dev;
+        output->metrics = &registry.add(device_name(dev));
+        output->ring = open_ring(dev, args);
+        try
+        {
+            output->file = static_cast<long>(writer.add_file(args.log_path, log_host(dev), output->metrics));
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+        metrics::DeviceMetrics* device_metrics = output->metrics;
+        {
+            std::unique_lock<std::shared_mutex> lock(outputs.mutex);
+            outputs.items.push_back(std::move(output));
+        }
+        engine.add_device(dev, device_metrics);
+    }
+
+    /**
+    * Помощна функция, която премахва устройство от reactor и затваря файловете му.
+    */
+    static void remove_reactor_device(reactor::PollReactor& engine, export_data::LogWriter& writer, ReactorOutputs& outputs, size_t index)
+    {
+        engine.remove_device(index);
+        std::unique_ptr<ReactorOutput> output;
+        {
+            std::unique_lock<std::shared_mutex> lock(outputs.mutex);
+            output = std::move(outputs.items[index]);
+        }
+        if (output->file >= 0)
+            writer.remove_file(static_cast<size_t>(output->file));
+        registry.remove(output->metrics);
+    }
+
+    /**
+    * Помощна функция, която прилага новия конфигурационен файл при четене чрез 'reactor::PollReactor'.
+    * Новите устройства се добавят, премахнатите се затварят, а на променените се сменят интервалът, pipelining и името, без да се затваря връзката.
+    */
+    static void reload_reactor(reactor::PollReactor& engine, export_data::LogWriter& writer, ReactorOutputs& outputs, const Args& args)
+    {
+        size_t device_count = 0;
+        device::Device* devices = reload_devices(args, device_count);
+        if (!devices)
+            return;
+        // Само главната нишка променя списъка, затова тук може да се чете без заключване
+        std::vector<device::Device> current;
+        std::vector<size_t> indices;
+        for (size_t i = 0; i < outputs.items.size(); ++i)
+        {
+            if (!outputs.items[i])
+                continue;
+            current.push_back(outputs.items[i]->dev);
+            indices.push_back(i);
+        }
+        device::DeviceDiff diff = device::diff_devices(current.data(), current.size(), devices, device_count);
+
+        for (size_t index : diff.removed)
+            remove_reactor_device(engine, writer, outputs, indices[index]);
+        for (size_t i = 0; i < device_count; ++i)
+        {
+            if (diff.previous[i] == device::DeviceDiff::NEW_DEVICE)
+            {
+                add_reactor_device(engine, writer, outputs, devices[i], args);
+            }
+            else if (diff.changed[i])
+            {
+                size_t index = indices[diff.previous[i]];
+                ReactorOutput& output = *outputs.items[index];
+                output.dev = devices[i];
+                registry.rename(*output.metrics, device_name(devices[i]));
+                engine.update_device(index, devices[i], output.metrics);
+            }
+        }
+        print_reload(diff);
+        delete[] devices;
+    }
+
+    /**
+    * Функция, която чете от всички устройства с 'reactor::PollReactor' и записва резултатите на всяко устройство в отделен .csv файл.
+    * Ако не е зададен '--no-watch', при промяна на конфигурационния файл се прилагат само разликите (вижте 'reload_reactor').
+    * Връща се след получаване на сигнал за прекъсване.
+    * @param devices Масив с устройствата.
+    * @param device_count Броя на елементите в масива devices.
+    * @param args Аргументите на програмата.
+    */
+    void poll_devices_reactor(const device::Device* devices, size_t device_count, const Args& args)
+    {
+        std::filesystem::create_directories(args.log_path);
+        // Нишките на reactor само копират резултатите в опашките, а записът на диска е в отделна нишка
+        export_data::LogWriter writer(reg::reg_plan, writer_options(args));
+        ReactorOutputs outputs;
+
+        reactor::Options options;
+        options.interval = args.interval;
+        options.timeout = args.timeout;
+        options.connect_timeout = args.connect_timeout;
+        options.pipeline_depth = args.pipeline_depth;
+        options.share_connections = args.share;
+        options.align = args.align;
+        options.spread = args.spread;
+        reactor::PollReactor engine(reg::reg_plan, [&writer, &outputs](size_t device, int64_t timestamp_ms, const reg::RegisterResult* results)
+        {
+            std::shared_lock<std::shared_mutex> lock(outputs.mutex);
+            ReactorOutput* output = outputs.items[device].get();
+            if (!output)
+                return;
+            if (output->file >= 0)
+                writer.push(static_cast<size_t>(output->file), timestamp_ms, results);
+            if (output->ring)
+                output->ring->push(timestamp_ms, results);
+        }, options);
+        for (size_t i = 0; i < device_count; ++i)
+            add_reactor_device(engine, writer, outputs, devices[i], args);
+        writer.start();
+
+        if (!args.watch)
+        {
+            engine.run(stop_flag, args.reactors);
+        }
+        else
+        {
+            std::thread runner(&reactor::PollReactor::run, &engine, std::ref(stop_flag), args.reactors);
+            config_watch::Watcher watcher((std::filesystem::path(args.config_path) / args.json_name).string());
+            while (!stop_flag.load())
+            {
+                if (watcher.wait(std::chrono::milliseconds(200)) && !stop_flag.load())
+                    reload_reactor(engine, writer, outputs, args);
+            }
+            runner.join();
+        }
+        writer.stop();
+        if (writer.dropped() > 0)
+            std::cerr << "\nИзхвърлени отчети (бавен запис на диска): " << writer.dropped() << std::endl;
+    }
+    #endif
+
+    /**
+    * Функция, която преобразува двоичен лог файл в .csv файл със същото име в същата директория.
+    * @param bin_path Пътят до двоичния файл.
+    */
+    void convert_to_csv(const std::string& bin_path)
+    {
+        std::string csv_path = std::filesystem::path(bin_path).replace_extension(".csv").string();
+        try
+        {
+            size_t count = bin_log::to_csv(bin_path, csv_path);
+            std::cout << "\nПреобразувани записи: " << count << " -> " << csv_path << std::endl;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "\nГрешка при преобразуването: " << e.what() << std::endl;
+        }
+    }
+
+    /**
+    * Функция, която извежда на конзолата записите на едно устройство за даден период от лог файловете (вижте 'log_query')
+    * и статистиката на заявката в потока за грешки, затова изходът може да се пренасочи във файл.
+    * @param args Аргументите на програмата ('log_path' и 'query_*').
+    */
+    void query_logs(const Args& args)
+    {
+        log_query::Query query;
+        query.host = args.query_host;
+        query.from_ms = args.query_from;
+        query.to_ms = args.query_to;
+        query.columns = log_query::split_columns(args.query_columns);
+        try
+        {
+            auto start = std::chrono::steady_clock::now();
+            log_query::Stats stats = log_query::run(args.log_path, query, std::cout);
+            std::cout.flush();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cerr << "\nЗаписи: " << stats.rows << ", прочетени файлове: " << stats.files_read << ", пропуснати файлове: " << stats.files_skipped
+                      << ", прочетени байтове: " << stats.bytes_read << ", време: " << seconds << " s" << std::endl;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "\nГрешка при заявката: " << e.what() << std::endl;
+        }
+    }
+
     /**
     * Главната функция на програмата.
     * @param argc Променлива, която съдържа броят на аргументите (стойността на променливата винаги е поне единица).
@@ -154,6 +1052,8 @@ namespace program
             std::cout.imbue(std::locale());
         }
         std::signal(SIGINT, signal_handler);
+        // Запис в затворена от устройството връзка връща грешка (EPIPE) вместо да спре програмата, затова връзката се възстановява
+        std::signal(SIGPIPE, SIG_IGN);
     #endif
 
         Args* args = parse_args(argc, argv);
@@ -166,6 +1066,20 @@ namespace program
             return 0;
         }
 
+        if (!args->to_csv.empty())
+        {
+            convert_to_csv(args->to_csv);
+            delete args;
+            return 0;
+        }
+
+        if (!args->query_host.empty())
+        {
+            query_logs(*args);
+            delete args;
+            return 0;
+        }
+
         size_t device_count = 0;
         device::Device* devices = nullptr;
         try
@@ -177,33 +1091,27 @@ namespace program
             std::cerr << "\nГрешка при зареждане на данните на устройствата: " << e.what() << std::endl;
         }
 
-        std::cout << "\nЗа свързване с устройствата може да отнеме до 20 секунди преди да се затвори програмата.\n" << std::endl;
-        std::future<void>* futures = new std::future<void>[device_count];
-        if (!futures) throw std::runtime_error("Неуспешна инициализация на нишките.");
-        for (size_t i = 0; i < device_count; ++i)
-        {
-            futures[i] = std::async(std::launch::async, poll_device, devices[i], args->log_path);
-        }
-        while (!stop_flag.load())
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(200));
-        }
-        for (size_t i = 0; i < device_count; ++i)
+        std::thread reporter = start_stats(*args);
+        start_compactor(*args);
+
+    #ifdef __linux__
+        if (args->reactors > 0)
         {
-            try
-            {
-                futures[i].get();
-            }
-            catch (const std::exception &e)
-            {
-                std::cerr << "\n[Thread] Получена е грешка: " << e.what() << std::endl;
-            }
+            poll_devices_reactor(devices, device_count, *args);
+            compactor.reset();
+            if (reporter.joinable()) reporter.join();
+            delete[] devices;
+            delete args;
+            return 0;
         }
+    #endif
+
+        poll_devices_threads(devices, device_count, *args);
+        compactor.reset();
+        if (reporter.joinable()) reporter.join();
         delete[] devices;
-        delete[] futures;
         delete args;
         devices = nullptr;
-        futures = nullptr;
         args = nullptr;
         return 0;
     }
@@ -0,0 +1,685 @@
+#include "reactor.hpp"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace reactor
+{
+    /**
+    * Максимален брой събития, които се взимат с едно извикване на epoll_wait.
+    */
+    static const int MAX_EVENTS = 256;
+
+    /**
+    * Максимално време за изчакване в epoll_wait, за да се проверява флагът за спиране.
+    */
+    static const int MAX_WAIT_MS = 200;
+
+    /**
+    * Помощна функция, която преобразува време в секунди в 'Clock::duration'.
+    */
+    static Clock::duration to_duration(float seconds)
+    {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(seconds));
+    }
+
+    /**
+    * Помощна функция, която чака събития от epoll до даденото време. epoll_wait приема милисекунди и закъснява до 1 ms,
+    * затова (ако е наличен) се използва epoll_pwait2 с наносекунди, за да започват отчетите точно навреме.
+    */
+    static int wait_events(int epoll_fd, epoll_event* events, Clock::duration timeout)
+    {
+    #if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+        static std::atomic<bool> supported(true); // epoll_pwait2 е от Linux 5.11
+        if (supported.load(std::memory_order_relaxed))
+        {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+            timespec ts{ static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000) };
+            int n = epoll_pwait2(epoll_fd, events, MAX_EVENTS, &ts, nullptr);
+            if (n >= 0 || errno != ENOSYS)
+                return n;
+            supported.store(false, std::memory_order_relaxed);
+        }
+    #endif
+        return epoll_wait(epoll_fd, events, MAX_EVENTS, static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(timeout).count()));
+    }
+
+    PollReactor::Session::Session(const device::Device& dev, size_t id, const Options& options)
+     : reader(dev.ip, dev.port, dev.device_id)
+     , backoff(std::chrono::milliseconds(static_cast<long long>(options.retry_initial * 1000)),
+               std::chrono::milliseconds(static_cast<long long>(options.retry_max * 1000)),
+               static_cast<uint32_t>(id))
+    {
+    }
+
+    /**
+    * Клас, който чете от много устройства чрез epoll.
+    * @param plan Планът за четене (например 'reg::reg_plan'). Трябва да е валиден, докато обектът съществува.
+    * @param handler Функция, която получава резултатите от всеки отчет.
+    * @param options Интервал, максимални времена и дълбочина на pipelining (вижте 'Options').
+    */
+    PollReactor::PollReactor(const reg::ReadPlanView& plan, SampleHandler handler, const Options& options)
+     : _plan(plan)
+     , _handler(std::move(handler))
+     , _options(options)
+     , _timeout(to_duration(options.timeout))
+     , _connect_timeout(to_duration(options.connect_timeout))
+     , _next_link(0)
+    {
+    }
+
+    PollReactor::~PollReactor() = default;
+
+    /**
+    * Помощна функция, която връща плана за четене за даден интервал. Създава се само по един план за всеки различен интервал.
+    * Извиква се при заключен '_control_mutex'.
+    */
+    const reg::PollSchedule* PollReactor::schedule_for(float interval)
+    {
+        for (const auto& schedule : _schedules)
+            if (schedule.first == interval)
+                return schedule.second.get();
+        _schedules.emplace_back(interval, std::unique_ptr<reg::PollSchedule>(new reg::PollSchedule(_plan, interval)));
+        return _schedules.back().second.get();
+    }
+
+    /**
+    * Помощна функция, която съставя настройките на устройство (slave id, интервал, pipelining и статистика).
+    * Собствените 'interval' и 'pipeline_depth' на устройството (ако са зададени) заменят стойностите от 'Options'.
+    * Извиква се при заключен '_control_mutex'.
+    */
+    PollReactor::Unit PollReactor::make_unit(size_t index, const device::Device& dev, metrics::DeviceMetrics* device_metrics)
+    {
+        float interval = dev.interval > 0 ? dev.interval : _options.interval;
+        Unit unit;
+        unit.index = index;
+        unit.slave_id = dev.device_id;
+        unit.interval = ticker::period_from_seconds(interval);
+        unit.phase = _options.spread ? ticker::spread_phase(index, unit.interval) : Clock::duration::zero();
+        unit.schedule = schedule_for(interval);
+        unit.pipeline_depth = dev.pipeline_depth > 0 ? dev.pipeline_depth : _options.pipeline_depth;
+        unit.metrics = device_metrics;
+        return unit;
+    }
+
+    /**
+    * Добавя устройство. Може да се извика и докато 'run' работи - тогава устройството започва да се чете веднага.
+    * Устройствата с еднакви ip и port се четат през една връзка (вижте 'Options::share_connections').
+    * @param dev Устройството.
+    * @param device_metrics Статистиката на устройството (nullptr - не се записва).
+    * @return Индексът на устройството, който се подава на SampleHandler. Индексите на премахнатите устройства не се използват повторно.
+    */
+    size_t PollReactor::add_device(const device::Device& dev, metrics::DeviceMetrics* device_metrics)
+    {
+        std::lock_guard<std::mutex> lock(_control_mutex);
+        size_t index = _devices.size();
+        std::string key = device::connection_key(dev, _options.share_connections);
+        auto found = _options.share_connections ? _links.find(key) : _links.end();
+        Session* s = found != _links.end() ? found->second : nullptr;
+        if (!s)
+        {
+            size_t id = _next_link++;
+            _sessions.emplace_back(new Session(dev, id, _options));
+            s = _sessions.back().get();
+            s->key = key;
+            s->worker = _workers.empty() ? 0 : id % _workers.size();
+            if (_options.share_connections)
+                _links.emplace(key, s);
+        }
+        ++s->members;
+        _devices.push_back(s);
+
+        Unit unit = make_unit(index, dev, device_metrics);
+        if (_workers.empty())
+        {
+            s->units.push_back(unit);
+        }
+        else
+        {
+            Command command{ CommandType::ADD, s, unit };
+            send(command);
+        }
+        return index;
+    }
+
+    /**
+    * Променя интервала, pipelining и статистиката на устройство, без да затваря връзката с него.
+    * Докато 'run' работи, промяната се прилага от нишката, която обслужва устройството.
+    * @param device Индексът на устройството (върнат от 'add_device').
+    * @param dev Новите настройки на устройството. IP адресът, портът и идентификаторът не се променят.
+    * @param device_metrics Статистиката на устройството (nullptr - не се записва).
+    */
+    void PollReactor::update_device(size_t device, const device::Device& dev, metrics::DeviceMetrics* device_metrics)
+    {
+        std::lock_guard<std::mutex> lock(_control_mutex);
+        if (device >= _devices.size() || !_devices[device])
+            return;
+        Command command{ CommandType::UPDATE, _devices[device], make_unit(device, dev, device_metrics) };
+        if (_workers.empty())
+            update_unit(*command.session, command.unit, Clock::now());
+        else
+            send(command);
+    }
+
+    /**
+    * Премахва устройство. Връзката се затваря, ако през нея не се чете друго устройство. Докато 'run' работи, функцията чака
+    * нишката, която обслужва устройството, затова след връщането ѝ SampleHandler вече не се извиква за това устройство.
+    * @param device Индексът на устройството (върнат от 'add_device').
+    */
+    void PollReactor::remove_device(size_t device)
+    {
+        std::unique_lock<std::mutex> lock(_control_mutex);
+        if (device >= _devices.size() || !_devices[device])
+            return;
+        Session* s = _devices[device];
+        // Новите устройства със същия ключ вече получават нова връзка, дори ако нишката още не е затворила тази
+        if (--s->members == 0 && _options.share_connections)
+            _links.erase(s->key);
+        if (!_workers.empty())
+        {
+            Command command{ CommandType::REMOVE, s, Unit() };
+            command.unit.index = device;
+            send(command);
+            _control_changed.wait(lock, [this, device]() { return !_devices[device] || _workers.empty(); });
+            if (!_devices[device])
+                return;
+        }
+        // Преди 'run' (или след спирането му) устройството се премахва направо
+        remove_unit(*s, device);
+        _devices[device] = nullptr;
+        if (s->units.empty())
+        {
+            _sessions.erase(std::find_if(_sessions.begin(), _sessions.end(), [s](const std::unique_ptr<Session>& item) { return item.get() == s; }));
+        }
+    }
+
+    /**
+    * Функция за получаване на броя на добавените устройства (включително премахнатите, вижте 'add_device').
+    */
+    size_t PollReactor::device_count() const
+    {
+        std::lock_guard<std::mutex> lock(_control_mutex);
+        return _devices.size();
+    }
+
+    /**
+    * Чете от всички устройства, докато не се вдигне stop_flag. Връзките се разпределят поравно между нишките.
+    * @param stop_flag Флаг, с който се прекъсва функцията.
+    * @param threads Брой нишки (поне една).
+    */
+    void PollReactor::run(std::atomic<bool>& stop_flag, size_t threads)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_control_mutex);
+            if (threads == 0) threads = 1;
+            if (threads > _sessions.size() && !_sessions.empty()) threads = _sessions.size();
+            for (size_t t = 0; t < threads; ++t)
+            {
+                _workers.emplace_back(new Worker());
+                Worker& w = *_workers.back();
+                w.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+                w.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                epoll_event ev{};
+                ev.events = EPOLLIN;
+                ev.data.ptr = nullptr;
+                if (w.epoll_fd < 0 || w.wake_fd < 0 || epoll_ctl(w.epoll_fd, EPOLL_CTL_ADD, w.wake_fd, &ev) < 0)
+                {
+                    std::cerr << "\nГрешка при създаването на epoll: " << std::strerror(errno) << std::endl;
+                    stop_flag.store(true);
+                }
+            }
+            // Всяка връзка започва да се чете от нишката си чрез команда, както връзките, добавени по време на работа
+            size_t next = 0;
+            for (std::unique_ptr<Session>& s : _sessions)
+            {
+                s->worker = next++ % threads;
+                Command command{ CommandType::START, s.get(), Unit() };
+                send(command);
+            }
+        }
+
+        std::vector<std::thread> pool;
+        for (size_t t = 0; t < threads; ++t)
+            pool.emplace_back(&PollReactor::worker_loop, this, t, std::ref(stop_flag));
+        for (std::thread& th : pool)
+            th.join();
+
+        std::lock_guard<std::mutex> lock(_control_mutex);
+        for (std::unique_ptr<Worker>& w : _workers)
+        {
+            if (w->epoll_fd >= 0) close(w->epoll_fd);
+            if (w->wake_fd >= 0) close(w->wake_fd);
+        }
+        _workers.clear();
+        _control_changed.notify_all();
+    }
+
+    /**
+    * Помощна функция, която изпраща команда до нишката, обслужваща връзката. Извиква се при заключен '_control_mutex'.
+    */
+    void PollReactor::send(const Command& command)
+    {
+        Worker& w = *_workers[command.session->worker];
+        w.commands.push_back(command);
+        uint64_t one = 1;
+        if (write(w.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            std::cerr << "\nГрешка при събуждането на нишка: " << std::strerror(errno) << std::endl;
+    }
+
+    /**
+    * Помощна функция, която връща устройството с даден индекс във връзката (nullptr, ако е премахнато).
+    */
+    PollReactor::Unit* PollReactor::find_unit(Session& s, size_t index)
+    {
+        for (Unit& unit : s.units)
+            if (unit.index == index)
+                return &unit;
+        return nullptr;
+    }
+
+    /**
+    * Помощна функция, която добавя устройство към връзка по време на работа. Новата връзка започва веднага със свързване,
+    * а в свързана и свободна връзка таймерът се зарежда за първия отчет на устройството.
+    */
+    void PollReactor::add_unit(Worker& w, Session& s, const Unit& unit, Clock::time_point now)
+    {
+        s.units.push_back(unit);
+        s.units.back().ticker.start(unit.interval, unit.phase, _options.align, now);
+        if (s.units.size() == 1)
+            arm(w, s, now);
+        else if (s.state == State::IDLE)
+            arm_next_unit(w, s, now);
+    }
+
+    /**
+    * Помощна функция, която прилага нови настройки на устройство (от нишката, която го обслужва, или преди 'run').
+    * Поредният номер на отчета се запазва, а при нов интервал следващият отчет е на новата решетка.
+    */
+    void PollReactor::update_unit(Session& s, const Unit& settings, Clock::time_point now)
+    {
+        Unit* unit = find_unit(s, settings.index);
+        if (!unit)
+            return;
+        unit->interval = settings.interval;
+        unit->phase = settings.phase;
+        unit->ticker.set_period(settings.interval, now);
+        unit->schedule = settings.schedule;
+        unit->pipeline_depth = settings.pipeline_depth;
+        unit->metrics = settings.metrics;
+        if (s.state == State::READING && s.current == unit->index)
+            s.reader.set_metrics(unit->metrics);
+    }
+
+    /**
+    * Помощна функция, която премахва устройство от връзката. Ако отчетът му се чете в момента, резултатът се изхвърля.
+    */
+    void PollReactor::remove_unit(Session& s, size_t index)
+    {
+        s.units.erase(std::remove_if(s.units.begin(), s.units.end(), [index](const Unit& unit) { return unit.index == index; }), s.units.end());
+        if (s.state == State::READING && s.current == index)
+            s.reader.set_metrics(nullptr); // Статистиката може да бъде освободена веднага след 'remove_device'
+    }
+
+    /**
+    * Помощна функция, която изтрива наведнъж таймерите на празните връзки и ги освобождава. Извиква се при заключен '_control_mutex'.
+    */
+    void PollReactor::remove_sessions(Worker& w, std::vector<Session*>& removed)
+    {
+        std::sort(removed.begin(), removed.end());
+        std::vector<Timer> timers;
+        timers.reserve(w.timers.size());
+        for (; !w.timers.empty(); w.timers.pop())
+        {
+            if (!std::binary_search(removed.begin(), removed.end(), w.timers.top().session))
+                timers.push_back(w.timers.top());
+        }
+        for (const Timer& timer : timers)
+            w.timers.push(timer);
+
+        _sessions.erase(std::remove_if(_sessions.begin(), _sessions.end(), [&removed](const std::unique_ptr<Session>& s)
+        {
+            return std::binary_search(removed.begin(), removed.end(), s.get());
+        }), _sessions.end());
+    }
+
+    /**
+    * Изпълнява командите, изпратени до нишката: започва четенето на новите връзки и устройства, прилага промените и премахва устройства.
+    * Връзките, в които не са останали устройства, се затварят и освобождават.
+    */
+    void PollReactor::apply_commands(Worker& w, Clock::time_point now)
+    {
+        uint64_t count = 0;
+        if (read(w.wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            std::cerr << "\nГрешка при четенето на команди: " << std::strerror(errno) << std::endl;
+        std::vector<Command> commands;
+        {
+            std::lock_guard<std::mutex> lock(_control_mutex);
+            commands.swap(w.commands);
+        }
+
+        std::vector<size_t> removed_devices;
+        std::vector<Session*> removed;
+        for (const Command& command : commands)
+        {
+            Session& s = *command.session;
+            switch (command.type)
+            {
+                case CommandType::START:
+                    for (Unit& unit : s.units)
+                        unit.ticker.start(unit.interval, unit.phase, _options.align, now);
+                    arm(w, s, now);
+                    break;
+                case CommandType::ADD:
+                    add_unit(w, s, command.unit, now);
+                    break;
+                case CommandType::UPDATE:
+                    update_unit(s, command.unit, now);
+                    if (s.state == State::IDLE)
+                        arm_next_unit(w, s, now);
+                    break;
+                case CommandType::REMOVE:
+                    remove_unit(s, command.unit.index);
+                    removed_devices.push_back(command.unit.index);
+                    if (s.units.empty())
+                    {
+                        if (s.state != State::DISCONNECTED)
+                            disconnect(w, s);
+                        removed.push_back(&s);
+                    }
+                    break;
+            }
+        }
+        if (removed_devices.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(_control_mutex);
+        if (!removed.empty())
+            remove_sessions(w, removed);
+        for (size_t index : removed_devices)
+            _devices[index] = nullptr;
+        _control_changed.notify_all();
+    }
+
+    /**
+    * Главният цикъл на една нишка: изпълнява изтеклите таймери и обработва събитията от epoll.
+    */
+    void PollReactor::worker_loop(size_t worker, std::atomic<bool>& stop_flag)
+    {
+        Worker* worker_ptr = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(_control_mutex);
+            worker_ptr = _workers[worker].get();
+        }
+        Worker& w = *worker_ptr;
+        if (w.epoll_fd < 0 || w.wake_fd < 0)
+            return;
+
+        Clock::time_point now = Clock::now();
+        epoll_event events[MAX_EVENTS];
+        while (!stop_flag.load(std::memory_order_relaxed))
+        {
+            now = Clock::now();
+            while (!w.timers.empty() && w.timers.top().when <= now)
+            {
+                Timer timer = w.timers.top();
+                w.timers.pop();
+                if (timer.gen == timer.session->timer_gen)
+                    on_timer(w, *timer.session, now);
+            }
+
+            Clock::duration timeout = std::chrono::milliseconds(MAX_WAIT_MS);
+            if (!w.timers.empty())
+                timeout = std::max(Clock::duration::zero(), std::min(timeout, w.timers.top().when - now));
+            int n = wait_events(w.epoll_fd, events, timeout);
+            if (n < 0 && errno != EINTR)
+            {
+                std::cerr << "\nГрешка в epoll_wait: " << std::strerror(errno) << std::endl;
+                break;
+            }
+            now = Clock::now();
+            bool wake = false;
+            for (int i = 0; i < n; ++i)
+            {
+                if (events[i].data.ptr)
+                    on_event(w, *static_cast<Session*>(events[i].data.ptr), events[i].events, now);
+                else
+                    wake = true;
+            }
+            // Командите се изпълняват след събитията, защото може да премахнат устройство, за което има събитие в същия масив
+            if (wake)
+                apply_commands(w, now);
+        }
+
+        std::lock_guard<std::mutex> lock(_control_mutex);
+        for (std::unique_ptr<Session>& s : _sessions)
+        {
+            if (s && s->worker == worker && s->state != State::DISCONNECTED)
+                disconnect(w, *s);
+        }
+    }
+
+    /**
+    * Зарежда единствения таймер на връзката. Предишният таймер (ако има) става остарял.
+    */
+    void PollReactor::arm(Worker& w, Session& s, Clock::time_point when)
+    {
+        ++s.timer_gen;
+        w.timers.push({ when, &s, s.timer_gen });
+    }
+
+    /**
+    * Зарежда таймера на връзката за най-ранния предстоящ отчет на устройствата в нея.
+    */
+    void PollReactor::arm_next_unit(Worker& w, Session& s, Clock::time_point now)
+    {
+        Clock::time_point when = now;
+        for (size_t i = 0; i < s.units.size(); ++i)
+            if (i == 0 || s.units[i].ticker.deadline() < when)
+                when = s.units[i].ticker.deadline();
+        arm(w, s, when);
+    }
+
+    /**
+    * Планира следващия отчет на устройство. Пропуснатите отчети (при забавяне) не се наваксват, а се броят в 'missed_deadlines'.
+    */
+    void PollReactor::schedule_next(Unit& unit, Clock::time_point now)
+    {
+        uint64_t missed = unit.ticker.advance(now);
+        if (missed > 0 && unit.metrics)
+            metrics::increment(unit.metrics->missed_deadlines, missed);
+    }
+
+    /**
+    * Регистрира сокета на връзката в epoll за дадените събития (или променя вече регистрираните).
+    */
+    void PollReactor::watch(Worker& w, Session& s, uint32_t events)
+    {
+        if (s.events == events)
+            return;
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = &s;
+        epoll_ctl(w.epoll_fd, s.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, s.reader.get_socket(), &ev);
+        s.events = events;
+    }
+
+    /**
+    * Затваря връзката. При следващия таймер ще се опита ново свързване.
+    */
+    void PollReactor::disconnect(Worker& w, Session& s)
+    {
+        if (s.events != 0)
+            epoll_ctl(w.epoll_fd, EPOLL_CTL_DEL, s.reader.get_socket(), nullptr);
+        s.events = 0;
+        s.reader.close();
+        s.state = State::DISCONNECTED;
+        s.timeouts = 0;
+    }
+
+    void PollReactor::start_connect(Worker& w, Session& s, Clock::time_point now)
+    {
+        if (!s.reader.start_connect())
+        {
+            retry_connect(w, s, now);
+            return;
+        }
+        s.state = State::CONNECTING;
+        watch(w, s, EPOLLOUT | EPOLLRDHUP);
+        arm(w, s, now + _connect_timeout);
+    }
+
+    /**
+    * Затваря неуспешната връзка и планира нов опит след изчакване, което се удвоява при всеки следващ неуспех.
+    * Отчетите на устройствата започват отново от момента на успешното свързване.
+    */
+    void PollReactor::retry_connect(Worker& w, Session& s, Clock::time_point now)
+    {
+        if (s.state != State::DISCONNECTED)
+            disconnect(w, s);
+        arm(w, s, now + s.backoff.next());
+    }
+
+    /**
+    * Започва отчета на устройството с най-ранно време във връзката или изчаква до него.
+    * Преди всеки отчет се сменят slave id, pipelining и статистиката на връзката.
+    */
+    void PollReactor::start_sample(Worker& w, Session& s, Clock::time_point now)
+    {
+        if (s.units.empty())
+            return;
+        Unit* unit = &s.units[0];
+        for (Unit& candidate : s.units)
+            if (candidate.ticker.deadline() < unit->ticker.deadline())
+                unit = &candidate;
+        if (unit->ticker.deadline() > now)
+        {
+            arm(w, s, unit->ticker.deadline());
+            return;
+        }
+        if (unit->metrics)
+            unit->metrics->start_lag.record(now - unit->ticker.deadline());
+
+        s.state = State::READING;
+        s.current = unit->index;
+        s.reader.set_slave_id(unit->slave_id);
+        s.reader.set_pipeline_depth(unit->pipeline_depth);
+        s.reader.set_metrics(unit->metrics);
+        const reg::ReadPlanView& plan = unit->schedule->plan_for_tick(unit->ticker.tick());
+        if (!s.reader.start_read(plan))
+        {
+            complete_sample(w, s, now, false);
+            return;
+        }
+        if (plan.block_count == 0) // Няма величини за четене в този интервал
+        {
+            complete_sample(w, s, now, true);
+            return;
+        }
+        watch(w, s, EPOLLIN | EPOLLRDHUP | (s.reader.wants_write() ? EPOLLOUT : 0u));
+        arm(w, s, now + _timeout);
+    }
+
+    /**
+    * Предава резултата от отчета на SampleHandler (освен ако устройството е премахнато междувременно). При неуспех връзката се затваря.
+    */
+    void PollReactor::complete_sample(Worker& w, Session& s, Clock::time_point now, bool ok)
+    {
+        Unit* unit = find_unit(s, s.current);
+        try
+        {
+            const reg::RegisterResult* results = s.reader.finish_read();
+            if (unit)
+                _handler(unit->index, s.reader.sample_sent().realtime_ms(), results);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "\nГрешка при обработката на резултатите от " << s.reader.get_host() << ": " << e.what() << std::endl;
+        }
+        if (ok)
+        {
+            s.state = State::IDLE;
+            watch(w, s, EPOLLIN | EPOLLRDHUP);
+        }
+        else
+        {
+            disconnect(w, s);
+        }
+        if (unit)
+            schedule_next(*unit, now);
+        arm_next_unit(w, s, now);
+    }
+
+    void PollReactor::on_timer(Worker& w, Session& s, Clock::time_point now)
+    {
+        switch (s.state)
+        {
+            case State::DISCONNECTED:
+                start_connect(w, s, now);
+                break;
+            case State::CONNECTING: // Изтекло време за свързване
+                retry_connect(w, s, now);
+                break;
+            case State::IDLE:
+                start_sample(w, s, now);
+                break;
+            case State::READING: // Изтекло време за отговор - липсващите блокове се отбелязват като невалидни
+                s.reader.expire_read();
+                // Закъснелите отговори на едно устройство зад шлюза не пречат на следващите (разпознават се по transaction ID)
+                complete_sample(w, s, now, ++s.timeouts < s.units.size());
+                break;
+        }
+    }
+
+    void PollReactor::on_event(Worker& w, Session& s, uint32_t events, Clock::time_point now)
+    {
+        switch (s.state)
+        {
+            case State::CONNECTING:
+                if (s.reader.finish_connect())
+                {
+                    s.backoff.reset();
+                    s.state = State::IDLE;
+                    for (Unit& unit : s.units)
+                        unit.ticker.resume(now);
+                    start_sample(w, s, now);
+                }
+                else
+                {
+                    retry_connect(w, s, now);
+                }
+                break;
+            case State::IDLE:
+                // Закъснели отговори се изхвърлят, затворена връзка се възстановява при следващия отчет
+                if ((events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) || s.reader.on_readable() < 0)
+                    disconnect(w, s);
+                break;
+            case State::READING:
+            {
+                int status = 0;
+                if (events & EPOLLOUT)
+                    status = s.reader.on_writable() < 0 ? -1 : 0;
+                if (status == 0 && (events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP)))
+                    status = s.reader.on_readable();
+                if (status > 0)
+                    s.timeouts = 0;
+                if (status != 0)
+                    complete_sample(w, s, now, status > 0);
+                else
+                    watch(w, s, EPOLLIN | EPOLLRDHUP | (s.reader.wants_write() ? EPOLLOUT : 0u));
+                break;
+            }
+            case State::DISCONNECTED:
+                break;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,268 @@
+#include "ring_store.hpp"
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ring_store
+{
+    /**
+    * Отместване на полетата в един елемент на пръстена.
+    */
+    static const size_t SLOT_TIMESTAMP = 8;
+    static const size_t SLOT_VALUES = 16;
+
+    static size_t align64(size_t size)
+    {
+        return (size + 63) & ~static_cast<size_t>(63);
+    }
+
+    static std::atomic<uint64_t>& slot_sequence(char* slot)
+    {
+        return *reinterpret_cast<std::atomic<uint64_t>*>(slot);
+    }
+
+    static const std::atomic<uint64_t>& slot_sequence(const char* slot)
+    {
+        return *reinterpret_cast<const std::atomic<uint64_t>*>(slot);
+    }
+
+    /**
+    * Функция, която съставя името на файла на дадено устройство: P30H(<ip>)_<port>_<id>.ring.
+    * @param dir Директорията на файловете.
+    * @param dev Устройството.
+    */
+    std::string ring_file_name(const std::string& dir, const device::Device& dev)
+    {
+        std::string name = "P30H(" + dev.ip + ")_" + std::to_string(dev.port) + "_" + std::to_string(dev.device_id) + ".ring";
+        return (std::filesystem::path(dir) / name).string();
+    }
+
+    /**
+    * Клас за запис на последните отчети на едно устройство. Файлът се създава наново.
+    * @param path Пътят до файла.
+    * @param plan Планът за четене, по който са получени резултатите.
+    * @param capacity Брой отчети, които се пазят.
+    * @throws std::runtime_error Ако файлът не може да се създаде.
+    */
+    Writer::Writer(const std::string& path, const reg::ReadPlanView& plan, uint32_t capacity)
+     : _data(nullptr)
+     , _size(0)
+     , _header(nullptr)
+     , _map(plan.map)
+     , _column_count(plan.reg_count)
+    {
+        if (capacity == 0) capacity = 1;
+        std::string columns;
+        bin_log::append_header(columns, plan);
+        size_t slots_offset = align64(sizeof(RingHeader) + columns.size());
+        size_t slot_size = align64(SLOT_VALUES + 5 * plan.reg_count);
+        _size = slots_offset + slot_size * capacity;
+
+        // Новият файл се подготвя под временно име, за да не го види Reader непопълнен
+        std::string temp_path = path + ".tmp";
+        int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Грешка при създаването на " + path + ": " + std::strerror(errno));
+        if (ftruncate(fd, static_cast<off_t>(_size)) != 0)
+        {
+            int error = errno;
+            close(fd);
+            throw std::runtime_error("Грешка при създаването на " + path + ": " + std::strerror(error));
+        }
+        void* data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Грешка при mmap на " + path + ": " + std::strerror(errno));
+        _data = static_cast<char*>(data);
+
+        _header = new (_data) RingHeader();
+        std::memcpy(_header->magic, MAGIC, sizeof(MAGIC));
+        _header->version = VERSION;
+        _header->column_count = static_cast<uint32_t>(plan.reg_count);
+        _header->capacity = capacity;
+        _header->slot_size = static_cast<uint32_t>(slot_size);
+        _header->slots_offset = static_cast<uint32_t>(slots_offset);
+        _header->columns_size = static_cast<uint32_t>(columns.size());
+        _header->head.store(0, std::memory_order_relaxed);
+        std::memcpy(_data + sizeof(RingHeader), columns.data(), columns.size());
+
+        if (rename(temp_path.c_str(), path.c_str()) != 0)
+        {
+            int error = errno;
+            munmap(_data, _size);
+            throw std::runtime_error("Грешка при преименуването на " + temp_path + ": " + std::strerror(error));
+        }
+    }
+
+    Writer::~Writer()
+    {
+        if (_data) munmap(_data, _size);
+    }
+
+    /**
+    * Записва нов отчет на мястото на най-стария и го публикува. Не заделя памет и не прави системни извиквания.
+    * @param timestamp_ms Времето на прочитане в милисекунди от 1970-01-01 UTC.
+    * @param results Резултатите в реда на плана за четене.
+    */
+    void Writer::push(int64_t timestamp_ms, const reg::RegisterResult* results)
+    {
+        uint64_t index = _header->head.load(std::memory_order_relaxed);
+        char* slot = _data + _header->slots_offset + (index % _header->capacity) * _header->slot_size;
+        std::atomic<uint64_t>& sequence = slot_sequence(slot);
+
+        // Нечетна стойност означава "записва се" - Reader, който е започнал да чете елемента, ще повтори
+        sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::memcpy(slot + SLOT_TIMESTAMP, &timestamp_ms, sizeof(timestamp_ms));
+        char* values = slot + SLOT_VALUES;
+        char* valid = values + 4 * _column_count;
+        for (size_t i = 0; i < _column_count; ++i)
+        {
+            uint32_t raw = results[i].value.val_int16;
+            if (_map[i].type == reg::REG_FLOAT32)
+                std::memcpy(&raw, &results[i].value.val_float32, sizeof(raw));
+            std::memcpy(values + 4 * i, &raw, sizeof(raw));
+            valid[i] = results[i].valid ? 1 : 0;
+        }
+
+        sequence.store(2 * index + 2, std::memory_order_release);
+        _header->head.store(index + 1, std::memory_order_release);
+    }
+
+    /**
+    * Клас за четене на последните отчети на едно устройство.
+    * @param path Пътят до файла, създаден от Writer.
+    * @throws std::runtime_error Ако файлът не може да се отвори или не е валиден.
+    */
+    Reader::Reader(const std::string& path)
+     : _data(nullptr)
+     , _size(0)
+     , _header(nullptr)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("Грешка при отварянето на " + path + ": " + std::strerror(errno));
+        struct stat st{};
+        fstat(fd, &st);
+        _size = static_cast<size_t>(st.st_size);
+        void* data = _size >= sizeof(RingHeader) ? mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Грешка при mmap на " + path);
+        _data = static_cast<const char*>(data);
+        _header = reinterpret_cast<const RingHeader*>(_data);
+
+        if (std::memcmp(_header->magic, MAGIC, sizeof(MAGIC)) != 0 || _header->version != VERSION ||
+            _header->slots_offset + static_cast<size_t>(_header->slot_size) * _header->capacity > _size ||
+            sizeof(RingHeader) + _header->columns_size > _header->slots_offset)
+        {
+            munmap(const_cast<char*>(_data), _size);
+            throw std::runtime_error("Файлът не е валиден: " + path);
+        }
+        std::istringstream columns(std::string(_data + sizeof(RingHeader), _header->columns_size));
+        try
+        {
+            bin_log::read_header(columns, _columns);
+            if (_columns.size() != _header->column_count || _header->slot_size < SLOT_VALUES + 5 * _columns.size())
+                throw std::runtime_error("Неправилен размер на елементите.");
+        }
+        catch (const std::exception& e)
+        {
+            munmap(const_cast<char*>(_data), _size);
+            throw std::runtime_error(path + ": " + e.what());
+        }
+    }
+
+    Reader::~Reader()
+    {
+        if (_data) munmap(const_cast<char*>(_data), _size);
+    }
+
+    /**
+    * Функция за получаване на колоните (символ, мерна единица, тип).
+    */
+    const bin_log::Columns& Reader::columns() const
+    {
+        return _columns;
+    }
+
+    /**
+    * Функция за получаване на броя на отчетите, които се пазят във файла.
+    */
+    uint32_t Reader::capacity() const
+    {
+        return _header->capacity;
+    }
+
+    /**
+    * Функция за получаване на броя на публикуваните отчети (номерът на следващия отчет).
+    */
+    uint64_t Reader::head() const
+    {
+        return _header->head.load(std::memory_order_acquire);
+    }
+
+    /**
+    * Прочита отчет по номер. Успява само за последните 'capacity()' отчета.
+    * @param index Номерът на отчета (от 0 до head() - 1).
+    * @param timestamp_ms Променлива, в която се записва времето в милисекунди от 1970-01-01 UTC.
+    * @param results Масив с 'columns().size()' елемента, в който се записват стойностите.
+    * @return False, ако отчетът още не е публикуван или вече е презаписан.
+    */
+    bool Reader::read(uint64_t index, int64_t& timestamp_ms, reg::RegisterResult* results) const
+    {
+        const char* slot = _data + _header->slots_offset + (index % _header->capacity) * _header->slot_size;
+        const std::atomic<uint64_t>& sequence = slot_sequence(slot);
+        size_t count = _columns.size();
+        const reg::RegisterRead* columns = _columns.data();
+
+        uint64_t before = sequence.load(std::memory_order_acquire);
+        if (before != 2 * index + 2)
+            return false;
+        std::memcpy(&timestamp_ms, slot + SLOT_TIMESTAMP, sizeof(timestamp_ms));
+        const char* values = slot + SLOT_VALUES;
+        const char* valid = values + 4 * count;
+        for (size_t i = 0; i < count; ++i)
+        {
+            results[i].name = columns[i].name;
+            uint32_t raw = 0;
+            std::memcpy(&raw, values + 4 * i, sizeof(raw));
+            if (columns[i].type == reg::REG_FLOAT32)
+                std::memcpy(&results[i].value.val_float32, &raw, sizeof(raw));
+            else
+                results[i].value.val_int16 = static_cast<uint16_t>(raw);
+            results[i].valid = valid[i] != 0;
+        }
+        // Ако Writer е започнал да презаписва елемента по време на четенето, номерът вече е различен
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return sequence.load(std::memory_order_relaxed) == before;
+    }
+
+    /**
+    * Прочита последния публикуван отчет.
+    * @return False, ако все още няма отчети.
+    */
+    bool Reader::latest(int64_t& timestamp_ms, reg::RegisterResult* results) const
+    {
+        while (true)
+        {
+            uint64_t h = head();
+            if (h == 0)
+                return false;
+            if (read(h - 1, timestamp_ms, results))
+                return true;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include "snapshot.hpp"
+
+namespace snapshot
+{
+    static constexpr std::align_val_t ALIGNMENT{64};
+
+    Snapshot::Snapshot()
+     : _device_count(0)
+     , _reg_count(0)
+     , _stride(0)
+     , _memory(nullptr)
+     , _values(nullptr)
+     , _valid(nullptr)
+     , _timestamps(nullptr)
+     , _versions(nullptr)
+    {
+    }
+
+    Snapshot::~Snapshot()
+    {
+        if (_memory)
+            ::operator delete[](_memory, ALIGNMENT);
+    }
+
+    /**
+    * Заделя паметта за даден брой устройства и величини (ако размерът е различен) и я нулира.
+    * Колоните са закръглени до 64 устройства, затова всяка колона с стойности е подравнена на 64 байта, а маските са цели думи.
+    * @param device_count Броят на устройствата.
+    * @param reg_count Броят на величините.
+    */
+    void Snapshot::resize(size_t device_count, size_t reg_count)
+    {
+        size_t stride = (device_count + 63) / 64 * 64;
+        size_t values = reg_count * stride * sizeof(float);
+        size_t valid = reg_count * (stride / 64) * sizeof(uint64_t);
+        size_t size = values + valid + stride * (sizeof(int64_t) + sizeof(uint64_t));
+        if (device_count != _device_count || reg_count != _reg_count)
+        {
+            if (_memory)
+                ::operator delete[](_memory, ALIGNMENT);
+            _memory = nullptr;
+            if (size > 0)
+                _memory = static_cast<unsigned char*>(::operator new[](size, ALIGNMENT));
+            _device_count = device_count;
+            _reg_count = reg_count;
+            _stride = stride;
+            _values = reinterpret_cast<float*>(_memory);
+            _valid = reinterpret_cast<uint64_t*>(_memory + values);
+            _timestamps = reinterpret_cast<int64_t*>(_memory + values + valid);
+            _versions = reinterpret_cast<uint64_t*>(_memory + values + valid + stride * sizeof(int64_t));
+        }
+        if (_memory)
+            std::memset(_memory, 0, size);
+    }
+
+    /**
+    * Клас с последните стойности на всички устройства.
+    * @param plan Планът за четене, по който са получени резултатите (определя броя и типа на величините).
+    * @param device_count Броят на устройствата. Индексите в 'store' са от 0 до device_count - 1.
+    */
+    FleetSnapshot::FleetSnapshot(const reg::ReadPlanView& plan, size_t device_count)
+     : _map(plan.map)
+     , _sequence(new std::atomic<uint64_t>[device_count]())
+    {
+        _live.resize(device_count, plan.reg_count);
+    }
+
+    FleetSnapshot::~FleetSnapshot()
+    {
+        delete[] _sequence;
+    }
+
+    std::atomic<uint64_t>& FleetSnapshot::valid_word(size_t reg, size_t device) const
+    {
+        return *reinterpret_cast<std::atomic<uint64_t>*>(_live._valid + reg * (_live._stride / 64) + device / 64);
+    }
+
+    /**
+    * Записва отчета на едно устройство. Не заделя памет, а битовете за валидност се променят само когато са различни.
+    * @param device Индексът на устройството.
+    * @param timestamp_ms Времето на прочитане в милисекунди от 1970-01-01 UTC.
+    * @param results Резултатите в реда на плана за четене.
+    */
+    void FleetSnapshot::store(size_t device, int64_t timestamp_ms, const reg::RegisterResult* results)
+    {
+        std::atomic<uint64_t>& sequence = _sequence[device];
+        uint64_t before = sequence.load(std::memory_order_relaxed);
+
+        // Нечетна стойност означава "записва се" - копие, което е започнало по време на записа, ще повтори устройството
+        sequence.store(before + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        uint64_t bit = uint64_t(1) << (device % 64);
+        float* values = _live._values + device;
+        for (size_t r = 0; r < _live._reg_count; ++r)
+        {
+            values[r * _live._stride] = _map[r].type == reg::REG_FLOAT32 ? results[r].value.val_float32 : static_cast<float>(results[r].value.val_int16);
+            // Една дума е обща за 64 устройства, които може да се записват от различни нишки
+            std::atomic<uint64_t>& word = valid_word(r, device);
+            bool was_valid = (word.load(std::memory_order_relaxed) & bit) != 0;
+            if (results[r].valid && !was_valid)
+                word.fetch_or(bit, std::memory_order_relaxed);
+            else if (!results[r].valid && was_valid)
+                word.fetch_and(~bit, std::memory_order_relaxed);
+        }
+        _live._timestamps[device] = timestamp_ms;
+
+        sequence.store(before + 2, std::memory_order_release);
+    }
+
+    /**
+    * Отбелязва всички стойности на устройството като невалидни (например след премахването му от конфигурационния файл).
+    * @param device Индексът на устройството.
+    */
+    void FleetSnapshot::clear(size_t device)
+    {
+        std::atomic<uint64_t>& sequence = _sequence[device];
+        uint64_t before = sequence.load(std::memory_order_relaxed);
+        sequence.store(before + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        uint64_t bit = uint64_t(1) << (device % 64);
+        for (size_t r = 0; r < _live._reg_count; ++r)
+            valid_word(r, device).fetch_and(~bit, std::memory_order_relaxed);
+        _live._timestamps[device] = 0;
+        sequence.store(before + 2, std::memory_order_release);
+    }
+
+    /**
+    * Копира последните отчети на всички устройства. Колоните се копират наведнъж, след което се повтарят само устройствата,
+    * които са били записвани по време на копирането, затова копието не спира нишките, които четат устройствата.
+    * @param out Копието. Паметта му се заделя само при първото копиране (или при различен брой устройства/величини).
+    */
+    void FleetSnapshot::copy_to(Snapshot& out) const
+    {
+        size_t devices = _live._device_count;
+        if (out._device_count != devices || out._reg_count != _live._reg_count)
+            out.resize(devices, _live._reg_count);
+
+        for (size_t d = 0; d < devices; ++d)
+            out._versions[d] = _sequence[d].load(std::memory_order_acquire);
+        std::memcpy(out._values, _live._values, _live._reg_count * _live._stride * sizeof(float));
+        size_t words = _live._reg_count * (_live._stride / 64);
+        for (size_t w = 0; w < words; ++w)
+            out._valid[w] = reinterpret_cast<const std::atomic<uint64_t>*>(_live._valid)[w].load(std::memory_order_relaxed);
+        std::memcpy(out._timestamps, _live._timestamps, devices * sizeof(int64_t));
+
+        // Устройствата, чийто брояч е бил нечетен или се е променил, са записвани по време на копирането
+        std::atomic_thread_fence(std::memory_order_acquire);
+        for (size_t d = 0; d < devices; ++d)
+        {
+            uint64_t before = out._versions[d];
+            if (before % 2 != 0 || _sequence[d].load(std::memory_order_relaxed) != before)
+                copy_device(d, out);
+            else
+                out._versions[d] = before / 2;
+        }
+    }
+
+    /**
+    * Копира отчета на едно устройство, докато не получи копие, по време на което устройството не е записвано.
+    */
+    void FleetSnapshot::copy_device(size_t device, Snapshot& out) const
+    {
+        uint64_t bit = uint64_t(1) << (device % 64);
+        while (true)
+        {
+            uint64_t before = _sequence[device].load(std::memory_order_acquire);
+            if (before % 2 != 0)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            for (size_t r = 0; r < _live._reg_count; ++r)
+            {
+                out._values[r * out._stride + device] = _live._values[r * _live._stride + device];
+                uint64_t& word = out._valid[r * (out._stride / 64) + device / 64];
+                if (valid_word(r, device).load(std::memory_order_relaxed) & bit)
+                    word |= bit;
+                else
+                    word &= ~bit;
+            }
+            out._timestamps[device] = _live._timestamps[device];
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_sequence[device].load(std::memory_order_relaxed) == before)
+            {
+                out._versions[device] = before / 2;
+                return;
+            }
+        }
+    }
+
+    /**
+    * Функция за получаване на броя на устройствата.
+    */
+    size_t FleetSnapshot::device_count() const
+    {
+        return _live._device_count;
+    }
+
+    /**
+    * Функция за получаване на броя на величините.
+    */
+    size_t FleetSnapshot::reg_count() const
+    {
+        return _live._reg_count;
+    }
+};
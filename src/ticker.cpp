@@ -0,0 +1,144 @@
+#include "ticker.hpp"
+
+namespace ticker
+{
+    /**
+    * Функция, която преобразува интервал в секунди в период, закръглен до микросекунда.
+    * Така 0.1f (0.100000001490116 s) става точно 100 ms и отчетите не се изместват спрямо границите на секундата.
+    * @param seconds Интервалът в секунди.
+    */
+    Clock::duration period_from_seconds(float seconds)
+    {
+        if (seconds <= 0)
+            return Clock::duration::zero();
+        return std::chrono::round<std::chrono::microseconds>(std::chrono::duration<double>(seconds));
+    }
+
+    /**
+    * Функция, която връща фазата на устройство, така че отчетите на много устройства да са разпределени равномерно в периода,
+    * вместо всички да се изпращат в една и съща милисекунда. Използва се редицата frac(index * φ) (златното сечение),
+    * която разпределя равномерно всеки брой устройства, без да е нужно да се знае броят им предварително,
+    * затова фазата на устройство не се променя, когато се добавят или премахват други устройства.
+    * @param index Поредният номер на устройството.
+    * @param period Периодът на четене.
+    * @return Фаза между 0 и периода.
+    */
+    Clock::duration spread_phase(uint64_t index, Clock::duration period)
+    {
+        // 2^64 / φ: умножението по модул 2^64 дава дробната част на index * φ с 64-битова точност
+        const uint64_t GOLDEN = 0x9E3779B97F4A7C15ull;
+        uint64_t fraction = index * GOLDEN;
+        return Clock::duration(static_cast<Clock::rep>(static_cast<double>(fraction) / 18446744073709551616.0 * static_cast<double>(period.count())));
+    }
+
+    Ticker::Ticker()
+     : _origin()
+     , _period(Clock::duration::zero())
+     , _phase(Clock::duration::zero())
+     , _align(false)
+     , _tick(0)
+    {
+    }
+
+    /**
+    * Започва отчетите от първото време след 'now'.
+    * @param period Периодът между два отчета. При 0 всеки отчет започва веднага след предишния.
+    * @param phase Изместване на отчетите в рамките на периода (0 до периода).
+    * @param align Дали отчетите да са на границите на периода по системния часовник (плюс фазата). Иначе първият отчет е в 'now' плюс фазата.
+    * @param now Текущото време.
+    */
+    void Ticker::start(Clock::duration period, Clock::duration phase, bool align, Clock::time_point now)
+    {
+        _period = period;
+        _phase = period.count() > 0 ? phase % period : Clock::duration::zero();
+        _align = align;
+        _tick = 0;
+        if (!align || period.count() <= 0)
+        {
+            _origin = now + _phase;
+            return;
+        }
+        // steady_clock няма връзка с календарното време, затова границата се изчислява по system_clock и се пренася с разликата
+        auto wall = std::chrono::duration_cast<Clock::duration>(std::chrono::system_clock::now().time_since_epoch());
+        Clock::duration until = period - wall % period + _phase;
+        if (until > period)
+            until -= period;
+        _origin = now + until;
+    }
+
+    /**
+    * Сменя периода (например при презареждане на конфигурационния файл). Следващият отчет е на новата решетка, след 'now'.
+    * @param period Новият период.
+    * @param now Текущото време.
+    */
+    void Ticker::set_period(Clock::duration period, Clock::time_point now)
+    {
+        if (period == _period)
+            return;
+        start(period, _phase, _align, now);
+    }
+
+    /**
+    * Преминава към следващия отчет след завършването на текущия.
+    * Ако следващото време вече е минало (отчетът е продължил повече от периода), пропуснатите отчети не се наваксват,
+    * а следващият отчет е на следващото време от решетката.
+    * @param now Времето на завършване на отчета.
+    * @return Брой пропуснати отчети (0, ако няма закъснение).
+    */
+    uint64_t Ticker::advance(Clock::time_point now)
+    {
+        ++_tick;
+        if (_period.count() <= 0)
+        {
+            _origin = now;
+            return 0;
+        }
+        Clock::time_point next = deadline();
+        if (next > now)
+            return 0;
+        uint64_t missed = static_cast<uint64_t>((now - next) / _period) + 1;
+        _tick += missed;
+        return missed;
+    }
+
+    /**
+    * Прескача отчетите, чието време е минало, без да ги брои за пропуснати (например докато устройството е било недостъпно).
+    * Следващият отчет остава на решетката.
+    * @param now Текущото време.
+    */
+    void Ticker::resume(Clock::time_point now)
+    {
+        if (deadline() >= now)
+            return;
+        if (_period.count() <= 0)
+        {
+            _origin = now;
+            return;
+        }
+        _tick += static_cast<uint64_t>((now - deadline() + _period - Clock::duration(1)) / _period);
+    }
+
+    /**
+    * Функция за получаване на времето на следващия отчет.
+    */
+    Clock::time_point Ticker::deadline() const
+    {
+        return _origin + _period * static_cast<Clock::rep>(_tick);
+    }
+
+    /**
+    * Функция за получаване на поредния номер на следващия отчет от началото (включително пропуснатите), например за 'reg::PollSchedule'.
+    */
+    uint64_t Ticker::tick() const
+    {
+        return _tick;
+    }
+
+    /**
+    * Функция за получаване на периода.
+    */
+    Clock::duration Ticker::period() const
+    {
+        return _period;
+    }
+};
@@ -0,0 +1,145 @@
+#include "timestamp.hpp"
+
+namespace timestamp
+{
+    /**
+    * Функция, която записва текущия момент по двата часовника. Четенето на всеки от тях е чрез vDSO (без системно извикване) в Linux.
+    */
+    Stamp Stamp::now()
+    {
+        Stamp stamp;
+        stamp.monotonic = std::chrono::steady_clock::now();
+        stamp.realtime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        return stamp;
+    }
+
+    /**
+    * Функция, която превръща друго монотонно време в момент по двата часовника чрез разликата с този момент.
+    * @param t Монотонното време (например времето на изпращане на заявка).
+    */
+    Stamp Stamp::at(std::chrono::steady_clock::time_point t) const
+    {
+        Stamp stamp;
+        stamp.monotonic = t;
+        stamp.realtime_ns = realtime_ns + std::chrono::duration_cast<std::chrono::nanoseconds>(t - monotonic).count();
+        return stamp;
+    }
+
+    /**
+    * Функция за получаване на календарното време в милисекунди от 1970-01-01 UTC.
+    */
+    int64_t Stamp::realtime_ms() const
+    {
+        int64_t ms = realtime_ns / 1000000;
+        return realtime_ns < 0 && ms * 1000000 != realtime_ns ? ms - 1 : ms;
+    }
+
+    /**
+    * Функция, която превръща време в локална дата и час. За разлика от std::localtime може да се извиква едновременно от няколко нишки.
+    * @param t Времето в секунди от 1970-01-01 UTC.
+    */
+    std::tm local_time(std::time_t t)
+    {
+        std::tm local_tm{};
+    #ifdef _WIN32
+        localtime_s(&local_tm, &t);
+    #else
+        localtime_r(&t, &local_tm);
+    #endif
+        return local_tm;
+    }
+
+    /**
+    * Функция, която преобразува локална дата и час във вида на лог файловете: "YYYY-mm-dd", "YYYY-mm-dd HH:MM", "YYYY-mm-dd HH:MM:SS"
+    * или "YYYY-mm-dd HH:MM:SS.mmm" (вместо интервал може да има 'T').
+    * @param text Текстът.
+    * @param realtime_ms Променлива, в която се записва времето в милисекунди от 1970-01-01 UTC.
+    * @return False, ако текстът не е в някой от тези формати.
+    */
+    bool parse_local(std::string_view text, int64_t& realtime_ms)
+    {
+        // Началото, броят на цифрите и знакът преди всяка част
+        static const struct { size_t position; size_t digits; char separator; } parts[] =
+        {
+            { 0, 4, 0 }, { 5, 2, '-' }, { 8, 2, '-' }, { 11, 2, ' ' }, { 14, 2, ':' }, { 17, 2, ':' }, { 20, 3, '.' }
+        };
+        if (text.size() != 10 && text.size() != 16 && text.size() != 19 && text.size() != 23)
+            return false;
+        int values[7] = { 0, 1, 1, 0, 0, 0, 0 };
+        for (size_t p = 0; p < 7 && parts[p].position < text.size(); ++p)
+        {
+            char separator = parts[p].position > 0 ? text[parts[p].position - 1] : 0;
+            if (separator != parts[p].separator && !(parts[p].separator == ' ' && separator == 'T'))
+                return false;
+            int value = 0;
+            for (size_t i = 0; i < parts[p].digits; ++i)
+            {
+                char c = text[parts[p].position + i];
+                if (c < '0' || c > '9')
+                    return false;
+                value = value * 10 + (c - '0');
+            }
+            values[p] = value;
+        }
+
+        std::tm local_tm{};
+        local_tm.tm_year = values[0] - 1900;
+        local_tm.tm_mon = values[1] - 1;
+        local_tm.tm_mday = values[2];
+        local_tm.tm_hour = values[3];
+        local_tm.tm_min = values[4];
+        local_tm.tm_sec = values[5];
+        local_tm.tm_isdst = -1;
+        std::time_t t = std::mktime(&local_tm);
+        if (t == static_cast<std::time_t>(-1))
+            return false;
+        realtime_ms = static_cast<int64_t>(t) * 1000 + values[6];
+        return true;
+    }
+
+    Formatter::Formatter()
+     : _second(INT64_MIN)
+     , _length(0)
+     , _text{}
+    {
+    }
+
+    /**
+    * Форматира време с милисекунди.
+    * @param realtime_ms Времето в милисекунди от 1970-01-01 UTC.
+    * @return Текстът. Валиден е до следващото извикване.
+    */
+    std::string_view Formatter::format(int64_t realtime_ms)
+    {
+        int64_t second = realtime_ms / 1000;
+        int64_t ms = realtime_ms % 1000;
+        if (ms < 0)
+        {
+            --second;
+            ms += 1000;
+        }
+        format_seconds(static_cast<std::time_t>(second));
+        char* tail = _text + _length;
+        tail[0] = '.';
+        tail[1] = static_cast<char>('0' + ms / 100);
+        tail[2] = static_cast<char>('0' + ms / 10 % 10);
+        tail[3] = static_cast<char>('0' + ms % 10);
+        return std::string_view(_text, _length + 4);
+    }
+
+    /**
+    * Форматира време без милисекунди ("%Y-%m-%d %H:%M:%S").
+    * @param t Времето в секунди от 1970-01-01 UTC.
+    * @return Текстът. Валиден е до следващото извикване.
+    */
+    std::string_view Formatter::format_seconds(std::time_t t)
+    {
+        if (static_cast<int64_t>(t) != _second)
+        {
+            std::tm local_tm = local_time(t);
+            _length = std::strftime(_text, sizeof(_text) - 4, "%Y-%m-%d %H:%M:%S", &local_tm);
+            _second = static_cast<int64_t>(t);
+        }
+        return std::string_view(_text, _length);
+    }
+};
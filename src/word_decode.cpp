@@ -0,0 +1,144 @@
+#include "p30h_readPlan.hpp"
+#include "word_decode.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WORD_DECODE_X86 1
+#include <immintrin.h>
+#endif
+
+namespace word_decode
+{
+    /**
+    * Декодира 'count' числа от регистрите така, както са в отговора на Modbus (big-endian, по две думи за число) - без SIMD.
+    */
+    static void be_to_float32_scalar(const uint8_t* bytes, float* out, size_t count, bool lo_first)
+    {
+        size_t first = lo_first ? 2 : 0, second = lo_first ? 0 : 2;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const uint8_t* p = bytes + 4 * i;
+            uint16_t hi = static_cast<uint16_t>(p[first] << 8 | p[first + 1]);
+            uint16_t lo = static_cast<uint16_t>(p[second] << 8 | p[second + 1]);
+            out[i] = reg::words_to_float32(hi, lo);
+        }
+    }
+
+#ifdef WORD_DECODE_X86
+    /**
+    * Разменя байтовете на всяка дума (lo_first) или на цялото число (старшата дума първа) с една инструкция pshufb за 4 числа.
+    */
+    __attribute__((target("ssse3")))
+    static void be_to_float32_ssse3(const uint8_t* bytes, float* out, size_t count, bool lo_first)
+    {
+        const __m128i shuffle = lo_first ? _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14)
+                                         : _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 4 * i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(v, shuffle));
+        }
+        be_to_float32_scalar(bytes + 4 * i, out + i, count - i, lo_first);
+    }
+
+    /**
+    * Същото като 'be_to_float32_ssse3', но за 8 числа наведнъж (vpshufb разменя байтовете във всяка 128-битова половина поотделно).
+    */
+    __attribute__((target("avx2")))
+    static void be_to_float32_avx2(const uint8_t* bytes, float* out, size_t count, bool lo_first)
+    {
+        const __m256i shuffle = lo_first ? _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                                            1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14)
+                                         : _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                                            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + 4 * i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_shuffle_epi8(v, shuffle));
+        }
+        be_to_float32_ssse3(bytes + 4 * i, out + i, count - i, lo_first);
+    }
+#endif
+
+    typedef void (*BeToFloat)(const uint8_t*, float*, size_t, bool);
+
+    /**
+    * Избраната функция. Задава се веднъж при стартиране (вижте 'set_isa' и 'initial_isa') и след това само се четат.
+    * До избора (например от статичен обект в друг файл) се използва вариантът без SIMD.
+    */
+    static Isa active_isa = Isa::SCALAR;
+    static BeToFloat be_to_float32_impl = be_to_float32_scalar;
+
+    /**
+    * Функция, която връща най-добрия набор от инструкции, поддържан от процесора.
+    */
+    Isa detect()
+    {
+    #ifdef WORD_DECODE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return Isa::AVX2;
+        if (__builtin_cpu_supports("ssse3"))
+            return Isa::SSSE3;
+    #endif
+        return Isa::SCALAR;
+    }
+
+    /**
+    * Функция за получаване на набора от инструкции, който се използва в момента.
+    */
+    Isa active()
+    {
+        return active_isa;
+    }
+
+    /**
+    * Избира набор от инструкции (например за сравнение в бенчмарк). Не трябва да се извиква, докато друга нишка декодира.
+    * @param isa Желаният набор. Ако процесорът не го поддържа, се избира най-добрият поддържан.
+    * @return Избраният набор.
+    */
+    Isa set_isa(Isa isa)
+    {
+        Isa supported = detect();
+        if (static_cast<int>(isa) > static_cast<int>(supported))
+            isa = supported;
+        be_to_float32_impl = be_to_float32_scalar;
+    #ifdef WORD_DECODE_X86
+        if (isa == Isa::SSSE3)
+            be_to_float32_impl = be_to_float32_ssse3;
+        if (isa == Isa::AVX2)
+            be_to_float32_impl = be_to_float32_avx2;
+    #endif
+        active_isa = isa;
+        return isa;
+    }
+
+    [[maybe_unused]] static const Isa initial_isa = set_isa(detect());
+
+    /**
+    * Функция за получаване на името на набор от инструкции.
+    */
+    const char* isa_name(Isa isa)
+    {
+        switch (isa)
+        {
+            case Isa::AVX2: return "AVX2";
+            case Isa::SSSE3: return "SSSE3";
+            default: return "scalar";
+        }
+    }
+
+    /**
+    * Декодира последователни 32-битови числа с плаваща запетая направо от байтовете на отговора на Modbus (big-endian регистри),
+    * като разменя байтовете и думите на цели вектори, вместо да сглобява всяко число от две думи.
+    * @param bytes Байтовете на регистрите (4 * count байта).
+    * @param out Масив с поне count елемента за резултата.
+    * @param count Броят на числата.
+    * @param lo_first Ако е True, младшата дума на всяко число е първа.
+    */
+    void be_to_float32(const uint8_t* bytes, float* out, size_t count, bool lo_first)
+    {
+        be_to_float32_impl(bytes, out, count, lo_first);
+    }
+};